@@ -2,30 +2,17 @@ local plugin   = {}
 plugin.name    = "Align Tokens"
 plugin.version = "1.0"
 
-local lines = {}
-
 local function rtrim(s)
   local n = #s
   while n > 0 and s:find("^%s", n) do n = n - 1 end
   return s:sub(1, n)
 end
 
-local function get_line(i)
-  if lines[i] then
-    return lines[i]
-  else
-    line = rtrim(get_buffer_at_line(i))
-    lines[i] = line
-    return line
-  end
-end
-
-local function find_position_of_farthest_token(pattern, first_line, last_line)
+local function find_position_of_farthest_token(pattern, lines)
 
   last = -1
-  for i = first_line, last_line, 1 do
-    line = get_line(i)
-    a, b = string.find(line, pattern)
+  for i, line in ipairs(lines) do
+    a, b = string.find(rtrim(line), pattern)
     if b and b > last then last = b end
   end
 
@@ -34,23 +21,24 @@ end
 
 local function align_tokens(first_line, last_line)
 
+  local lines = get_lines(first_line, last_line)
   last_space_after_string = "[^%s]+%s+"
 
   -- first col is the last space before the second non-space block
   -- for example, in " foo: bar" it would be the 6th char, just before the 'b'
   -- in something like " :foo  => 'bar'" it would be the 7th char, just before the '='
-  first_col  = find_position_of_farthest_token(last_space_after_string, first_line, last_line)
+  first_col  = find_position_of_farthest_token(last_space_after_string, lines)
   if first_col <= 0 then return first_col end
 
-  for i = first_line, last_line, 1 do
-    line = get_line(i)
+  for i, orig in ipairs(lines) do
+    line = rtrim(orig)
     if string.len(line) > 0 then
-    
+
     a, b = string.find(line, last_space_after_string)
 
     if a and b < first_col then
       offset = first_col - b
-      insert_buffer_at_line(i, string.rep(" ", offset), b - 1)
+      orig = orig:sub(1, b - 1) .. string.rep(" ", offset) .. orig:sub(b)
     else
       offset = 0
     end
@@ -61,13 +49,16 @@ local function align_tokens(first_line, last_line)
       c, d = string.find(line, "[^%s]+%s+[^%s]+%s+") -- last space in second block of space
       if c and d > second_col then
         diff = d - second_col
-        delete_chars_at_line(i, second_col+offset, diff)
+        orig = orig:sub(1, second_col + offset) .. orig:sub(second_col + offset + diff + 1)
       end
     end
+
+    lines[i] = orig
     end
   end
 
-  for k in pairs(lines) do lines[k] = nil end
+  -- write all the aligned lines back as a single edit
+  set_lines(first_line, last_line, lines)
 
 end
 
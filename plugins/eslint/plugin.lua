@@ -6,12 +6,15 @@ local function script_path()
   return debug.getinfo(1).source:match("@?(.*/)")
 end
 
-local function exec(cmd)
-  local handle = io.popen(cmd)
-  local result = handle:read("*a")
-  trimmed, idx = result:gsub("%s+$", "")
-  handle:close()
-  return trimmed
+-- runs cmd in the background and calls done(output) once it exits
+local function exec(cmd, done)
+  local chunks = {}
+  spawn(cmd, function(chunk)
+    chunks[#chunks+1] = chunk
+  end, function(code)
+    trimmed, idx = table.concat(chunks):gsub("%s+$", "")
+    done(trimmed)
+  end)
 end
 
 local current_error = -1
@@ -95,25 +98,26 @@ plugin.check_current_file = function()
   local config  = "eslintrc"
   local options = string.format('-c "%s%s"', script_path(), config)
 
-  cmd = string.format('%s %s "%s"', command, options, filename)
-  out = exec(cmd)
-  -- print(out)
-
-  -- title = string.format("ESLint: %s", filename)
-  -- open_new_tab(title, out)
-
-  if error_count > 0 then clean_errors() end
-
-  parse_result(out)
-  if error_count == 0 then
-    show_message("No errors!")
-  else
-    -- print(error_count, "errors found.")
-    paint_errors(2)
-    goto_line(number)
-    prompt = error_message(1)
-    show_prompt(prompt, plugin.on_prompt_input)
-  end
+  cmd = string.format('%s %s "%s" 2>/dev/null', command, options, filename)
+  exec(cmd, function(out)
+    -- print(out)
+
+    -- title = string.format("ESLint: %s", filename)
+    -- open_new_tab(title, out)
+
+    if error_count > 0 then clean_errors() end
+
+    parse_result(out)
+    if error_count == 0 then
+      show_message("No errors!")
+    else
+      -- print(error_count, "errors found.")
+      paint_errors(2)
+      goto_line(number)
+      prompt = error_message(1)
+      show_prompt(prompt, plugin.on_prompt_input)
+    end
+  end)
 end
 
 plugin.boot = function()
@@ -2,31 +2,40 @@ local plugin = {}
 plugin.name  = "Git Commit File Changes"
 plugin.version = "1.0"
 
-local git = {}
-git.file_changed = function(filename)
-  out = exec(string.format("git status | grep %s", filename))
+-- runs cmd in the background and calls done(output, code) once it exits
+local function exec(cmd, done)
+  local chunks = {}
+  spawn(cmd, function(chunk)
+    chunks[#chunks+1] = chunk
+  end, function(code)
+    if done then done(table.concat(chunks), code) end
+  end)
 end
 
-git.add = function(filename)
-  exec(string.format("git add %s", filename))
+local git = {}
+git.file_changed = function(filename, done)
+  exec(string.format("git status --porcelain -- '%s' 2>/dev/null", filename), function(out, code)
+    done(code == 0 and string.len(out) > 0)
+  end)
 end
 
-git.commit = function(msg)
-  exec(string.format("git commit -m '%s'", msg))
+git.add_and_commit = function(filename, msg, done)
+  exec(string.format("git add -- '%s' && git commit -m '%s' >/dev/null 2>&1", filename, msg), done)
 end
 
 plugin.commit_changes = function()
-  file = get_current_file()
-  if git.file_changed(file.name) then
-    default_msg = string.format("Update %s", file.name)
+  file = current_file_path()
+  if not file then return 0 end
+
+  git.file_changed(file, function(changed)
+    if not changed then return end
+
+    default_msg = string.format("Update %s", file)
     commit_msg  = prompt_user("Commit message:", default_msg)
-    if not commit_msg then -- cancelled
-      return 0
-    else
-      git.add(file.name)
-      return git.commit(commit_msg)
+    if commit_msg then -- not cancelled
+      git.add_and_commit(file, commit_msg)
     end
-  end
+  end)
 end
 
 function plugin.boot()
@@ -3,18 +3,20 @@ plugin.name    = "Remove Trailing Spaces on Save"
 plugin.version = "1.0"
 
 function plugin.remove_trailing_spaces()
-  trim_count = 0
-  line_count = get_line_count()
+  local trim_count = 0
+  local lines = get_lines(0, get_line_count()-1)
 
-  for i = 0, line_count-1, 1 do
-    line = get_buffer_at_line(i)
-    col = string.find(line, "([ \t]+)$")
+  for i, line in ipairs(lines) do
+    local col = string.find(line, "([ \t]+)$")
     if col then
       trim_count = trim_count+1
-      delete_chars_at_line(i, col-1)
+      lines[i] = string.sub(line, 1, col-1)
     end
   end
 
+  -- write everything back as a single edit
+  if trim_count > 0 then set_lines(0, #lines-1, lines) end
+
   return trim_count
 end
 
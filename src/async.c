@@ -5,9 +5,22 @@
 #include <sys/time.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
 #include "utlist.h"
 #include "eon.h"
 
+static int _async_init_loop(editor_t* editor);
+static void _async_watch(editor_t* editor, async_proc_t* aproc);
+static void _async_unwatch(editor_t* editor, async_proc_t* aproc);
+static int _async_wait(editor_t* editor, int timeout_ms, int* ret_tty_ready);
+static void _async_arm_timer(editor_t* editor);
+static void _async_run_timers(editor_t* editor);
+static int _async_timespec_cmp(struct timespec* a, struct timespec* b);
+
 // Return a new async_proc_t
 async_proc_t* async_proc_new(editor_t* editor, void* owner, async_proc_t** owner_aproc, char* shell_cmd, int rw, async_proc_cb_t callback) {
   async_proc_t* aproc;
@@ -35,8 +48,12 @@ async_proc_t* async_proc_new(editor_t* editor, void* owner, async_proc_t** owner
 
   if (aproc->wpipe) setvbuf(aproc->wpipe, NULL, _IONBF, 0);
 
+  // Reads are drained until EAGAIN, so they must not block
+  fcntl(aproc->rfd, F_SETFL, fcntl(aproc->rfd, F_GETFL) | O_NONBLOCK);
+
   aproc->callback = callback;
   DL_APPEND(editor->async_procs, aproc);
+  _async_watch(editor, aproc);
   return aproc;
 
 async_proc_new_failure:
@@ -44,6 +61,23 @@ async_proc_new_failure:
   return NULL;
 }
 
+// Return a new async_proc_t that reads from an already open fd, e.g. a pipe
+// fed by threads. The fd is closed when the aproc is destroyed.
+async_proc_t* async_proc_new_fd(editor_t* editor, void* owner, async_proc_t** owner_aproc, int rfd, async_proc_cb_t callback) {
+  async_proc_t* aproc;
+  aproc = calloc(1, sizeof(async_proc_t));
+  aproc->editor = editor;
+  async_proc_set_owner(aproc, owner, owner_aproc);
+
+  aproc->rfd = rfd;
+  fcntl(aproc->rfd, F_SETFL, fcntl(aproc->rfd, F_GETFL) | O_NONBLOCK);
+
+  aproc->callback = callback;
+  DL_APPEND(editor->async_procs, aproc);
+  _async_watch(editor, aproc);
+  return aproc;
+}
+
 // Set aproc owner
 int async_proc_set_owner(async_proc_t* aproc, void* owner, async_proc_t** owner_aproc) {
   if (aproc->owner_aproc) {
@@ -59,8 +93,10 @@ int async_proc_set_owner(async_proc_t* aproc, void* owner, async_proc_t** owner_
 // Destroy an async_proc_t
 int async_proc_destroy(async_proc_t* aproc, int preempt) {
   DL_DELETE(aproc->editor->async_procs, aproc);
+  _async_unwatch(aproc->editor, aproc);
 
   if (aproc->owner_aproc) *aproc->owner_aproc = NULL;
+  if (aproc->owner && aproc->destroy_callback) aproc->destroy_callback(aproc, NULL, 0);
 
   if (preempt) {
     if (aproc->rfd) close(aproc->rfd);
@@ -68,90 +104,312 @@ int async_proc_destroy(async_proc_t* aproc, int preempt) {
     if (aproc->pid) kill(aproc->pid, SIGTERM);
   }
 
-  if (aproc->rpipe) pclose(aproc->rpipe);
+  if (aproc->rpipe) {
+    pclose(aproc->rpipe);
+  } else if (!preempt && aproc->rfd) {
+    close(aproc->rfd); // from async_proc_new_fd
+  }
+
   if (aproc->wpipe) pclose(aproc->wpipe);
 
   free(aproc);
   return EON_OK;
 }
 
-// Manage async procs, giving priority to user input. Return 1 if drain should
-// be called again, else return 0.
-int async_proc_drain_all(async_proc_t* aprocs, int* ttyfd) {
-  int maxfd;
-  fd_set readfds;
+// Manage async procs and timers, giving priority to user input. Return 1 if
+// drain should be called again, else return 0.
+int async_proc_drain_all(editor_t* editor) {
   async_proc_t* aproc;
   async_proc_t* aproc_tmp;
-  char buf[1024 + 1];
+  async_proc_t* solo;
+  char buf[EON_ASYNC_READ_SIZE + 1];
   ssize_t nbytes;
-  int rc;
+  int tty_ready;
+  int timeout_ms;
 
-  // Exit early if no aprocs
-  if (!aprocs) return 0;
+  // Exit early if nothing to wait for
+  if (!editor->async_procs && !editor->async_timers) return 0;
 
-  // Open ttyfd if not already open
-  if (!*ttyfd) {
-    if ((*ttyfd = open("/dev/tty", O_RDONLY)) < 0) {
-      // TODO error
-      return 0;
-    }
+  if (_async_init_loop(editor) != EON_OK) {
+    return 0; // TODO error
   }
 
-  // Add tty to readfds
-  FD_ZERO(&readfds);
-  FD_SET(*ttyfd, &readfds);
-
-  // Add async procs to readfds
-  // Simultaneously check for solo, which takes precedence over everything
-  maxfd = *ttyfd;
-  DL_FOREACH(aprocs, aproc) {
-    if (aproc->is_solo) {
-      FD_ZERO(&readfds);
-      FD_SET(aproc->rfd, &readfds);
-      maxfd = aproc->rfd;
-      break;
+  // Procs are read edge-triggered, so don't block if one still has data
+  // left over from an earlier wakeup. Check for solo, which takes
+  // precedence over everything, at the same time.
+  solo = NULL;
+  timeout_ms = -1;
+  DL_FOREACH(editor->async_procs, aproc) {
+    if (aproc->is_solo) solo = aproc;
+    if (aproc->is_readable) timeout_ms = 0;
+  }
 
-    } else {
-      FD_SET(aproc->rfd, &readfds);
+  tty_ready = 0;
+  if (_async_wait(editor, timeout_ms, &tty_ready) != EON_OK) {
+    return 0; // TODO error
+  }
+
+  _async_run_timers(editor);
+
+  if (tty_ready && !solo) {
+    // Immediately give priority to user input
+    return 0;
+  }
+
+  // Read async procs, one chunk each per call so input stays responsive
+  DL_FOREACH_SAFE(editor->async_procs, aproc, aproc_tmp) {
+    if (!aproc->is_readable || (solo && aproc != solo)) continue;
+
+    nbytes = read(aproc->rfd, buf, EON_ASYNC_READ_SIZE);
+
+    if (nbytes < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        aproc->is_readable = 0; // drained, wait for the next edge
+        continue;
 
-      if (aproc->rfd > maxfd) maxfd = aproc->rfd;
+      } else if (errno == EINTR) {
+        continue;
+      }
+
+      nbytes = 0; // treat read errors as eof
     }
+
+    // Invoke callback, destroying on eof
+    buf[nbytes] = '\0';
+    aproc->callback(aproc, buf, nbytes);
+
+    if (nbytes == 0) aproc->is_done = 1;
+    if (aproc->is_done) async_proc_destroy(aproc, 0);
   }
 
-  // Perform select
-  rc = select(maxfd + 1, &readfds, NULL, NULL, NULL);
+  return 1;
+}
 
-  if (rc < 0) {
-    return 0; // TODO error
+// Return a new one-shot timer, run by async_proc_drain_all after delay_ms
+async_timer_t* async_timer_new(editor_t* editor, long delay_ms, async_timer_cb_t callback, void* udata) {
+  async_timer_t* timer;
+  async_timer_t* cur;
+
+  timer = calloc(1, sizeof(async_timer_t));
+  timer->editor = editor;
+  timer->callback = callback;
+  timer->udata = udata;
 
-  } else if (rc == 0) {
-    return 1; // Nothing to read, call again
+  clock_gettime(CLOCK_MONOTONIC, &timer->when);
+  timer->when.tv_sec += delay_ms / 1000;
+  timer->when.tv_nsec += (delay_ms % 1000) * 1000000;
+
+  if (timer->when.tv_nsec >= 1000000000) {
+    timer->when.tv_sec += 1;
+    timer->when.tv_nsec -= 1000000000;
   }
 
-  if (FD_ISSET(*ttyfd, &readfds)) {
-    // Immediately give priority to user input
-    return 0;
+  // Keep timers sorted by due time
+  DL_FOREACH(editor->async_timers, cur) {
+    if (_async_timespec_cmp(&timer->when, &cur->when) < 0) break;
+  }
 
+  if (cur) {
+    DL_PREPEND_ELEM(editor->async_timers, cur, timer);
   } else {
-    // Read async procs
-    DL_FOREACH_SAFE(aprocs, aproc, aproc_tmp) {
-      // Read and invoke callback
-      if (FD_ISSET(aproc->rfd, &readfds)) {
-        nbytes = read(aproc->rfd, &buf, 1024);
-        buf[nbytes] = '\0';
-        aproc->callback(aproc, buf, nbytes);
-
-        if (nbytes == 0) aproc->is_done = 1;
-      }
+    DL_APPEND(editor->async_timers, timer);
+  }
+
+  _async_arm_timer(editor);
+  return timer;
+}
+
+// Destroy a timer that hasn't run yet
+int async_timer_destroy(async_timer_t* timer) {
+  editor_t* editor = timer->editor;
+  DL_DELETE(editor->async_timers, timer);
+  free(timer);
+  _async_arm_timer(editor);
+  return EON_OK;
+}
+
+// Run due timers, then rearm for the next one
+static void _async_run_timers(editor_t* editor) {
+  async_timer_t* timer;
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  // Timers may add or destroy timers, so always take the head
+  while ((timer = editor->async_timers) && _async_timespec_cmp(&timer->when, &now) <= 0) {
+    DL_DELETE(editor->async_timers, timer);
+    timer->callback(timer, timer->udata);
+    free(timer);
+  }
+
+  _async_arm_timer(editor);
+}
+
+static int _async_timespec_cmp(struct timespec* a, struct timespec* b) {
+  if (a->tv_sec != b->tv_sec) return a->tv_sec < b->tv_sec ? -1 : 1;
+  if (a->tv_nsec != b->tv_nsec) return a->tv_nsec < b->tv_nsec ? -1 : 1;
+  return 0;
+}
+
+// Open the tty for polling if not already open
+static int _async_open_tty(editor_t* editor) {
+  if (editor->ttyfd) return EON_OK;
+
+  if ((editor->ttyfd = open("/dev/tty", O_RDONLY)) < 0) {
+    editor->ttyfd = 0;
+    return EON_ERR;
+  }
+
+  return EON_OK;
+}
+
+#ifdef __linux__
+
+// Create the epoll set with persistent registrations for the tty, the timerfd
+// and every aproc
+static int _async_init_loop(editor_t* editor) {
+  struct epoll_event ev = {0};
+  async_proc_t* aproc;
+
+  if (editor->epfd) return EON_OK;
+  if (_async_open_tty(editor) != EON_OK) return EON_ERR;
+
+  if ((editor->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    editor->epfd = 0;
+    return EON_ERR;
+  }
+
+  // The tty is read by termbox, not us, so keep it level-triggered
+  ev.events = EPOLLIN;
+  ev.data.ptr = editor;
+  epoll_ctl(editor->epfd, EPOLL_CTL_ADD, editor->ttyfd, &ev);
+
+  if ((editor->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+    editor->timerfd = 0;
+  } else {
+    ev.events = EPOLLIN;
+    ev.data.ptr = &editor->timerfd;
+    epoll_ctl(editor->epfd, EPOLL_CTL_ADD, editor->timerfd, &ev);
+    _async_arm_timer(editor);
+  }
+
+  // Register procs started before the loop existed
+  DL_FOREACH(editor->async_procs, aproc) {
+    _async_watch(editor, aproc);
+  }
+
+  return EON_OK;
+}
+
+static void _async_watch(editor_t* editor, async_proc_t* aproc) {
+  struct epoll_event ev = {0};
+  if (!editor->epfd) return; // Registered once the loop is created
+
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.ptr = aproc;
+  epoll_ctl(editor->epfd, EPOLL_CTL_ADD, aproc->rfd, &ev);
+  aproc->is_readable = 1; // Anything already buffered won't trigger an edge
+}
+
+static void _async_unwatch(editor_t* editor, async_proc_t* aproc) {
+  if (editor->epfd) epoll_ctl(editor->epfd, EPOLL_CTL_DEL, aproc->rfd, NULL);
+}
+
+static int _async_wait(editor_t* editor, int timeout_ms, int* ret_tty_ready) {
+  struct epoll_event events[EON_ASYNC_MAX_EVENTS];
+  uint64_t expirations;
+  int i, n;
+
+  n = epoll_wait(editor->epfd, events, EON_ASYNC_MAX_EVENTS, timeout_ms);
+  if (n < 0) return errno == EINTR ? EON_OK : EON_ERR;
 
-      // Destroy on eof.
-      // Not sure if ferror and feof have any effect here given we're not
-      // using fread.
-      if (ferror(aproc->rpipe) || feof(aproc->rpipe) || aproc->is_done) {
-        async_proc_destroy(aproc, 0);
+  for (i = 0; i < n; i++) {
+    if (events[i].data.ptr == editor) {
+      *ret_tty_ready = 1;
+
+    } else if (events[i].data.ptr == &editor->timerfd) {
+      if (read(editor->timerfd, &expirations, sizeof(expirations)) < 0) {
+        // Nothing to do, due timers are run regardless
       }
+
+    } else {
+      ((async_proc_t*)events[i].data.ptr)->is_readable = 1;
     }
   }
 
-  return 1;
+  return EON_OK;
 }
+
+// Arm the timerfd for the earliest timer, or disarm it if there are none
+static void _async_arm_timer(editor_t* editor) {
+  struct itimerspec its = {0};
+  if (!editor->timerfd) return;
+
+  if (editor->async_timers) {
+    its.it_value = editor->async_timers->when;
+    if (!its.it_value.tv_sec && !its.it_value.tv_nsec) its.it_value.tv_nsec = 1;
+  }
+
+  timerfd_settime(editor->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+#else
+
+// Fall back to select where epoll isn't available
+static int _async_init_loop(editor_t* editor) {
+  return _async_open_tty(editor);
+}
+
+static void _async_watch(editor_t* editor, async_proc_t* aproc) {
+  aproc->is_readable = 1;
+}
+
+static void _async_unwatch(editor_t* editor, async_proc_t* aproc) {
+}
+
+static int _async_wait(editor_t* editor, int timeout_ms, int* ret_tty_ready) {
+  fd_set readfds;
+  struct timeval tv;
+  struct timespec now;
+  async_proc_t* aproc;
+  long timer_ms;
+  int maxfd;
+
+  // Wake up for the earliest timer
+  if (editor->async_timers) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timer_ms = (editor->async_timers->when.tv_sec - now.tv_sec) * 1000
+      + (editor->async_timers->when.tv_nsec - now.tv_nsec) / 1000000;
+    if (timer_ms < 0) timer_ms = 0;
+    if (timeout_ms < 0 || timer_ms < timeout_ms) timeout_ms = (int)timer_ms;
+  }
+
+  FD_ZERO(&readfds);
+  FD_SET(editor->ttyfd, &readfds);
+  maxfd = editor->ttyfd;
+
+  DL_FOREACH(editor->async_procs, aproc) {
+    FD_SET(aproc->rfd, &readfds);
+    if (aproc->rfd > maxfd) maxfd = aproc->rfd;
+  }
+
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+  if (select(maxfd + 1, &readfds, NULL, NULL, timeout_ms < 0 ? NULL : &tv) < 0) {
+    return errno == EINTR ? EON_OK : EON_ERR;
+  }
+
+  *ret_tty_ready = FD_ISSET(editor->ttyfd, &readfds);
+
+  DL_FOREACH(editor->async_procs, aproc) {
+    if (FD_ISSET(aproc->rfd, &readfds)) aproc->is_readable = 1;
+  }
+
+  return EON_OK;
+}
+
+static void _async_arm_timer(editor_t* editor) {
+}
+
+#endif
@@ -0,0 +1,608 @@
+#include <stdlib.h>
+#include <string.h>
+#include "eon.h"
+#include "colors.h"
+
+#define EON_BRACKET_NUM_TYPES 3 // (), [] and {}
+
+typedef struct bracket_stat_s bracket_stat_t;
+typedef struct bracket_line_s bracket_line_t;
+
+// Net depth change and lowest depth reached (never above 0) over a line
+// or run of lines, per bracket type
+struct bracket_stat_s {
+  bint_t sum[EON_BRACKET_NUM_TYPES];
+  bint_t min[EON_BRACKET_NUM_TYPES];
+};
+
+// A counted line
+struct bracket_line_s {
+  bracket_stat_t stat;
+  srule_t* eol_rule; // style state carried into the next line when counted
+};
+
+// bracket_index_t
+struct bracket_index_s {
+  bview_shared_t* shared;
+  bracket_line_t* lines; // lines before lines_len are counted
+  bint_t lines_len;
+  bint_t lines_cap;
+  bracket_stat_t* tree; // segment tree over lines, leaves start at tree_size
+  bint_t tree_size;
+  int is_tree_stale;
+  bint_t dirty_lo; // lines to recount before the next lookup, -1 if none
+  bint_t dirty_hi;
+  mark_t* build_mark; // near lines_len, to find its bline quickly
+  async_timer_t* timer;
+  bint_t version; // shared->version as of the last update
+};
+
+static int _bracket_get_type(bline_char_t* c, int* ret_is_open);
+static int _bracket_has_any(bline_t* bline);
+static void _bracket_count(bline_t* bline, bracket_line_t* line);
+static bint_t _bracket_scan_depth(bline_t* bline, int type, bint_t col);
+static bint_t _bracket_scan_next(bline_t* bline, int type, bint_t from, bint_t depth, bint_t target);
+static bint_t _bracket_scan_prev(bline_t* bline, int type, bint_t to, bint_t depth, bint_t target);
+static void _bracket_stat_join(bracket_stat_t* a, bracket_stat_t* b, bracket_stat_t* ret);
+static void _bracket_index_build_tree(bracket_index_t* index);
+static void _bracket_index_set_leaf(bracket_index_t* index, bint_t line_index);
+static bint_t _bracket_index_depth_at(bracket_index_t* index, int type, bint_t line_index);
+static bint_t _bracket_index_tree_next(bracket_index_t* index, int type, bint_t node, bint_t node_lo, bint_t node_hi, bint_t from, bint_t target, bint_t* depth);
+static bint_t _bracket_index_tree_prev(bracket_index_t* index, int type, bint_t node, bint_t node_lo, bint_t node_hi, bint_t to, bint_t target, bint_t* depth);
+static int _bracket_index_find_next(bracket_index_t* index, int type, bline_t* bline, bint_t from, bint_t target, bline_t** ret_bline, bint_t* ret_col);
+static int _bracket_index_find_prev(bracket_index_t* index, int type, bline_t* bline, bint_t to, bint_t target, bline_t** ret_bline, bint_t* ret_col);
+static int _bracket_index_refresh(bracket_index_t* index, bline_t* near_bline);
+static void _bracket_index_reset(bracket_index_t* index);
+static int _bracket_index_build(bracket_index_t* index, bint_t max_lines);
+static void _bracket_index_timer_cb(async_timer_t* timer, void* udata);
+
+// Index bracket depth over a buffer so pairs can be found in O(log n) with
+// no search limit. The index is built in the background and kept up to
+// date as lines are edited.
+int bracket_index_new(bview_shared_t* shared, bracket_index_t** ret_index) {
+  bracket_index_t* index;
+  index = calloc(1, sizeof(bracket_index_t));
+  index->shared = shared;
+  index->build_mark = buffer_add_mark(shared->buffer, shared->buffer->first_line, 0);
+  _bracket_index_reset(index);
+  *ret_index = index;
+  return EON_OK;
+}
+
+// Update index after an edit. Edited lines are recounted on the next
+// lookup, counts below them are shifted. A NULL action means the edit is
+// unknown, so the index is rebuilt.
+int bracket_index_update(bracket_index_t* index, baction_t* action) {
+  buffer_t* buffer;
+  srule_t* carried_rule;
+  bint_t start;
+  bint_t old_end;
+  bint_t new_end;
+  bint_t delta;
+  bint_t i;
+
+  buffer = index->shared->buffer;
+
+  if (!action) {
+    _bracket_index_reset(index);
+    return EON_OK;
+  }
+
+  start = action->start_line_index;
+  delta = action->line_delta < 0 ? -action->line_delta : action->line_delta;
+
+  if (action->type == MLBUF_BACTION_TYPE_DELETE) {
+    old_end = start + delta;
+    new_end = start;
+    delta = -delta;
+  } else {
+    old_end = start;
+    new_end = start + delta;
+  }
+
+  index->version = index->shared->version;
+
+  // Lines not yet counted are picked up by the build
+  if (start >= index->lines_len) return EON_OK;
+
+  // Edit reaches past what is counted, so build again from start
+  if (old_end >= index->lines_len) {
+    index->lines_len = start;
+    index->is_tree_stale = 1;
+    if (index->dirty_lo >= start) index->dirty_lo = -1;
+    if (index->dirty_hi >= start) index->dirty_hi = start - 1;
+    mark_move_to(index->build_mark, start, 0);
+    if (!index->timer) index->timer = async_timer_new(index->shared->editor, 0, _bracket_index_timer_cb, index);
+    return EON_OK;
+  }
+
+  // Splice in blank counts for the edited lines and shift the rest. The
+  // last one keeps the old style state so a change there is noticed.
+  carried_rule = index->lines[old_end].eol_rule;
+
+  if (index->lines_len + delta > index->lines_cap) {
+    index->lines_cap = (index->lines_len + delta) * 2;
+    index->lines = realloc(index->lines, sizeof(bracket_line_t) * index->lines_cap);
+  }
+
+  memmove(index->lines + new_end + 1, index->lines + old_end + 1, sizeof(bracket_line_t) * (index->lines_len - (old_end + 1)));
+  index->lines_len += delta;
+
+  for (i = start; i <= new_end; i++) memset(index->lines + i, 0, sizeof(bracket_line_t));
+  index->lines[new_end].eol_rule = carried_rule;
+
+  if (index->dirty_lo < 0) {
+    index->dirty_lo = start;
+    index->dirty_hi = new_end;
+  } else {
+    index->dirty_lo = EON_MIN(start, index->dirty_lo > old_end ? index->dirty_lo + delta : index->dirty_lo);
+    index->dirty_hi = EON_MAX(new_end, index->dirty_hi > old_end ? index->dirty_hi + delta : index->dirty_hi);
+  }
+
+  if (delta != 0) index->is_tree_stale = 1;
+  return EON_OK;
+}
+
+// Find the bracket paired with the one at mark. Return EON_ERR if mark
+// isn't at a bracket outside strings and comments, the index isn't built
+// yet, or there is no pair.
+int bracket_index_find_pair(bracket_index_t* index, mark_t* mark, bline_t** ret_bline, bint_t* ret_col) {
+  bline_t* bline;
+  bint_t depth;
+  int type;
+  int is_open;
+
+  if (!_bracket_index_refresh(index, mark->bline)) return EON_ERR;
+
+  bline = mark->bline;
+  MLBUF_BLINE_ENSURE_CHARS(bline);
+  if (mark->col >= bline->char_count) return EON_ERR;
+
+  type = _bracket_get_type(&bline->chars[mark->col], &is_open);
+  if (type < 0) return EON_ERR;
+
+  depth = _bracket_index_depth_at(index, type, bline->line_index) + _bracket_scan_depth(bline, type, mark->col);
+
+  if (is_open) {
+    return _bracket_index_find_next(index, type, bline, mark->col + 1, depth + 1, ret_bline, ret_col);
+  }
+
+  return _bracket_index_find_prev(index, type, bline, mark->col, depth - 1, ret_bline, ret_col);
+}
+
+// Find the nearest bracket of any type before mark that is not closed
+// before mark. Return EON_ERR if there is none or the index isn't built
+// yet.
+int bracket_index_find_top(bracket_index_t* index, mark_t* mark, bline_t** ret_bline, bint_t* ret_col) {
+  bline_t* bline;
+  bline_t* top_bline;
+  bint_t col;
+  bint_t top_col;
+  bint_t depth;
+  int type;
+
+  if (!_bracket_index_refresh(index, mark->bline)) return EON_ERR;
+
+  MLBUF_BLINE_ENSURE_CHARS(mark->bline);
+  top_bline = NULL;
+  top_col = 0;
+
+  for (type = 0; type < EON_BRACKET_NUM_TYPES; type++) {
+    depth = _bracket_index_depth_at(index, type, mark->bline->line_index) + _bracket_scan_depth(mark->bline, type, mark->col);
+
+    if (_bracket_index_find_prev(index, type, mark->bline, mark->col, depth - 1, &bline, &col) != EON_OK) {
+      continue;
+    }
+
+    if (!top_bline || bline->line_index > top_bline->line_index
+        || (bline == top_bline && col > top_col)) {
+      top_bline = bline;
+      top_col = col;
+    }
+  }
+
+  if (!top_bline) return EON_ERR;
+
+  *ret_bline = top_bline;
+  *ret_col = top_col;
+  return EON_OK;
+}
+
+// Return 1 if every line is counted, else 0
+int bracket_index_is_complete(bracket_index_t* index) {
+  return index->lines_len >= index->shared->buffer->line_count ? 1 : 0;
+}
+
+// Free an index
+int bracket_index_destroy(bracket_index_t* index) {
+  if (index->timer) async_timer_destroy(index->timer);
+  if (index->build_mark) mark_destroy(index->build_mark);
+  if (index->lines) free(index->lines);
+  if (index->tree) free(index->tree);
+  free(index);
+  return EON_OK;
+}
+
+// Return the type of bracket c is and set ret_is_open, or return -1 if c
+// isn't a bracket. Brackets styled as strings or comments don't count.
+static int _bracket_get_type(bline_char_t* c, int* ret_is_open) {
+  int type;
+
+  switch (c->ch) {
+    case '(': type = 0; *ret_is_open = 1; break;
+    case ')': type = 0; *ret_is_open = 0; break;
+    case '[': type = 1; *ret_is_open = 1; break;
+    case ']': type = 1; *ret_is_open = 0; break;
+    case '{': type = 2; *ret_is_open = 1; break;
+    case '}': type = 2; *ret_is_open = 0; break;
+    default: return -1;
+  }
+
+  if (c->style.fg == COMMENT_FG
+      || c->style.fg == SINGLE_QUOTE_STRING_FG
+      || c->style.fg == DOUBLE_QUOTE_STRING_FG
+      || c->style.fg == TRIPLE_QUOTE_COMMENT_FG
+     ) {
+    return -1;
+  }
+
+  return type;
+}
+
+// Return 1 if bline has any bracket bytes. Brackets are ASCII, so this
+// spares decoding chars of lines without any.
+static int _bracket_has_any(bline_t* bline) {
+  bint_t i;
+
+  for (i = 0; i < bline->data_len; i++) {
+    switch (bline->data[i]) {
+      case '(': case ')': case '[': case ']': case '{': case '}':
+        return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Count the brackets in bline
+static void _bracket_count(bline_t* bline, bracket_line_t* line) {
+  bint_t col;
+  int type;
+  int is_open;
+
+  memset(line, 0, sizeof(bracket_line_t));
+  line->eol_rule = bline->eol_rule;
+  if (!_bracket_has_any(bline)) return;
+
+  MLBUF_BLINE_ENSURE_CHARS(bline);
+
+  for (col = 0; col < bline->char_count; col++) {
+    type = _bracket_get_type(&bline->chars[col], &is_open);
+    if (type < 0) continue;
+
+    line->stat.sum[type] += is_open ? 1 : -1;
+    if (line->stat.sum[type] < line->stat.min[type]) line->stat.min[type] = line->stat.sum[type];
+  }
+}
+
+// Return the depth change from the start of bline to before col
+static bint_t _bracket_scan_depth(bline_t* bline, int type, bint_t col) {
+  bint_t depth;
+  bint_t i;
+  int is_open;
+
+  depth = 0;
+
+  for (i = 0; i < col && i < bline->char_count; i++) {
+    if (_bracket_get_type(&bline->chars[i], &is_open) == type) depth += is_open ? 1 : -1;
+  }
+
+  return depth;
+}
+
+// Return the first col at or after from where depth, the depth before
+// from, drops below target, or -1
+static bint_t _bracket_scan_next(bline_t* bline, int type, bint_t from, bint_t depth, bint_t target) {
+  bint_t col;
+  int is_open;
+
+  MLBUF_BLINE_ENSURE_CHARS(bline);
+
+  for (col = from; col < bline->char_count; col++) {
+    if (_bracket_get_type(&bline->chars[col], &is_open) != type) continue;
+
+    depth += is_open ? 1 : -1;
+    if (depth < target) return col;
+  }
+
+  return -1;
+}
+
+// Return the last opening bracket before to with a depth at or below
+// target in front of it, or -1. depth is the depth at the start of bline.
+static bint_t _bracket_scan_prev(bline_t* bline, int type, bint_t to, bint_t depth, bint_t target) {
+  bint_t col;
+  bint_t last;
+  int is_open;
+
+  MLBUF_BLINE_ENSURE_CHARS(bline);
+  last = -1;
+
+  for (col = 0; col < to && col < bline->char_count; col++) {
+    if (_bracket_get_type(&bline->chars[col], &is_open) != type) continue;
+
+    if (is_open && depth <= target) last = col;
+    depth += is_open ? 1 : -1;
+  }
+
+  return last;
+}
+
+// Combine the stats of two adjacent runs, a before b
+static void _bracket_stat_join(bracket_stat_t* a, bracket_stat_t* b, bracket_stat_t* ret) {
+  int type;
+
+  for (type = 0; type < EON_BRACKET_NUM_TYPES; type++) {
+    ret->min[type] = EON_MIN(a->min[type], a->sum[type] + b->min[type]);
+    ret->sum[type] = a->sum[type] + b->sum[type];
+  }
+}
+
+// Build the tree from line counts
+static void _bracket_index_build_tree(bracket_index_t* index) {
+  bint_t size;
+  bint_t i;
+
+  for (size = 1; size < index->lines_len; size *= 2);
+
+  if (size != index->tree_size) {
+    index->tree_size = size;
+    index->tree = realloc(index->tree, sizeof(bracket_stat_t) * size * 2);
+  }
+
+  memset(index->tree, 0, sizeof(bracket_stat_t) * size * 2);
+  for (i = 0; i < index->lines_len; i++) index->tree[size + i] = index->lines[i].stat;
+  for (i = size - 1; i >= 1; i--) _bracket_stat_join(&index->tree[i * 2], &index->tree[i * 2 + 1], &index->tree[i]);
+
+  index->is_tree_stale = 0;
+}
+
+// Update the tree after a line is recounted
+static void _bracket_index_set_leaf(bracket_index_t* index, bint_t line_index) {
+  bint_t node;
+
+  node = index->tree_size + line_index;
+  index->tree[node] = index->lines[line_index].stat;
+
+  for (node /= 2; node >= 1; node /= 2) {
+    _bracket_stat_join(&index->tree[node * 2], &index->tree[node * 2 + 1], &index->tree[node]);
+  }
+}
+
+// Return the depth at the start of a line
+static bint_t _bracket_index_depth_at(bracket_index_t* index, int type, bint_t line_index) {
+  bint_t depth;
+  bint_t lo;
+  bint_t hi;
+
+  depth = 0;
+  lo = index->tree_size;
+  hi = index->tree_size + line_index;
+
+  while (lo < hi) {
+    if (lo & 1) depth += index->tree[lo++].sum[type];
+    if (hi & 1) depth += index->tree[--hi].sum[type];
+    lo /= 2;
+    hi /= 2;
+  }
+
+  return depth;
+}
+
+// Return the first line at or after from where depth drops below target,
+// or -1. depth starts as the depth at from and ends as the depth at the
+// returned line.
+static bint_t _bracket_index_tree_next(bracket_index_t* index, int type, bint_t node, bint_t node_lo, bint_t node_hi, bint_t from, bint_t target, bint_t* depth) {
+  bint_t mid;
+  bint_t found;
+
+  if (node_hi <= from || node_lo >= index->lines_len) return -1;
+
+  if (node_lo >= from && *depth + index->tree[node].min[type] >= target) {
+    *depth += index->tree[node].sum[type];
+    return -1;
+  }
+
+  if (node_hi - node_lo == 1) return node_lo;
+
+  mid = node_lo + (node_hi - node_lo) / 2;
+  found = _bracket_index_tree_next(index, type, node * 2, node_lo, mid, from, target, depth);
+  if (found >= 0) return found;
+  return _bracket_index_tree_next(index, type, node * 2 + 1, mid, node_hi, from, target, depth);
+}
+
+// Return the last line at or before to where depth reaches target or
+// below, or -1. depth starts as the depth after to and ends as the depth
+// at the returned line.
+static bint_t _bracket_index_tree_prev(bracket_index_t* index, int type, bint_t node, bint_t node_lo, bint_t node_hi, bint_t to, bint_t target, bint_t* depth) {
+  bint_t mid;
+  bint_t found;
+  bint_t start_depth;
+
+  if (node_lo > to) return -1;
+
+  if (node_hi - 1 <= to) {
+    start_depth = *depth - index->tree[node].sum[type];
+
+    if (start_depth + index->tree[node].min[type] > target) {
+      *depth = start_depth;
+      return -1;
+    }
+
+    if (node_hi - node_lo == 1) {
+      *depth = start_depth;
+      return node_lo;
+    }
+  }
+
+  mid = node_lo + (node_hi - node_lo) / 2;
+  found = _bracket_index_tree_prev(index, type, node * 2 + 1, mid, node_hi, to, target, depth);
+  if (found >= 0) return found;
+  return _bracket_index_tree_prev(index, type, node * 2, node_lo, mid, to, target, depth);
+}
+
+// Find where depth drops below target at or after from in bline. Only
+// bline and the line found are scanned, the tree skips the lines between.
+static int _bracket_index_find_next(bracket_index_t* index, int type, bline_t* bline, bint_t from, bint_t target, bline_t** ret_bline, bint_t* ret_col) {
+  bint_t depth;
+  bint_t line_index;
+  bint_t col;
+
+  depth = _bracket_index_depth_at(index, type, bline->line_index);
+  col = _bracket_scan_next(bline, type, from, depth + _bracket_scan_depth(bline, type, from), target);
+
+  if (col < 0) {
+    depth = _bracket_index_depth_at(index, type, bline->line_index + 1);
+    line_index = _bracket_index_tree_next(index, type, 1, 0, index->tree_size, bline->line_index + 1, target, &depth);
+    if (line_index < 0) return EON_ERR;
+
+    bline = util_get_bline(index->shared->buffer, bline, line_index);
+    col = bline ? _bracket_scan_next(bline, type, 0, depth, target) : -1;
+
+    // Counts disagree with the buffer, so start over
+    if (col < 0) {
+      _bracket_index_reset(index);
+      return EON_ERR;
+    }
+  }
+
+  *ret_bline = bline;
+  *ret_col = col;
+  return EON_OK;
+}
+
+// Find the last opening bracket before to in bline, or in a line above it,
+// with a depth at or below target in front of it
+static int _bracket_index_find_prev(bracket_index_t* index, int type, bline_t* bline, bint_t to, bint_t target, bline_t** ret_bline, bint_t* ret_col) {
+  bint_t depth;
+  bint_t line_index;
+  bint_t col;
+
+  depth = _bracket_index_depth_at(index, type, bline->line_index);
+  col = _bracket_scan_prev(bline, type, to, depth, target);
+
+  if (col < 0) {
+    if (bline->line_index < 1) return EON_ERR;
+
+    line_index = _bracket_index_tree_prev(index, type, 1, 0, index->tree_size, bline->line_index - 1, target, &depth);
+    if (line_index < 0) return EON_ERR;
+
+    bline = util_get_bline(index->shared->buffer, bline, line_index);
+    col = -1;
+    if (bline) {
+      MLBUF_BLINE_ENSURE_CHARS(bline);
+      col = _bracket_scan_prev(bline, type, bline->char_count, depth, target);
+    }
+
+    // Counts disagree with the buffer, so start over
+    if (col < 0) {
+      _bracket_index_reset(index);
+      return EON_ERR;
+    }
+  }
+
+  *ret_bline = bline;
+  *ret_col = col;
+  return EON_OK;
+}
+
+// Recount edited lines and bring the tree up to date. Lines after them are
+// recounted too while their style state changed, e.g., on opening a block
+// comment. near_bline is where to look for them from. Return 1 if the index
+// can be used, else 0.
+static int _bracket_index_refresh(bracket_index_t* index, bline_t* near_bline) {
+  buffer_t* buffer;
+  bline_t* bline;
+  srule_t* old_rule;
+  bint_t i;
+  int is_carried;
+
+  buffer = index->shared->buffer;
+
+  // Rebuild if the buffer changed without an update
+  if (index->version != index->shared->version) {
+    _bracket_index_reset(index);
+    return 0;
+  }
+
+  if (!bracket_index_is_complete(index)) return 0;
+
+  if (index->is_tree_stale) _bracket_index_build_tree(index);
+
+  if (index->dirty_lo >= 0) {
+    bline = util_get_bline(buffer, near_bline, index->dirty_lo);
+    is_carried = 0;
+
+    for (i = index->dirty_lo; bline && i < index->lines_len && (i <= index->dirty_hi || is_carried); i++, bline = bline->next) {
+      old_rule = index->lines[i].eol_rule;
+      _bracket_count(bline, index->lines + i);
+      _bracket_index_set_leaf(index, i);
+      is_carried = index->lines[i].eol_rule != old_rule ? 1 : 0;
+    }
+
+    index->dirty_lo = -1;
+    index->dirty_hi = -1;
+  }
+
+  return 1;
+}
+
+// Drop all counts and start building again
+static void _bracket_index_reset(bracket_index_t* index) {
+  index->lines_len = 0;
+  index->is_tree_stale = 1;
+  index->dirty_lo = -1;
+  index->dirty_hi = -1;
+  index->version = index->shared->version;
+  mark_move_beginning(index->build_mark);
+  if (!index->timer) index->timer = async_timer_new(index->shared->editor, 0, _bracket_index_timer_cb, index);
+}
+
+// Count up to max_lines more lines. Return 1 if complete, else 0.
+static int _bracket_index_build(bracket_index_t* index, bint_t max_lines) {
+  buffer_t* buffer;
+  bline_t* bline;
+  bint_t i;
+
+  buffer = index->shared->buffer;
+
+  if (buffer->line_count > index->lines_cap) {
+    index->lines_cap = buffer->line_count;
+    index->lines = realloc(index->lines, sizeof(bracket_line_t) * index->lines_cap);
+  }
+
+  bline = util_get_bline(buffer, index->build_mark->bline, index->lines_len);
+
+  for (i = 0; bline && i < max_lines; i++, bline = bline->next) {
+    _bracket_count(bline, index->lines + index->lines_len);
+    index->lines_len += 1;
+  }
+
+  index->is_tree_stale = 1;
+  if (!bline) return 1;
+
+  mark_move_to_w_bline(index->build_mark, bline, 0);
+  return 0;
+}
+
+// Timer callback that counts a slice of lines at a time so input stays
+// responsive on big buffers
+static void _bracket_index_timer_cb(async_timer_t* timer, void* udata) {
+  bracket_index_t* index;
+  index = (bracket_index_t*)udata;
+  index->timer = NULL; // timer is freed by the event loop
+
+  if (!_bracket_index_build(index, EON_BRACKET_INDEX_LINES)) {
+    index->timer = async_timer_new(index->shared->editor, 0, _bracket_index_timer_cb, index);
+  }
+}
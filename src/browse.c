@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "utlist.h"
+#include "eon.h"
+
+// browse_dir_t
+struct browse_dir_s {
+    char* path; // absolute, also the hash key
+    str_t listing; // .. then sorted dirs then sorted files, one per line
+    int wd; // inotify watch, or -1 if mtime is checked instead
+    struct timespec mtime;
+    int is_stale;
+    UT_hash_handle hh;
+};
+
+static browse_dir_t* _browse_get_dir(editor_t* editor, char* path);
+static int _browse_list(browse_dir_t* dir);
+static int _browse_entry_cmp(const void* a, const void* b);
+static void _browse_watch(editor_t* editor, browse_dir_t* dir);
+static void _browse_destroy_dir(editor_t* editor, browse_dir_t* dir);
+static void _browse_aproc_cb(async_proc_t* aproc, char* buf, size_t buf_len);
+static int _browse_show(bview_t* menu, char* path);
+static int _browse_select(bview_t* menu, char* name);
+static int _browse_menu_cb(cmd_context_t* ctx, char* action);
+
+// Open a menu listing a dir, or cwd if opt_path is NULL
+int browse_open(editor_t* editor, char* opt_path) {
+  bview_t* menu;
+  char path[PATH_MAX + 1];
+
+  if (!realpath(opt_path ? opt_path : ".", path)) {
+    EON_RETURN_ERR(editor, "[browse] Cannot open '%s': %s", opt_path ? opt_path : ".", strerror(errno));
+  }
+
+  editor_page_menu(editor, _browse_menu_cb, NULL, 0, NULL, &menu);
+
+  if (_browse_show(menu, path) != EON_OK) {
+    editor_close_bview(editor, menu, NULL);
+    return EON_ERR;
+  }
+
+  return EON_OK;
+}
+
+// Free every cached listing and stop watching for changes
+int browse_destroy_all(editor_t* editor) {
+  browse_dir_t* dir;
+  browse_dir_t* dir_tmp;
+
+  HASH_ITER(hh, editor->browse_dirs, dir, dir_tmp) {
+    _browse_destroy_dir(editor, dir);
+  }
+
+  if (editor->browse_aproc) async_proc_destroy(editor->browse_aproc, 1);
+  return EON_OK;
+}
+
+// Return the cached listing of a dir, relisting it if it changed
+static browse_dir_t* _browse_get_dir(editor_t* editor, char* path) {
+  browse_dir_t* dir;
+  struct stat st;
+
+  HASH_FIND_STR(editor->browse_dirs, path, dir);
+
+  if (dir) {
+    // Without a watch, fall back to checking the dir's mtime
+    if (dir->wd < 0 && stat(path, &st) == 0
+      && (st.st_mtim.tv_sec != dir->mtime.tv_sec || st.st_mtim.tv_nsec != dir->mtime.tv_nsec)
+    ) {
+      dir->is_stale = 1;
+    }
+
+    if (dir->is_stale && _browse_list(dir) != EON_OK) {
+      _browse_destroy_dir(editor, dir);
+      return NULL;
+    }
+
+    // Readd so hash order stays least recently used first
+    HASH_DELETE(hh, editor->browse_dirs, dir);
+    HASH_ADD_KEYPTR(hh, editor->browse_dirs, dir->path, strlen(dir->path), dir);
+    return dir;
+  }
+
+  if (HASH_COUNT(editor->browse_dirs) >= EON_BROWSE_CACHE_SIZE) {
+    _browse_destroy_dir(editor, editor->browse_dirs);
+  }
+
+  dir = calloc(1, sizeof(browse_dir_t));
+  dir->path = strdup(path);
+  dir->wd = -1;
+  HASH_ADD_KEYPTR(hh, editor->browse_dirs, dir->path, strlen(dir->path), dir);
+
+  // Watch before listing so no change in between is missed
+  _browse_watch(editor, dir);
+
+  if (_browse_list(dir) != EON_OK) {
+    _browse_destroy_dir(editor, dir);
+    return NULL;
+  }
+
+  return dir;
+}
+
+// Read and sort a dir's entries into its listing
+static int _browse_list(browse_dir_t* dir) {
+  dir_entry_t* entries;
+  struct stat st;
+  int entries_len;
+  int dfd;
+  int i;
+
+  if ((dfd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) return EON_ERR;
+
+  if (fstat(dfd, &st) == 0) dir->mtime = st.st_mtim;
+
+  if (util_read_dir(dfd, &entries, &entries_len) != EON_OK) {
+    close(dfd);
+    return EON_ERR;
+  }
+
+  // Resolve types up front so sorting doesn't stat, following symlinks
+  for (i = 0; i < entries_len; i++) {
+    if (entries[i].type != DT_UNKNOWN && entries[i].type != DT_LNK) continue;
+    if (fstatat(dfd, entries[i].name, &st, 0) != 0) continue;
+    entries[i].type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+  }
+
+  close(dfd);
+  if (entries_len > 0) qsort(entries, entries_len, sizeof(dir_entry_t), _browse_entry_cmp);
+
+  // Hide dotfiles like tree does
+  str_clear(&dir->listing);
+  str_append(&dir->listing, "..");
+
+  for (i = 0; i < entries_len; i++) {
+    if (entries[i].name[0] == '.') continue;
+    str_append(&dir->listing, "\n");
+    str_append(&dir->listing, entries[i].name);
+    if (entries[i].type == DT_DIR) str_append(&dir->listing, "/");
+  }
+
+  util_free_dir(entries, entries_len);
+  dir->is_stale = 0;
+  return EON_OK;
+}
+
+// Sort dirs before files, then by name
+static int _browse_entry_cmp(const void* a, const void* b) {
+  dir_entry_t* ea = (dir_entry_t*)a;
+  dir_entry_t* eb = (dir_entry_t*)b;
+  int a_is_dir = ea->type == DT_DIR ? 1 : 0;
+  int b_is_dir = eb->type == DT_DIR ? 1 : 0;
+
+  if (a_is_dir != b_is_dir) return b_is_dir - a_is_dir;
+  return strcmp(ea->name, eb->name);
+}
+
+// Ask inotify to mark a dir stale when its entries change
+static void _browse_watch(editor_t* editor, browse_dir_t* dir) {
+#ifdef __linux__
+  int fd;
+
+  if (!editor->browse_aproc) {
+    if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) return;
+    async_proc_new_fd(editor, editor, &editor->browse_aproc, fd, _browse_aproc_cb);
+  }
+
+  dir->wd = inotify_add_watch(editor->browse_aproc->rfd, dir->path,
+    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+#endif
+}
+
+// Remove a dir from the cache and free it
+static void _browse_destroy_dir(editor_t* editor, browse_dir_t* dir) {
+  if (!dir) return;
+
+  HASH_DELETE(hh, editor->browse_dirs, dir);
+
+#ifdef __linux__
+  if (dir->wd >= 0 && editor->browse_aproc) {
+    inotify_rm_watch(editor->browse_aproc->rfd, dir->wd);
+  }
+#endif
+
+  str_free(&dir->listing);
+  free(dir->path);
+  free(dir);
+}
+
+// Mark dirs stale on inotify events, then refresh any menu showing one
+static void _browse_aproc_cb(async_proc_t* aproc, char* buf, size_t buf_len) {
+#ifdef __linux__
+  editor_t* editor;
+  struct inotify_event event;
+  browse_dir_t* dir;
+  browse_dir_t* dir_tmp;
+  bview_t* bview;
+  bline_t* bline;
+  char* name;
+  bint_t line_index;
+  size_t pos;
+
+  editor = aproc->editor;
+
+  // Events may not be aligned within buf, so copy each header out
+  for (pos = 0; pos + sizeof(struct inotify_event) <= buf_len; pos += sizeof(struct inotify_event) + event.len) {
+    memcpy(&event, buf + pos, sizeof(struct inotify_event));
+
+    HASH_ITER(hh, editor->browse_dirs, dir, dir_tmp) {
+      if (dir->wd != event.wd) continue;
+      dir->is_stale = 1;
+      if (event.mask & IN_IGNORED) dir->wd = -1; // watch is gone
+    }
+  }
+
+  CDL_FOREACH2(editor->all_bviews, bview, all_next) {
+    if (!bview->browse_path) continue;
+
+    HASH_FIND_STR(editor->browse_dirs, bview->browse_path, dir);
+    if (dir && !dir->is_stale) continue;
+
+    // Keep the cursor on the same entry, or the same line if it went away
+    bline = bview->active_cursor->mark->bline;
+    name = strndup(bline->data, bline->data_len);
+    line_index = bline->line_index;
+
+    if (_browse_show(bview, bview->browse_path) == EON_OK && !_browse_select(bview, name)) {
+      mark_move_to(bview->active_cursor->mark, EON_MIN(line_index, bview->buffer->line_count - 1), 0);
+      bview_rectify_viewport(bview);
+    }
+
+    free(name);
+  }
+#endif
+}
+
+// Show the listing of an absolute path in a menu
+static int _browse_show(bview_t* menu, char* path) {
+  browse_dir_t* dir;
+  char* path_dup;
+
+  if (!(dir = _browse_get_dir(menu->editor, path))) {
+    EON_RETURN_ERR(menu->editor, "[browse] Cannot open '%s': %s", path, strerror(errno));
+  }
+
+  // path may be menu->browse_path itself
+  path_dup = strdup(path);
+  if (menu->browse_path) free(menu->browse_path);
+  menu->browse_path = path_dup;
+
+  buffer_set(menu->buffer, dir->listing.data, dir->listing.len);
+  mark_move_beginning(menu->active_cursor->mark);
+  bview_rectify_viewport(menu);
+  return EON_OK;
+}
+
+// Move the menu cursor to the line equal to name. Return 1 if found.
+static int _browse_select(bview_t* menu, char* name) {
+  bline_t* bline;
+  size_t name_len;
+
+  name_len = strlen(name);
+
+  for (bline = menu->buffer->first_line; bline; bline = bline->next) {
+    if ((size_t)bline->data_len != name_len || memcmp(bline->data, name, name_len) != 0) continue;
+    mark_move_to(menu->active_cursor->mark, bline->line_index, 0);
+    bview_rectify_viewport(menu);
+    return 1;
+  }
+
+  return 0;
+}
+
+// Callback from browse_open. Dirs are listed in the same menu, files are
+// opened and close it.
+static int _browse_menu_cb(cmd_context_t* ctx, char* action) {
+  if (!action) return EON_OK; // cancelled
+
+  bview_t* menu;
+  bview_t* new_bview;
+  bline_t* bline;
+  char cwd[PATH_MAX + 1];
+  char* name;
+  char* path;
+  char* slash;
+  char* rel_path;
+  size_t cwd_len;
+
+  menu = ctx->bview;
+  if (!menu->browse_path) return EON_OK;
+
+  bline = menu->active_cursor->mark->bline;
+  name = strndup(bline->data, bline->data_len);
+
+  if (strcmp(name, "..") == 0) {
+    // Go up, leaving the cursor on the dir we came from
+    path = strdup(menu->browse_path);
+    slash = strrchr(path, '/');
+    free(name);
+    name = NULL;
+
+    if (slash && *(slash + 1) != '\0') {
+      if (asprintf(&name, "%s/", slash + 1) < 0) name = NULL;
+      *(slash == path ? slash + 1 : slash) = '\0';
+    }
+
+    if (_browse_show(menu, path) == EON_OK && name) _browse_select(menu, name);
+
+  } else if (bline->data_len > 1 && name[bline->data_len - 1] == '/') {
+    name[bline->data_len - 1] = '\0';
+
+    if (asprintf(&path, "%s/%s", strcmp(menu->browse_path, "/") == 0 ? "" : menu->browse_path, name) < 0) {
+      free(name);
+      return EON_ERR;
+    }
+
+    _browse_show(menu, path);
+
+  } else {
+    if (asprintf(&path, "%s/%s", strcmp(menu->browse_path, "/") == 0 ? "" : menu->browse_path, name) < 0) {
+      free(name);
+      return EON_ERR;
+    }
+
+    // Prefer a path relative to cwd, as if it were opened from the shell
+    rel_path = path;
+    if (getcwd(cwd, PATH_MAX) && (cwd_len = strlen(cwd)) > 1
+      && strncmp(path, cwd, cwd_len) == 0 && path[cwd_len] == '/'
+    ) {
+      rel_path = path + cwd_len + 1;
+    }
+
+    new_bview = NULL;
+    editor_open_bview(ctx->editor, NULL, EON_BVIEW_TYPE_EDIT, rel_path, strlen(rel_path), 0, 0, &ctx->editor->rect_edit, NULL, &new_bview);
+    editor_close_bview(ctx->editor, menu, NULL);
+    if (new_bview) editor_set_active(ctx->editor, new_bview);
+  }
+
+  if (name) free(name);
+  free(path);
+  return EON_OK;
+}
@@ -10,6 +10,21 @@ static void _bview_init(bview_t* self, buffer_t* buffer);
 static void _bview_init_resized(bview_t* self);
 static kmap_t* _bview_get_init_kmap(editor_t* editor);
 static void _bview_buffer_callback(buffer_t* buffer, baction_t* action, void* udata);
+static void _bview_settle_edit(editor_t* editor, buffer_t* buffer, int is_line_delta);
+static void _bview_track_edit(bview_t* self, baction_t* action);
+static int _bview_join_undo_record(bview_t* self);
+static void _bview_get_action_end(baction_t* action, bint_t* ret_line, bint_t* ret_col);
+static undo_tree_t* _bview_get_undo_tree(bview_t* self);
+static swap_t* _bview_get_swap(bview_t* self);
+static bview_shared_t* _bview_get_shared(bview_t* self);
+static void _bview_release_shared(bview_t* self);
+static void _bview_count_undo(bview_t* self, baction_t* action);
+static void _bview_trim_undo(editor_t* editor, buffer_t* buffer);
+static bint_t _bview_undo_size(baction_t* action);
+static int _bview_cursor_cmp(const void* a, const void* b);
+static int _bview_anchored_cmp(const void* a, const void* b);
+static void _bview_sort_anchored(bview_t* self);
+static void _bview_free_cursor(bview_t* self, cursor_t* cursor);
 static int _bview_set_linenum_width(bview_t* self);
 static void _bview_deinit(bview_t* self);
 static void _bview_set_tab_width(bview_t* self, int tab_width);
@@ -19,7 +34,11 @@ static void _bview_draw_prompt(bview_t* self);
 static void _bview_draw_status(bview_t* self);
 static void _bview_draw_edit(bview_t* self, int x, int y, int w, int h);
 static void _bview_draw_bline(bview_t* self, bline_t* bline, int rect_y, bline_t** optret_bline, int* optret_rect_y);
+static void _bview_collect_sels(bview_t* self);
+static void _bview_get_line_sels(bview_t* self, bint_t line_index, int* ret_from, int* ret_to);
 static void _bview_highlight_bracket_pair(bview_t* self, mark_t* mark);
+static void _bview_output_timer_cb(async_timer_t* timer, void* udata);
+static void _bview_isearch_count_cb(async_timer_t* timer, void* udata);
 
 // Create a new bview
 bview_t* bview_new(editor_t* editor, char* opt_path, int opt_path_len, buffer_t* opt_buffer) {
@@ -170,16 +189,38 @@ int bview_draw(bview_t* self) {
   return EON_OK;
 }
 
-// Set cursor to screen
+// Set cursor to screen. Only cursors on visible lines are looked at.
 int bview_draw_cursor(bview_t* self, int set_real_cursor) {
   cursor_t* cursor;
   mark_t* mark;
   int screen_x;
   int screen_y;
   struct tb_cell* cell;
-  DL_FOREACH(self->cursors, cursor) {
+  int lo;
+  int hi;
+  int mid;
+
+  bview_sort_cursors(self);
+
+  // Find first cursor at or below viewport
+  lo = 0;
+  hi = self->cursors_len;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (self->cursors[mid]->mark->bline->line_index < self->viewport_y) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (; lo < self->cursors_len; lo++) {
+    cursor = self->cursors[lo];
     mark = cursor->mark;
 
+    if (mark->bline->line_index >= self->viewport_y + self->rect_buffer.h) break;
+
     if (bview_get_screen_coords(self, mark, &screen_x, &screen_y, &cell) != EON_OK) {
       // Out of bounds
       continue;
@@ -264,25 +305,24 @@ int bview_split(bview_t* self, int is_vertical, float factor, bview_t** optret_b
 
 // Return number of active cursors
 int bview_get_active_cursor_count(bview_t* self) {
-  int count;
-  cursor_t* cursor;
-  count = 0;
-  DL_FOREACH(self->cursors, cursor) {
-    if (!cursor->is_asleep) {
-      count += 1;
-    }
-  }
-  return count;
+  return self->cursors_len - self->num_asleep_cursors;
 }
 
-// Add a cursor to a bview
+// Add a cursor to a bview. Cursors added out of order are sorted the next
+// time they're iterated.
 int bview_add_cursor(bview_t* self, bline_t* bline, bint_t col, cursor_t** optret_cursor) {
   cursor_t* cursor;
 
   cursor = calloc(1, sizeof(cursor_t));
   cursor->bview = self;
   cursor->mark = buffer_add_mark(self->buffer, bline, col);
-  DL_APPEND(self->cursors, cursor);
+
+  if (self->cursors_len >= self->cursors_cap) {
+    self->cursors_cap = self->cursors_cap > 0 ? self->cursors_cap * 2 : 8;
+    self->cursors = realloc(self->cursors, sizeof(cursor_t*) * self->cursors_cap);
+  }
+
+  self->cursors[self->cursors_len++] = cursor;
 
   if (!self->active_cursor) {
     self->active_cursor = cursor;
@@ -301,56 +341,119 @@ int bview_add_cursor_asleep(bview_t* self, bline_t* bline, bint_t col, cursor_t*
 
   bview_add_cursor(self, bline, col, &cursor);
   cursor->is_asleep = 1;
+  self->num_asleep_cursors += 1;
   if (optret_cursor) *optret_cursor = cursor;
 
   return EON_OK;
 }
 
+// Track a cursor that was just anchored, for drawing its selection
+int bview_add_anchored(bview_t* self, cursor_t* cursor) {
+  if (self->anchored_len >= self->anchored_cap) {
+    self->anchored_cap = self->anchored_cap > 0 ? self->anchored_cap * 2 : 8;
+    self->anchored = realloc(self->anchored, sizeof(cursor_t*) * self->anchored_cap);
+    self->anchored_reach = realloc(self->anchored_reach, sizeof(bint_t) * self->anchored_cap);
+  }
+
+  self->anchored[self->anchored_len++] = cursor;
+  return EON_OK;
+}
+
+// Stop tracking a cursor whose anchor was lifted
+int bview_remove_anchored(bview_t* self, cursor_t* cursor) {
+  int i;
+
+  for (i = self->anchored_len - 1; i >= 0; i--) {
+    if (self->anchored[i] == cursor) break;
+  }
+
+  if (i < 0) return EON_ERR;
+
+  memmove(self->anchored + i, self->anchored + i + 1, sizeof(cursor_t*) * (self->anchored_len - i - 1));
+  self->anchored_len -= 1;
+  return EON_OK;
+}
+
 // Wake all sleeping cursors
 int bview_wake_sleeping_cursors(bview_t* self) {
-  cursor_t* cursor;
-  DL_FOREACH(self->cursors, cursor) {
-    if (cursor->is_asleep) {
-      cursor->is_asleep = 0;
-    }
+  int i;
+
+  if (self->num_asleep_cursors < 1) return EON_OK;
+
+  for (i = 0; i < self->cursors_len; i++) {
+    self->cursors[i]->is_asleep = 0;
   }
+
+  self->num_asleep_cursors = 0;
   return EON_OK;
 }
 
 // Remove all cursors except one
 int bview_remove_cursors_except(bview_t* self, cursor_t* one) {
-  cursor_t* cursor;
-  cursor_t* cursor_tmp;
-  DL_FOREACH_SAFE(self->cursors, cursor, cursor_tmp) {
-    if (cursor != one) {
-      bview_remove_cursor(self, cursor);
+  int i;
+  int is_found;
+
+  is_found = 0;
+  self->anchored_len = 0;
+
+  for (i = 0; i < self->cursors_len; i++) {
+    if (self->cursors[i] == one) {
+      is_found = 1;
+    } else {
+      _bview_free_cursor(self, self->cursors[i]);
     }
   }
+
+  self->cursors_len = 0;
+  self->num_asleep_cursors = 0;
+  self->active_cursor = NULL;
+
+  if (is_found) {
+    self->cursors[self->cursors_len++] = one;
+    self->active_cursor = one;
+    if (one->is_asleep) self->num_asleep_cursors = 1;
+    if (one->is_anchored) bview_add_anchored(self, one);
+  }
+
   return EON_OK;
 }
 
 // Remove a cursor from a bview
 int bview_remove_cursor(bview_t* self, cursor_t* cursor) {
-  cursor_t* el;
-  cursor_t* tmp;
-  DL_FOREACH_SAFE(self->cursors, el, tmp) {
-    if (el == cursor) {
-      self->active_cursor = el->prev && el->prev != el ? el->prev : el->next;
-      DL_DELETE(self->cursors, el);
-
-      if (el->sel_rule) {
-        buffer_remove_srule(el->bview->buffer, el->sel_rule, 0, 0);
-        srule_destroy(el->sel_rule);
-        el->sel_rule = NULL;
-      }
+  int i;
 
-      if (el->cut_buffer) free(el->cut_buffer);
+  for (i = self->cursors_len - 1; i >= 0; i--) {
+    if (self->cursors[i] == cursor) break;
+  }
 
-      free(el);
-      return EON_OK;
-    }
+  if (i < 0) return EON_ERR;
+
+  memmove(self->cursors + i, self->cursors + i + 1, sizeof(cursor_t*) * (self->cursors_len - i - 1));
+  self->cursors_len -= 1;
+
+  if (self->active_cursor == cursor) {
+    self->active_cursor = self->cursors_len > 0 ? self->cursors[i > 0 ? i - 1 : 0] : NULL;
   }
-  return EON_ERR;
+
+  if (cursor->is_asleep) self->num_asleep_cursors -= 1;
+  _bview_free_cursor(self, cursor);
+  return EON_OK;
+}
+
+// Sort cursors by position if edits or moves have reordered them. Cheap
+// when already sorted, which is the common case.
+int bview_sort_cursors(bview_t* self) {
+  int i;
+
+  for (i = 1; i < self->cursors_len; i++) {
+    if (_bview_cursor_cmp(self->cursors + i - 1, self->cursors + i) > 0) break;
+  }
+
+  if (i < self->cursors_len) {
+    qsort(self->cursors, self->cursors_len, sizeof(cursor_t*), _bview_cursor_cmp);
+  }
+
+  return EON_OK;
 }
 
 int bview_is_line_visible(bview_t* self, bint_t number) {
@@ -458,6 +561,455 @@ int bview_rectify_viewport(bview_t* self) {
   return EON_OK;
 }
 
+// Queue output (e.g., from an aproc) to be appended to the end of the buffer.
+// Output is appended in one batch once EON_BVIEW_OUTPUT_FLUSH_SIZE bytes are
+// pending or EON_BVIEW_OUTPUT_FLUSH_MS have passed, whichever comes first.
+int bview_queue_output(bview_t* self, char* data, size_t data_len) {
+  if (!data || data_len < 1) return EON_OK;
+
+  str_append_len(&self->pending_output, data, data_len);
+
+  if (self->pending_output.len >= EON_BVIEW_OUTPUT_FLUSH_SIZE) {
+    return bview_flush_output(self);
+  }
+
+  if (!self->output_timer) {
+    self->output_timer = async_timer_new(self->editor, EON_BVIEW_OUTPUT_FLUSH_MS, _bview_output_timer_cb, self);
+  }
+
+  // Nothing visible changed, so skip the redraw
+  self->editor->is_display_deferred = 1;
+  return EON_OK;
+}
+
+// Append pending output to the end of the buffer
+int bview_flush_output(bview_t* self) {
+  mark_t* active_mark;
+  int is_cursor_at_zero;
+
+  if (self->output_timer) {
+    async_timer_destroy(self->output_timer);
+    self->output_timer = NULL;
+  }
+
+  if (self->pending_output.len < 1) return EON_OK;
+
+  // Remember if cursor is at 0
+  active_mark = self->active_cursor->mark;
+  is_cursor_at_zero = active_mark->bline->line_index == 0 && active_mark->col == 0 ? 1 : 0;
+
+  // Inserting before the end mark keeps it at the end for the next batch
+  if (!self->output_mark) {
+    self->output_mark = buffer_add_mark(self->buffer, NULL, 0);
+    mark_move_end(self->output_mark);
+  }
+
+  mark_insert_before(self->output_mark, self->pending_output.data, self->pending_output.len);
+  str_clear(&self->pending_output);
+
+  if (is_cursor_at_zero) mark_move_beginning(active_mark);
+  bview_rectify_viewport(self);
+  return EON_OK;
+}
+
+// Highlight matches of regex over the visible rows and count them in the
+// background. The buffer isn't restyled. Clear the overlay if opt_regex is
+// NULL.
+int bview_set_isearch(bview_t* self, char* opt_regex, bint_t regex_len) {
+  char* regex;
+  const char* error;
+  int erroffset;
+
+  if (self->isearch_timer) {
+    async_timer_destroy(self->isearch_timer);
+    self->isearch_timer = NULL;
+  }
+
+  if (self->isearch_count_mark) {
+    mark_destroy(self->isearch_count_mark);
+    self->isearch_count_mark = NULL;
+  }
+
+  if (self->isearch_cre_extra) {
+    pcre_free_study(self->isearch_cre_extra);
+    self->isearch_cre_extra = NULL;
+  }
+
+  if (self->isearch_cre) {
+    pcre_free(self->isearch_cre);
+    self->isearch_cre = NULL;
+  }
+
+  if (self->isearch_literal) {
+    free(self->isearch_literal);
+    self->isearch_literal = NULL;
+  }
+
+  self->isearch_count = 0;
+
+  if (!opt_regex || regex_len < 1) return EON_OK;
+
+  regex = strndup(opt_regex, regex_len);
+  self->isearch_cre = pcre_compile(regex, PCRE_CASELESS, &error, &erroffset, NULL);
+  free(regex);
+
+  if (!self->isearch_cre) return EON_ERR;
+
+  self->isearch_cre_extra = pcre_study(self->isearch_cre, 0, &error);
+
+  // Plain text is found with memmem instead of pcre
+  search_get_literal(opt_regex, regex_len, &self->isearch_literal, &self->isearch_literal_len, &self->isearch_is_caseless);
+
+  self->isearch_count_mark = buffer_add_mark(self->buffer, self->buffer->first_line, 0);
+  self->isearch_timer = async_timer_new(self->editor, 0, _bview_isearch_count_cb, self);
+  return EON_OK;
+}
+
+// Find the first non-empty isearch match in bline starting at or after byte
+// offset from. Return 1 and set byte offsets if found, else return 0.
+int bview_find_isearch(bview_t* self, bline_t* bline, bint_t from, bint_t* ret_start, bint_t* ret_end) {
+  int ovector[3];
+  char* hit;
+
+  if (!self->isearch_cre || from >= bline->data_len) return 0;
+
+  if (self->isearch_literal) {
+    hit = search_memmem(bline->data + from, bline->data_len - from, self->isearch_literal, self->isearch_literal_len, self->isearch_is_caseless);
+    if (!hit) return 0;
+
+    *ret_start = hit - bline->data;
+    *ret_end = *ret_start + self->isearch_literal_len;
+    return 1;
+  }
+
+  if (pcre_exec(self->isearch_cre, self->isearch_cre_extra, bline->data, bline->data_len, from, PCRE_NOTEMPTY, ovector, 3) < 0) {
+    return 0;
+  }
+
+  *ret_start = ovector[0];
+  *ret_end = ovector[1];
+  return 1;
+}
+
+// Move mark to the next isearch match at or after it, or after it if nudge
+int bview_move_next_isearch(bview_t* self, mark_t* mark, int nudge) {
+  bline_t* bline;
+  bint_t col;
+
+  if (!self->isearch_cre) return EON_ERR;
+
+  if (!self->isearch_literal) {
+    return (nudge ? mark_move_next_cre_nudge(mark, self->isearch_cre) : mark_move_next_cre(mark, self->isearch_cre)) == MLBUF_OK ? EON_OK : EON_ERR;
+  }
+
+  if (search_find_next_literal(mark, self->isearch_literal, self->isearch_literal_len, self->isearch_is_caseless, nudge, &bline, &col, NULL) != EON_OK) {
+    return EON_ERR;
+  }
+
+  mark_move_to_w_bline(mark, bline, col);
+  return EON_OK;
+}
+
+// Find the bracket paired with the one at mark. Until the bracket index is
+// built, or for brackets in strings and comments, fall back to a scan of
+// at most EON_BRACKET_PAIR_MAX_SEARCH chars.
+int bview_find_bracket_pair(bview_t* self, mark_t* mark, bline_t** ret_bline, bint_t* ret_col) {
+  bint_t brkt;
+
+  if (!self->shared->bracket_index) bracket_index_new(self->shared, &self->shared->bracket_index);
+
+  if (bracket_index_find_pair(self->shared->bracket_index, mark, ret_bline, ret_col) == EON_OK) {
+    return EON_OK;
+  }
+
+  return mark_find_bracket_pair(mark, EON_BRACKET_PAIR_MAX_SEARCH, ret_bline, ret_col, &brkt) == MLBUF_OK ? EON_OK : EON_ERR;
+}
+
+// Move mark to the nearest unclosed bracket before it, see
+// bview_find_bracket_pair
+int bview_move_bracket_top(bview_t* self, mark_t* mark) {
+  bline_t* bline;
+  bint_t col;
+
+  if (!self->shared->bracket_index) bracket_index_new(self->shared, &self->shared->bracket_index);
+
+  if (bracket_index_find_top(self->shared->bracket_index, mark, &bline, &col) == EON_OK) {
+    mark_move_to_w_bline(mark, bline, col);
+    return EON_OK;
+  }
+
+  return mark_move_bracket_top(mark, EON_BRACKET_PAIR_MAX_SEARCH) == MLBUF_OK ? EON_OK : EON_ERR;
+}
+
+// Start an edit. Until the matching bview_end_edit, buffer changes are
+// collected rather than restyled and settled one by one, so an edit made
+// by thousands of cursors costs one restyle and one undo step. Edits may
+// nest.
+int bview_begin_edit(bview_t* self) {
+  self->edit_depth += 1;
+  if (self->edit_depth > 1) return EON_OK;
+
+  self->edit_num_actions = 0;
+  self->edit_first_action = NULL;
+  self->edit_last_action = NULL;
+  self->buffer->is_style_disabled += 1;
+  return EON_OK;
+}
+
+// Finish an edit started with bview_begin_edit. If edit_is_typing is set,
+// the edit joins the undo record before it.
+int bview_end_edit(bview_t* self) {
+  bline_t* bline;
+  bint_t start;
+  int is_typing;
+
+  if (self->edit_depth < 1) return EON_ERR;
+
+  self->edit_depth -= 1;
+  if (self->edit_depth > 0) return EON_OK;
+
+  is_typing = self->edit_is_typing;
+  self->edit_is_typing = 0;
+  self->buffer->is_style_disabled -= 1;
+  if (self->edit_num_actions < 1) return EON_OK;
+
+  // Restyle touched lines once
+  start = EON_MIN(self->edit_start_line, self->buffer->line_count - 1);
+
+  if (buffer_get_bline(self->buffer, start, &bline) == MLBUF_OK) {
+    buffer_apply_styles(self->buffer, bline, EON_MAX(self->edit_end_line - start, 0));
+  }
+
+  // Undo and redo the actions together
+  if (!self->is_in_undo) {
+    if (is_typing && _bview_join_undo_record(self)) {
+      // Joined the typing run
+    } else {
+      is_typing = 0;
+      if (self->edit_num_actions > 1) {
+        bview_add_undo_group(self, self->edit_first_action, self->edit_last_action, self->edit_num_actions);
+      }
+    }
+
+    undo_tree_add(_bview_get_undo_tree(self), self->edit_first_action, self->edit_last_action, self->edit_num_actions, is_typing);
+
+    // Remember where this edit left off for the next keystroke to join
+    self->undo_join_action = self->edit_last_action;
+    _bview_get_action_end(self->edit_first_action, &self->undo_join_line, &self->undo_join_col);
+    _bview_trim_undo(self->editor, self->buffer);
+  } else {
+    self->undo_join_action = NULL;
+  }
+
+  _bview_settle_edit(self->editor, self->buffer, 1);
+  return EON_OK;
+}
+
+// Undo the last action, or the whole group if it ends one
+int bview_undo(bview_t* self) {
+  buffer_t* buffer;
+  baction_t* action;
+  bview_undo_group_t* group;
+  int num_actions;
+  int i;
+
+  buffer = self->buffer;
+
+  // Past the oldest action, look for history from earlier sessions
+  if ((buffer->action_undone ? buffer->action_undone == buffer->actions : !buffer->action_tail)
+    && undo_tree_load(_bview_get_undo_tree(self), self) != EON_OK
+  ) {
+    return EON_ERR;
+  }
+
+  if (buffer->action_undone) {
+    if (buffer->action_undone == buffer->actions) return EON_ERR;
+    action = buffer->action_undone->prev;
+  } else {
+    action = buffer->action_tail;
+  }
+
+  if (!action) return EON_ERR;
+
+  // Groups are undone newest first, so only the newest live one can match
+  num_actions = 1;
+
+  for (i = self->shared->undo_groups_len - 1; i >= 0; i--) {
+    group = self->shared->undo_groups + i;
+    if (group->is_undone) continue;
+
+    if (group->last == action) {
+      num_actions = group->num_actions;
+      group->is_undone = 1;
+    }
+
+    break;
+  }
+
+  self->is_in_undo = 1;
+  bview_begin_edit(self);
+
+  for (i = 0; i < num_actions; i++) {
+    if (buffer_undo(buffer) != MLBUF_OK) break;
+  }
+
+  undo_tree_undo(_bview_get_undo_tree(self));
+  bview_end_edit(self);
+  self->is_in_undo = 0;
+  return EON_OK;
+}
+
+// Redo the next undone action, or the whole group if it starts one
+int bview_redo(bview_t* self) {
+  buffer_t* buffer;
+  bview_undo_group_t* group;
+  int num_actions;
+  int i;
+
+  buffer = self->buffer;
+  if (!buffer->action_undone) return EON_ERR;
+
+  // Groups are redone oldest first
+  num_actions = 1;
+
+  for (i = 0; i < self->shared->undo_groups_len; i++) {
+    group = self->shared->undo_groups + i;
+    if (!group->is_undone) continue;
+
+    if (group->first == buffer->action_undone) {
+      num_actions = group->num_actions;
+      group->is_undone = 0;
+    }
+
+    break;
+  }
+
+  self->is_in_undo = 1;
+  bview_begin_edit(self);
+
+  for (i = 0; i < num_actions; i++) {
+    if (buffer_redo(buffer) != MLBUF_OK) break;
+  }
+
+  undo_tree_redo(_bview_get_undo_tree(self));
+  bview_end_edit(self);
+  self->is_in_undo = 0;
+  return EON_OK;
+}
+
+// Move to the undo state num_steps after (or before, if negative) the
+// current one in the order states were made, across branches
+int bview_undo_step(bview_t* self, int num_steps) {
+  undo_tree_t* tree;
+  undo_node_t* node;
+
+  tree = _bview_get_undo_tree(self);
+  if (undo_tree_step(tree, num_steps, &node) != EON_OK) return EON_ERR;
+  return undo_tree_jump(tree, self, node);
+}
+
+// Move to the newest undo state made at or before when
+int bview_undo_to_time(bview_t* self, time_t when) {
+  undo_tree_t* tree;
+  undo_node_t* node;
+
+  tree = _bview_get_undo_tree(self);
+  undo_tree_find_time(tree, when, &node);
+  return undo_tree_jump(tree, self, node);
+}
+
+// Get the position of the current undo state among all states of the
+// buffer, how many there are, and when it was made (0 for the oldest)
+int bview_get_undo_state(bview_t* self, bint_t* ret_index, bint_t* ret_count, time_t* ret_time) {
+  return undo_tree_get_state(_bview_get_undo_tree(self), ret_index, ret_count, ret_time);
+}
+
+// Note a save of the buffer in its undo journal, so the undo history can
+// be picked up when the saved file is opened again
+int bview_save_undo(bview_t* self) {
+  return undo_tree_save(_bview_get_undo_tree(self));
+}
+
+// Start the swap file of the buffer over from the file just saved
+int bview_save_swap(bview_t* self) {
+  swap_t* swap;
+
+  if (!(swap = _bview_get_swap(self))) return EON_ERR;
+  return swap_save(swap);
+}
+
+// Add an undo group for the actions first through last. Groups belong to
+// the buffer, so every bview on it undoes them whole.
+int bview_add_undo_group(bview_t* self, baction_t* first, baction_t* last, int num_actions) {
+  bview_shared_t* shared;
+  bview_undo_group_t* group;
+
+  shared = self->shared;
+
+  if (shared->undo_groups_len >= shared->undo_groups_cap) {
+    shared->undo_groups_cap = shared->undo_groups_cap > 0 ? shared->undo_groups_cap * 2 : 16;
+    shared->undo_groups = realloc(shared->undo_groups, sizeof(bview_undo_group_t) * shared->undo_groups_cap);
+  }
+
+  group = shared->undo_groups + shared->undo_groups_len;
+  group->first = first;
+  group->last = last;
+  group->num_actions = num_actions;
+  group->is_undone = 0;
+  shared->undo_groups_len += 1;
+  return EON_OK;
+}
+
+// Forget the undo actions of the buffer before stop and their groups, once
+// the undo tree has copies of them. stop must start a record.
+int bview_forget_undo(bview_t* self, baction_t* stop) {
+  bview_shared_t* shared;
+  bview_t* bview;
+  baction_t* action;
+  int num_groups;
+
+  shared = self->shared;
+  num_groups = 0;
+
+  for (action = self->buffer->actions; action && action != stop; action = action->next) {
+    if (num_groups < shared->undo_groups_len && shared->undo_groups[num_groups].first == action) num_groups += 1;
+  }
+
+  if (num_groups > 0) {
+    memmove(shared->undo_groups, shared->undo_groups + num_groups, sizeof(bview_undo_group_t) * (shared->undo_groups_len - num_groups));
+    shared->undo_groups_len -= num_groups;
+  }
+
+  buffer_trim_actions(self->buffer, stop);
+
+  // Undo memory is recounted from scratch on the next edit
+  CDL_FOREACH2(self->editor->all_bviews, bview, all_next) {
+    if (bview->buffer == self->buffer) bview->undo_counted_action = NULL;
+  }
+
+  return EON_OK;
+}
+
+// Get the memory held by the undo history of the buffer and the number of
+// steps it can be undone
+int bview_get_undo_usage(bview_t* self, bint_t* ret_bytes, bint_t* ret_num_records) {
+  bint_t num_records;
+  int i;
+
+  if (!self->undo_counted_action) _bview_count_undo(self, NULL);
+
+  // Each group counts once however many actions it has
+  num_records = self->undo_num_actions;
+
+  for (i = 0; i < self->shared->undo_groups_len; i++) {
+    num_records -= self->shared->undo_groups[i].num_actions - 1;
+  }
+
+  *ret_bytes = self->undo_bytes;
+  *ret_num_records = EON_MAX(num_records, 0);
+  return EON_OK;
+}
+
 // Add a listener
 int bview_add_listener(bview_t* self, bview_listener_cb_t callback, void* udata) {
   bview_listener_t* listener;
@@ -475,6 +1027,51 @@ int bview_destroy_listener(bview_t* self, bview_listener_t* listener) {
   return EON_OK;
 }
 
+// Timer callback that flushes pending output
+static void _bview_output_timer_cb(async_timer_t* timer, void* udata) {
+  bview_t* self;
+  self = (bview_t*)udata;
+  self->output_timer = NULL; // timer is freed by the event loop
+  bview_flush_output(self);
+}
+
+// Timer callback that counts isearch matches on the main thread, at most
+// EON_ISEARCH_COUNT_MS per event loop pass, so input stays responsive on big
+// buffers
+static void _bview_isearch_count_cb(async_timer_t* timer, void* udata) {
+  bview_t* self;
+  bline_t* bline;
+  bint_t start;
+  bint_t end;
+  struct timespec since;
+  struct timespec now;
+
+  self = (bview_t*)udata;
+  self->isearch_timer = NULL; // timer is freed by the event loop
+  bline = self->isearch_count_mark->bline;
+  clock_gettime(CLOCK_MONOTONIC, &since);
+
+  while (bline) {
+    end = 0;
+    while (bview_find_isearch(self, bline, end, &start, &end)) {
+      self->isearch_count += 1;
+    }
+    bline = bline->next;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - since.tv_sec) * 1000 + (now.tv_nsec - since.tv_nsec) / 1000000 >= EON_ISEARCH_COUNT_MS) break;
+  }
+
+  if (!bline) {
+    mark_destroy(self->isearch_count_mark);
+    self->isearch_count_mark = NULL;
+    return;
+  }
+
+  mark_move_to_w_bline(self->isearch_count_mark, bline, 0);
+  self->isearch_timer = async_timer_new(self->editor, 0, _bview_isearch_count_cb, self);
+}
+
 // Rectify a viewport dimension. Return 1 if changed, else 0.
 static int _bview_rectify_viewport_dim(bview_t* self, bline_t* bline, bint_t vpos, int dim_scope, int dim_size, bint_t *view_vpos) {
   int rc;
@@ -521,6 +1118,10 @@ static void _bview_init(bview_t* self, buffer_t* buffer) {
   self->buffer = buffer;
   self->buffer->ref_count += 1;
   _bview_set_linenum_width(self);
+  _bview_get_shared(self);
+
+  // Keep unsaved edits on disk
+  _bview_get_swap(self);
 
   // Push normal mode
   kmap_init = _bview_get_init_kmap(self->editor);
@@ -563,41 +1164,423 @@ static kmap_t* _bview_get_init_kmap(editor_t* editor) {
 static void _bview_buffer_callback(buffer_t* buffer, baction_t* action, void* udata) {
   editor_t* editor;
   bview_t* self;
-  bview_t* active;
+  bview_t* bview;
   bview_listener_t* listener;
+  bview_shared_t* shared;
+  swap_t* swap;
+  int is_in_edit;
+  int is_in_undo;
 
   self = (bview_t*)udata;
   editor = self->editor;
-  active = editor->active;
+  shared = NULL;
+  swap = NULL;
+  is_in_edit = 0;
+  is_in_undo = 0;
+
+  CDL_FOREACH2(editor->all_bviews, bview, all_next) {
+    if (bview->buffer != buffer) continue;
+
+    // Collect edits made between bview_begin_edit and bview_end_edit
+    if (bview->edit_depth > 0) {
+      is_in_edit = 1;
+      if (action) _bview_track_edit(bview, action);
+    }
 
-  // Rectify viewport if edit was on active bview
-  if (active->buffer == buffer) {
-    bview_rectify_viewport(active);
-  }
-
-  if (action && action->line_delta != 0) {
-    bview_t* bview;
-    bview_t* tmp1;
-    bview_t* tmp2;
-    CDL_FOREACH_SAFE2(editor->all_bviews, bview, tmp1, tmp2, all_prev, all_next) {
-      if (bview->buffer == buffer) {
-        // Adjust linenum_width
-        if (_bview_set_linenum_width(bview)) {
-          bview_resize(bview, bview->x, bview->y, bview->w, bview->h);
-        }
+    if (action && !bview->is_in_undo) {
+      _bview_count_undo(bview, action);
+    } else if (!action) {
+      bview->undo_counted_action = NULL;
+    }
+
+    if (bview->is_in_undo) is_in_undo = 1;
+    if (bview->swap) swap = bview->swap;
+    if (bview->shared) shared = bview->shared;
+  }
+
+  // Keep per-buffer state in sync, once per action
+  if (shared) {
+    shared->version += 1;
+    if (shared->search_index) search_index_update(shared->search_index, action);
+    if (shared->bracket_index) bracket_index_update(shared->bracket_index, action);
 
-        // Adjust viewport_bline
-        buffer_get_bline(bview->buffer, bview->viewport_y, &bview->viewport_bline);
+    // A new edit discards undone actions, so forget their groups too
+    if (action && !is_in_undo) {
+      while (shared->undo_groups_len > 0 && shared->undo_groups[shared->undo_groups_len - 1].is_undone) {
+        shared->undo_groups_len -= 1;
       }
     }
   }
 
+  // Every action goes to the swap file, undone ones included
+  if (swap) swap_add(swap, action);
+
+  // Viewports are settled and the undo history trimmed once per edit
+  if (!is_in_edit) {
+    if (action && !is_in_undo) {
+      undo_tree_add(_bview_get_undo_tree(self), action, action, 1, 0);
+      _bview_trim_undo(editor, buffer);
+    }
+    _bview_settle_edit(editor, buffer, action && action->line_delta != 0);
+  }
+
   // Call bview listeners
   DL_FOREACH(self->listeners, listener) {
     listener->callback(self, action, listener->udata);
   }
 }
 
+// Rectify the active viewport and, if lines were added or removed, line
+// number widths of bviews on buffer
+static void _bview_settle_edit(editor_t* editor, buffer_t* buffer, int is_line_delta) {
+  bview_t* bview;
+  bview_t* tmp1;
+  bview_t* tmp2;
+
+  // Rectify viewport if edit was on active bview
+  if (editor->active->buffer == buffer) {
+    bview_rectify_viewport(editor->active);
+  }
+
+  if (!is_line_delta) return;
+
+  CDL_FOREACH_SAFE2(editor->all_bviews, bview, tmp1, tmp2, all_prev, all_next) {
+    if (bview->buffer == buffer) {
+      // Adjust linenum_width
+      if (_bview_set_linenum_width(bview)) {
+        bview_resize(bview, bview->x, bview->y, bview->w, bview->h);
+      }
+
+      // Adjust viewport_bline
+      buffer_get_bline(bview->buffer, bview->viewport_y, &bview->viewport_bline);
+    }
+  }
+}
+
+// Widen the range of lines touched by the current edit to cover action
+static void _bview_track_edit(bview_t* self, baction_t* action) {
+  bint_t start;
+  bint_t end;
+  bint_t delta;
+
+  start = action->start_line_index;
+  delta = action->line_delta < 0 ? -action->line_delta : action->line_delta;
+  if (action->type == MLBUF_BACTION_TYPE_DELETE) delta = -delta;
+  end = start + EON_MAX(delta, 0);
+
+  if (self->edit_num_actions < 1) {
+    self->edit_start_line = start;
+    self->edit_end_line = end;
+    self->edit_first_action = action;
+  } else {
+    // Lines touched earlier move with the lines added or removed above them
+    if (start <= self->edit_end_line) self->edit_end_line = EON_MAX(self->edit_end_line + delta, start);
+    self->edit_start_line = EON_MIN(self->edit_start_line, start);
+    self->edit_end_line = EON_MAX(self->edit_end_line, end);
+  }
+
+  self->edit_last_action = action;
+  self->edit_num_actions += 1;
+}
+
+// Extend the undo record that ends right before the current edit to cover
+// it. Only an edit that follows this bview's last one, with nothing in
+// between, and starts where it left off is joined. Return 1 if joined.
+static int _bview_join_undo_record(bview_t* self) {
+  baction_t* prev;
+  bview_undo_group_t* group;
+
+  if (self->edit_first_action == self->buffer->actions) return 0;
+  prev = self->edit_first_action->prev;
+  if (!prev || prev != self->undo_join_action) return 0;
+
+  if (self->edit_first_action->start_line_index != self->undo_join_line
+    || self->edit_first_action->start_col != self->undo_join_col
+  ) {
+    return 0;
+  }
+
+  // Undone groups were dropped by the edit, so the newest group is live
+  group = self->shared->undo_groups_len > 0 ? self->shared->undo_groups + self->shared->undo_groups_len - 1 : NULL;
+
+  if (group && group->last == prev) {
+    group->last = self->edit_last_action;
+    group->num_actions += self->edit_num_actions;
+  } else {
+    bview_add_undo_group(self, prev, self->edit_last_action, self->edit_num_actions + 1);
+  }
+
+  return 1;
+}
+
+// Get the position right after what action inserted, or where it deleted
+static void _bview_get_action_end(baction_t* action, bint_t* ret_line, bint_t* ret_col) {
+  bint_t col;
+  bint_t i;
+
+  *ret_line = action->start_line_index;
+  *ret_col = action->start_col;
+  if (action->type != MLBUF_BACTION_TYPE_INSERT) return;
+
+  if (action->line_delta == 0) {
+    *ret_col += action->char_delta;
+    return;
+  }
+
+  // Count the chars after the last newline inserted
+  col = 0;
+
+  for (i = action->data_len - 1; i >= 0 && action->data[i] != '\n'; i--) {
+    if ((action->data[i] & 0xc0) != 0x80) col += 1;
+  }
+
+  *ret_line += action->line_delta;
+  *ret_col = col;
+}
+
+// Add action to the undo memory tally, or recount the whole history if
+// action is NULL or does not follow the last one counted
+static void _bview_count_undo(bview_t* self, baction_t* action) {
+  baction_t* cur;
+
+  if (action
+    && self->undo_counted_action
+    && action != self->buffer->actions
+    && action->prev == self->undo_counted_action
+  ) {
+    self->undo_bytes += _bview_undo_size(action);
+    self->undo_num_actions += 1;
+    self->undo_counted_action = action;
+    return;
+  }
+
+  self->undo_bytes = 0;
+  self->undo_num_actions = 0;
+
+  DL_FOREACH(self->buffer->actions, cur) {
+    self->undo_bytes += _bview_undo_size(cur);
+    self->undo_num_actions += 1;
+  }
+
+  self->undo_counted_action = self->buffer->action_tail;
+}
+
+// Discard the oldest undo records of buffer once its history outgrows
+// editor->undo_max_bytes. Records are discarded whole, and the newest one
+// and anything undone are always kept.
+static void _bview_trim_undo(editor_t* editor, buffer_t* buffer) {
+  bview_t* bview;
+  bview_t* owner;
+  bview_shared_t* shared;
+  bview_undo_group_t* group;
+  baction_t* action;
+  baction_t* stop;
+  bint_t bytes;
+  bint_t num_actions;
+  int num_groups;
+
+  if (editor->undo_max_bytes < 1) return;
+
+  // Every bview on buffer keeps the same tally
+  owner = NULL;
+
+  CDL_FOREACH2(editor->all_bviews, bview, all_next) {
+    if (bview->buffer == buffer && bview->undo_counted_action) {
+      owner = bview;
+      break;
+    }
+  }
+
+  if (!owner || owner->undo_bytes <= editor->undo_max_bytes) return;
+
+  // Go down to three quarters of the cap so trims are far apart
+  bytes = owner->undo_bytes;
+  stop = buffer->actions;
+
+  while (stop
+    && stop != buffer->action_tail
+    && stop != buffer->action_undone
+    && bytes > editor->undo_max_bytes / 4 * 3
+  ) {
+    bytes -= _bview_undo_size(stop);
+    stop = stop->next;
+  }
+
+  // Move stop past groups it splits, or back before one holding the newest
+  // action, then forget the groups before it
+  shared = owner->shared;
+  num_groups = 0;
+
+  for (action = buffer->actions; action && action != stop; action = action->next) {
+    if (num_groups >= shared->undo_groups_len) break;
+
+    group = shared->undo_groups + num_groups;
+    if (group->first != action) continue;
+
+    while (action != group->last && action->next != stop) action = action->next;
+
+    if (action != group->last) {
+      if (group->last == buffer->action_tail) {
+        stop = group->first;
+        break;
+      }
+
+      stop = group->last->next;
+      action = group->last;
+    }
+
+    num_groups += 1;
+  }
+
+  if (num_groups > 0) {
+    memmove(shared->undo_groups, shared->undo_groups + num_groups, sizeof(bview_undo_group_t) * (shared->undo_groups_len - num_groups));
+    shared->undo_groups_len -= num_groups;
+  }
+
+  // Free actions before stop
+  CDL_FOREACH2(editor->all_bviews, bview, all_next) {
+    if (bview->buffer == buffer && bview->undo_tree) {
+      undo_tree_trim(bview->undo_tree, stop);
+      break;
+    }
+  }
+
+  bytes = 0;
+  num_actions = 0;
+
+  for (action = buffer->actions; action && action != stop; action = action->next) {
+    bytes += _bview_undo_size(action);
+    num_actions += 1;
+  }
+
+  buffer_trim_actions(buffer, stop);
+
+  CDL_FOREACH2(editor->all_bviews, bview, all_next) {
+    if (bview->buffer != buffer || !bview->undo_counted_action) continue;
+    bview->undo_bytes -= bytes;
+    bview->undo_num_actions -= num_actions;
+  }
+}
+
+// Return the undo tree of the buffer, shared by all bviews on it
+static undo_tree_t* _bview_get_undo_tree(bview_t* self) {
+  bview_t* bview;
+
+  if (self->undo_tree) return self->undo_tree;
+
+  CDL_FOREACH2(self->editor->all_bviews, bview, all_next) {
+    if (bview != self && bview->buffer == self->buffer && bview->undo_tree) {
+      self->undo_tree = undo_tree_share(bview->undo_tree);
+      return self->undo_tree;
+    }
+  }
+
+  undo_tree_new(self->editor, self->buffer, &self->undo_tree);
+  return self->undo_tree;
+}
+
+// Return the swap of the buffer, shared by all bviews on it, or NULL if
+// its edits are not kept
+static swap_t* _bview_get_swap(bview_t* self) {
+  bview_t* bview;
+
+  if (self->swap) return self->swap;
+  if (!self->editor->swap || self->editor->headless_mode || !self->buffer->path) return NULL;
+
+  CDL_FOREACH2(self->editor->all_bviews, bview, all_next) {
+    if (bview != self && bview->buffer == self->buffer && bview->swap) {
+      self->swap = swap_share(bview->swap);
+      return self->swap;
+    }
+  }
+
+  swap_new(self->editor, self->buffer, &self->swap);
+  return self->swap;
+}
+
+// Return the state of the buffer shared by all bviews on it
+static bview_shared_t* _bview_get_shared(bview_t* self) {
+  bview_t* bview;
+
+  if (self->shared) return self->shared;
+
+  CDL_FOREACH2(self->editor->all_bviews, bview, all_next) {
+    if (bview != self && bview->buffer == self->buffer && bview->shared) {
+      self->shared = bview->shared;
+      self->shared->ref_count += 1;
+      return self->shared;
+    }
+  }
+
+  self->shared = calloc(1, sizeof(bview_shared_t));
+  self->shared->editor = self->editor;
+  self->shared->buffer = self->buffer;
+  self->shared->ref_count = 1;
+  return self->shared;
+}
+
+// Drop a reference to the shared state, freeing it with the last one
+static void _bview_release_shared(bview_t* self) {
+  bview_shared_t* shared;
+
+  shared = self->shared;
+  self->shared = NULL;
+  if (--shared->ref_count > 0) return;
+
+  if (shared->search_index) search_index_destroy(shared->search_index);
+  if (shared->bracket_index) bracket_index_destroy(shared->bracket_index);
+  if (shared->undo_groups) free(shared->undo_groups);
+  free(shared);
+}
+
+// Return the memory held by an undo action
+static bint_t _bview_undo_size(baction_t* action) {
+  return (bint_t)sizeof(baction_t) + action->data_len;
+}
+
+// qsort callback for ordering cursors by position
+static int _bview_cursor_cmp(const void* a, const void* b) {
+  mark_t* mark_a;
+  mark_t* mark_b;
+  mark_a = (*(cursor_t**)a)->mark;
+  mark_b = (*(cursor_t**)b)->mark;
+
+  if (mark_a->bline->line_index != mark_b->bline->line_index) {
+    return mark_a->bline->line_index < mark_b->bline->line_index ? -1 : 1;
+  }
+
+  if (mark_a->col != mark_b->col) return mark_a->col < mark_b->col ? -1 : 1;
+  return 0;
+}
+
+// qsort callback for ordering anchored cursors by where their selections
+// start
+static int _bview_anchored_cmp(const void* a, const void* b) {
+  mark_t* lo_a;
+  mark_t* lo_b;
+  mark_t* hi;
+  cursor_get_lo_hi(*(cursor_t**)a, &lo_a, &hi);
+  cursor_get_lo_hi(*(cursor_t**)b, &lo_b, &hi);
+
+  if (lo_a->bline->line_index != lo_b->bline->line_index) {
+    return lo_a->bline->line_index < lo_b->bline->line_index ? -1 : 1;
+  }
+
+  if (lo_a->col != lo_b->col) return lo_a->col < lo_b->col ? -1 : 1;
+  return 0;
+}
+
+// Free a cursor and its selection state
+static void _bview_free_cursor(bview_t* self, cursor_t* cursor) {
+  if (cursor->is_anchored) {
+    bview_remove_anchored(self, cursor);
+    mark_destroy(cursor->anchor);
+  }
+  mark_destroy(cursor->mark);
+  if (cursor->cut_buffer) free(cursor->cut_buffer);
+  free(cursor);
+}
+
 // Set linenum_width and return 1 if changed
 static int _bview_set_linenum_width(bview_t* self) {
   int orig;
@@ -648,9 +1631,32 @@ static void _bview_deinit(bview_t* self) {
   }
 
   // Remove all cursors
-  while (self->active_cursor) {
-    bview_remove_cursor(self, self->active_cursor);
-    self->active_cursor = NULL;
+  self->anchored_len = 0;
+  while (self->cursors_len > 0) {
+    _bview_free_cursor(self, self->cursors[--self->cursors_len]);
+  }
+
+  if (self->cursors) {
+    free(self->cursors);
+    self->cursors = NULL;
+    self->cursors_cap = 0;
+  }
+
+  if (self->anchored) {
+    free(self->anchored);
+    free(self->anchored_reach);
+    self->anchored = NULL;
+    self->anchored_reach = NULL;
+    self->anchored_cap = 0;
+  }
+
+  self->num_asleep_cursors = 0;
+  self->active_cursor = NULL;
+
+  // Stop grep workers before closing the pipe they write to
+  if (self->grep) {
+    grep_destroy(self->grep);
+    self->grep = NULL;
   }
 
   // Destroy async proc
@@ -659,6 +1665,49 @@ static void _bview_deinit(bview_t* self) {
     self->async_proc = NULL;
   }
 
+  // Drop pending output
+  if (self->output_timer) {
+    async_timer_destroy(self->output_timer);
+    self->output_timer = NULL;
+  }
+
+  if (self->output_mark) {
+    mark_destroy(self->output_mark);
+    self->output_mark = NULL;
+  }
+
+  str_free(&self->pending_output);
+  bview_set_isearch(self, NULL, 0);
+
+  if (self->browse_path) {
+    free(self->browse_path);
+    self->browse_path = NULL;
+  }
+
+  if (self->ctag_name) {
+    free(self->ctag_name);
+    self->ctag_name = NULL;
+  }
+
+  if (self->undo_tree) {
+    undo_tree_destroy(self->undo_tree);
+    self->undo_tree = NULL;
+  }
+
+  if (self->swap) {
+    swap_destroy(self->swap);
+    self->swap = NULL;
+  }
+
+  if (self->shared) _bview_release_shared(self);
+
+  if (self->sels) {
+    free(self->sels);
+    self->sels = NULL;
+    self->sels_len = 0;
+    self->sels_cap = 0;
+  }
+
   // Remove all listeners
   DL_FOREACH_SAFE(self->listeners, listener, listener_tmp) {
     bview_destroy_listener(self, listener);
@@ -736,6 +1785,9 @@ int bview_set_syntax(bview_t* self, char* opt_syntax) {
 
   buffer_set_styles_enabled(self->buffer, 1);
 
+  // Brackets in strings and comments are told apart by style
+  if (self->shared->bracket_index) bracket_index_update(self->shared->bracket_index, NULL);
+
   return use_syntax ? EON_OK : EON_ERR;
 }
 
@@ -855,6 +1907,7 @@ static buffer_t* _bview_open_buffer(bview_t* self, char* opt_path, int opt_path_
 }
 
 static void _bview_draw_prompt(bview_t* self) {
+  _bview_collect_sels(self);
   _bview_draw_bline(self, self->buffer->first_line, 0, NULL, NULL);
 }
 
@@ -873,6 +1926,13 @@ static void _bview_draw_status(bview_t* self) {
   if (active == editor->prompt) {
     rect_printf(editor->rect_status, 0, 0, PROMPT_FG, PROMPT_BG, "%-*.*s -- ", editor->rect_status.w, editor->rect_status.w,
               self->editor->prompt->prompt_str);
+
+    // isearch match count, with a + while still counting
+    if (active_edit->isearch_cre) {
+      char count[64];
+      int count_len = snprintf(count, sizeof(count), "%ld%s matches ", (long)active_edit->isearch_count, active_edit->isearch_count_mark ? "+" : "");
+      rect_printf(editor->rect_status, editor->rect_status.w - count_len, 0, PROMPT_FG, PROMPT_BG, "%s", count);
+    }
     goto _bview_draw_status_end;
   }
 
@@ -963,6 +2023,21 @@ static void _bview_draw_status(bview_t* self) {
     LINECOL_CURRENT_FG, 0, mark->col, 0, 0, LINECOL_TOTAL_FG, 0, mark->bline->char_count, 0, 0
   );
 
+  // Search match position, with a + while still indexing
+  if (active_edit->shared->search_index) {
+    char smatch[64];
+    int smatch_len;
+    bint_t nth;
+
+    if (search_index_find_at(active_edit->shared->search_index, mark, &nth) == EON_OK) {
+      smatch_len = snprintf(smatch, sizeof(smatch), "match %ld of %ld%s ", (long)nth + 1, (long)search_index_get_count(active_edit->shared->search_index), search_index_is_complete(active_edit->shared->search_index) ? "" : "+");
+    } else {
+      smatch_len = snprintf(smatch, sizeof(smatch), "%ld%s matches ", (long)search_index_get_count(active_edit->shared->search_index), search_index_is_complete(active_edit->shared->search_index) ? "" : "+");
+    }
+
+    rect_printf(editor->rect_status, editor->rect_status.w - 11 - smatch_len, 0, LINECOL_TOTAL_FG, RECT_STATUS_BG, "%s", smatch);
+  }
+
   rect_printf(editor->rect_status, editor->rect_status.w - 11, 0, TB_WHITE | TB_BOLD, RECT_STATUS_BG, " eon %s", EON_VERSION);
 
   // Overlay errstr if present
@@ -1066,6 +2141,7 @@ static void _bview_draw_edit(bview_t* self, int x, int y, int w, int h) {
   }
 
   bline = self->viewport_bline;
+  _bview_collect_sels(self);
 
   for (rect_y = 0; rect_y < self->rect_buffer.h; rect_y++) {
     if (self->viewport_y + rect_y < 0 || self->viewport_y + rect_y >= self->buffer->line_count || !bline) { // "|| !bline" See TODOs below
@@ -1098,6 +2174,15 @@ static void _bview_draw_bline(bview_t* self, bline_t* bline, int rect_y, bline_t
   int is_cursor_line;
   int is_soft_wrap;
   int orig_rect_y;
+  int has_isearch;
+  bview_sel_t* sel;
+  int sel_i;
+  int sel_to;
+  bint_t sel_end;
+  bint_t byte_offset;
+  bint_t match_from;
+  bint_t match_start;
+  bint_t match_end;
 
   MLBUF_BLINE_ENSURE_CHARS(bline);
 
@@ -1144,6 +2229,27 @@ static void _bview_draw_bline(bview_t* self, bline_t* bline, int rect_y, bline_t
     }
   }
 
+  // Selections are painted over buffer styles, so moving an anchored cursor
+  // never restyles the lines it passes over. The ones that may cover this
+  // line start in column order, so they are taken up as the row is drawn.
+  _bview_get_line_sels(self, bline->line_index, &sel_i, &sel_to);
+  sel_end = 0;
+
+  // Matches are found as the row is drawn, so only visible rows are searched
+  has_isearch = self->isearch_cre && EON_BVIEW_IS_EDIT(self) ? 1 : 0;
+  byte_offset = 0;
+  match_start = -1;
+  match_end = -1;
+
+  for (i = 0; has_isearch && i < viewport_x && i < bline->char_count; i++) {
+    byte_offset += bline->chars[i].len;
+  }
+
+  // A match that starts left of the viewport is clipped to it, not skipped
+  for (match_from = 0; has_isearch && byte_offset > 0; match_from = match_end) {
+    if (!bview_find_isearch(self, bline, match_from, &match_start, &match_end) || match_end > byte_offset) break;
+  }
+
   // Render 0 thru rect_buffer.w cell by cell
   orig_rect_y = rect_y;
   rect_x = 0;
@@ -1170,6 +2276,28 @@ static void _bview_draw_bline(bview_t* self, bline_t* bline, int rect_y, bline_t
         ch = '?';
       }
 
+      for (; sel_i < sel_to && (self->sels[sel_i].lo_line < bline->line_index || self->sels[sel_i].lo_col <= char_col); sel_i++) {
+        sel = self->sels + sel_i;
+        if (sel->hi_line < bline->line_index) continue;
+        sel_end = EON_MAX(sel_end, sel->hi_line > bline->line_index ? bline->char_count : sel->hi_col);
+      }
+
+      if (char_col < sel_end) {
+        bg = SELECTION_BG;
+      }
+
+      if (has_isearch) {
+        if (byte_offset >= match_end && !bview_find_isearch(self, bline, byte_offset, &match_start, &match_end)) {
+          has_isearch = 0;
+
+        } else if (byte_offset >= match_start) {
+          fg = ISEARCH_FG;
+          bg = ISEARCH_BG;
+        }
+
+        byte_offset += bline->chars[char_col].len;
+      }
+
       if (self->editor->color_col == char_col && EON_BVIEW_IS_EDIT(self)) {
         bg |= CURSOR_BG;
       }
@@ -1214,10 +2342,121 @@ static void _bview_draw_bline(bview_t* self, bline_t* bline, int rect_y, bline_t
   if (optret_rect_y) *optret_rect_y = rect_y;
 }
 
+// Sort anchored cursors by where their selections start, if moves or edits
+// have reordered them, and note how far down the selections up to each
+// reach. Cheap when already sorted, like bview_sort_cursors.
+static void _bview_sort_anchored(bview_t* self) {
+  mark_t* lo;
+  mark_t* hi;
+  bint_t reach;
+  int i;
+
+  for (i = 1; i < self->anchored_len; i++) {
+    if (_bview_anchored_cmp(self->anchored + i - 1, self->anchored + i) > 0) break;
+  }
+
+  if (i < self->anchored_len) {
+    qsort(self->anchored, self->anchored_len, sizeof(cursor_t*), _bview_anchored_cmp);
+  }
+
+  for (i = 0, reach = -1; i < self->anchored_len; i++) {
+    cursor_get_lo_hi(self->anchored[i], &lo, &hi);
+    reach = EON_MAX(reach, hi->bline->line_index);
+    self->anchored_reach[i] = reach;
+  }
+}
+
+// Gather selections of anchored cursors that reach the visible rows, in the
+// order they start. The first one is found by binary search on the reach,
+// which never decreases, so selections above the viewport are skipped
+// however far back they start.
+static void _bview_collect_sels(bview_t* self) {
+  mark_t* lo;
+  mark_t* hi;
+  bview_sel_t* sel;
+  bint_t viewport_end;
+  bint_t reach;
+  int i;
+  int j;
+  int mid;
+
+  self->sels_len = 0;
+  viewport_end = self->viewport_y + EON_MAX(1, self->rect_buffer.h);
+  _bview_sort_anchored(self);
+
+  i = 0;
+  j = self->anchored_len;
+
+  while (i < j) {
+    mid = i + (j - i) / 2;
+    if (self->anchored_reach[mid] < self->viewport_y) {
+      i = mid + 1;
+    } else {
+      j = mid;
+    }
+  }
+
+  for (reach = -1; i < self->anchored_len; i++) {
+    cursor_get_lo_hi(self->anchored[i], &lo, &hi);
+    if (lo->bline->line_index >= viewport_end) break;
+
+    if (hi->bline->line_index < self->viewport_y || (lo->bline == hi->bline && lo->col == hi->col)) {
+      continue;
+    }
+
+    if (self->sels_len >= self->sels_cap) {
+      self->sels_cap = self->sels_cap > 0 ? self->sels_cap * 2 : 8;
+      self->sels = realloc(self->sels, sizeof(bview_sel_t) * self->sels_cap);
+    }
+
+    sel = self->sels + self->sels_len;
+    sel->lo_line = lo->bline->line_index;
+    sel->lo_col = lo->col;
+    sel->hi_line = hi->bline->line_index;
+    sel->hi_col = hi->col;
+    reach = EON_MAX(reach, sel->hi_line);
+    sel->reach_line = reach;
+    self->sels_len += 1;
+  }
+}
+
+// Find the sels that may cover a line: from the first whose reach gets to
+// it up to the first that starts below it. Some in between may end above it.
+static void _bview_get_line_sels(bview_t* self, bint_t line_index, int* ret_from, int* ret_to) {
+  int i;
+  int j;
+  int mid;
+
+  i = 0;
+  j = self->sels_len;
+
+  while (i < j) {
+    mid = i + (j - i) / 2;
+    if (self->sels[mid].reach_line < line_index) {
+      i = mid + 1;
+    } else {
+      j = mid;
+    }
+  }
+
+  *ret_from = i;
+  j = self->sels_len;
+
+  while (i < j) {
+    mid = i + (j - i) / 2;
+    if (self->sels[mid].lo_line <= line_index) {
+      i = mid + 1;
+    } else {
+      j = mid;
+    }
+  }
+
+  *ret_to = i;
+}
+
 // Highlight matching bracket pair under mark
 static void _bview_highlight_bracket_pair(bview_t* self, mark_t* mark) {
   bline_t* line;
-  bint_t brkt;
   bint_t col;
   mark_t pair;
   int screen_x;
@@ -1231,7 +2470,7 @@ static void _bview_highlight_bracket_pair(bview_t* self, mark_t* mark) {
     return;
   }
 
-  if (mark_find_bracket_pair(mark, EON_BRACKET_PAIR_MAX_SEARCH, &line, &col, &brkt) != MLBUF_OK) {
+  if (bview_find_bracket_pair(self, mark, &line, &col) != EON_OK) {
     // No pair found
     return;
   }
@@ -1241,8 +2480,7 @@ static void _bview_highlight_bracket_pair(bview_t* self, mark_t* mark) {
     return;
   }
 
-  pair.bline = line;
-  pair.col = col;
+  pair = EON_TMARK(line, col);
 
   if (bview_get_screen_coords(self, &pair, &screen_x, &screen_y, &cell) != EON_OK) {
     // Out of bounds
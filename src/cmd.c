@@ -5,30 +5,45 @@
 #include <unistd.h>
 #include "eon.h"
 
+// Edits made by all cursors are settled together, see bview_begin_edit
 #define EON_MULTI_CURSOR_MARK_FN(pcursor, pfn, ...) do {\
   cursor_t* cursor; \
-  DL_FOREACH((pcursor)->bview->cursors, cursor) { \
+  int cursor_i; \
+  bview_t* edit_bview = (pcursor)->bview; \
+  bview_sort_cursors(edit_bview); \
+  bview_begin_edit(edit_bview); \
+  for (cursor_i = 0; cursor_i < edit_bview->cursors_len; cursor_i++) { \
+    cursor = edit_bview->cursors[cursor_i]; \
     if (cursor->is_asleep) continue; \
     pfn(cursor->mark, ##__VA_ARGS__); \
   } \
+  bview_end_edit(edit_bview); \
 } while(0)
 
 #define EON_MULTI_CURSOR_CODE(pcursor, pcode) do { \
   cursor_t* cursor; \
-  DL_FOREACH((pcursor)->bview->cursors, cursor) { \
+  int cursor_i; \
+  bview_t* edit_bview = (pcursor)->bview; \
+  bview_sort_cursors(edit_bview); \
+  bview_begin_edit(edit_bview); \
+  for (cursor_i = 0; cursor_i < edit_bview->cursors_len; cursor_i++) { \
+    cursor = edit_bview->cursors[cursor_i]; \
     if (cursor->is_asleep) continue; \
     pcode \
   } \
+  bview_end_edit(edit_bview); \
 } while(0)
 
 static void _cmd_force_redraw(cmd_context_t* ctx);
 static int _cmd_pre_close(editor_t* editor, bview_t* bview);
 static int _cmd_quit_inner(editor_t* editor, bview_t* bview);
 static int _cmd_save(editor_t* editor, bview_t* bview, int save_as);
-static int _cmd_search_next(bview_t* bview, cursor_t* cursor, mark_t* search_mark, char* regex, int regex_len);
+static int _cmd_search_next(bview_t* bview, cursor_t* cursor, char* regex, int regex_len);
+static int _cmd_search_prev(bview_t* bview, cursor_t* cursor, char* regex, int regex_len);
+static int _cmd_ensure_search_index(bview_t* bview);
 static void _cmd_aproc_bview_passthru_cb(async_proc_t* self, char* buf, size_t buf_len);
+static void _cmd_aproc_grep_cb(async_proc_t* aproc, char* buf, size_t buf_len);
 static void _cmd_isearch_prompt_cb(bview_t* bview, baction_t* action, void* udata);
-static int _cmd_menu_browse_cb(cmd_context_t* ctx, char * action);
 static int _cmd_menu_grep_cb(cmd_context_t* ctx, char * action);
 static int _cmd_menu_ctag_cb(cmd_context_t* ctx, char * action);
 static int _cmd_indent(cmd_context_t* ctx, int outdent);
@@ -36,6 +51,8 @@ static int _cmd_indent_line(bline_t* bline, int use_tabs, int outdent, int col);
 static void _cmd_help_inner(char* buf, kbinding_t* trie, str_t* h);
 static void _cmd_insert_smart_newline(cmd_context_t* ctx);
 static void _cmd_insert_smart_closing_bracket(cmd_context_t* ctx);
+static int _cmd_is_typed_char(char* data, bint_t data_len);
+static void _cmd_undo_settle(cmd_context_t* ctx);
 
 // Insert data
 int cmd_insert_data(cmd_context_t* ctx) {
@@ -95,6 +112,15 @@ int cmd_insert_data(cmd_context_t* ctx) {
 
   ctx->editor->insertbuf[insertbuf_len] = '\0';
 
+  // Chars typed one after another are undone together. A newline or a
+  // paste ends the run.
+  bview_begin_edit(ctx->bview);
+  ctx->bview->edit_is_typing = ctx->pastebuf_len < 1
+    && ctx->loop_ctx->last_cmd
+    && ctx->loop_ctx->last_cmd->func == cmd_insert_data
+    && _cmd_is_typed_char(ctx->loop_ctx->last_insert.data, ctx->loop_ctx->last_insert.len)
+    && _cmd_is_typed_char(ctx->editor->insertbuf, insertbuf_len) ? 1 : 0;
+
   // Insert
   if (insertbuf_len > 1
     && ctx->editor->trim_paste
@@ -106,15 +132,17 @@ int cmd_insert_data(cmd_context_t* ctx) {
     util_pcre_replace("(?m) +$", ctx->editor->insertbuf, "", &trimmed, &trimmed_len);
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_insert_before, trimmed, trimmed_len);
     free(trimmed);
-  } else if (ctx->editor->smart_indent && !ctx->cursor->next && insertbuf_len == 1 && ctx->editor->insertbuf[0] == '\n') {
+  } else if (ctx->editor->smart_indent && bview_get_active_cursor_count(ctx->bview) < 2 && insertbuf_len == 1 && ctx->editor->insertbuf[0] == '\n') {
     _cmd_insert_smart_newline(ctx);
-  } else if (ctx->editor->smart_indent && !ctx->cursor->next && insertbuf_len == 1 && ctx->editor->insertbuf[0] == '}') {
+  } else if (ctx->editor->smart_indent && bview_get_active_cursor_count(ctx->bview) < 2 && insertbuf_len == 1 && ctx->editor->insertbuf[0] == '}') {
     _cmd_insert_smart_closing_bracket(ctx);
   } else {
     // Insert without trim
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_insert_before, ctx->editor->insertbuf, insertbuf_len);
   }
 
+  bview_end_edit(ctx->bview);
+
   // Remember last insert data
   str_set_len(&ctx->loop_ctx->last_insert, ctx->editor->insertbuf, insertbuf_len);
 
@@ -136,7 +164,7 @@ int cmd_delete_before(cmd_context_t* ctx) {
     EON_MULTI_CURSOR_CODE(ctx->cursor,
       mark_delete_between_mark(cursor->mark, cursor->anchor);
     );
-    cursor_toggle_anchor(ctx->cursor, 0);
+    cursor_toggle_anchor(ctx->cursor);
   } else {
     bint_t offset;
     mark_get_offset(ctx->cursor->mark, &offset);
@@ -155,7 +183,7 @@ int cmd_delete_after(cmd_context_t* ctx) {
     EON_MULTI_CURSOR_CODE(ctx->cursor,
       mark_delete_between_mark(cursor->mark, cursor->anchor);
     );
-    cursor_toggle_anchor(ctx->cursor, 0);
+    cursor_toggle_anchor(ctx->cursor);
   } else {
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_delete_after, 1);
   }
@@ -165,7 +193,7 @@ int cmd_delete_after(cmd_context_t* ctx) {
 
 int cmd_mouse_move(cmd_context_t* ctx, int mouse_down, int mx, int my) {
   if ((mouse_down && !ctx->cursor->is_anchored) || (!mouse_down && ctx->cursor->is_anchored)) {
-    cursor_toggle_anchor(ctx->cursor, 1);
+    cursor_toggle_anchor(ctx->cursor);
   }
 
   int offsetx = mx;
@@ -210,29 +238,30 @@ int cmd_scroll_down(cmd_context_t * ctx) {
 // Move cursor to beginning of line
 int cmd_move_bol(cmd_context_t* ctx) {
   uint32_t ch;
-  mark_t* mark;
+  mark_t tmark;
+  bline_t* bline;
+  bint_t col;
 
   if (ctx->cursor->is_anchored) {
-    cursor_toggle_anchor(ctx->cursor, 0);
+    cursor_toggle_anchor(ctx->cursor);
   }
 
   EON_MULTI_CURSOR_CODE(ctx->cursor,
 
-    mark_clone(cursor->mark, &mark);
-    mark_move_bol(mark);
-    mark_get_char_after(mark, &ch);
+    tmark = EON_TMARK(cursor->mark->bline, 0);
+    mark_get_char_after(&tmark, &ch);
+    bline = tmark.bline;
+    col = 0;
 
     if (isspace((char)ch)) {
-      mark_move_next_re(mark, "\\S", 2);
+      mark_find_next_re(&tmark, "\\S", 2, &bline, &col, NULL);
     }
 
-    if (mark->col < cursor->mark->col) {
-      mark_join(cursor->mark, mark);
+    if (col < cursor->mark->col) {
+      mark_move_to_w_bline(cursor->mark, bline, col);
     } else {
       mark_move_bol(cursor->mark);
     }
-
-    mark_destroy(mark);
   );
 
   bview_rectify_viewport(ctx->bview);
@@ -242,7 +271,7 @@ int cmd_move_bol(cmd_context_t* ctx) {
 // Move cursor to end of line
 int cmd_move_eol(cmd_context_t* ctx) {
   if (ctx->cursor->is_anchored) {
-    cursor_toggle_anchor(ctx->cursor, 0);
+    cursor_toggle_anchor(ctx->cursor);
   }
 
   EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_move_eol);
@@ -401,24 +430,28 @@ int cmd_move_bracket_back(cmd_context_t* ctx) {
 
 // Delete word back
 int cmd_delete_word_before(cmd_context_t* ctx) {
-  mark_t* tmark;
+  mark_t tmark;
+  bline_t* bline;
+  bint_t col;
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    mark_clone(cursor->mark, &tmark);
-    mark_move_prev_re(tmark, EON_RE_WORD_BACK, sizeof(EON_RE_WORD_BACK) - 1);
-    mark_delete_between_mark(cursor->mark, tmark);
-    mark_destroy(tmark);
+    if (mark_find_prev_re(cursor->mark, EON_RE_WORD_BACK, sizeof(EON_RE_WORD_BACK) - 1, &bline, &col, NULL) == MLBUF_OK) {
+      tmark = EON_TMARK(bline, col);
+      tmark_delete_between(cursor->mark, &tmark);
+    }
   );
   return EON_OK;
 }
 
 // Delete word ahead
 int cmd_delete_word_after(cmd_context_t* ctx) {
-  mark_t* tmark;
+  mark_t tmark;
+  bline_t* bline;
+  bint_t col;
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    mark_clone(cursor->mark, &tmark);
-    mark_move_next_re(tmark, EON_RE_WORD_FORWARD, sizeof(EON_RE_WORD_FORWARD) - 1);
-    mark_delete_between_mark(cursor->mark, tmark);
-    mark_destroy(tmark);
+    if (mark_find_next_re(cursor->mark, EON_RE_WORD_FORWARD, sizeof(EON_RE_WORD_FORWARD) - 1, &bline, &col, NULL) == MLBUF_OK) {
+      tmark = EON_TMARK(bline, col);
+      tmark_delete_between(cursor->mark, &tmark);
+    }
   );
   return EON_OK;
 }
@@ -426,14 +459,14 @@ int cmd_delete_word_after(cmd_context_t* ctx) {
 // Toggle sel bound on cursors
 int cmd_toggle_anchor(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    cursor_toggle_anchor(cursor, 1);
+    cursor_toggle_anchor(cursor);
   );
   return EON_OK;
 }
 
 int cmd_select_bol(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (!cursor->is_anchored) cursor_toggle_anchor(cursor, 1);
+    if (!cursor->is_anchored) cursor_toggle_anchor(cursor);
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_move_bol);
   );
 
@@ -442,7 +475,7 @@ int cmd_select_bol(cmd_context_t* ctx) {
 
 int cmd_select_eol(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (!cursor->is_anchored) cursor_toggle_anchor(cursor, 1);
+    if (!cursor->is_anchored) cursor_toggle_anchor(cursor);
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_move_eol);
   );
 
@@ -451,7 +484,7 @@ int cmd_select_eol(cmd_context_t* ctx) {
 
 int cmd_select_beginning(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (!cursor->is_anchored) cursor_toggle_anchor(cursor, 1);
+    if (!cursor->is_anchored) cursor_toggle_anchor(cursor);
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_move_beginning);
   );
 
@@ -461,7 +494,7 @@ int cmd_select_beginning(cmd_context_t* ctx) {
 
 int cmd_select_end(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (!cursor->is_anchored) cursor_toggle_anchor(cursor, 1);
+    if (!cursor->is_anchored) cursor_toggle_anchor(cursor);
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_move_end);
   );
 
@@ -471,7 +504,7 @@ int cmd_select_end(cmd_context_t* ctx) {
 
 int cmd_select_up(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (!cursor->is_anchored) cursor_toggle_anchor(cursor, 1);
+    if (!cursor->is_anchored) cursor_toggle_anchor(cursor);
 
     // move up
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_move_vert, -1);
@@ -483,7 +516,7 @@ int cmd_select_up(cmd_context_t* ctx) {
 
 int cmd_select_down(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (!cursor->is_anchored) cursor_toggle_anchor(cursor, 1);
+    if (!cursor->is_anchored) cursor_toggle_anchor(cursor);
 
     // move down
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_move_vert, 1);
@@ -495,7 +528,7 @@ int cmd_select_down(cmd_context_t* ctx) {
 
 int cmd_select_left(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (!cursor->is_anchored) cursor_toggle_anchor(cursor, 1);
+    if (!cursor->is_anchored) cursor_toggle_anchor(cursor);
 
     // move left
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_move_by, -1);
@@ -506,7 +539,7 @@ int cmd_select_left(cmd_context_t* ctx) {
 
 int cmd_select_right(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (!cursor->is_anchored) cursor_toggle_anchor(cursor, 1);
+    if (!cursor->is_anchored) cursor_toggle_anchor(cursor);
 
     // move right
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_move_by, 1);
@@ -517,7 +550,7 @@ int cmd_select_right(cmd_context_t* ctx) {
 
 int cmd_select_word_back(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (!cursor->is_anchored) cursor_toggle_anchor(cursor, 1);
+    if (!cursor->is_anchored) cursor_toggle_anchor(cursor);
     cmd_move_word_back(ctx);
   );
 
@@ -526,7 +559,7 @@ int cmd_select_word_back(cmd_context_t* ctx) {
 
 int cmd_select_word_forward(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (!cursor->is_anchored) cursor_toggle_anchor(cursor, 1);
+    if (!cursor->is_anchored) cursor_toggle_anchor(cursor);
     cmd_move_word_forward(ctx);
   );
 
@@ -535,9 +568,9 @@ int cmd_select_word_forward(cmd_context_t* ctx) {
 
 int cmd_select_current_word(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (cursor->is_anchored) cursor_toggle_anchor(cursor, 0);
+    if (cursor->is_anchored) cursor_toggle_anchor(cursor);
     cmd_move_word_back(ctx);
-    cursor_toggle_anchor(cursor, 1);
+    cursor_toggle_anchor(cursor);
     cmd_move_word_forward(ctx);
   );
 
@@ -546,9 +579,9 @@ int cmd_select_current_word(cmd_context_t* ctx) {
 
 int cmd_select_current_line(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    if (cursor->is_anchored) cursor_toggle_anchor(cursor, 0);
+    if (cursor->is_anchored) cursor_toggle_anchor(cursor);
     cmd_move_bol(ctx);
-    cursor_toggle_anchor(cursor, 1);
+    cursor_toggle_anchor(cursor);
     cmd_move_eol(ctx);
   );
 
@@ -556,7 +589,7 @@ int cmd_select_current_line(cmd_context_t* ctx) {
 }
 
 int cmd_new_cursor_up(cmd_context_t* ctx) {
-  if (!ctx->cursor->is_anchored) cursor_toggle_anchor(ctx->cursor, 1);
+  if (!ctx->cursor->is_anchored) cursor_toggle_anchor(ctx->cursor);
 
   mark_move_vert(ctx->cursor->mark, -1);
   cmd_drop_cursor_column(ctx);
@@ -564,7 +597,7 @@ int cmd_new_cursor_up(cmd_context_t* ctx) {
 }
 
 int cmd_new_cursor_down(cmd_context_t* ctx) {
-  if (!ctx->cursor->is_anchored) cursor_toggle_anchor(ctx->cursor, 1);
+  if (!ctx->cursor->is_anchored) cursor_toggle_anchor(ctx->cursor);
 
   mark_move_vert(ctx->cursor->mark, 1);
   cmd_drop_cursor_column(ctx);
@@ -610,7 +643,7 @@ int cmd_drop_cursor_column(cmd_context_t* ctx) {
         bview_add_cursor(ctx->bview, bline, col, NULL);
       }
     }
-  cursor_toggle_anchor(cursor, 1);
+  cursor_toggle_anchor(cursor);
   );
   return EON_OK;
 }
@@ -619,7 +652,6 @@ int cmd_drop_cursor_column(cmd_context_t* ctx) {
 int cmd_search(cmd_context_t* ctx) {
   char* regex;
   int regex_len, res;
-  mark_t* search_mark;
 
   char * prompt;
   char * default_str = "Regex";
@@ -635,18 +667,17 @@ int cmd_search(cmd_context_t* ctx) {
     if (ctx->bview->last_search) free(ctx->bview->last_search);
 
     ctx->bview->last_search = regex;
+    _cmd_ensure_search_index(ctx->bview);
 
   } else if (ctx->bview->last_search) {
     regex = ctx->bview->last_search;
     regex_len = strlen(ctx->bview->last_search);
   }
 
-  search_mark = buffer_add_mark(ctx->bview->buffer, NULL, 0);
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    _cmd_search_next(ctx->bview, cursor, search_mark, regex, regex_len);
+    _cmd_search_next(ctx->bview, cursor, regex, regex_len);
   );
 
-  mark_destroy(search_mark);
   return EON_OK;
 }
 
@@ -654,16 +685,58 @@ int cmd_search(cmd_context_t* ctx) {
 // Search for next instance of last search regex
 int cmd_search_next(cmd_context_t* ctx) {
   int regex_len;
-  mark_t* search_mark;
 
   if (!ctx->bview->last_search) return EON_OK;
 
   regex_len = strlen(ctx->bview->last_search);
-  search_mark = buffer_add_mark(ctx->bview->buffer, NULL, 0);
+  _cmd_ensure_search_index(ctx->bview);
+  EON_MULTI_CURSOR_CODE(ctx->cursor,
+    _cmd_search_next(ctx->bview, cursor, ctx->bview->last_search, regex_len);
+  );
+  return EON_OK;
+}
+
+// Search for previous instance of last search regex
+int cmd_search_prev(cmd_context_t* ctx) {
+  int regex_len;
+
+  if (!ctx->bview->last_search) return EON_OK;
+
+  regex_len = strlen(ctx->bview->last_search);
+  _cmd_ensure_search_index(ctx->bview);
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    _cmd_search_next(ctx->bview, cursor, search_mark, ctx->bview->last_search, regex_len);
+    _cmd_search_prev(ctx->bview, cursor, ctx->bview->last_search, regex_len);
   );
-  mark_destroy(search_mark);
+  return EON_OK;
+}
+
+// Jump to the nth match of last search regex
+int cmd_search_nth(cmd_context_t* ctx) {
+  char* nthstr;
+  bint_t nth;
+  bint_t count;
+
+  if (!ctx->bview->last_search) return EON_OK;
+
+  editor_prompt(ctx->editor, "search_nth: Match num?", NULL, &nthstr);
+
+  if (!nthstr) return EON_OK;
+
+  nth = strtoll(nthstr, NULL, 10);
+  free(nthstr);
+
+  if (_cmd_ensure_search_index(ctx->bview) != EON_OK) {
+    EON_RETURN_ERR(ctx->editor, "Invalid regex: %s", ctx->bview->last_search);
+  }
+
+  search_index_complete(ctx->bview->shared->search_index);
+  count = search_index_get_count(ctx->bview->shared->search_index);
+
+  if (count < 1) EON_RETURN_ERR(ctx->editor, "No matches for %s", ctx->bview->last_search);
+
+  nth = EON_MAX(1, EON_MIN(nth, count));
+  search_index_move_to(ctx->bview->shared->search_index, ctx->cursor->mark, nth - 1);
+  bview_center_viewport_y(ctx->bview);
   return EON_OK;
 }
 
@@ -702,24 +775,15 @@ int cmd_viewport_bot(cmd_context_t* ctx) {
 
 // Find next occurence of word under cursor
 int cmd_find_word(cmd_context_t* ctx) {
-  char* re;
   char* word;
-  bint_t re_len;
   bint_t word_len;
   EON_MULTI_CURSOR_CODE(ctx->cursor,
 
   if (cursor_select_by(cursor, "word") == EON_OK) {
-  mark_get_between_mark(cursor->mark, cursor->anchor, &word, &word_len);
-    re_len = asprintf(&re, "\\b%s\\b", word);
+    mark_get_between_mark(cursor->mark, cursor->anchor, &word, &word_len);
+    cursor_toggle_anchor(cursor);
+    search_move_next_word(cursor->mark, word, word_len);
     free(word);
-    cursor_toggle_anchor(cursor, 0);
-
-    if (mark_move_next_re(cursor->mark, re, re_len) == MLBUF_ERR) {
-      mark_move_beginning(cursor->mark);
-      mark_move_next_re(cursor->mark, re, re_len);
-    }
-
-    free(re);
   }
   );
   bview_rectify_viewport(ctx->bview);
@@ -728,17 +792,19 @@ int cmd_find_word(cmd_context_t* ctx) {
 
 // Incremental search
 int cmd_isearch(cmd_context_t* ctx) {
+  mark_t* origin;
+
+  // Patterns that don't extend the previous one are searched from here
+  mark_clone(ctx->cursor->mark, &origin);
+
   editor_prompt(ctx->editor, "isearch: Regex?", &(editor_prompt_params_t) {
     .kmap = ctx->editor->kmap_prompt_isearch,
-    .prompt_cb = _cmd_isearch_prompt_cb
+    .prompt_cb = _cmd_isearch_prompt_cb,
+    .prompt_cb_udata = origin
   }, NULL);
 
-  if (ctx->bview->isearch_rule) {
-    buffer_remove_srule(ctx->bview->buffer, ctx->bview->isearch_rule, 1, 100);
-    srule_destroy(ctx->bview->isearch_rule);
-    ctx->bview->isearch_rule = NULL;
-  }
-
+  bview_set_isearch(ctx->bview, NULL, 0);
+  mark_destroy(origin);
   return EON_OK;
 }
 
@@ -747,7 +813,7 @@ int cmd_cut(cmd_context_t* ctx) {
   int append;
   append = ctx->loop_ctx->last_cmd && ctx->loop_ctx->last_cmd->func == cmd_cut ? 1 : 0;
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    cursor_cut_copy(cursor, 1, 1, append);
+    cursor_cut_copy(cursor, 1, append);
   );
   return EON_OK;
 }
@@ -758,7 +824,7 @@ int cmd_copy(cmd_context_t* ctx) {
     return EON_OK;
 
   EON_MULTI_CURSOR_CODE(ctx->cursor,
-    cursor_cut_copy(cursor, 0, 1, 0);
+    cursor_cut_copy(cursor, 0, 0);
   );
   return EON_OK;
 }
@@ -779,7 +845,7 @@ int cmd_uncut(cmd_context_t* ctx) {
 int cmd_copy_by(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
     if (cursor_select_by(cursor, ctx->static_param) == EON_OK) {
-      cursor_cut_copy(cursor, 0, 0, 0);
+      cursor_cut_copy(cursor, 0, 0);
     }
   );
   return EON_OK;
@@ -789,7 +855,7 @@ int cmd_copy_by(cmd_context_t* ctx) {
 int cmd_cut_by(cmd_context_t* ctx) {
   EON_MULTI_CURSOR_CODE(ctx->cursor,
     if (cursor_select_by(cursor, ctx->static_param) == EON_OK) {
-      cursor_cut_copy(cursor, 1, 0, 0);
+      cursor_cut_copy(cursor, 1, 0);
     }
   );
   return EON_OK;
@@ -829,52 +895,47 @@ int cmd_split_horizontal(cmd_context_t* ctx) {
   return EON_OK;
 }
 
-// Fuzzy path search via fzf
+// Fuzzy path search
 int cmd_fsearch(cmd_context_t* ctx) {
   char* path;
-  size_t path_len;
-  path = NULL;
 
-  if (util_shell_exec(ctx->editor, "fzf", -1, NULL, 0, NULL, &path, &path_len) == EON_ERR) {
+  if (fsearch_prompt(ctx->editor, &path) != EON_OK) {
     return EON_ERR;
   }
 
-  _cmd_force_redraw(ctx);
-
-  if (path && path_len > 0) {
-    while (path[path_len - 1] == '\n') {
-      // Strip trailing newlines
-      path_len -= 1;
-    }
-
-    if (path_len > 0) {
-      editor_open_bview(ctx->editor, NULL, EON_BVIEW_TYPE_EDIT, path, path_len, 1, 0, &ctx->editor->rect_edit, NULL, NULL);
-    }
+  if (path) {
+    editor_open_bview(ctx->editor, NULL, EON_BVIEW_TYPE_EDIT, path, strlen(path), 1, 0, &ctx->editor->rect_edit, NULL, NULL);
+    free(path);
   }
 
-  free(path);
   return EON_OK;
 }
 
 // Grep for pattern in cwd
 int cmd_grep(cmd_context_t* ctx) {
   async_proc_t* aproc;
+  bview_t* menu;
   char* path;
   char* path_arg;
   char* cmd;
   char* grep_fmt;
+  int rc;
   editor_prompt(ctx->editor, "grep: Pattern?", NULL, &path);
 
   if (!path) return EON_OK;
 
-  if (ctx->static_param) {
-    grep_fmt = ctx->static_param;
+  if (!ctx->static_param) {
+    // Search natively unless a custom grep command was bound
+    editor_page_menu(ctx->editor, _cmd_menu_grep_cb, NULL, 0, NULL, &menu);
+    rc = grep_new(ctx->editor, path, ".", menu, &(menu->async_proc), _cmd_aproc_grep_cb, &(menu->grep));
+    free(path);
 
-  } else {
-    // grep_fmt = "grep --color=never -P -i -I -n -r %s . 2>/dev/null";
-    grep_fmt = "grep --context=1 --color=never -i -I -n -r %s . 2>/dev/null"; // without -P, which may not be supported
+    if (rc != EON_OK) editor_close_bview(ctx->editor, menu, NULL);
+    return rc;
   }
 
+  grep_fmt = ctx->static_param;
+
   path_arg = util_escape_shell_arg(path, strlen(path));
   int res = asprintf(&cmd, grep_fmt, path_arg);
 
@@ -896,52 +957,59 @@ int cmd_grep(cmd_context_t* ctx) {
 
 // Invoke ctag search
 int cmd_ctag(cmd_context_t* ctx) {
-  async_proc_t* aproc;
+  ctags_match_t* matches;
+  bview_t* menu;
+  str_t lines = {0};
   char* word;
-  char* word_arg;
-  char* cmd;
   bint_t word_len;
-  int res;
+  int matches_len;
+  int i;
 
   if (cursor_select_by(ctx->cursor, "word") != EON_OK) {
     return EON_ERR;
   }
 
   mark_get_between_mark(ctx->cursor->mark, ctx->cursor->anchor, &word, &word_len);
-  cursor_toggle_anchor(ctx->cursor, 0);
-  word_arg = util_escape_shell_arg(word, word_len);
-  free(word);
-  res = asprintf(&cmd, "readtags -e - %s", word_arg);
-  free(word_arg);
+  cursor_toggle_anchor(ctx->cursor);
 
-  if (!cmd) {
-    EON_RETURN_ERR(ctx->editor, "%s", "Failed to format readtags cmd");
+  if (ctags_find(ctx->editor, word, word_len, &matches, &matches_len) != EON_OK) {
+    free(word);
+    return EON_ERR;
   }
 
-  aproc = async_proc_new(ctx->editor, ctx->bview, &(ctx->bview->async_proc), cmd, 0, _cmd_aproc_bview_passthru_cb);
-  free(cmd);
+  if (matches_len < 1) {
+    EON_SET_ERR(ctx->editor, "ctags: No tag found for %s", word);
+    free(word);
+    return EON_ERR;
+  }
 
-  if (!aproc) return EON_ERR;
+  // Jump straight to a unique tag, else let the user pick
+  if (matches_len == 1) {
+    ctags_open_match(ctx->editor, &matches[0]);
+    free(word);
+
+  } else {
+    for (i = 0; i < matches_len; i++) {
+      if (i > 0) str_append(&lines, "\n");
+      str_append(&lines, matches[i].file);
+      str_append(&lines, "\t");
+      str_append(&lines, matches[i].address);
+    }
 
-  editor_page_menu(ctx->editor, _cmd_menu_ctag_cb, NULL, 0, aproc, NULL);
+    editor_page_menu(ctx->editor, _cmd_menu_ctag_cb, lines.data, lines.len, NULL, &menu);
+    mark_move_beginning(menu->active_cursor->mark);
+    menu->ctag_name = word;
+    str_free(&lines);
+  }
+
+  ctags_free_matches(matches, matches_len);
   return EON_OK;
 }
 
 
-// Browse directory via tree
+// Browse directory
 int cmd_browse(cmd_context_t* ctx) {
-  bview_t* menu;
-  async_proc_t* aproc;
-  char* cmd;
-  int res = asprintf(&cmd, "tree --charset C -n -f -L 1 %s 2>/dev/null", ctx->static_param ? ctx->static_param : "");
-  aproc = async_proc_new(ctx->editor, ctx->bview, &(ctx->bview->async_proc), cmd, 0, _cmd_aproc_bview_passthru_cb);
-  free(cmd);
-
-  if (!aproc) return EON_ERR;
-
-  editor_page_menu(ctx->editor, _cmd_menu_browse_cb, "..\n", 3, aproc, &menu);
-  mark_move_beginning(menu->active_cursor->mark);
-  return EON_OK;
+  return browse_open(ctx->editor, ctx->static_param);
 }
 
 // Save-as file
@@ -1166,9 +1234,63 @@ int cmd_undo(cmd_context_t* ctx) {
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_move_to, action_to_undo->start_line_index, action_to_undo->start_col);
   }
 
-  EON_MULTI_CURSOR_CODE(ctx->cursor,
-    buffer_undo(ctx->bview->buffer);
-  );
+  bview_undo(ctx->bview);
+  return EON_OK;
+}
+
+// Show the memory held by the undo history
+int cmd_undo_info(cmd_context_t* ctx) {
+  bint_t bytes;
+  bint_t num_records;
+
+  bview_get_undo_usage(ctx->bview, &bytes, &num_records);
+
+  if (ctx->editor->undo_max_bytes > 0) {
+    EON_SET_INFO(ctx->editor, "undo: %ld step%s, %ld of %ld KiB",
+      (long)num_records, num_records == 1 ? "" : "s",
+      (long)(bytes / 1024), (long)(ctx->editor->undo_max_bytes / 1024));
+  } else {
+    EON_SET_INFO(ctx->editor, "undo: %ld step%s, %ld KiB",
+      (long)num_records, num_records == 1 ? "" : "s", (long)(bytes / 1024));
+  }
+
+  return EON_OK;
+}
+
+// Step back to the undo state made before the current one, which may be
+// on another branch
+int cmd_undo_earlier(cmd_context_t* ctx) {
+  if (bview_undo_step(ctx->bview, -1) == EON_OK) _cmd_undo_settle(ctx);
+  return EON_OK;
+}
+
+// Step forward to the undo state made after the current one
+int cmd_undo_later(cmd_context_t* ctx) {
+  if (bview_undo_step(ctx->bview, 1) == EON_OK) _cmd_undo_settle(ctx);
+  return EON_OK;
+}
+
+// Go back to the undo state as of a while ago
+int cmd_undo_time(cmd_context_t* ctx) {
+  char* agostr;
+  char* unit;
+  long ago;
+
+  editor_prompt(ctx->editor, "undo_time: How long ago? (e.g. 90s, 10m, 2h)", NULL, &agostr);
+
+  if (!agostr) return EON_OK;
+
+  ago = strtol(agostr, &unit, 10);
+
+  switch (*unit) {
+    case 'd': ago *= 86400; break;
+    case 'h': ago *= 3600; break;
+    case 'm': ago *= 60; break;
+  }
+
+  free(agostr);
+
+  if (bview_undo_to_time(ctx->bview, time(NULL) - EON_MAX(ago, 0)) == EON_OK) _cmd_undo_settle(ctx);
   return EON_OK;
 }
 
@@ -1191,9 +1313,7 @@ int cmd_redo(cmd_context_t* ctx) {
     EON_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_move_to, action_to_redo->start_line_index, action_to_redo->start_col);
   }
 
-  EON_MULTI_CURSOR_CODE(ctx->cursor,
-    buffer_redo(ctx->bview->buffer);
-  );
+  bview_redo(ctx->bview);
   return EON_OK;
 }
 
@@ -1236,6 +1356,9 @@ int cmd_set_opt(cmd_context_t* ctx) {
 
   } else if (strcmp(ctx->static_param, "soft_wrap") == 0) {
     ctx->editor->soft_wrap = vali ? 1 : 0;
+
+  } else if (strcmp(ctx->static_param, "undo_max_kb") == 0) {
+    ctx->editor->undo_max_bytes = (bint_t)EON_MAX(vali, 0) * 1024;
   }
 
   return EON_OK;
@@ -1760,31 +1883,51 @@ static int _cmd_save(editor_t* editor, bview_t* bview, int save_as) {
     bview_set_syntax(bview, NULL);
   }
 
+  if (rc == MLBUF_OK) {
+    bview_save_undo(bview);
+    bview_save_swap(bview);
+  }
+
   return rc == MLBUF_OK ? EON_OK : EON_ERR;
 }
 
 // Move cursor to next occurrence of term, wrap if necessary. Return EON_OK if
 // there was a match, or EON_ERR if no match.
-static int _cmd_search_next(bview_t* bview, cursor_t* cursor, mark_t* search_mark, char* regex, int regex_len) {
+static int _cmd_search_next(bview_t* bview, cursor_t* cursor, char* regex, int regex_len) {
+  mark_t tmark;
+  bline_t* bline;
+  bint_t col;
+  bint_t nth;
   int rc;
   rc = EON_ERR;
 
-  // Move search_mark to cursor
-  mark_join(search_mark, cursor->mark);
+  // Use the match index once it's built
+  if (bview->shared->search_index && search_index_is_for(bview->shared->search_index, regex, regex_len)) {
+    if (search_index_find_next(bview->shared->search_index, cursor->mark, &nth) == EON_OK
+      && search_index_move_to(bview->shared->search_index, cursor->mark, nth) == EON_OK
+    ) {
+      bview_rectify_viewport(bview);
+      return EON_OK;
+    }
+
+    if (search_index_is_complete(bview->shared->search_index) && search_index_get_count(bview->shared->search_index) < 1) {
+      return EON_ERR;
+    }
+  }
 
   // Look for match ahead of us
-  if (mark_move_next_re_nudge(search_mark, regex, regex_len) == MLBUF_OK) {
+  if (search_find_next(cursor->mark, regex, regex_len, 1, &bline, &col, NULL) == EON_OK) {
     // Match! Move there
-    mark_join(cursor->mark, search_mark);
+    mark_move_to_w_bline(cursor->mark, bline, col);
     rc = EON_OK;
 
   } else {
     // No match, try from beginning
-    mark_move_beginning(search_mark);
+    tmark = EON_TMARK(bview->buffer->first_line, 0);
 
-    if (mark_move_next_re(search_mark, regex, regex_len) == MLBUF_OK) {
+    if (search_find_next(&tmark, regex, regex_len, 0, &bline, &col, NULL) == EON_OK) {
       // Match! Move there
-      mark_join(cursor->mark, search_mark);
+      mark_move_to_w_bline(cursor->mark, bline, col);
       rc = EON_OK;
     }
   }
@@ -1795,63 +1938,163 @@ static int _cmd_search_next(bview_t* bview, cursor_t* cursor, mark_t* search_mar
   return rc;
 }
 
+// Move cursor to previous occurrence of term, wrap if necessary. Return
+// EON_OK if there was a match, or EON_ERR if no match.
+static int _cmd_search_prev(bview_t* bview, cursor_t* cursor, char* regex, int regex_len) {
+  mark_t tmark;
+  bline_t* bline;
+  bint_t col;
+  bint_t nth;
+  int rc;
+  rc = EON_ERR;
+
+  // Use the match index once it's built
+  if (bview->shared->search_index && search_index_is_for(bview->shared->search_index, regex, regex_len)) {
+    if (search_index_find_prev(bview->shared->search_index, cursor->mark, &nth) == EON_OK
+      && search_index_move_to(bview->shared->search_index, cursor->mark, nth) == EON_OK
+    ) {
+      bview_rectify_viewport(bview);
+      return EON_OK;
+    }
+
+    if (search_index_is_complete(bview->shared->search_index) && search_index_get_count(bview->shared->search_index) < 1) {
+      return EON_ERR;
+    }
+  }
+
+  // Look for match behind us
+  if (search_find_prev(cursor->mark, regex, regex_len, &bline, &col, NULL) == EON_OK) {
+    // Match! Move there
+    mark_move_to_w_bline(cursor->mark, bline, col);
+    rc = EON_OK;
+
+  } else {
+    // No match, try from end
+    MLBUF_BLINE_ENSURE_CHARS(bview->buffer->last_line);
+    tmark = EON_TMARK(bview->buffer->last_line, bview->buffer->last_line->char_count);
+
+    if (search_find_prev(&tmark, regex, regex_len, &bline, &col, NULL) == EON_OK) {
+      // Match! Move there
+      mark_move_to_w_bline(cursor->mark, bline, col);
+      rc = EON_OK;
+    }
+  }
+
+  // Rectify viewport if needed
+  if (rc == EON_OK) bview_rectify_viewport(bview);
+
+  return rc;
+}
+
+// Make sure bview's buffer has a match index for bview's last search
+static int _cmd_ensure_search_index(bview_t* bview) {
+  if (!bview->last_search) return EON_ERR;
+
+  if (bview->shared->search_index) {
+    if (search_index_is_for(bview->shared->search_index, bview->last_search, strlen(bview->last_search))) {
+      return EON_OK;
+    }
+
+    search_index_destroy(bview->shared->search_index);
+    bview->shared->search_index = NULL;
+  }
+
+  return search_index_new(bview->shared, bview->last_search, strlen(bview->last_search), &bview->shared->search_index);
+}
+
 // Aproc callback that writes buf to bview buffer
 static void _cmd_aproc_bview_passthru_cb(async_proc_t* aproc, char* buf, size_t buf_len) {
-  mark_t* active_mark;
-  mark_t* ins_mark;
-  int is_cursor_at_zero;
   bview_t* bview;
+  bview = (bview_t*)aproc->owner;
 
-  if (!buf || buf_len < 1) return;
+  // Batch output, appending whatever is left once the aproc is done
+  if (!buf || buf_len < 1) {
+    bview_flush_output(bview);
+    return;
+  }
 
-  // Remeber if cursor is at 0
-  bview = (bview_t*)aproc->owner;
-  active_mark = bview->active_cursor->mark;
-  is_cursor_at_zero = active_mark->bline->line_index == 0 && active_mark->col == 0 ? 1 : 0;
+  bview_queue_output(bview, buf, buf_len);
+}
+
+// Aproc callback that writes new native grep results to the menu, one line
+// per result so a menu line index finds its result
+static void _cmd_aproc_grep_cb(async_proc_t* aproc, char* buf, size_t buf_len) {
+  bview_t* menu;
+  grep_result_t* result;
+  str_t lines = {0};
+  char prefix[64];
+  bint_t count;
+  bint_t num;
+  bint_t i;
+
+  menu = (bview_t*)aproc->owner;
+  if (!menu->grep) return;
+
+  num = grep_take_results(menu->grep);
+  count = grep_get_result_count(menu->grep);
+
+  for (i = count - num; i < count; i++) {
+    result = grep_get_result(menu->grep, i);
+    snprintf(prefix, sizeof(prefix), ":%ld:%ld: ", (long)result->line, (long)result->col + 1);
+    str_append(&lines, result->path);
+    str_append(&lines, prefix);
+    str_append_len(&lines, result->text, result->text_len);
+    str_append_len(&lines, "\n", 1);
+
+    // Only needed for display
+    free(result->text);
+    result->text = NULL;
+  }
 
-  // Append data at end of menu buffer
-  ins_mark = buffer_add_mark(bview->buffer, NULL, 0);
-  mark_move_end(ins_mark);
-  mark_insert_before(ins_mark, buf, buf_len);
-  mark_destroy(ins_mark);
-  bview_rectify_viewport(bview);
+  bview_queue_output(menu, lines.data, lines.len);
+  str_free(&lines);
 
-  if (is_cursor_at_zero) mark_move_beginning(active_mark);
+  if (buf_len < 1) {
+    bview_flush_output(menu);
+    EON_SET_INFO(menu->editor, "grep: %ld match%s", (long)count, count == 1 ? "" : "es");
+  }
 }
 
 // Incremental search prompt callback
 static void _cmd_isearch_prompt_cb(bview_t* bview_prompt, baction_t* action, void* udata) {
   bview_t* bview;
+  mark_t* origin;
   char* regex;
   int regex_len;
+  int is_extension;
 
   bview = bview_prompt->editor->active_edit;
-
-  if (bview->isearch_rule) {
-    buffer_remove_srule(bview->buffer, bview->isearch_rule, 1, 100);
-    srule_destroy(bview->isearch_rule);
-    bview->isearch_rule = NULL;
-  }
+  origin = (mark_t*)udata;
 
   regex = bview_prompt->buffer->first_line->data;
   regex_len = bview_prompt->buffer->first_line->data_len;
 
+  // A pattern that only grew matches where the old one did (barring
+  // alternation), so keep looking from the current match
+  is_extension = bview->isearch_cre && bview->last_search
+    && regex_len > (int)strlen(bview->last_search)
+    && strncmp(regex, bview->last_search, strlen(bview->last_search)) == 0 ? 1 : 0;
+
   if (bview->last_search) {
     free(bview->last_search);
     bview->last_search = NULL;
   }
 
-  if (regex_len < 1) return;
+  if (regex_len < 1) {
+    bview_set_isearch(bview, NULL, 0);
+    mark_join(bview->active_cursor->mark, origin);
+    bview_center_viewport_y(bview);
+    return;
+  }
 
   // set the current string as the last search term so we can use F3/C-g
   bview->last_search = strndup(regex, regex_len);
 
-  bview->isearch_rule = srule_new_single(regex, regex_len, 1, 0, TB_YELLOW);
+  // Highlighting is a render-time overlay, the buffer isn't restyled
+  if (bview_set_isearch(bview, regex, regex_len) != EON_OK) return;
 
-  if (!bview->isearch_rule) return;
-
-  buffer_add_srule(bview->buffer, bview->isearch_rule, 0, 100);
-  mark_move_next_cre(bview->active_cursor->mark, bview->isearch_rule->cre);
+  if (!is_extension) mark_join(bview->active_cursor->mark, origin);
+  bview_move_next_isearch(bview, bview->active_cursor->mark, 0);
 
   bview_center_viewport_y(bview);
 }
@@ -1863,6 +2106,20 @@ static int _cmd_menu_grep_cb(cmd_context_t* ctx, char * action) {
   bint_t linenum;
   char* line;
   char* colon;
+  grep_result_t* result;
+  bview_t* bview;
+
+  // Native grep results are looked up by menu line, no parsing needed
+  if (ctx->bview->grep) {
+    result = grep_get_result(ctx->bview->grep, ctx->bview->active_cursor->mark->bline->line_index);
+    if (!result) return EON_OK;
+
+    editor_open_bview(ctx->editor, NULL, EON_BVIEW_TYPE_EDIT, result->path, strlen(result->path), 1, result->line, &ctx->editor->rect_edit, NULL, &bview);
+    mark_move_to(bview->active_cursor->mark, result->line - 1, result->col);
+    bview_rectify_viewport(bview);
+    return EON_OK;
+  }
+
   line = strndup(ctx->bview->active_cursor->mark->bline->data, ctx->bview->active_cursor->mark->bline->data_len);
   colon = strchr(line, ':');
 
@@ -1886,123 +2143,27 @@ static int _cmd_menu_grep_cb(cmd_context_t* ctx, char * action) {
 
 // Callback from cmd_ctag
 static int _cmd_menu_ctag_cb(cmd_context_t* ctx, char * action) {
-  char* line;
-  char* tok;
-  char* fname;
-  char* re;
-  char* qre;
-  char* qre2;
-  int re_len;
-  int qre_len;
-  int i;
-
-  bview_t* bview;
-  line = strndup(ctx->bview->active_cursor->mark->bline->data, ctx->bview->active_cursor->mark->bline->data_len);
-  i = 0;
-  fname = NULL;
-  re = NULL;
-  tok = strtok(line, "\t");
-
-  while (tok) {
-    if (i == 1) {
-      fname = tok;
-    } else if (i == 2) {
-      re = tok;
-      break;
-    }
-    tok = strtok(NULL, "\t");
-    i += 1;
-  }
-
-  re_len = re ? strlen(re) : 0;
-
-  if (!fname || re_len < 4) {
-    free(line);
-    return EON_OK;
-  }
-
-  re += 2; // Skip leading `/^`
-  re_len -= 2;
-  re[re_len-4] = '\0'; // Trunc trailing `$/;"`
-  re_len -= 4;
-
-  util_pcre_replace("([\\.\\\\\\+\\*\\?\\^\\$\\[\\]\\(\\)\\{\\}\\=\\!\\>\\<\\|\\:\\-])", re, "\\\\$1", &qre, &qre_len);
-  editor_close_bview(ctx->editor, ctx->bview, NULL);
-  editor_open_bview(ctx->editor, NULL, EON_BVIEW_TYPE_EDIT, fname, strlen(fname), 1, 0, &ctx->editor->rect_edit, NULL, &bview);
-  int len = asprintf(&qre2, "^%s", qre);
-
-  mark_move_next_re(bview->active_cursor->mark, qre2, qre_len+1);
-  bview_center_viewport_y(bview);
-
-  free(line);
-  free(qre);
-  free(qre2);
-
-  return EON_OK;
-}
-
-// Callback from cmd_browse
-static int _cmd_menu_browse_cb(cmd_context_t* ctx, char * action) {
   if (!action) return EON_OK; // cancelled
 
-  char* line;
-  char* path;
-  char cwd[PATH_MAX];
-  char* corrected_path;
-  bview_t* new_bview;
-  int res;
-
-  // Get path from tree output
-  line = strndup(ctx->bview->active_cursor->mark->bline->data, ctx->bview->active_cursor->mark->bline->data_len);
-
-  if ((path = strstr(line, "- ")) != NULL) {
-    path += 2;
+  ctags_match_t* matches;
+  int matches_len;
+  bint_t line_index;
 
-  } else if (strcmp(line, "..") == 0) {
-    path = ".."; //
+  if (!ctx->bview->ctag_name) return EON_OK;
 
-  } else if (util_is_dir(line) && !strstr(line, "../")) {
-    path = line;
+  // Lookups are cheap, so find the tag again and pick the match by menu line
+  line_index = ctx->bview->active_cursor->mark->bline->line_index;
 
-  } else {
-    EON_SET_ERR(ctx->editor, "[browse] Cannot open '%s'", line);
-    free(line);
+  if (ctags_find(ctx->editor, ctx->bview->ctag_name, strlen(ctx->bview->ctag_name), &matches, &matches_len) != EON_OK) {
     return EON_ERR;
   }
 
-  if (getcwd(cwd, PATH_MAX) == NULL) {
-    strcpy(cwd, ".");
-  }
-
-  if (strcmp(cwd, ctx->bview->init_cwd) != 0) {
-    res = asprintf(&corrected_path, "%s/%s", ctx->bview->init_cwd, path);
-  } else {
-    corrected_path = strdup(path);
+  if (line_index < matches_len) {
+    editor_close_bview(ctx->editor, ctx->bview, NULL);
+    ctags_open_match(ctx->editor, &matches[line_index]);
   }
 
-  // Open file or browse dir
-  new_bview = NULL;
-
-  if (util_is_dir(corrected_path)) {
-    // debug("Opening dir: %s\n", corrected_path);
-    res = chdir(corrected_path);
-    ctx->bview = ctx->editor->active_edit;
-    cmd_browse(ctx);
-  } else {
-    // debug("Opening file: %s\n", corrected_path);
-    editor_open_bview(ctx->editor, NULL, EON_BVIEW_TYPE_EDIT, corrected_path, strlen(corrected_path), 0, 0, &ctx->editor->rect_edit, NULL, &new_bview);
-  }
-
-  // Close menu
-  editor_close_bview(ctx->editor, ctx->bview, NULL);
-  res = chdir(cwd);
-
-  // Set new_bview to active
-  if (new_bview) editor_set_active(ctx->editor, new_bview);
-
-  free(line);
-  free(corrected_path);
-
+  ctags_free_matches(matches, matches_len);
   return EON_OK;
 }
 
@@ -2099,3 +2260,38 @@ static void _cmd_insert_smart_closing_bracket(cmd_context_t* ctx) {
   if (this_line) free(this_line);
   if (prev_line) free(prev_line);
 }
+
+// Put the cursor on the last change after moving through undo history and
+// say where in it the buffer is
+static void _cmd_undo_settle(cmd_context_t* ctx) {
+  baction_t* action;
+  bint_t index;
+  bint_t count;
+  time_t when;
+
+  if (ctx->buffer->action_undone) {
+    action = ctx->buffer->action_undone == ctx->buffer->actions ? NULL : ctx->buffer->action_undone->prev;
+  } else {
+    action = ctx->buffer->action_tail;
+  }
+
+  if (action && bview_get_active_cursor_count(ctx->bview) < 2) {
+    mark_move_to(ctx->cursor->mark, action->start_line_index, action->start_col);
+  }
+
+  bview_rectify_viewport(ctx->bview);
+
+  if (bview_get_undo_state(ctx->bview, &index, &count, &when) != EON_OK) return;
+
+  if (when > 0) {
+    EON_SET_INFO(ctx->editor, "undo: State %ld of %ld, %lds ago", (long)index, (long)(count - 1), (long)(time(NULL) - when));
+  } else {
+    EON_SET_INFO(ctx->editor, "undo: Oldest state of %ld", (long)(count - 1));
+  }
+}
+
+// Return 1 if data is a single char other than a newline
+static int _cmd_is_typed_char(char* data, bint_t data_len) {
+  if (!data || data_len < 1 || data[0] == '\n') return 0;
+  return tb_utf8_char_length(data[0]) == data_len ? 1 : 0;
+}
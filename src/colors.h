@@ -33,6 +33,11 @@
 
 #define BRACKET_HIGHLIGHT TB_REVERSE
 
+#define ISEARCH_FG TB_DEFAULT
+#define ISEARCH_BG TB_YELLOW
+
+#define SELECTION_BG TB_REVERSE
+
 // #define RECT_CAPTION_FG TB_DARK_GREY
 // #define RECT_CAPTION_BG TB_BLACK
 
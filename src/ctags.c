@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "eon.h"
+
+#define EON_CTAGS_UNSORTED 0
+#define EON_CTAGS_SORTED 1
+#define EON_CTAGS_FOLDCASE 2
+
+typedef struct ctags_index_s ctags_index_t; // Lines of one tag in an unsorted file
+
+// ctags_index_t
+struct ctags_index_s {
+    char* name; // into ctags_t.data, not terminated
+    size_t* lines; // offsets into ctags_t.data
+    int lines_len;
+    int lines_cap;
+    UT_hash_handle hh;
+};
+
+// ctags_t
+struct ctags_s {
+    char path[PATH_MAX + 1];
+    off_t size;
+    struct timespec mtime;
+    char* data; // mmapped tags file
+    size_t len;
+    char* body; // first line after the !_TAG_ headers
+    int sort_mode;
+    ctags_index_t* index; // only built for unsorted files
+};
+
+static int _ctags_load(editor_t* editor, ctags_t** ret_ctags);
+static int _ctags_read_sort_mode(ctags_t* ctags);
+static int _ctags_is_sorted(ctags_t* ctags, int sample_only);
+static void _ctags_build_index(ctags_t* ctags);
+static char* _ctags_lower_bound(ctags_t* ctags, char* name, size_t name_len);
+static char* _ctags_line_start(ctags_t* ctags, char* pos, char* min);
+static char* _ctags_line_end(ctags_t* ctags, char* line);
+static size_t _ctags_name_len(ctags_t* ctags, char* line);
+static int _ctags_cmp(char* a, size_t a_len, char* b, size_t b_len, int fold);
+static void _ctags_add_match(ctags_t* ctags, char* line, ctags_match_t** matches, int* matches_len);
+static void _ctags_goto_address(bview_t* bview, char* address);
+
+// Find all tags named name in ./tags. Matches must be freed with
+// ctags_free_matches.
+int ctags_find(editor_t* editor, char* name, size_t name_len, ctags_match_t** ret_matches, int* ret_matches_len) {
+  ctags_t* ctags;
+  ctags_index_t* entry;
+  ctags_match_t* matches;
+  char* line;
+  char* end;
+  int matches_len;
+  int i;
+
+  *ret_matches = NULL;
+  *ret_matches_len = 0;
+
+  if (_ctags_load(editor, &ctags) != EON_OK) return EON_ERR;
+
+  matches = NULL;
+  matches_len = 0;
+  end = ctags->data + ctags->len;
+
+  if (ctags->index) {
+    HASH_FIND(hh, ctags->index, name, name_len, entry);
+
+    for (i = 0; entry && i < entry->lines_len; i++) {
+      _ctags_add_match(ctags, ctags->data + entry->lines[i], &matches, &matches_len);
+    }
+
+  } else {
+    // With foldcase sorting, lines differing only in case are interleaved
+    for (line = _ctags_lower_bound(ctags, name, name_len); line < end; line = _ctags_line_end(ctags, line) + 1) {
+      if (_ctags_cmp(line, _ctags_name_len(ctags, line), name, name_len, ctags->sort_mode == EON_CTAGS_FOLDCASE) != 0) break;
+      if (_ctags_name_len(ctags, line) == name_len && memcmp(line, name, name_len) == 0) {
+        _ctags_add_match(ctags, line, &matches, &matches_len);
+      }
+    }
+  }
+
+  *ret_matches = matches;
+  *ret_matches_len = matches_len;
+  return EON_OK;
+}
+
+// Free matches returned by ctags_find
+void ctags_free_matches(ctags_match_t* matches, int matches_len) {
+  int i;
+
+  for (i = 0; i < matches_len; i++) {
+    free(matches[i].file);
+    free(matches[i].address);
+  }
+
+  free(matches);
+}
+
+// Open the file of a tag and move to its definition
+int ctags_open_match(editor_t* editor, ctags_match_t* match) {
+  bview_t* bview;
+
+  if (editor_open_bview(editor, NULL, EON_BVIEW_TYPE_EDIT, match->file, strlen(match->file), 1, 0, &editor->rect_edit, NULL, &bview) != EON_OK) {
+    return EON_ERR;
+  }
+
+  _ctags_goto_address(bview, match->address);
+  bview_center_viewport_y(bview);
+  return EON_OK;
+}
+
+// Unmap a tags file and free its index
+int ctags_destroy(ctags_t* ctags) {
+  ctags_index_t* entry;
+  ctags_index_t* entry_tmp;
+
+  // Entries are dropped all at once, deleting each is slow on big indexes
+  HASH_ITER(hh, ctags->index, entry, entry_tmp) {
+    free(entry->lines);
+    free(entry);
+  }
+
+  HASH_CLEAR(hh, ctags->index);
+
+  munmap(ctags->data, ctags->len);
+  free(ctags);
+  return EON_OK;
+}
+
+// Map ./tags, reusing the cached one if it hasn't changed
+static int _ctags_load(editor_t* editor, ctags_t** ret_ctags) {
+  ctags_t* ctags;
+  char path[PATH_MAX + 1];
+  struct stat st;
+  int fd;
+
+  if (!realpath("tags", path) || stat(path, &st) != 0) {
+    EON_RETURN_ERR(editor, "%s", "ctags: No tags file found");
+  }
+
+  ctags = editor->ctags;
+
+  if (ctags && strcmp(ctags->path, path) == 0 && ctags->size == st.st_size
+    && ctags->mtime.tv_sec == st.st_mtim.tv_sec && ctags->mtime.tv_nsec == st.st_mtim.tv_nsec
+  ) {
+    *ret_ctags = ctags;
+    return EON_OK;
+  }
+
+  if (ctags) {
+    ctags_destroy(ctags);
+    editor->ctags = NULL;
+  }
+
+  if (st.st_size < 1) {
+    EON_RETURN_ERR(editor, "ctags: %s is empty", path);
+  }
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+    EON_RETURN_ERR(editor, "ctags: Failed to open %s: %s", path, strerror(errno));
+  }
+
+  ctags = calloc(1, sizeof(ctags_t));
+  snprintf(ctags->path, sizeof(ctags->path), "%s", path);
+  ctags->size = st.st_size;
+  ctags->mtime = st.st_mtim;
+  ctags->len = (size_t)st.st_size;
+  ctags->data = mmap(NULL, ctags->len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (ctags->data == MAP_FAILED) {
+    free(ctags);
+    EON_RETURN_ERR(editor, "ctags: Failed to map %s: %s", path, strerror(errno));
+  }
+
+  madvise(ctags->data, ctags->len, MADV_RANDOM);
+
+  // Trust a sorted header after a spot check, else check every line. Fall
+  // back to a hash index if the file turns out unsorted.
+  ctags->sort_mode = _ctags_read_sort_mode(ctags);
+
+  if (ctags->sort_mode == EON_CTAGS_UNSORTED || !_ctags_is_sorted(ctags, ctags->sort_mode >= 0)) {
+    ctags->sort_mode = EON_CTAGS_UNSORTED;
+    _ctags_build_index(ctags);
+  }
+
+  if (ctags->sort_mode < 0) ctags->sort_mode = EON_CTAGS_SORTED;
+
+  editor->ctags = ctags;
+  *ret_ctags = ctags;
+  return EON_OK;
+}
+
+// Skip the !_TAG_ header lines. Return the sort mode they declare, or -1
+// if there is none.
+static int _ctags_read_sort_mode(ctags_t* ctags) {
+  char* line;
+  char* end;
+  int sort_mode;
+
+  sort_mode = -1;
+  end = ctags->data + ctags->len;
+
+  for (line = ctags->data; line < end && *line == '!'; line = _ctags_line_end(ctags, line) + 1) {
+    if (end - line > 18 && strncmp(line, "!_TAG_FILE_SORTED\t", 18) == 0) {
+      sort_mode = line[18] - '0';
+      if (sort_mode < EON_CTAGS_UNSORTED || sort_mode > EON_CTAGS_FOLDCASE) sort_mode = -1;
+    }
+  }
+
+  ctags->body = EON_MIN(line, end);
+  return sort_mode;
+}
+
+// Return 1 if tag names never decrease, checking a sample of lines or all
+static int _ctags_is_sorted(ctags_t* ctags, int sample_only) {
+  char* line;
+  char* prev;
+  char* end;
+  size_t body_len;
+  int fold;
+  int i;
+
+  end = ctags->data + ctags->len;
+  body_len = end - ctags->body;
+  fold = ctags->sort_mode == EON_CTAGS_FOLDCASE;
+  prev = NULL;
+
+  for (i = 0; sample_only ? i < EON_CTAGS_SORT_SAMPLES : 1; i++) {
+    if (sample_only) {
+      line = _ctags_line_start(ctags, ctags->body + (body_len * i) / EON_CTAGS_SORT_SAMPLES, ctags->body);
+    } else {
+      line = prev ? _ctags_line_end(ctags, prev) + 1 : ctags->body;
+      if (line >= end) break;
+    }
+
+    if (prev && _ctags_cmp(prev, _ctags_name_len(ctags, prev), line, _ctags_name_len(ctags, line), fold) > 0) {
+      return 0;
+    }
+
+    prev = line;
+  }
+
+  return 1;
+}
+
+// Index the lines of an unsorted file by tag name
+static void _ctags_build_index(ctags_t* ctags) {
+  ctags_index_t* entry;
+  char* line;
+  char* end;
+  size_t name_len;
+
+  end = ctags->data + ctags->len;
+
+  for (line = ctags->body; line < end; line = _ctags_line_end(ctags, line) + 1) {
+    name_len = _ctags_name_len(ctags, line);
+    if (name_len < 1) continue;
+
+    HASH_FIND(hh, ctags->index, line, name_len, entry);
+
+    if (!entry) {
+      entry = calloc(1, sizeof(ctags_index_t));
+      entry->name = line;
+      HASH_ADD_KEYPTR(hh, ctags->index, entry->name, name_len, entry);
+    }
+
+    if (entry->lines_len >= entry->lines_cap) {
+      entry->lines_cap = entry->lines_cap ? entry->lines_cap * 2 : 2;
+      entry->lines = realloc(entry->lines, sizeof(size_t) * entry->lines_cap);
+    }
+
+    entry->lines[entry->lines_len++] = line - ctags->data;
+  }
+}
+
+// Return the first line whose tag name is not less than name
+static char* _ctags_lower_bound(ctags_t* ctags, char* name, size_t name_len) {
+  char* lo;
+  char* hi;
+  char* line;
+  int fold;
+
+  lo = ctags->body;
+  hi = ctags->data + ctags->len;
+  fold = ctags->sort_mode == EON_CTAGS_FOLDCASE;
+
+  // Lines before lo are less than name, lines from hi on are not
+  while (lo < hi) {
+    line = _ctags_line_start(ctags, lo + (hi - lo) / 2, lo);
+
+    if (_ctags_cmp(line, _ctags_name_len(ctags, line), name, name_len, fold) < 0) {
+      lo = _ctags_line_end(ctags, line) + 1;
+    } else {
+      hi = line;
+    }
+  }
+
+  return lo;
+}
+
+// Return the start of the line containing pos, not looking before min
+static char* _ctags_line_start(ctags_t* ctags, char* pos, char* min) {
+  char* nl;
+  if (pos <= min) return min;
+  nl = memrchr(min, '\n', pos - min);
+  return nl ? nl + 1 : min;
+}
+
+// Return the newline ending line, or the end of data
+static char* _ctags_line_end(ctags_t* ctags, char* line) {
+  char* end = ctags->data + ctags->len;
+  char* nl = memchr(line, '\n', end - line);
+  return nl ? nl : end;
+}
+
+// Return the length of the tag name at the start of line
+static size_t _ctags_name_len(ctags_t* ctags, char* line) {
+  char* end = _ctags_line_end(ctags, line);
+  char* tab = memchr(line, '\t', end - line);
+  return (tab ? tab : end) - line;
+}
+
+// Compare tag names like sort(1) with LC_ALL=C, optionally folding case
+static int _ctags_cmp(char* a, size_t a_len, char* b, size_t b_len, int fold) {
+  size_t len;
+  size_t i;
+  int ca;
+  int cb;
+  int rc;
+
+  len = EON_MIN(a_len, b_len);
+
+  if (!fold) {
+    if ((rc = memcmp(a, b, len)) != 0) return rc;
+  } else {
+    for (i = 0; i < len; i++) {
+      ca = toupper((unsigned char)a[i]);
+      cb = toupper((unsigned char)b[i]);
+      if (ca != cb) return ca - cb;
+    }
+  }
+
+  return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+// Split a tag line into file and address and add it to matches
+static void _ctags_add_match(ctags_t* ctags, char* line, ctags_match_t** matches, int* matches_len) {
+  ctags_match_t* match;
+  char* end;
+  char* file;
+  char* file_end;
+  char* address;
+  char* address_end;
+
+  end = _ctags_line_end(ctags, line);
+  if (end > line && *(end - 1) == '\r') end -= 1;
+
+  if (!(file = memchr(line, '\t', end - line))) return;
+  file += 1;
+  if (!(file_end = memchr(file, '\t', end - file))) return;
+  address = file_end + 1;
+
+  // Patterns may contain tabs, so the address ends at the ;" before fields
+  for (address_end = address; address_end < end; address_end++) {
+    if (address_end + 1 < end && address_end[0] == ';' && address_end[1] == '"'
+      && (address_end + 2 == end || address_end[2] == '\t')
+    ) {
+      break;
+    }
+  }
+
+  *matches = realloc(*matches, sizeof(ctags_match_t) * (*matches_len + 1));
+  match = &(*matches)[*matches_len];
+  match->file = strndup(file, file_end - file);
+  match->address = strndup(address, address_end - address);
+  *matches_len += 1;
+}
+
+// Move to a tag address, either a line number or an ex search pattern
+static void _ctags_goto_address(bview_t* bview, char* address) {
+  bline_t* bline;
+  char* pattern;
+  char* src;
+  char* dst;
+  char delim;
+  size_t len;
+  int is_bol;
+  int is_eol;
+
+  if (isdigit((unsigned char)*address)) {
+    mark_move_to(bview->active_cursor->mark, strtoll(address, NULL, 10) - 1, 0);
+    return;
+  }
+
+  delim = *address;
+  if (delim != '/' && delim != '?') return;
+
+  // Unescape the pattern, which is matched literally like vi's nomagic
+  pattern = strdup(address + 1);
+  len = strlen(pattern);
+  if (len > 0 && pattern[len - 1] == delim) pattern[--len] = '\0';
+
+  for (src = dst = pattern; *src; src++) {
+    if (*src == '\\' && (src[1] == delim || src[1] == '\\')) src++;
+    *dst++ = *src;
+  }
+
+  *dst = '\0';
+  len = dst - pattern;
+  src = pattern;
+
+  is_bol = len > 0 && *src == '^';
+  if (is_bol) { src++; len--; }
+  is_eol = len > 0 && src[len - 1] == '$';
+  if (is_eol) len--;
+
+  for (bline = bview->buffer->first_line; bline; bline = bline->next) {
+    if (is_bol && is_eol) {
+      if ((size_t)bline->data_len != len || memcmp(bline->data, src, len) != 0) continue;
+    } else if (is_bol) {
+      if ((size_t)bline->data_len < len || memcmp(bline->data, src, len) != 0) continue;
+    } else if (!memmem(bline->data, bline->data_len, src, len)) {
+      continue;
+    }
+
+    mark_move_to(bview->active_cursor->mark, bline->line_index, 0);
+    break;
+  }
+
+  free(pattern);
+}
@@ -4,13 +4,26 @@
 
 char* shared_cutbuf;
 
+typedef struct cursor_match_s cursor_match_t;
+
+// A match found by _cursor_replace_all and where its replacement text is
+struct cursor_match_s {
+  bline_t* bline;
+  bint_t start; // byte index in bline
+  bint_t end;
+  bint_t repl_start; // byte index in the replacement buffer
+  bint_t repl_len;
+};
+
+static int _cursor_replace_all(mark_t* from, mark_t* to, pcre* cre, pcre_extra* crex, char* replacement);
+
 // Clone cursor
-int cursor_clone(cursor_t* cursor, int use_srules, cursor_t** ret_clone) {
+int cursor_clone(cursor_t* cursor, cursor_t** ret_clone) {
   cursor_t* clone;
   bview_add_cursor(cursor->bview, cursor->mark->bline, cursor->mark->col, &clone);
 
   if (cursor->is_anchored) {
-    cursor_toggle_anchor(clone, use_srules);
+    cursor_toggle_anchor(clone);
     mark_join(clone->anchor, cursor->anchor);
   }
 
@@ -24,8 +37,8 @@ int cursor_destroy(cursor_t* cursor) {
 }
 
 // Select by mark
-int cursor_select_between(cursor_t* cursor, mark_t* a, mark_t* b, int use_srules) {
-  cursor_drop_anchor(cursor, use_srules);
+int cursor_select_between(cursor_t* cursor, mark_t* a, mark_t* b) {
+  cursor_drop_anchor(cursor);
 
   if (mark_is_lt(a, b)) {
     mark_join(cursor->mark, a);
@@ -39,28 +52,18 @@ int cursor_select_between(cursor_t* cursor, mark_t* a, mark_t* b, int use_srules
   return EON_OK;
 }
 
-// Toggle cursor anchor
-int cursor_toggle_anchor(cursor_t* cursor, int use_srules) {
+// Toggle cursor anchor. The selection is painted by bview at draw time.
+int cursor_toggle_anchor(cursor_t* cursor) {
   // TODO: check if this fixes the segfault when closing tabs
   if (cursor == NULL) return EON_OK;
 
   if (!cursor->is_anchored) {
     mark_clone(cursor->mark, &(cursor->anchor));
-
-    if (use_srules) {
-      cursor->sel_rule = srule_new_range(cursor->mark, cursor->anchor, 0, TB_REVERSE);
-      buffer_add_srule(cursor->bview->buffer, cursor->sel_rule, EON_MAX(cursor->mark->bline->line_index - 50, 0), 100);
-    }
-
     cursor->is_anchored = 1;
+    bview_add_anchored(cursor->bview, cursor);
 
   } else {
-    if (use_srules && cursor->sel_rule) {
-      buffer_remove_srule(cursor->bview->buffer, cursor->sel_rule, EON_MAX(cursor->mark->bline->line_index - 50, 0), 100);
-      srule_destroy(cursor->sel_rule);
-      cursor->sel_rule = NULL;
-    }
-
+    bview_remove_anchored(cursor->bview, cursor);
     mark_destroy(cursor->anchor);
     cursor->is_anchored = 0;
   }
@@ -69,17 +72,17 @@ int cursor_toggle_anchor(cursor_t* cursor, int use_srules) {
 }
 
 // Drop cursor anchor
-int cursor_drop_anchor(cursor_t* cursor, int use_srules) {
+int cursor_drop_anchor(cursor_t* cursor) {
   if (cursor->is_anchored) return EON_OK;
 
-  return cursor_toggle_anchor(cursor, use_srules);
+  return cursor_toggle_anchor(cursor);
 }
 
 // Lift cursor anchor
 int cursor_lift_anchor(cursor_t* cursor) {
   if (!cursor->is_anchored) return EON_OK;
 
-  return cursor_toggle_anchor(cursor, cursor->sel_rule ? 1 : 0);
+  return cursor_toggle_anchor(cursor);
 }
 
 // Get lo and hi marks in a is_anchored=1 cursor
@@ -119,11 +122,11 @@ int cursor_select_by(cursor_t* cursor, const char* strat) {
     return cursor_select_by_word_forward(cursor);
 
   } else if (strcmp(strat, "eol") == 0 && !mark_is_at_eol(cursor->mark)) {
-    cursor_toggle_anchor(cursor, 0);
+    cursor_toggle_anchor(cursor);
     mark_move_eol(cursor->anchor);
 
   } else if (strcmp(strat, "bol") == 0 && !mark_is_at_bol(cursor->mark)) {
-    cursor_toggle_anchor(cursor, 0);
+    cursor_toggle_anchor(cursor);
     mark_move_bol(cursor->anchor);
 
   } else if (strcmp(strat, "string") == 0) {
@@ -138,25 +141,26 @@ int cursor_select_by(cursor_t* cursor, const char* strat) {
 
 // Select by bracket
 int cursor_select_by_bracket(cursor_t* cursor) {
-  mark_t* orig;
-  mark_clone(cursor->mark, &orig);
+  mark_t orig;
+  bline_t* bline;
+  bint_t col;
+  orig = EON_TMARK(cursor->mark->bline, cursor->mark->col);
 
-  if (mark_move_bracket_top(cursor->mark, EON_BRACKET_PAIR_MAX_SEARCH) != MLBUF_OK) {
-    mark_destroy(orig);
+  if (bview_move_bracket_top(cursor->bview, cursor->mark) != EON_OK) {
     return EON_ERR;
   }
 
-  cursor_toggle_anchor(cursor, 0);
+  cursor_toggle_anchor(cursor);
 
-  if (mark_move_bracket_pair(cursor->anchor, EON_BRACKET_PAIR_MAX_SEARCH) != MLBUF_OK) {
-    cursor_toggle_anchor(cursor, 0);
-    mark_join(cursor->mark, orig);
-    mark_destroy(orig);
+  if (bview_find_bracket_pair(cursor->bview, cursor->anchor, &bline, &col) != EON_OK) {
+    cursor_toggle_anchor(cursor);
+    mark_move_to_w_bline(cursor->mark, orig.bline, orig.col);
     return EON_ERR;
   }
 
+  mark_move_to_w_bline(cursor->anchor, bline, col);
+
   mark_move_by(cursor->mark, 1);
-  mark_destroy(orig);
   return EON_OK;
 }
 
@@ -164,7 +168,7 @@ int cursor_select_by_bracket(cursor_t* cursor) {
 int cursor_select_by_word_back(cursor_t* cursor) {
   if (mark_is_at_word_bound(cursor->mark, -1)) return EON_ERR;
 
-  cursor_toggle_anchor(cursor, 0);
+  cursor_toggle_anchor(cursor);
   mark_move_prev_re(cursor->mark, EON_RE_WORD_BACK, sizeof(EON_RE_WORD_BACK) - 1);
   return EON_OK;
 }
@@ -173,24 +177,23 @@ int cursor_select_by_word_back(cursor_t* cursor) {
 int cursor_select_by_word_forward(cursor_t* cursor) {
   if (mark_is_at_word_bound(cursor->mark, 1)) return EON_ERR;
 
-  cursor_toggle_anchor(cursor, 0);
+  cursor_toggle_anchor(cursor);
   mark_move_next_re(cursor->mark, EON_RE_WORD_FORWARD, sizeof(EON_RE_WORD_FORWARD) - 1);
   return EON_OK;
 }
 
 // Select by string
 int cursor_select_by_string(cursor_t* cursor) {
-  mark_t* orig;
+  mark_t orig;
   uint32_t qchar;
   char* qre;
-  mark_clone(cursor->mark, &orig);
+  orig = EON_TMARK(cursor->mark->bline, cursor->mark->col);
 
   if (mark_move_prev_re(cursor->mark, "(?<!\\\\)[`'\"]", strlen("(?<!\\\\)[`'\"]")) != MLBUF_OK) {
-    mark_destroy(orig);
     return EON_ERR;
   }
 
-  cursor_toggle_anchor(cursor, 0);
+  cursor_toggle_anchor(cursor);
   mark_get_char_after(cursor->mark, &qchar);
   mark_move_by(cursor->mark, 1);
 
@@ -205,13 +208,11 @@ int cursor_select_by_string(cursor_t* cursor) {
   }
 
   if (mark_move_next_re(cursor->anchor, qre, strlen(qre)) != MLBUF_OK) {
-    cursor_toggle_anchor(cursor, 0);
-    mark_join(cursor->mark, orig);
-    mark_destroy(orig);
+    cursor_toggle_anchor(cursor);
+    mark_move_to_w_bline(cursor->mark, orig.bline, orig.col);
     return EON_ERR;
   }
 
-  mark_destroy(orig);
   return EON_OK;
 }
 
@@ -228,13 +229,13 @@ int cursor_select_by_word(cursor_t* cursor) {
     mark_move_prev_re(cursor->mark, EON_RE_WORD_BACK, sizeof(EON_RE_WORD_BACK) - 1);
   }
 
-  cursor_toggle_anchor(cursor, 0);
+  cursor_toggle_anchor(cursor);
   mark_move_next_re(cursor->mark, EON_RE_WORD_FORWARD, sizeof(EON_RE_WORD_FORWARD) - 1);
   return EON_OK;
 }
 
 // Cut or copy text
-int cursor_cut_copy(cursor_t* cursor, int is_cut, int use_srules, int append) {
+int cursor_cut_copy(cursor_t* cursor, int is_cut, int append) {
   char* cutbuf;
   bint_t cutbuf_len;
   bint_t cur_len;
@@ -245,8 +246,7 @@ int cursor_cut_copy(cursor_t* cursor, int is_cut, int use_srules, int append) {
   }
 
   if (!cursor->is_anchored) {
-    use_srules = 0;
-    cursor_toggle_anchor(cursor, use_srules);
+    cursor_toggle_anchor(cursor);
     mark_move_bol(cursor->mark);
     mark_move_eol(cursor->anchor);
     mark_move_by(cursor->anchor, 1);
@@ -281,7 +281,7 @@ int cursor_cut_copy(cursor_t* cursor, int is_cut, int use_srules, int append) {
     mark_delete_between_mark(cursor->mark, cursor->anchor);
   }
 
-  cursor_toggle_anchor(cursor, use_srules);
+  cursor_toggle_anchor(cursor);
   return EON_OK;
 }
 
@@ -318,6 +318,10 @@ int cursor_replace(cursor_t* cursor, int interactive, char* opt_regex, char* opt
   int pcre_ovector[30];
   str_t repl_backref = {0};
   int num_replacements;
+  pcre* cre;
+  pcre_extra* crex;
+  const char* error;
+  int erroffset;
 
   if (!interactive && (!opt_regex || !opt_replacement)) {
     return EON_ERR;
@@ -334,6 +338,8 @@ int cursor_replace(cursor_t* cursor, int interactive, char* opt_regex, char* opt
   anchored_before = 0;
   all = interactive ? 0 : 1;
   num_replacements = 0;
+  cre = NULL;
+  crex = NULL;
 
   mark_set_pcre_capture(&pcre_rc, pcre_ovector, 30);
 
@@ -374,6 +380,29 @@ int cursor_replace(cursor_t* cursor, int interactive, char* opt_regex, char* opt
     }
 
     while (1) {
+      // Replace the rest in one pass once all are confirmed
+      if (all) {
+        cre = pcre_compile(regex, PCRE_CASELESS, &error, &erroffset, NULL);
+        if (!cre) break;
+        crex = pcre_study(cre, 0, &error);
+
+        if (mark_is_lt(search_mark, lo_mark)) mark_join(search_mark, lo_mark);
+
+        // One edit, so it restyles once and undoes in one step
+        bview_begin_edit(cursor->bview);
+
+        if (!wrapped) {
+          num_replacements += _cursor_replace_all(search_mark, hi_mark, cre, crex, replacement);
+          num_replacements += _cursor_replace_all(lo_mark, orig_mark, cre, crex, replacement);
+        } else {
+          num_replacements += _cursor_replace_all(search_mark, orig_mark, cre, crex, replacement);
+        }
+
+        bview_end_edit(cursor->bview);
+
+        break;
+      }
+
       pcre_rc = 0;
 
       if (mark_find_next_re(search_mark, regex, strlen(regex), &bline, &col, &char_count) == MLBUF_OK
@@ -436,6 +465,8 @@ int cursor_replace(cursor_t* cursor, int interactive, char* opt_regex, char* opt
 
   mark_set_pcre_capture(NULL, NULL, 0);
 
+  if (crex) pcre_free_study(crex);
+  if (cre) pcre_free(cre);
   if (regex) free(regex);
   if (replacement) free(replacement);
   if (lo_mark) mark_destroy(lo_mark);
@@ -452,3 +483,96 @@ int cursor_replace(cursor_t* cursor, int interactive, char* opt_regex, char* opt
 
   return EON_OK;
 }
+
+// Replace every match of cre that starts between from and to. Each line is
+// rewritten once, from its first match to its last, going up from the last
+// line so the lines above are untouched when reached. Return number of
+// replacements.
+static int _cursor_replace_all(mark_t* from, mark_t* to, pcre* cre, pcre_extra* crex, char* replacement) {
+  bline_t* bline;
+  cursor_match_t* matches;
+  cursor_match_t* match;
+  bint_t matches_len;
+  bint_t matches_cap;
+  bint_t from_index;
+  bint_t to_index;
+  bint_t offset;
+  bint_t limit;
+  bint_t start_col;
+  bint_t end_col;
+  bint_t i;
+  bint_t j;
+  bint_t k;
+  str_t repls = {0};
+  str_t line = {0};
+  int ovector[30];
+  int rc;
+
+  if (!mark_is_lt(from, to)) return 0;
+
+  from_index = util_bline_col_to_index(from->bline, from->col);
+  to_index = util_bline_col_to_index(to->bline, to->col);
+
+  matches = NULL;
+  matches_len = 0;
+  matches_cap = 0;
+
+  // Find every match before replacing any, so none is matched against
+  // replaced text
+  for (bline = from->bline; bline; bline = bline->next) {
+    offset = bline == from->bline ? from_index : 0;
+    limit = bline == to->bline ? to_index : bline->data_len + 1;
+
+    while (offset <= bline->data_len) {
+      rc = pcre_exec(cre, crex, bline->data, bline->data_len, offset, 0, ovector, 30);
+      if (rc < 0 || ovector[0] >= limit) break;
+      if (rc == 0) rc = 10; // ovector full
+
+      if (matches_len >= matches_cap) {
+        matches_cap = matches_cap > 0 ? matches_cap * 2 : 64;
+        matches = realloc(matches, sizeof(cursor_match_t) * matches_cap);
+      }
+
+      match = &matches[matches_len++];
+      match->bline = bline;
+      match->start = ovector[0];
+      match->end = ovector[1];
+      match->repl_start = repls.len;
+      str_append_replace_with_backrefs(&repls, bline->data, replacement, rc, ovector, 30);
+      match->repl_len = repls.len - match->repl_start;
+
+      // Step past empty matches by a whole char
+      offset = ovector[1];
+
+      if (ovector[1] == ovector[0]) {
+        offset += 1;
+        while (offset < bline->data_len && (bline->data[offset] & 0xc0) == 0x80) offset++;
+      }
+    }
+
+    if (bline == to->bline) break;
+  }
+
+  // Matches j through i are on the same line; join their replacements with
+  // the text between them into one edit
+  for (i = matches_len - 1; i >= 0; i = j - 1) {
+    bline = matches[i].bline;
+    for (j = i; j > 0 && matches[j - 1].bline == bline; j--);
+
+    str_clear(&line);
+    for (k = j; k <= i; k++) {
+      if (k > j) str_append_len(&line, bline->data + matches[k - 1].end, matches[k].start - matches[k - 1].end);
+      str_append_len(&line, repls.data ? repls.data + matches[k].repl_start : "", matches[k].repl_len);
+    }
+
+    MLBUF_BLINE_ENSURE_CHARS(bline);
+    bline_index_to_col(bline, matches[j].start, &start_col);
+    bline_index_to_col(bline, matches[i].end, &end_col);
+    bline_replace(bline, start_col, end_col - start_col, line.data ? line.data : "", line.len);
+  }
+
+  if (matches) free(matches);
+  str_free(&repls);
+  str_free(&line);
+  return (int)matches_len;
+}
@@ -12,6 +12,8 @@
 int load_plugins(editor_t * editor);
 int unload_plugins(void);
 int trigger_plugin_event(char * event, cmd_context_t ctx);
+void flush_plugin_procs(void);
+void plugin_budget_suspend(int is_suspend);
 #endif
 
 static int _editor_set_macro_toggle_key(editor_t* editor, char* key);
@@ -96,6 +98,9 @@ int editor_init(editor_t* editor, int argc, char** argv) {
     editor->highlight_bracket_pairs = EON_DEFAULT_HILI_BRACKET_PAIRS;
     editor->read_rc_file = EON_DEFAULT_READ_RC_FILE;
     editor->soft_wrap = EON_DEFAULT_SOFT_WRAP;
+    editor->undo_max_bytes = EON_DEFAULT_UNDO_MAX_BYTES;
+    editor->undo_journal = EON_DEFAULT_UNDO_JOURNAL;
+    editor->swap = EON_DEFAULT_SWAP;
     editor->viewport_scope_x = -4;
     editor->viewport_scope_y = -1;
     editor->color_col = -1;
@@ -137,6 +142,9 @@ int editor_init(editor_t* editor, int argc, char** argv) {
     rv = _editor_init_from_args(editor, argc, argv);
     if (rv != EON_OK) break;
 
+    // Journals of files not edited in a long while hold old copies of them
+    if (editor->undo_journal) undo_journal_prune(editor);
+
     _editor_init_status(editor);
     _editor_init_bviews(editor, argc, argv);
     _editor_init_or_deinit_commands(editor, 0);
@@ -230,10 +238,20 @@ int editor_deinit(editor_t* editor) {
     free(editor->macro_record);
   }
 
+  if (editor->fsearch) fsearch_destroy(editor->fsearch);
+  browse_destroy_all(editor);
+  if (editor->ctags) ctags_destroy(editor->ctags);
+
   _editor_destroy_syntax_map(editor->syntax_map);
   if (editor->kmap_init_name) free(editor->kmap_init_name);
   if (editor->insertbuf) free(editor->insertbuf);
+  while (editor->async_timers) {
+    async_timer_destroy(editor->async_timers);
+  }
+
   if (editor->ttyfd) close(editor->ttyfd);
+  if (editor->epfd) close(editor->epfd);
+  if (editor->timerfd) close(editor->timerfd);
   if (editor->startup_macro_name) free(editor->startup_macro_name);
 
   return EON_OK;
@@ -280,6 +298,7 @@ int editor_prompt(editor_t* editor, char* prompt, editor_prompt_params_t* params
   editor_set_prompt_str(editor, prompt);
 
   if (params && params->prompt_cb) bview_add_listener(editor->prompt, params->prompt_cb, params->prompt_cb_udata);
+  if (params && params->menu_callback) editor->prompt->menu_callback = params->menu_callback;
   bview_push_kmap(editor->prompt, params && params->kmap ? params->kmap : editor->kmap_prompt_input);
 
   // Insert data if present
@@ -288,8 +307,15 @@ int editor_prompt(editor_t* editor, char* prompt, editor_prompt_params_t* params
     mark_move_eol(editor->prompt->active_cursor->mark);
   }
 
-  // Loop inside prompt
+  // Loop inside prompt. A plugin waiting on it is not charged for the
+  // editor work done meanwhile.
+#ifdef WITH_PLUGINS
+  plugin_budget_suspend(1);
+#endif
   _editor_loop(editor, &loop_ctx);
+#ifdef WITH_PLUGINS
+  plugin_budget_suspend(0);
+#endif
 
   // Set answer
   if (optret_answer) {
@@ -833,6 +859,8 @@ static int _editor_menu_submit(cmd_context_t* ctx) {
 // Invoked when user hits C-c in a menu
 static int _editor_menu_cancel(cmd_context_t* ctx) {
   if (ctx->bview->async_proc) async_proc_destroy(ctx->bview->async_proc, 1);
+  if (ctx->bview->grep) grep_stop(ctx->bview->grep);
+  bview_flush_output(ctx->bview);
   // if (ctx->bview->menu_callback) return ctx->bview->menu_callback(ctx, NULL);
 
   return EON_OK;
@@ -887,8 +915,8 @@ static int _editor_prompt_menu_page_down(cmd_context_t* ctx) {
 
 // Invoked when user hits down in a prompt_isearch
 static int _editor_prompt_isearch_next(cmd_context_t* ctx) {
-  if (ctx->editor->active_edit->isearch_rule) {
-    mark_move_next_cre_nudge(ctx->editor->active_edit->active_cursor->mark, ctx->editor->active_edit->isearch_rule->cre);
+  if (ctx->editor->active_edit->isearch_cre) {
+    bview_move_next_isearch(ctx->editor->active_edit, ctx->editor->active_edit->active_cursor->mark, 1);
     bview_center_viewport_y(ctx->editor->active_edit);
   }
 
@@ -897,8 +925,8 @@ static int _editor_prompt_isearch_next(cmd_context_t* ctx) {
 
 // Invoked when user hits up in a prompt_isearch
 static int _editor_prompt_isearch_prev(cmd_context_t* ctx) {
-  if (ctx->editor->active_edit->isearch_rule) {
-    mark_move_prev_cre(ctx->editor->active_edit->active_cursor->mark, ctx->editor->active_edit->isearch_rule->cre);
+  if (ctx->editor->active_edit->isearch_cre) {
+    mark_move_prev_cre(ctx->editor->active_edit->active_cursor->mark, ctx->editor->active_edit->isearch_cre);
     bview_center_viewport_y(ctx->editor->active_edit);
   }
 
@@ -929,20 +957,18 @@ static int _editor_prompt_toggle_replace(cmd_context_t* ctx) {
 static int _editor_prompt_isearch_drop_cursors(cmd_context_t* ctx) {
   bview_t* bview;
   mark_t* mark;
-  pcre* cre;
   cursor_t* orig_cursor;
   cursor_t* last_cursor;
   bview = ctx->editor->active_edit;
 
-  if (!bview->isearch_rule) return EON_OK;
+  if (!bview->isearch_cre) return EON_OK;
 
   orig_cursor = bview->active_cursor;
   mark = bview->active_cursor->mark;
-  cre = bview->isearch_rule->cre;
   mark_move_beginning(mark);
   last_cursor = NULL;
 
-  while (mark_move_next_cre_nudge(mark, cre) == MLBUF_OK) {
+  while (bview_move_next_isearch(bview, mark, 1) == EON_OK) {
     if (mark->col == 0 && mark->bline->line_index == 0) {
       break; // otherwise hell breaks loose. FIXME: we should skip to the next one.
     }
@@ -982,13 +1008,18 @@ static void _editor_loop(editor_t* editor, loop_context_t* loop_ctx) {
     editor->loop_ctx = loop_ctx;
 
     // Display editor
-    if (!editor->is_display_disabled) {
+    // Skip it if the last pass only queued output for a later batch
+    if (!editor->is_display_disabled && !editor->is_display_deferred) {
       editor_display(editor);
     }
+    editor->is_display_deferred = 0;
 
     // Check for async io
     // async_proc_drain_all will bail and return 0 if there's any tty data
-    if (editor->async_procs && async_proc_drain_all(editor->async_procs, &editor->ttyfd)) {
+    if ((editor->async_procs || editor->async_timers) && async_proc_drain_all(editor)) {
+#ifdef WITH_PLUGINS
+      flush_plugin_procs();
+#endif
       continue;
     }
 
@@ -1670,6 +1701,7 @@ static void _editor_graceful_exit(int signum) {
   if (tb_width() >= 0) tb_shutdown();
 
   CDL_FOREACH2(_editor.all_bviews, bview, all_next) {
+    if (bview->swap) swap_keep(bview->swap);
     if (bview->buffer->is_unsaved) {
       snprintf((char*)&path, 64, ".eon.bak.%d.%d", getpid(), bview_num);
       buffer_save_as(bview->buffer, path, NULL);
@@ -1742,6 +1774,8 @@ static void _editor_register_cmds(editor_t* editor) {
   _editor_register_cmd_fn(editor, "cmd_save_as", cmd_save_as);
   _editor_register_cmd_fn(editor, "cmd_search", cmd_search);
   _editor_register_cmd_fn(editor, "cmd_search_next", cmd_search_next);
+  _editor_register_cmd_fn(editor, "cmd_search_nth", cmd_search_nth);
+  _editor_register_cmd_fn(editor, "cmd_search_prev", cmd_search_prev);
   _editor_register_cmd_fn(editor, "cmd_set_opt", cmd_set_opt);
   _editor_register_cmd_fn(editor, "cmd_shell", cmd_shell);
   _editor_register_cmd_fn(editor, "cmd_show_help", cmd_show_help);
@@ -1765,6 +1799,10 @@ static void _editor_register_cmds(editor_t* editor) {
   _editor_register_cmd_fn(editor, "cmd_new_cursor_down", cmd_new_cursor_down);
   _editor_register_cmd_fn(editor, "cmd_uncut", cmd_uncut);
   _editor_register_cmd_fn(editor, "cmd_undo", cmd_undo);
+  _editor_register_cmd_fn(editor, "cmd_undo_earlier", cmd_undo_earlier);
+  _editor_register_cmd_fn(editor, "cmd_undo_info", cmd_undo_info);
+  _editor_register_cmd_fn(editor, "cmd_undo_later", cmd_undo_later);
+  _editor_register_cmd_fn(editor, "cmd_undo_time", cmd_undo_time);
   _editor_register_cmd_fn(editor, "cmd_viewport_top", cmd_viewport_top);
   _editor_register_cmd_fn(editor, "cmd_viewport_mid", cmd_viewport_mid);
   _editor_register_cmd_fn(editor, "cmd_viewport_bot", cmd_viewport_bot);
@@ -1834,6 +1872,9 @@ static void _editor_init_kmaps(editor_t* editor) {
     EON_KBINDING_DEF("cmd_search", "C-w"),
     EON_KBINDING_DEF("cmd_search_next", "C-g"),
     EON_KBINDING_DEF("cmd_search_next", "F3"),
+    EON_KBINDING_DEF("cmd_search_prev", "MS-g"),
+    EON_KBINDING_DEF("cmd_search_prev", "S-F3"),
+    EON_KBINDING_DEF("cmd_search_nth", "M-x n"),
     EON_KBINDING_DEF("cmd_find_word", "C-v"),
     EON_KBINDING_DEF("cmd_isearch", "C-f"),
     EON_KBINDING_DEF("cmd_replace", "C-r"),
@@ -1917,6 +1958,10 @@ static void _editor_init_kmaps(editor_t* editor) {
     EON_KBINDING_DEF("cmd_undo", "C-z"),
     EON_KBINDING_DEF("cmd_redo", "C-y"),
     EON_KBINDING_DEF("cmd_redo", "CS-z"),
+    EON_KBINDING_DEF("cmd_undo_info", "M-u"),
+    EON_KBINDING_DEF("cmd_undo_earlier", "M-z"),
+    EON_KBINDING_DEF("cmd_undo_later", "M-y"),
+    EON_KBINDING_DEF("cmd_undo_time", "M-t"),
     EON_KBINDING_DEF("cmd_save", "C-s"),
     // EON_KBINDING_DEF("cmd_save_as", "M-s"),
     EON_KBINDING_DEF("cmd_save_as", "C-o"),
@@ -1925,6 +1970,7 @@ static void _editor_init_kmaps(editor_t* editor) {
     EON_KBINDING_DEF_EX("cmd_set_opt", "M-o t", "tab_width"),
     EON_KBINDING_DEF_EX("cmd_set_opt", "M-o s", "syntax"),
     EON_KBINDING_DEF_EX("cmd_set_opt", "M-o w", "soft_wrap"),
+    EON_KBINDING_DEF_EX("cmd_set_opt", "M-o u", "undo_max_kb"),
     EON_KBINDING_DEF("cmd_open_new", "C-n"),
     // EON_KBINDING_DEF("cmd_open_file", "C-o"),
     EON_KBINDING_DEF("cmd_open_replace_new", "C-q n"),
@@ -2017,6 +2063,20 @@ static void _editor_init_kmaps(editor_t* editor) {
     EON_KBINDING_DEF(NULL, NULL)
   });
 
+  // fuzzy file search keymap. typing refines the results, up/down select one.
+  _editor_init_kmap(editor, &editor->kmap_prompt_fsearch, "eon_prompt_fsearch", NULL, 1, (kbinding_def_t[]) {
+    EON_KBINDING_DEF("_editor_prompt_input_submit", "enter"),
+    EON_KBINDING_DEF("_editor_prompt_menu_up", "up"),
+    EON_KBINDING_DEF("_editor_prompt_menu_down", "down"),
+    EON_KBINDING_DEF("_editor_prompt_menu_page_up", "page-up"),
+    EON_KBINDING_DEF("_editor_prompt_menu_page_down", "page-down"),
+    EON_KBINDING_DEF("_editor_prompt_cancel", "escape"),
+    EON_KBINDING_DEF("_editor_prompt_cancel", "C-c"),
+    EON_KBINDING_DEF("_editor_prompt_cancel", "C-x"),
+    EON_KBINDING_DEF("_editor_prompt_cancel", "M-c"),
+    EON_KBINDING_DEF(NULL, NULL)
+  });
+
   // incremental search keymap. allows jumping to prev/next result, dropping cursors on them, etc
   _editor_init_kmap(editor, &editor->kmap_prompt_isearch, "eon_prompt_isearch", NULL, 1, (kbinding_def_t[]) {
     EON_KBINDING_DEF("_editor_prompt_toggle_replace", "C-f"),
@@ -2489,7 +2549,7 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv) {
   cur_syntax = NULL;
   optind = 0;
 
-  while (rv == EON_OK && (c = getopt(argc, argv, "ha:b:c:gn:H:i:K:k:l:M:m:Nn:p:S:s:t:vw:y:z:")) != -1) {
+  while (rv == EON_OK && (c = getopt(argc, argv, "ha:b:c:gn:H:i:j:K:k:l:M:m:Nn:p:r:S:s:t:u:vw:y:z:")) != -1) {
     switch (c) {
     case 'h':
       printf("eon version %s\n\n", EON_VERSION);
@@ -2501,6 +2561,7 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv) {
       printf("    -g           Disable mouse\n");
       printf("    -H <1|0>     Enable/disable headless mode (default: 1 if no tty, else 0)\n");
       printf("    -i <1|0>     Enable/disable smart_indent (default: %d)\n", EON_DEFAULT_SMART_INDENT);
+      printf("    -j <1|0>     Enable/disable undo history kept across sessions (default: %d)\n", EON_DEFAULT_UNDO_JOURNAL);
       printf("    -K <kdef>    Set current kmap definition (use with -k)\n");
       printf("    -k <kbind>   Add key binding to current kmap definition (use with -K)\n");
       printf("    -l <ltype>   Set linenum type (default: 0)\n");
@@ -2509,9 +2570,11 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv) {
       printf("    -N           Skip reading of rc file\n");
       printf("    -n <kmap>    Set init kmap (default: eon_normal)\n");
       printf("    -p <macro>   Set startup macro\n");
+      printf("    -r <1|0>     Enable/disable crash recovery of unsaved changes (default: %d)\n", EON_DEFAULT_SWAP);
       printf("    -S <syndef>  Set current syntax definition (use with -s)\n");
       printf("    -s <synrule> Add syntax rule to current syntax definition (use with -S)\n");
       printf("    -t <size>    Set tab size (default: %d)\n", EON_DEFAULT_TAB_WIDTH);
+      printf("    -u <kbytes>  Set undo history size per buffer, 0 for no limit (default: %d)\n", EON_DEFAULT_UNDO_MAX_BYTES / 1024);
       printf("    -v           Print version and exit\n");
       printf("    -w <1|0>     Enable/disable soft word wrap (default: %d)\n", EON_DEFAULT_SOFT_WRAP);
       printf("    -y <syntax>  Set override syntax for files opened at start up\n");
@@ -2555,6 +2618,10 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv) {
       editor->smart_indent = atoi(optarg) ? 1 : 0;
       break;
 
+    case 'j':
+      editor->undo_journal = atoi(optarg) ? 1 : 0;
+      break;
+
     case 'K':
       if (_editor_init_kmap_by_str(editor, &cur_kmap, optarg) != EON_OK) {
         EON_LOG_ERR("Could not init kmap by str: %s\n", optarg);
@@ -2604,6 +2671,10 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv) {
       editor->startup_macro_name = strdup(optarg);
       break;
 
+    case 'r':
+      editor->swap = atoi(optarg) ? 1 : 0;
+      break;
+
     case 'S':
       if (_editor_init_syntax_by_str(editor, &cur_syntax, optarg) != EON_OK) {
         EON_LOG_ERR("Could not init syntax by str: %s\n", optarg);
@@ -2624,6 +2695,10 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv) {
       editor->tab_width = atoi(optarg);
       break;
 
+    case 'u':
+      editor->undo_max_bytes = (bint_t)EON_MAX(atoi(optarg), 0) * 1024;
+      break;
+
     case 'v':
       printf("eon version %s\n", EON_VERSION);
       rv = EON_ERR;
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <limits.h>
+#include <time.h>
 #include "termbox.h"
 #include "uthash.h"
 #include "mlbuf.h"
@@ -12,6 +13,9 @@ typedef struct bview_s bview_t; // A view of a buffer
 typedef struct bview_rect_s bview_rect_t; // A rectangle in bview with a default styling
 typedef struct bview_listener_s bview_listener_t; // A listener to buffer events in a bview
 typedef void (*bview_listener_cb_t)(bview_t* bview, baction_t* action, void* udata); // A bview_listener_t callback
+typedef struct bview_undo_group_s bview_undo_group_t; // A run of buffer actions undone and redone together
+typedef struct bview_shared_s bview_shared_t; // State of a buffer shared by every bview on it
+typedef struct bview_sel_s bview_sel_t; // A selection visible in a bview, painted over buffer styles
 typedef struct cursor_s cursor_t; // A cursor (insertion mark + selection bound mark) in a buffer
 typedef struct loop_context_s loop_context_t; // Context for a single _editor_loop
 typedef struct cmd_s cmd_t; // A command definition
@@ -27,6 +31,24 @@ typedef struct syntax_node_s syntax_node_t; // A node in a linked list of syntax
 typedef struct srule_def_s srule_def_t; // A definition of a syntax
 typedef struct async_proc_s async_proc_t; // An asynchronous process
 typedef void (*async_proc_cb_t)(async_proc_t* self, char* buf, size_t buf_len); // An async_proc_t callback
+typedef struct async_timer_s async_timer_t; // A one-shot timer run by the event loop
+typedef void (*async_timer_cb_t)(async_timer_t* self, void* udata); // An async_timer_t callback
+typedef struct grep_s grep_t; // A native multi-threaded project search
+typedef struct grep_result_s grep_result_t; // A single match found by a grep_t
+typedef struct dir_entry_s dir_entry_t; // An entry read by util_read_dir
+typedef struct fsearch_s fsearch_t; // A fuzzy-searchable index of project files
+typedef struct ctags_s ctags_t; // A mapped tags file
+typedef struct ctags_match_s ctags_match_t; // A tag found by ctags_find
+typedef struct search_index_s search_index_t; // Positions of every match of a search in a buffer
+typedef struct bracket_index_s bracket_index_t; // Bracket depth of every line in a buffer
+typedef struct undo_tree_s undo_tree_t; // Every state of a buffer's undo history, branches included
+typedef struct undo_node_s undo_node_t; // A record in an undo_tree_t
+typedef struct undo_snapshot_s undo_snapshot_t; // Buffer contents at an undo checkpoint, whole or as a diff
+typedef struct undo_op_s undo_op_t; // A copy of a buffer action
+typedef struct undo_rec_s undo_rec_t; // An undo record read from an undo_journal_t
+typedef struct undo_journal_s undo_journal_t; // The undo history of a file, kept on disk across sessions
+typedef struct swap_s swap_t; // Unsaved edits to a buffer, kept on disk to recover from a crash
+typedef struct browse_dir_s browse_dir_t; // A cached, sorted listing of a directory
 typedef struct editor_prompt_params_s editor_prompt_params_t; // Extra params for editor_prompt
 typedef struct tb_event tb_event_t; // A termbox event
 typedef struct prompt_history_s prompt_history_t; // A map of prompt histories keyed by prompt_str
@@ -68,6 +90,7 @@ struct editor_s {
     bview_rect_t rect_prompt;
     syntax_t* syntax_map;
     int is_display_disabled;
+    int is_display_deferred;
     kmacro_t* macro_map;
     kinput_t macro_toggle_key;
     kmacro_t* macro_record;
@@ -83,14 +106,22 @@ struct editor_s {
     kmap_t* kmap_prompt_yna;
     kmap_t* kmap_prompt_ok;
     kmap_t* kmap_prompt_isearch;
+    kmap_t* kmap_prompt_fsearch;
     kmap_t* kmap_prompt_menu;
     kmap_t* kmap_menu;
     prompt_history_t* prompt_history;
     char* kmap_init_name;
     kmap_t* kmap_init;
     async_proc_t* async_procs;
+    async_timer_t* async_timers;
+    fsearch_t* fsearch;
+    browse_dir_t* browse_dirs;
+    async_proc_t* browse_aproc; // inotify events for browse_dirs
+    ctags_t* ctags;
     FILE* tty;
     int ttyfd;
+    int epfd;
+    int timerfd;
     char* syntax_override;
     int linenum_type;
     int tab_width;
@@ -101,6 +132,9 @@ struct editor_s {
     int highlight_bracket_pairs;
     int color_col;
     int soft_wrap;
+    bint_t undo_max_bytes; // undo history kept per buffer, 0 for no limit
+    int undo_journal; // keep undo history on disk across sessions
+    int swap; // keep unsaved edits on disk to recover from a crash
     int viewport_scope_x; // TODO cli option
     int viewport_scope_y; // TODO cli option
     int headless_mode;
@@ -179,18 +213,58 @@ struct bview_s {
     bint_t startup_linenum;
     kmap_node_t* kmap_stack;
     kmap_node_t* kmap_tail;
-    cursor_t* cursors;
+    cursor_t** cursors; // sorted by position, see bview_sort_cursors
+    int cursors_len;
+    int cursors_cap;
+    int num_asleep_cursors;
+    cursor_t** anchored; // anchored cursors by lo position, see _bview_sort_anchored
+    bint_t* anchored_reach; // last line reached by the selections up to each
+    int anchored_len;
+    int anchored_cap;
     cursor_t* active_cursor;
     char* last_search;
-    srule_t* isearch_rule;
+    pcre* isearch_cre; // highlighted over visible rows while isearching
+    pcre_extra* isearch_cre_extra;
+    char* isearch_literal; // set if the pattern has no metachars
+    bint_t isearch_literal_len;
+    int isearch_is_caseless;
+    bint_t isearch_count; // matches counted so far
+    mark_t* isearch_count_mark; // next line to count, NULL when done
+    async_timer_t* isearch_timer;
     int tab_width;
     int tab_to_space;
     syntax_t* syntax;
     async_proc_t* async_proc;
+    grep_t* grep;
+    str_t pending_output;
+    mark_t* output_mark;
+    async_timer_t* output_timer;
+    char* browse_path; // dir listed in a browse menu
+    char* ctag_name; // tag listed in a ctag menu
     cb_func_t menu_callback;
     int is_menu;
     char init_cwd[PATH_MAX + 1];
     bview_listener_t* listeners;
+    int edit_depth; // nesting of bview_begin_edit
+    bint_t edit_start_line; // lines touched by the current edit
+    bint_t edit_end_line;
+    baction_t* edit_first_action;
+    baction_t* edit_last_action;
+    int edit_num_actions;
+    int edit_is_typing; // join the edit to the typing run before it
+    baction_t* undo_join_action; // newest action of this bview's last edit, see _bview_join_undo_record
+    bint_t undo_join_line; // where the first action of that edit ended
+    bint_t undo_join_col;
+    int is_in_undo;
+    bint_t undo_bytes; // memory held by the buffer's undo history
+    bint_t undo_num_actions;
+    baction_t* undo_counted_action; // newest action in undo_bytes
+    undo_tree_t* undo_tree; // shared with bviews on the same buffer
+    swap_t* swap; // shared with bviews on the same buffer
+    bview_shared_t* shared; // shared with bviews on the same buffer
+    bview_sel_t* sels; // selections on visible rows by lo position, see _bview_collect_sels
+    int sels_len;
+    int sels_cap;
     bview_t* top_next;
     bview_t* top_prev;
     bview_t* all_next;
@@ -205,6 +279,36 @@ struct bview_listener_s {
     bview_listener_t* prev;
 };
 
+// bview_undo_group_t
+struct bview_undo_group_s {
+    baction_t* first;
+    baction_t* last;
+    int num_actions;
+    int is_undone;
+};
+
+// bview_shared_t
+struct bview_shared_s {
+    editor_t* editor;
+    buffer_t* buffer;
+    bint_t version; // bumped on every buffer action
+    search_index_t* search_index; // matches of the last search, see cmd_search_next
+    bracket_index_t* bracket_index; // see bview_find_bracket_pair
+    bview_undo_group_t* undo_groups; // oldest first
+    int undo_groups_len;
+    int undo_groups_cap;
+    int ref_count;
+};
+
+// bview_sel_t
+struct bview_sel_s {
+    bint_t lo_line;
+    bint_t lo_col;
+    bint_t hi_line;
+    bint_t hi_col; // exclusive
+    bint_t reach_line; // last line reached by this or an earlier sel
+};
+
 // cursor_t
 struct cursor_s {
     bview_t* bview;
@@ -212,10 +316,7 @@ struct cursor_s {
     mark_t* anchor;
     int is_anchored;
     int is_asleep;
-    srule_t* sel_rule;
     char* cut_buffer;
-    cursor_t* next;
-    cursor_t* prev;
 };
 
 // kmacro_t
@@ -336,11 +437,62 @@ struct async_proc_s {
     int wfd;
     int is_done;
     int is_solo;
+    int is_readable;
     async_proc_cb_t callback;
+    async_proc_cb_t destroy_callback; // if set, called with no data when destroyed while owned
     async_proc_t* next;
     async_proc_t* prev;
 };
 
+// grep_result_t
+struct grep_result_s {
+    char* path;
+    bint_t line; // 1-based
+    bint_t col; // 0-based, in chars
+    char* text;
+    size_t text_len;
+    grep_result_t* next;
+};
+
+// ctags_match_t
+struct ctags_match_s {
+    char* file;
+    char* address; // line number or ex search pattern
+};
+
+// undo_op_t
+struct undo_op_s {
+    int type; // MLBUF_BACTION_TYPE_*
+    bint_t line_index;
+    bint_t col;
+    bint_t num_chars;
+    char* data;
+    bint_t data_len;
+};
+
+// undo_rec_t
+struct undo_rec_s {
+    time_t time;
+    undo_op_t* ops;
+    int num_ops;
+};
+
+// dir_entry_t
+struct dir_entry_s {
+    char* name;
+    unsigned char type; // DT_* from dirent.h
+};
+
+// async_timer_t
+struct async_timer_s {
+    editor_t* editor;
+    struct timespec when;
+    async_timer_cb_t callback;
+    void* udata;
+    async_timer_t* next;
+    async_timer_t* prev;
+};
+
 // editor_prompt_params_t
 struct editor_prompt_params_s {
     char* data;
@@ -348,6 +500,7 @@ struct editor_prompt_params_s {
     kmap_t* kmap;
     bview_listener_cb_t prompt_cb;
     void* prompt_cb_udata;
+    cb_func_t menu_callback;
 };
 
 // prompt_history_t
@@ -385,9 +538,22 @@ int editor_add_binding_to_keymap(editor_t* editor, kmap_t* kmap, kbinding_def_t*
 // bview functions
 bview_t* bview_get_split_root(bview_t* self);
 bview_t* bview_new(editor_t* editor, char* opt_path, int opt_path_len, buffer_t* opt_buffer);
+int bview_add_anchored(bview_t* self, cursor_t* cursor);
 int bview_add_cursor_asleep(bview_t* self, bline_t* bline, bint_t col, cursor_t** optret_cursor);
 int bview_add_cursor(bview_t* self, bline_t* bline, bint_t col, cursor_t** optret_cursor);
 int bview_add_listener(bview_t* self, bview_listener_cb_t callback, void* udata);
+int bview_begin_edit(bview_t* self);
+int bview_end_edit(bview_t* self);
+int bview_undo(bview_t* self);
+int bview_redo(bview_t* self);
+int bview_get_undo_usage(bview_t* self, bint_t* ret_bytes, bint_t* ret_num_records);
+int bview_undo_step(bview_t* self, int num_steps);
+int bview_undo_to_time(bview_t* self, time_t when);
+int bview_get_undo_state(bview_t* self, bint_t* ret_index, bint_t* ret_count, time_t* ret_time);
+int bview_add_undo_group(bview_t* self, baction_t* first, baction_t* last, int num_actions);
+int bview_forget_undo(bview_t* self, baction_t* stop);
+int bview_save_undo(bview_t* self);
+int bview_save_swap(bview_t* self);
 int bview_set_line_bg(bview_t* self, bint_t line_index, int color);
 int bview_move_to_line(bview_t* self, bint_t number);
 int bview_scroll_viewport(bview_t* self, int offset);
@@ -396,15 +562,24 @@ int bview_destroy(bview_t* self);
 int bview_destroy_listener(bview_t* self, bview_listener_t* listener);
 int bview_draw(bview_t* self);
 int bview_draw_cursor(bview_t* self, int set_real_cursor);
+int bview_flush_output(bview_t* self);
+int bview_set_isearch(bview_t* self, char* opt_regex, bint_t regex_len);
+int bview_find_isearch(bview_t* self, bline_t* bline, bint_t from, bint_t* ret_start, bint_t* ret_end);
+int bview_move_next_isearch(bview_t* self, mark_t* mark, int nudge);
+int bview_find_bracket_pair(bview_t* self, mark_t* mark, bline_t** ret_bline, bint_t* ret_col);
+int bview_move_bracket_top(bview_t* self, mark_t* mark);
 int bview_get_active_cursor_count(bview_t* self);
 int bview_get_screen_coords(bview_t* self, mark_t* mark, int* ret_x, int* ret_y, struct tb_cell** optret_cell);
 int bview_max_viewport_y(bview_t* self);
 int bview_open(bview_t* self, char* path, int path_len);
 int bview_pop_kmap(bview_t* bview, kmap_t** optret_kmap);
 int bview_push_kmap(bview_t* bview, kmap_t* kmap);
+int bview_queue_output(bview_t* self, char* data, size_t data_len);
 int bview_rectify_viewport(bview_t* self);
+int bview_remove_anchored(bview_t* self, cursor_t* cursor);
 int bview_remove_cursor(bview_t* self, cursor_t* cursor);
 int bview_remove_cursors_except(bview_t* self, cursor_t* one);
+int bview_sort_cursors(bview_t* self);
 int bview_resize(bview_t* self, int x, int y, int w, int h);
 int bview_set_syntax(bview_t* self, char* opt_syntax);
 int bview_split(bview_t* self, int is_vertical, float factor, bview_t** optret_bview);
@@ -413,21 +588,21 @@ int bview_wake_sleeping_cursors(bview_t* self);
 int bview_zero_viewport_y(bview_t* self);
 
 // cursor functions
-int cursor_clone(cursor_t* cursor, int use_srules, cursor_t** ret_clone);
-int cursor_cut_copy(cursor_t* cursor, int is_cut, int use_srules, int append);
+int cursor_clone(cursor_t* cursor, cursor_t** ret_clone);
+int cursor_cut_copy(cursor_t* cursor, int is_cut, int append);
 int cursor_destroy(cursor_t* cursor);
-int cursor_drop_anchor(cursor_t* cursor, int use_srules);
+int cursor_drop_anchor(cursor_t* cursor);
 int cursor_get_lo_hi(cursor_t* cursor, mark_t** ret_lo, mark_t** ret_hi);
 int cursor_lift_anchor(cursor_t* cursor);
 int cursor_replace(cursor_t* cursor, int interactive, char* opt_regex, char* opt_replacement);
-int cursor_select_between(cursor_t* cursor, mark_t* a, mark_t* b, int use_srules);
+int cursor_select_between(cursor_t* cursor, mark_t* a, mark_t* b);
 int cursor_select_by(cursor_t* cursor, const char* strat);
 int cursor_select_by_bracket(cursor_t* cursor);
 int cursor_select_by_string(cursor_t* cursor);
 int cursor_select_by_word_back(cursor_t* cursor);
 int cursor_select_by_word(cursor_t* cursor);
 int cursor_select_by_word_forward(cursor_t* cursor);
-int cursor_toggle_anchor(cursor_t* cursor, int use_srules);
+int cursor_toggle_anchor(cursor_t* cursor);
 int cursor_uncut(cursor_t* cursor);
 
 // cmd functions
@@ -497,6 +672,8 @@ int cmd_save_as(cmd_context_t* ctx);
 int cmd_save(cmd_context_t* ctx);
 int cmd_search(cmd_context_t* ctx);
 int cmd_search_next(cmd_context_t* ctx);
+int cmd_search_nth(cmd_context_t* ctx);
+int cmd_search_prev(cmd_context_t* ctx);
 int cmd_select_beginning(cmd_context_t* ctx);
 int cmd_select_end(cmd_context_t* ctx);
 int cmd_select_bol(cmd_context_t* ctx);
@@ -520,6 +697,10 @@ int cmd_toggle_anchor(cmd_context_t* ctx);
 int cmd_toggle_mouse_mode(cmd_context_t* ctx);
 int cmd_uncut(cmd_context_t* ctx);
 int cmd_undo(cmd_context_t* ctx);
+int cmd_undo_info(cmd_context_t* ctx);
+int cmd_undo_earlier(cmd_context_t* ctx);
+int cmd_undo_later(cmd_context_t* ctx);
+int cmd_undo_time(cmd_context_t* ctx);
 int cmd_viewport_bot(cmd_context_t* ctx);
 int cmd_viewport_mid(cmd_context_t* ctx);
 int cmd_viewport_top(cmd_context_t* ctx);
@@ -527,9 +708,101 @@ int cmd_wake_sleeping_cursors(cmd_context_t* ctx);
 
 // async functions
 async_proc_t* async_proc_new(editor_t* editor, void* owner, async_proc_t** owner_aproc, char* shell_cmd, int rw, async_proc_cb_t callback);
+async_proc_t* async_proc_new_fd(editor_t* editor, void* owner, async_proc_t** owner_aproc, int rfd, async_proc_cb_t callback);
 int async_proc_set_owner(async_proc_t* aproc, void* owner, async_proc_t** owner_aproc);
 int async_proc_destroy(async_proc_t* aproc, int preempt);
-int async_proc_drain_all(async_proc_t* aprocs, int* ttyfd);
+int async_proc_drain_all(editor_t* editor);
+async_timer_t* async_timer_new(editor_t* editor, long delay_ms, async_timer_cb_t callback, void* udata);
+int async_timer_destroy(async_timer_t* timer);
+
+// grep functions
+int grep_new(editor_t* editor, char* opt_pattern, char* path, void* owner, async_proc_t** owner_aproc, async_proc_cb_t callback, grep_t** ret_grep);
+bint_t grep_take_results(grep_t* grep);
+grep_result_t* grep_get_result(grep_t* grep, bint_t index);
+bint_t grep_get_result_count(grep_t* grep);
+int grep_stop(grep_t* grep);
+int grep_destroy(grep_t* grep);
+
+// search functions
+int search_get_literal(char* regex, bint_t regex_len, char** ret_literal, bint_t* ret_literal_len, int* ret_is_caseless);
+char* search_memmem(char* hay, bint_t hay_len, char* needle, bint_t needle_len, int is_caseless);
+int search_find_next_literal(mark_t* mark, char* literal, bint_t literal_len, int is_caseless, int nudge, bline_t** ret_bline, bint_t* ret_col, bint_t* ret_num_chars);
+int search_find_next(mark_t* mark, char* regex, bint_t regex_len, int nudge, bline_t** ret_bline, bint_t* ret_col, bint_t* ret_num_chars);
+int search_move_next(mark_t* mark, char* regex, bint_t regex_len, int nudge);
+int search_find_prev(mark_t* mark, char* regex, bint_t regex_len, bline_t** ret_bline, bint_t* ret_col, bint_t* ret_num_chars);
+int search_move_prev(mark_t* mark, char* regex, bint_t regex_len);
+int search_move_next_word(mark_t* mark, char* word, bint_t word_len);
+int search_index_new(bview_shared_t* shared, char* regex, bint_t regex_len, search_index_t** ret_index);
+int search_index_is_for(search_index_t* index, char* regex, bint_t regex_len);
+int search_index_update(search_index_t* index, baction_t* action);
+int search_index_is_complete(search_index_t* index);
+int search_index_complete(search_index_t* index);
+bint_t search_index_get_count(search_index_t* index);
+int search_index_find_at(search_index_t* index, mark_t* mark, bint_t* ret_nth);
+int search_index_find_next(search_index_t* index, mark_t* mark, bint_t* ret_nth);
+int search_index_find_prev(search_index_t* index, mark_t* mark, bint_t* ret_nth);
+int search_index_move_to(search_index_t* index, mark_t* mark, bint_t nth);
+int search_index_destroy(search_index_t* index);
+
+// bracket functions
+int bracket_index_new(bview_shared_t* shared, bracket_index_t** ret_index);
+int bracket_index_update(bracket_index_t* index, baction_t* action);
+int bracket_index_find_pair(bracket_index_t* index, mark_t* mark, bline_t** ret_bline, bint_t* ret_col);
+int bracket_index_find_top(bracket_index_t* index, mark_t* mark, bline_t** ret_bline, bint_t* ret_col);
+int bracket_index_is_complete(bracket_index_t* index);
+int bracket_index_destroy(bracket_index_t* index);
+
+// undo functions
+int undo_tree_new(editor_t* editor, buffer_t* buffer, undo_tree_t** ret_tree);
+undo_tree_t* undo_tree_share(undo_tree_t* self);
+int undo_tree_add(undo_tree_t* self, baction_t* first, baction_t* last, int num_actions, int is_join);
+int undo_tree_undo(undo_tree_t* self);
+int undo_tree_redo(undo_tree_t* self);
+int undo_tree_trim(undo_tree_t* self, baction_t* stop);
+int undo_tree_jump(undo_tree_t* self, bview_t* bview, undo_node_t* node);
+int undo_tree_step(undo_tree_t* self, int num_steps, undo_node_t** ret_node);
+int undo_tree_find_time(undo_tree_t* self, time_t when, undo_node_t** ret_node);
+int undo_tree_get_state(undo_tree_t* self, bint_t* ret_index, bint_t* ret_count, time_t* ret_time);
+int undo_tree_load(undo_tree_t* self, bview_t* bview);
+int undo_tree_save(undo_tree_t* self);
+int undo_tree_destroy(undo_tree_t* self);
+
+// journal functions
+int undo_journal_new(editor_t* editor, buffer_t* buffer, undo_journal_t** ret_journal);
+int undo_journal_add(undo_journal_t* self, baction_t* last, int num_actions, int is_join);
+int undo_journal_add_rec(undo_journal_t* self, undo_rec_t* rec);
+int undo_journal_undo(undo_journal_t* self, int num_records);
+int undo_journal_redo(undo_journal_t* self, int num_records);
+int undo_journal_reset(undo_journal_t* self);
+int undo_journal_save(undo_journal_t* self, int* ret_is_new_file);
+int undo_journal_load(undo_journal_t* self, undo_rec_t** ret_recs, bint_t* ret_num_recs);
+int undo_journal_free_recs(undo_rec_t* recs, bint_t num_recs);
+int undo_journal_destroy(undo_journal_t* self);
+int undo_journal_prune(editor_t* editor);
+
+// swap functions
+int swap_new(editor_t* editor, buffer_t* buffer, swap_t** ret_swap);
+swap_t* swap_share(swap_t* self);
+int swap_add(swap_t* self, baction_t* action);
+int swap_flush(swap_t* self);
+int swap_recover(swap_t* self, bint_t* ret_num_edits);
+int swap_save(swap_t* self);
+int swap_keep(swap_t* self);
+int swap_destroy(swap_t* self);
+
+// browse functions
+int browse_open(editor_t* editor, char* opt_path);
+int browse_destroy_all(editor_t* editor);
+
+// ctags functions
+int ctags_find(editor_t* editor, char* name, size_t name_len, ctags_match_t** ret_matches, int* ret_matches_len);
+void ctags_free_matches(ctags_match_t* matches, int matches_len);
+int ctags_open_match(editor_t* editor, ctags_match_t* match);
+int ctags_destroy(ctags_t* ctags);
+
+// fsearch functions
+int fsearch_prompt(editor_t* editor, char** ret_path);
+int fsearch_destroy(fsearch_t* fs);
 
 // util functions
 const char * util_get_url(const char * url);
@@ -539,11 +812,17 @@ int util_popen2(char* cmd, char* opt_shell, int* optret_fdread, int* optret_fdwr
 int util_get_bracket_pair(uint32_t ch, int* optret_is_closing);
 int util_is_file(char* path, char* opt_mode, FILE** optret_file);
 int util_is_dir(char* path);
+int util_mkdir_p(char* path, mode_t mode);
+int util_read_dir(int dfd, dir_entry_t** ret_entries, int* ret_entries_len);
+void util_free_dir(dir_entry_t* entries, int entries_len);
 char * util_read_file(char* path);
 void util_expand_tilde(char* path, int path_len, char** ret_path);
 int util_pcre_match(char* re, char* subject, int subject_len, char** optret_capture, int* optret_capture_len);
 int util_pcre_replace(char* re, char* subj, char* repl, char** ret_result, int* ret_result_len);
+bint_t util_bline_col_to_index(bline_t* bline, bint_t col);
+bline_t* util_get_bline(buffer_t* buffer, bline_t* hint, bint_t line_index);
 int util_timeval_is_gt(struct timeval* a, struct timeval* b);
+uint64_t util_fnv1a(char* data, bint_t data_len);
 char* util_escape_shell_arg(char* str, int l);
 int rect_printf(bview_rect_t rect, int x, int y, uint16_t fg, uint16_t bg, const char *fmt, ...);
 int rect_printf_attr(bview_rect_t rect, int x, int y, const char *fmt, ...);
@@ -555,6 +834,11 @@ void str_clear(str_t* str);
 void str_free(str_t* str);
 void str_append_replace_with_backrefs(str_t* str, char* subj, char* repl, int pcre_rc, int* pcre_ovector, int pcre_ovecsize);
 
+// tmark functions, see EON_TMARK
+int tmark_move_by(mark_t* tmark, bint_t char_delta);
+int tmark_replace_between(mark_t* a, mark_t* b, char* data, bint_t data_len);
+int tmark_delete_between(mark_t* a, mark_t* b);
+
 // plugin_opt struct, used on plugin boot
 // when doing get_option(value)
 typedef struct plugin_opt {
@@ -584,6 +868,47 @@ extern cmd_context_t * plugin_ctx;
 #define EON_DEFAULT_HILI_BRACKET_PAIRS 1
 #define EON_DEFAULT_READ_RC_FILE 1
 #define EON_DEFAULT_SOFT_WRAP 0
+#define EON_DEFAULT_UNDO_MAX_BYTES 67108864 // undo history kept per buffer
+#define EON_DEFAULT_UNDO_JOURNAL 0
+#define EON_DEFAULT_SWAP 1
+
+#define EON_ASYNC_READ_SIZE 65536 // bytes read from an aproc per wakeup
+#define EON_ASYNC_MAX_EVENTS 64
+#define EON_BVIEW_OUTPUT_FLUSH_SIZE 262144 // pending aproc output appended at once
+#define EON_BVIEW_OUTPUT_FLUSH_MS 16 // max delay before pending output is appended
+#define EON_ISEARCH_COUNT_MS 8 // time spent counting matches per event loop pass
+#define EON_SEARCH_INDEX_LINES 10000 // lines indexed per event loop pass
+#define EON_BRACKET_INDEX_LINES 10000 // lines counted per event loop pass
+#define EON_UNDO_CHECKPOINT_RECORDS 32 // records between the buffer snapshots undo jumps start from
+#define EON_UNDO_CHECKPOINT_CHAIN 8 // snapshots kept as diffs from the one before, between whole ones
+#define EON_UNDO_JOURNAL_DIR "~/.cache/eon/undo"
+#define EON_UNDO_JOURNAL_COMPACT_SIZE 1048576 // journal size past which saves compact it
+#define EON_UNDO_JOURNAL_MAX_AGE 2592000 // seconds an unused journal is kept (30 days)
+#define EON_SWAP_DIR "~/.cache/eon/swap"
+#define EON_SWAP_IDLE_MS 1000 // pause in edits before they are written to the swap file
+#define EON_SWAP_MAX_DELAY_MS 10000 // max delay before edits are written
+#define EON_SWAP_FLUSH_SIZE 1048576 // pending edits written at once
+
+#define EON_GREP_MAX_THREADS 8
+#define EON_GREP_MAX_LINE_LEN 512 // matched line text shown in the menu
+#define EON_GREP_BINARY_CHECK_SIZE 8192 // files with a NUL in here are skipped
+
+#define EON_BROWSE_CACHE_SIZE 64 // dir listings kept, least recently used go first
+
+#define EON_CTAGS_SORT_SAMPLES 64 // lines spot checked in a tags file declared sorted
+
+#define EON_FSEARCH_MAX_SHOWN 256
+#define EON_FSEARCH_REFRESH_S 30 // rebuild the file list when older than this
+#define EON_FSEARCH_BONUS_MATCH 16
+#define EON_FSEARCH_BONUS_CONSECUTIVE 10
+#define EON_FSEARCH_BONUS_BOUNDARY 10 // match after /, _, -, . or space
+#define EON_FSEARCH_BONUS_BASENAME 32 // whole query matched within the basename
+#define EON_FSEARCH_MAX_GAP_PENALTY 8
+
+#define EON_PLUGIN_TIME_BUDGET_MS 500 // per call, overridable via time_budget in plugin.conf
+#define EON_PLUGIN_MAX_OVERRUNS 3 // disable a plugin after this many, 0 to never disable
+#define EON_PLUGIN_HOOK_COUNT 1000 // once the budget timer fires, check the clock every N lua instructions
+#define EON_PLUGIN_REAP_MS 100 // how often to check on a process that closed its output but still runs
 
 #define EON_LOG_ERR(fmt, ...) do { \
     fprintf(stderr, (fmt), __VA_ARGS__); \
@@ -623,6 +948,17 @@ extern cmd_context_t * plugin_ctx;
     : ( (pcol) <= 0 ? 0 : (pline)->chars[(pcol)].vcol ) \
 )
 
+// A transient mark is a mark_t on the stack that is never added to its
+// buffer, so creating or dropping one is free and edits never walk it. It
+// goes stale on any edit. Only pass it where mlbuf reads a mark (find, get
+// and compare functions) and move it with tmark functions. Marks added to
+// a buffer are still kept by mlbuf, which shifts them one by one on edits
+// to their line; tmarks only keep short-lived positions out of that list.
+// An ordered store would replace the mark walks in mlbuf's line insert,
+// delete, split and join, none of which 01-mlbuf-patch.diff can be checked
+// against while the mlbuf sources are not part of this tree.
+#define EON_TMARK(pline, pcol) ((mark_t){ .bline = (pline), .col = (pcol), .target_col = (pcol) })
+
 // Sentinel values for numeric and wildcard kinputs
 #define EON_KINPUT_NUMERIC (kinput_t){ 0xffffffff, 0xffff, 0x40 }
 #define EON_KINPUT_WILDCARD (kinput_t){ 0xffffffff, 0xffff, 0x80 }
@@ -660,13 +996,11 @@ TODO
 --- LOW
 [ ] after bad shell cmd, EBADF on stdin/stdout ?
 [ ] consider find_budge=0 by default, emulate find_budge=1 in calling code
-[ ] use_srules sucks
 [ ] undo/redo should center viewport?
 [ ] smart indent
 [ ] func_viewport, func_display
 [ ] ctrl-enter in prompt inserts newline
 [ ] when opening path check if a buffer exists that already has it open via inode
-[ ] undo stack with same loop# should get undone as a group option
 [ ] refactor kmap, ** and ## is kind of inelegant, trie code not easy to grok
 [ ] refactor aproc and menu code
 [ ] ensure multi_cursor_code impl for all appropriate
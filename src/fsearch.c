@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include "eon.h"
+
+typedef struct fsearch_file_s fsearch_file_t; // A file in the index
+typedef struct fsearch_match_s fsearch_match_t; // A file matching the query
+
+// fsearch_file_t
+struct fsearch_file_s {
+    size_t lower_offset; // into fsearch_t.lower
+    int len;
+    uint64_t mask; // chars present in path, see _fsearch_mask
+};
+
+// fsearch_match_t
+struct fsearch_match_s {
+    bint_t file;
+    int score;
+};
+
+// fsearch_t
+struct fsearch_s {
+    editor_t* editor;
+    char root[PATH_MAX + 1];
+    grep_t* grep; // lists the files in the index
+    async_proc_t* aproc;
+    grep_t* next_grep; // refreshes the index in the background
+    async_proc_t* next_aproc;
+    time_t built_at;
+    fsearch_file_t* files;
+    bint_t files_len;
+    bint_t files_cap;
+    str_t lower; // lowercased paths
+    char* query;
+    int query_len;
+    uint64_t query_mask;
+    fsearch_match_t* matches;
+    bint_t matches_len;
+    bint_t matches_cap;
+    bint_t scored_len; // files already checked against query
+    fsearch_match_t shown[EON_FSEARCH_MAX_SHOWN]; // best matches, best first
+    int shown_len;
+    int is_shown_dirty;
+    bview_t* menu;
+};
+
+static fsearch_t* _fsearch_new(editor_t* editor, char* root);
+static grep_t* _fsearch_list_files(fsearch_t* fs, async_proc_t** owner_aproc);
+static void _fsearch_aproc_cb(async_proc_t* aproc, char* buf, size_t buf_len);
+static void _fsearch_next_aproc_cb(async_proc_t* aproc, char* buf, size_t buf_len);
+static void _fsearch_index(fsearch_t* fs, bint_t first, bint_t last);
+static uint64_t _fsearch_mask(char* str, int len);
+static void _fsearch_filter(fsearch_t* fs, char* query, int query_len);
+static void _fsearch_score_new(fsearch_t* fs);
+static int _fsearch_score(char* lower, int len, char* query, int query_len);
+static int _fsearch_score_window(char* lower, int from, int len, char* query, int query_len);
+static int _fsearch_cmp(fsearch_t* fs, fsearch_match_t* a, fsearch_match_t* b);
+static void _fsearch_offer(fsearch_t* fs, fsearch_match_t* match);
+static void _fsearch_show(fsearch_t* fs);
+static void _fsearch_prompt_cb(bview_t* bview_prompt, baction_t* action, void* udata);
+static int _fsearch_menu_cb(cmd_context_t* ctx, char* action);
+
+// Prompt for a path under cwd, fuzzy matching a cached file list as the user
+// types. Set ret_path to the chosen path, or NULL if cancelled.
+int fsearch_prompt(editor_t* editor, char** ret_path) {
+  fsearch_t* fs;
+  char cwd[PATH_MAX + 1];
+  char* answer;
+  grep_result_t* result;
+  bint_t line_index;
+
+  *ret_path = NULL;
+
+  if (!getcwd(cwd, PATH_MAX)) {
+    EON_RETURN_ERR(editor, "fsearch: getcwd failed: %s", strerror(errno));
+  }
+
+  // Build the index on first use, or when cwd changed
+  if (editor->fsearch && strcmp(editor->fsearch->root, cwd) != 0) {
+    fsearch_destroy(editor->fsearch);
+    editor->fsearch = NULL;
+  }
+
+  if (!editor->fsearch && !(editor->fsearch = _fsearch_new(editor, cwd))) {
+    return EON_ERR;
+  }
+
+  fs = editor->fsearch;
+
+  // Refresh a stale index in the background, keeping the old one until done
+  if (!fs->aproc && !fs->next_grep && time(NULL) - fs->built_at >= EON_FSEARCH_REFRESH_S) {
+    fs->next_grep = _fsearch_list_files(fs, &fs->next_aproc);
+  }
+
+  editor_page_menu(editor, NULL, NULL, 0, NULL, &fs->menu);
+  _fsearch_filter(fs, "", 0);
+  _fsearch_show(fs);
+
+  editor_prompt(editor, "fsearch: Path?", &(editor_prompt_params_t) {
+    .kmap = editor->kmap_prompt_fsearch,
+    .prompt_cb = _fsearch_prompt_cb,
+    .prompt_cb_udata = fs,
+    .menu_callback = _fsearch_menu_cb
+  }, &answer);
+
+  // The index may have been swapped while prompting, but shown is current
+  if (answer) {
+    line_index = fs->menu->active_cursor->mark->bline->line_index;
+
+    if (line_index < fs->shown_len && (result = grep_get_result(fs->grep, fs->shown[line_index].file))) {
+      *ret_path = strdup(result->path);
+    }
+
+    free(answer);
+  }
+
+  editor_close_bview(editor, fs->menu, NULL);
+  fs->menu = NULL;
+  return EON_OK;
+}
+
+// Stop indexing and free an fsearch_t
+int fsearch_destroy(fsearch_t* fs) {
+  if (fs->aproc) async_proc_destroy(fs->aproc, 1);
+  if (fs->next_aproc) async_proc_destroy(fs->next_aproc, 1);
+  if (fs->grep) grep_destroy(fs->grep);
+  if (fs->next_grep) grep_destroy(fs->next_grep);
+  if (fs->files) free(fs->files);
+  if (fs->matches) free(fs->matches);
+  if (fs->query) free(fs->query);
+  str_free(&fs->lower);
+  free(fs);
+  return EON_OK;
+}
+
+// Return a new fsearch_t, listing files under root in the background
+static fsearch_t* _fsearch_new(editor_t* editor, char* root) {
+  fsearch_t* fs;
+  fs = calloc(1, sizeof(fsearch_t));
+  fs->editor = editor;
+  snprintf(fs->root, sizeof(fs->root), "%s", root);
+
+  if (!(fs->grep = _fsearch_list_files(fs, &fs->aproc))) {
+    free(fs);
+    return NULL;
+  }
+
+  fs->built_at = time(NULL);
+  fs->query = strdup("");
+  return fs;
+}
+
+// Start listing files under cwd
+static grep_t* _fsearch_list_files(fsearch_t* fs, async_proc_t** owner_aproc) {
+  grep_t* grep;
+  async_proc_cb_t callback;
+  callback = owner_aproc == &fs->aproc ? _fsearch_aproc_cb : _fsearch_next_aproc_cb;
+
+  if (grep_new(fs->editor, NULL, ".", fs, owner_aproc, callback, &grep) != EON_OK) {
+    return NULL;
+  }
+
+  return grep;
+}
+
+// Aproc callback that indexes newly listed files, updating the menu if open
+static void _fsearch_aproc_cb(async_proc_t* aproc, char* buf, size_t buf_len) {
+  fsearch_t* fs;
+  bint_t num;
+
+  fs = (fsearch_t*)aproc->owner;
+  num = grep_take_results(fs->grep);
+
+  if (num > 0) {
+    _fsearch_index(fs, fs->files_len, fs->files_len + num);
+
+    if (fs->menu) {
+      _fsearch_score_new(fs);
+      _fsearch_show(fs);
+    }
+  }
+
+  if (buf_len < 1) fs->built_at = time(NULL);
+}
+
+// Aproc callback for a refresh. Swaps in the new file list once complete.
+static void _fsearch_next_aproc_cb(async_proc_t* aproc, char* buf, size_t buf_len) {
+  fsearch_t* fs;
+  fs = (fsearch_t*)aproc->owner;
+
+  grep_take_results(fs->next_grep);
+  if (buf_len > 0) return;
+
+  // Shown matches point into the old list, so drop them with it
+  fs->shown_len = 0;
+  fs->is_shown_dirty = 1;
+
+  grep_destroy(fs->grep);
+  fs->grep = fs->next_grep;
+  fs->next_grep = NULL;
+  fs->built_at = time(NULL);
+
+  fs->files_len = 0;
+  str_clear(&fs->lower);
+  _fsearch_index(fs, 0, grep_get_result_count(fs->grep));
+
+  // Rescore everything against the current query
+  fs->matches_len = 0;
+  fs->scored_len = 0;
+  _fsearch_score_new(fs);
+  _fsearch_show(fs);
+}
+
+// Add listed files first..last to the index
+static void _fsearch_index(fsearch_t* fs, bint_t first, bint_t last) {
+  fsearch_file_t* file;
+  grep_result_t* result;
+  char* lower;
+  bint_t i;
+  int j;
+
+  if (last > fs->files_cap) {
+    fs->files_cap = EON_MAX(last, fs->files_cap * 2);
+    fs->files = realloc(fs->files, sizeof(fsearch_file_t) * fs->files_cap);
+  }
+
+  for (i = first; i < last; i++) {
+    result = grep_get_result(fs->grep, i);
+    file = &fs->files[i];
+    file->len = strlen(result->path);
+    file->lower_offset = fs->lower.len;
+
+    str_append_len(&fs->lower, result->path, file->len + 1);
+    lower = fs->lower.data + file->lower_offset;
+
+    for (j = 0; j < file->len; j++) lower[j] = tolower((unsigned char)lower[j]);
+    file->mask = _fsearch_mask(lower, file->len);
+  }
+
+  fs->files_len = last;
+}
+
+// Return a bitmask of the chars in str. A path can only match a query if it
+// has every bit of the query's mask, so most paths are rejected with one AND.
+static uint64_t _fsearch_mask(char* str, int len) {
+  uint64_t mask;
+  unsigned char c;
+  int i;
+
+  mask = 0;
+
+  for (i = 0; i < len; i++) {
+    c = (unsigned char)str[i];
+
+    if (c >= 'a' && c <= 'z') {
+      mask |= 1ULL << (c - 'a');
+    } else if (c >= '0' && c <= '9') {
+      mask |= 1ULL << (26 + c - '0');
+    } else {
+      mask |= 1ULL << (36 + c % 28);
+    }
+  }
+
+  return mask;
+}
+
+// Filter the index by query. If the query only grew, just the previous
+// matches need checking.
+static void _fsearch_filter(fsearch_t* fs, char* query, int query_len) {
+  fsearch_match_t* match;
+  fsearch_file_t* file;
+  char* lower;
+  bint_t i;
+  bint_t j;
+  int k;
+
+  lower = malloc(query_len + 1);
+  for (k = 0; k < query_len; k++) lower[k] = tolower((unsigned char)query[k]);
+  lower[query_len] = '\0';
+
+  if (fs->query_len > 0 && query_len >= fs->query_len && strncmp(lower, fs->query, fs->query_len) == 0) {
+    if (query_len == fs->query_len) {
+      free(lower);
+      return;
+    }
+
+    free(fs->query);
+    fs->query = lower;
+    fs->query_len = query_len;
+    fs->query_mask = _fsearch_mask(lower, query_len);
+
+    // Refine previous matches in place
+    for (i = 0, j = 0; i < fs->matches_len; i++) {
+      match = &fs->matches[i];
+      file = &fs->files[match->file];
+      if ((file->mask & fs->query_mask) != fs->query_mask) continue;
+
+      match->score = _fsearch_score(fs->lower.data + file->lower_offset, file->len, fs->query, fs->query_len);
+      if (match->score >= 0) fs->matches[j++] = *match;
+    }
+
+    fs->matches_len = j;
+    fs->shown_len = 0;
+
+    for (i = 0; i < fs->matches_len; i++) _fsearch_offer(fs, &fs->matches[i]);
+    fs->is_shown_dirty = 1;
+    return;
+  }
+
+  free(fs->query);
+  fs->query = lower;
+  fs->query_len = query_len;
+  fs->query_mask = _fsearch_mask(lower, query_len);
+
+  // Start over from every file
+  fs->matches_len = 0;
+  fs->scored_len = 0;
+  fs->shown_len = 0;
+  fs->is_shown_dirty = 1;
+  _fsearch_score_new(fs);
+}
+
+// Check files indexed since the last filter against the query
+static void _fsearch_score_new(fsearch_t* fs) {
+  fsearch_match_t* match;
+  fsearch_file_t* file;
+  bint_t i;
+  int score;
+
+  for (i = fs->scored_len; i < fs->files_len; i++) {
+    file = &fs->files[i];
+    if ((file->mask & fs->query_mask) != fs->query_mask) continue;
+
+    score = _fsearch_score(fs->lower.data + file->lower_offset, file->len, fs->query, fs->query_len);
+    if (score < 0) continue;
+
+    if (fs->matches_len >= fs->matches_cap) {
+      fs->matches_cap = fs->matches_cap ? fs->matches_cap * 2 : 1024;
+      fs->matches = realloc(fs->matches, sizeof(fsearch_match_t) * fs->matches_cap);
+    }
+
+    match = &fs->matches[fs->matches_len++];
+    match->file = i;
+    match->score = score;
+    _fsearch_offer(fs, match);
+  }
+
+  fs->scored_len = fs->files_len;
+}
+
+// Return a score for lower as a subsequence match of query, or -1 if it does
+// not match. Matches within the basename are preferred.
+static int _fsearch_score(char* lower, int len, char* query, int query_len) {
+  char* slash;
+  int score;
+  int base;
+
+  if (query_len < 1) return 0;
+
+  slash = memrchr(lower, '/', len);
+  base = slash ? slash - lower + 1 : 0;
+
+  if (base > 0 && (score = _fsearch_score_window(lower, base, len, query, query_len)) >= 0) {
+    return score + EON_FSEARCH_BONUS_BASENAME;
+  }
+
+  return _fsearch_score_window(lower, 0, len, query, query_len);
+}
+
+// Score the tightest match of query in lower[from..len). memchr, which libc
+// vectorizes, finds each query char, then a backward pass shrinks the window
+// so that the match is as compact as possible.
+static int _fsearch_score_window(char* lower, int from, int len, char* query, int query_len) {
+  char* hit;
+  int start;
+  int end;
+  int score;
+  int prev;
+  int i;
+  int q;
+
+  // Forward pass, find where the first complete match ends
+  end = from;
+  for (q = 0; q < query_len; q++) {
+    if (!(hit = memchr(lower + end, query[q], len - end))) return -1;
+    end = hit - lower + 1;
+  }
+
+  // Backward pass, find the latest start for that end
+  start = end;
+  for (q = query_len - 1; q >= 0; q--) {
+    start -= 1;
+    while (lower[start] != query[q]) start -= 1;
+  }
+
+  // Score each matched char within the window
+  score = 0;
+  prev = -1;
+  q = 0;
+
+  for (i = start; i < end && q < query_len; i++) {
+    if (lower[i] != query[q]) continue;
+
+    score += EON_FSEARCH_BONUS_MATCH;
+
+    if (prev >= 0 && i == prev + 1) {
+      score += EON_FSEARCH_BONUS_CONSECUTIVE;
+    } else if (prev >= 0) {
+      score -= EON_MIN(i - prev - 1, EON_FSEARCH_MAX_GAP_PENALTY);
+    }
+
+    if (i == 0 || strchr("/_-. ", lower[i - 1])) {
+      score += EON_FSEARCH_BONUS_BOUNDARY;
+    }
+
+    prev = i;
+    q += 1;
+  }
+
+  return EON_MAX(score, 0);
+}
+
+// Compare matches, better first. Shorter paths win ties.
+static int _fsearch_cmp(fsearch_t* fs, fsearch_match_t* a, fsearch_match_t* b) {
+  if (a->score != b->score) return b->score - a->score;
+  if (fs->files[a->file].len != fs->files[b->file].len) return fs->files[a->file].len - fs->files[b->file].len;
+  return a->file < b->file ? -1 : 1;
+}
+
+// Insert a match into the shown list if it ranks high enough
+static void _fsearch_offer(fsearch_t* fs, fsearch_match_t* match) {
+  int i;
+
+  if (fs->shown_len >= EON_FSEARCH_MAX_SHOWN) {
+    if (_fsearch_cmp(fs, match, &fs->shown[fs->shown_len - 1]) >= 0) return;
+    fs->shown_len -= 1;
+  }
+
+  for (i = fs->shown_len; i > 0 && _fsearch_cmp(fs, match, &fs->shown[i - 1]) < 0; i--) {
+    fs->shown[i] = fs->shown[i - 1];
+  }
+
+  fs->shown[i] = *match;
+  fs->shown_len += 1;
+  fs->is_shown_dirty = 1;
+}
+
+// Write the shown matches to the menu
+static void _fsearch_show(fsearch_t* fs) {
+  grep_result_t* result;
+  str_t lines = {0};
+  int i;
+
+  if (!fs->menu || !fs->is_shown_dirty) return;
+
+  for (i = 0; i < fs->shown_len; i++) {
+    result = grep_get_result(fs->grep, fs->shown[i].file);
+    str_append(&lines, result->path);
+    str_append_len(&lines, "\n", 1);
+  }
+
+  buffer_set(fs->menu->buffer, lines.data ? lines.data : "", lines.len);
+  mark_move_beginning(fs->menu->active_cursor->mark);
+  bview_rectify_viewport(fs->menu);
+  str_free(&lines);
+
+  EON_SET_INFO(fs->editor, "fsearch: %ld of %ld files%s", (long)fs->matches_len, (long)fs->files_len, fs->aproc ? "..." : "");
+  fs->is_shown_dirty = 0;
+}
+
+// Prompt callback, refilters on every change to the query
+static void _fsearch_prompt_cb(bview_t* bview_prompt, baction_t* action, void* udata) {
+  fsearch_t* fs;
+  fs = (fsearch_t*)udata;
+  _fsearch_filter(fs, bview_prompt->buffer->first_line->data, bview_prompt->buffer->first_line->data_len);
+  _fsearch_show(fs);
+}
+
+// Prompt menu callback, moves the selection in the menu
+static int _fsearch_menu_cb(cmd_context_t* ctx, char* action) {
+  fsearch_t* fs;
+  bint_t delta;
+
+  fs = ctx->editor->fsearch;
+  if (!action || !fs || !fs->menu) return EON_OK;
+
+  if (strcmp(action, "up") == 0) {
+    delta = -1;
+  } else if (strcmp(action, "down") == 0) {
+    delta = 1;
+  } else if (strcmp(action, "pageup") == 0) {
+    delta = -1 * fs->menu->rect_buffer.h;
+  } else if (strcmp(action, "pagedown") == 0) {
+    delta = fs->menu->rect_buffer.h;
+  } else {
+    return EON_OK;
+  }
+
+  mark_move_vert(fs->menu->active_cursor->mark, delta);
+  bview_rectify_viewport(fs->menu);
+  return EON_OK;
+}
@@ -0,0 +1,697 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "utlist.h"
+#include "eon.h"
+
+typedef struct grep_dir_s grep_dir_t; // A directory waiting to be walked
+typedef struct grep_ignore_s grep_ignore_t; // Rules from one .gitignore file
+typedef struct grep_rule_s grep_rule_t; // A single .gitignore rule
+
+// grep_t
+struct grep_s {
+    editor_t* editor;
+    pcre* re;
+    pcre_extra* re_extra;
+    int is_file_list; // no pattern, every file is a result
+    char* literal; // lowercased literal every match must contain, if any
+    size_t literal_len;
+    int is_pure_literal; // literal is the whole pattern, so skip pcre
+    pthread_t threads[EON_GREP_MAX_THREADS];
+    int num_threads;
+    int num_running;
+    int num_busy;
+    int is_started;
+    int is_cancelled; // also polled by workers without the lock
+    int is_notified;
+    int wfd;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    grep_dir_t* dirs;
+    grep_ignore_t* ignores;
+    grep_result_t* pending; // found by workers, not yet seen by the editor
+    grep_result_t** pending_tail;
+    grep_result_t** results; // taken by the editor, in order
+    bint_t results_len;
+    bint_t results_cap;
+};
+
+// grep_dir_t
+struct grep_dir_s {
+    char* path;
+    grep_ignore_t* ignore;
+    grep_dir_t* next;
+};
+
+// grep_rule_t
+struct grep_rule_s {
+    char* pattern;
+    int is_negated;
+    int is_dir_only;
+    int is_anchored;
+};
+
+// grep_ignore_t
+struct grep_ignore_s {
+    char* base;
+    size_t base_len;
+    grep_rule_t* rules;
+    int rules_len;
+    grep_ignore_t* parent;
+    grep_ignore_t* next;
+};
+
+static void _grep_extract_literal(grep_t* grep, char* pattern);
+static void _grep_push_dir(grep_t* grep, char* path, grep_ignore_t* ignore);
+static grep_dir_t* _grep_pop_dir(grep_t* grep);
+static void* _grep_worker(void* arg);
+static void _grep_walk_dir(grep_t* grep, grep_dir_t* dir);
+static grep_ignore_t* _grep_load_ignore(grep_t* grep, int dfd, char* base, grep_ignore_t* parent);
+static int _grep_is_ignored(grep_ignore_t* ignore, char* path, char* name, int is_dir);
+static void _grep_search_file(grep_t* grep, int dfd, char* name, char* path);
+static void _grep_search(grep_t* grep, char* path, char* data, size_t len, grep_result_t*** ret_tail);
+static char* _grep_find_literal(grep_t* grep, char* hay, size_t hay_len);
+static grep_result_t* _grep_add_result(char* path, bint_t line, char* line_start, char* line_end, char* match);
+static void _grep_publish(grep_t* grep, grep_result_t* results, grep_result_t** results_tail);
+static void _grep_free_result(grep_result_t* result);
+
+// Start a native search for pattern under path, or list every file under
+// path if opt_pattern is NULL. The aproc callback is invoked when new results
+// can be taken, and with eof once the search is done.
+int grep_new(editor_t* editor, char* opt_pattern, char* path, void* owner, async_proc_t** owner_aproc, async_proc_cb_t callback, grep_t** ret_grep) {
+  grep_t* grep;
+  const char* error;
+  int erroffset;
+  int pipefd[2];
+  sigset_t all_signals;
+  sigset_t old_signals;
+  long num_cpus;
+  int i;
+
+  grep = calloc(1, sizeof(grep_t));
+  grep->editor = editor;
+  grep->wfd = -1;
+  grep->pending_tail = &grep->pending;
+
+  if (!opt_pattern) {
+    grep->is_file_list = 1;
+
+  // Match case-insensitively, like the grep -i we used to shell out to
+  } else if (!(grep->re = pcre_compile(opt_pattern, PCRE_CASELESS | PCRE_NO_AUTO_CAPTURE, &error, &erroffset, NULL))) {
+    free(grep);
+    EON_RETURN_ERR(editor, "grep: %s at offset %d", error, erroffset);
+
+  } else {
+    grep->re_extra = pcre_study(grep->re, 0, &error);
+    _grep_extract_literal(grep, opt_pattern);
+  }
+
+  if (pipe(pipefd) != 0) {
+    grep_destroy(grep);
+    EON_RETURN_ERR(editor, "grep: pipe failed: %s", strerror(errno));
+  }
+
+  fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+  fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+  grep->wfd = pipefd[1];
+
+  pthread_mutex_init(&grep->mutex, NULL);
+  pthread_cond_init(&grep->cond, NULL);
+  grep->is_started = 1;
+  _grep_push_dir(grep, path, NULL);
+
+  // The editor reads the other end of the pipe, which signals new results
+  // and hits eof once the last worker is done
+  *ret_grep = grep;
+  async_proc_new_fd(editor, owner, owner_aproc, pipefd[0], callback);
+
+  num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  grep->num_threads = EON_MAX(1, EON_MIN(EON_GREP_MAX_THREADS, num_cpus));
+
+  // Signals should be handled by the editor thread, not by workers
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_BLOCK, &all_signals, &old_signals);
+
+  for (i = 0; i < grep->num_threads; i++) {
+    if (pthread_create(&grep->threads[i], NULL, _grep_worker, grep) != 0) break;
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+  pthread_mutex_lock(&grep->mutex);
+  grep->num_threads = i;
+  grep->num_running = i;
+
+  if (i < 1) {
+    close(grep->wfd);
+    grep->wfd = -1;
+  }
+
+  pthread_mutex_unlock(&grep->mutex);
+  return EON_OK;
+}
+
+// Take results found since the last call, appending them to the list read
+// by grep_get_result. Return the number of new results.
+bint_t grep_take_results(grep_t* grep) {
+  grep_result_t* results;
+  grep_result_t* result;
+  bint_t num;
+
+  pthread_mutex_lock(&grep->mutex);
+  results = grep->pending;
+  grep->pending = NULL;
+  grep->pending_tail = &grep->pending;
+  grep->is_notified = 0;
+  pthread_mutex_unlock(&grep->mutex);
+
+  num = 0;
+
+  LL_FOREACH(results, result) {
+    if (grep->results_len >= grep->results_cap) {
+      grep->results_cap = grep->results_cap ? grep->results_cap * 2 : 1024;
+      grep->results = realloc(grep->results, sizeof(grep_result_t*) * grep->results_cap);
+    }
+
+    grep->results[grep->results_len++] = result;
+    num += 1;
+  }
+
+  return num;
+}
+
+// Return the nth taken result, or NULL
+grep_result_t* grep_get_result(grep_t* grep, bint_t index) {
+  if (index < 0 || index >= grep->results_len) return NULL;
+  return grep->results[index];
+}
+
+// Return the number of taken results
+bint_t grep_get_result_count(grep_t* grep) {
+  return grep->results_len;
+}
+
+// Stop all workers, waiting for them to finish
+int grep_stop(grep_t* grep) {
+  int i;
+
+  pthread_mutex_lock(&grep->mutex);
+  __atomic_store_n(&grep->is_cancelled, 1, __ATOMIC_RELAXED);
+  pthread_cond_broadcast(&grep->cond);
+  pthread_mutex_unlock(&grep->mutex);
+
+  for (i = 0; i < grep->num_threads; i++) {
+    pthread_join(grep->threads[i], NULL);
+  }
+
+  grep->num_threads = 0;
+  return EON_OK;
+}
+
+// Stop and free a grep_t
+int grep_destroy(grep_t* grep) {
+  grep_dir_t* dir;
+  grep_dir_t* dir_tmp;
+  grep_ignore_t* ignore;
+  grep_ignore_t* ignore_tmp;
+  grep_result_t* result;
+  grep_result_t* result_tmp;
+  bint_t i;
+  int j;
+
+  if (grep->is_started) {
+    grep_stop(grep);
+    if (grep->wfd >= 0) close(grep->wfd);
+    pthread_mutex_destroy(&grep->mutex);
+    pthread_cond_destroy(&grep->cond);
+  }
+
+  LL_FOREACH_SAFE(grep->dirs, dir, dir_tmp) {
+    free(dir->path);
+    free(dir);
+  }
+
+  LL_FOREACH_SAFE(grep->ignores, ignore, ignore_tmp) {
+    for (j = 0; j < ignore->rules_len; j++) free(ignore->rules[j].pattern);
+    free(ignore->rules);
+    free(ignore->base);
+    free(ignore);
+  }
+
+  LL_FOREACH_SAFE(grep->pending, result, result_tmp) {
+    _grep_free_result(result);
+  }
+
+  for (i = 0; i < grep->results_len; i++) {
+    _grep_free_result(grep->results[i]);
+  }
+
+  if (grep->results) free(grep->results);
+  if (grep->literal) free(grep->literal);
+  if (grep->re_extra) pcre_free_study(grep->re_extra);
+  if (grep->re) pcre_free(grep->re);
+  free(grep);
+  return EON_OK;
+}
+
+// Find the longest leading run of literal chars in pattern. Every match must
+// contain it, so files and lines without it can be skipped without pcre.
+static void _grep_extract_literal(grep_t* grep, char* pattern) {
+  char* c;
+  size_t len;
+
+  // Alternation means no single literal is required
+  if (strchr(pattern, '|')) return;
+
+  c = pattern;
+  if (*c == '^') c += 1;
+
+  len = strcspn(c, "\\^$.|?*+()[]{}");
+
+  // A trailing quantifier makes the last literal char optional
+  if (len > 0 && c[len] && strchr("?*{", c[len])) len -= 1;
+
+  if (len < 1) return;
+
+  grep->literal = strndup(c, len);
+  grep->literal_len = len;
+  grep->is_pure_literal = c == pattern && c[len] == '\0' ? 1 : 0;
+
+  for (c = grep->literal; *c; c++) *c = tolower((unsigned char)*c);
+}
+
+// Queue a directory to be walked
+static void _grep_push_dir(grep_t* grep, char* path, grep_ignore_t* ignore) {
+  grep_dir_t* dir;
+  dir = calloc(1, sizeof(grep_dir_t));
+  dir->path = strdup(path);
+  dir->ignore = ignore;
+
+  pthread_mutex_lock(&grep->mutex);
+  LL_PREPEND(grep->dirs, dir);
+  pthread_cond_signal(&grep->cond);
+  pthread_mutex_unlock(&grep->mutex);
+}
+
+// Take a directory to walk. Return NULL once every directory has been walked
+// or the search was cancelled.
+static grep_dir_t* _grep_pop_dir(grep_t* grep) {
+  grep_dir_t* dir;
+  dir = NULL;
+
+  pthread_mutex_lock(&grep->mutex);
+
+  // Wait while other workers may still find more directories
+  while (!grep->dirs && grep->num_busy > 0 && !grep->is_cancelled) {
+    pthread_cond_wait(&grep->cond, &grep->mutex);
+  }
+
+  if (grep->dirs && !grep->is_cancelled) {
+    dir = grep->dirs;
+    LL_DELETE(grep->dirs, dir);
+    grep->num_busy += 1;
+
+  } else {
+    pthread_cond_broadcast(&grep->cond);
+  }
+
+  pthread_mutex_unlock(&grep->mutex);
+  return dir;
+}
+
+// Worker thread. Walks directories until there are none left.
+static void* _grep_worker(void* arg) {
+  grep_t* grep;
+  grep_dir_t* dir;
+  grep = (grep_t*)arg;
+
+  while ((dir = _grep_pop_dir(grep)) != NULL) {
+    _grep_walk_dir(grep, dir);
+    free(dir->path);
+    free(dir);
+
+    pthread_mutex_lock(&grep->mutex);
+    grep->num_busy -= 1;
+    if (grep->num_busy < 1 && !grep->dirs) pthread_cond_broadcast(&grep->cond);
+    pthread_mutex_unlock(&grep->mutex);
+  }
+
+  // The last worker out closes the pipe so the editor sees eof
+  pthread_mutex_lock(&grep->mutex);
+  grep->num_running -= 1;
+
+  if (grep->num_running < 1 && grep->wfd >= 0) {
+    close(grep->wfd);
+    grep->wfd = -1;
+  }
+
+  pthread_mutex_unlock(&grep->mutex);
+  return NULL;
+}
+
+// Search regular files in a directory and queue its subdirectories
+static void _grep_walk_dir(grep_t* grep, grep_dir_t* dir) {
+  dir_entry_t* entries;
+  grep_ignore_t* ignore;
+  struct stat st;
+  char* path;
+  int entries_len;
+  int is_dir;
+  int dfd;
+  int i;
+
+  if ((dfd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) return;
+
+  if (util_read_dir(dfd, &entries, &entries_len) != EON_OK) {
+    close(dfd);
+    return;
+  }
+
+  // Rules from a .gitignore here apply to everything below this directory
+  ignore = dir->ignore;
+
+  for (i = 0; i < entries_len; i++) {
+    if (strcmp(entries[i].name, ".gitignore") == 0) {
+      ignore = _grep_load_ignore(grep, dfd, dir->path, dir->ignore);
+      break;
+    }
+  }
+
+  for (i = 0; i < entries_len && !__atomic_load_n(&grep->is_cancelled, __ATOMIC_RELAXED); i++) {
+    if (strcmp(entries[i].name, ".git") == 0) continue;
+
+    // Resolve unknown types, skipping symlinks like grep -r
+    if (entries[i].type == DT_UNKNOWN) {
+      if (fstatat(dfd, entries[i].name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+      if (S_ISDIR(st.st_mode)) entries[i].type = DT_DIR;
+      else if (S_ISREG(st.st_mode)) entries[i].type = DT_REG;
+    }
+
+    if (entries[i].type != DT_DIR && entries[i].type != DT_REG) continue;
+    is_dir = entries[i].type == DT_DIR ? 1 : 0;
+
+    if (strcmp(dir->path, ".") == 0) {
+      path = strdup(entries[i].name);
+    } else if (asprintf(&path, "%s/%s", dir->path, entries[i].name) < 0) {
+      continue;
+    }
+
+    if (!_grep_is_ignored(ignore, path, entries[i].name, is_dir)) {
+      if (is_dir) {
+        _grep_push_dir(grep, path, ignore);
+      } else {
+        _grep_search_file(grep, dfd, entries[i].name, path);
+      }
+    }
+
+    free(path);
+  }
+
+  util_free_dir(entries, entries_len);
+  close(dfd);
+}
+
+// Parse the .gitignore in a directory
+static grep_ignore_t* _grep_load_ignore(grep_t* grep, int dfd, char* base, grep_ignore_t* parent) {
+  grep_ignore_t* ignore;
+  grep_rule_t* rule;
+  FILE* fp;
+  char line[PATH_MAX];
+  char* pattern;
+  size_t len;
+  int fd;
+
+  if ((fd = openat(dfd, ".gitignore", O_RDONLY | O_CLOEXEC)) < 0) return parent;
+
+  if (!(fp = fdopen(fd, "r"))) {
+    close(fd);
+    return parent;
+  }
+
+  ignore = calloc(1, sizeof(grep_ignore_t));
+  ignore->base = strdup(base);
+  ignore->base_len = strcmp(base, ".") == 0 ? 0 : strlen(base);
+  ignore->parent = parent;
+
+  while (fgets(line, sizeof(line), fp)) {
+    len = strcspn(line, "\r\n");
+    while (len > 0 && line[len - 1] == ' ') len -= 1;
+    line[len] = '\0';
+
+    if (len < 1 || line[0] == '#') continue;
+
+    ignore->rules = realloc(ignore->rules, sizeof(grep_rule_t) * (ignore->rules_len + 1));
+    rule = &ignore->rules[ignore->rules_len];
+    memset(rule, 0, sizeof(grep_rule_t));
+    pattern = line;
+
+    if (*pattern == '!') {
+      rule->is_negated = 1;
+      pattern += 1;
+    } else if (*pattern == '\\') {
+      pattern += 1;
+    }
+
+    len = strlen(pattern);
+
+    if (len > 0 && pattern[len - 1] == '/') {
+      rule->is_dir_only = 1;
+      pattern[--len] = '\0';
+    }
+
+    // A slash anywhere else anchors the pattern to this directory
+    if (strchr(pattern, '/')) {
+      rule->is_anchored = 1;
+      if (*pattern == '/') pattern += 1;
+    }
+
+    if (*pattern == '\0') continue;
+
+    rule->pattern = strdup(pattern);
+    ignore->rules_len += 1;
+  }
+
+  fclose(fp);
+
+  pthread_mutex_lock(&grep->mutex);
+  LL_PREPEND(grep->ignores, ignore);
+  pthread_mutex_unlock(&grep->mutex);
+
+  return ignore;
+}
+
+// Return 1 if path is excluded by .gitignore rules. The last matching rule
+// wins, and rules in deeper directories win over their parents.
+static int _grep_is_ignored(grep_ignore_t* ignore, char* path, char* name, int is_dir) {
+  grep_rule_t* rule;
+  char* rel_path;
+  int flags;
+  int i;
+
+  for (; ignore; ignore = ignore->parent) {
+    rel_path = ignore->base_len > 0 ? path + ignore->base_len + 1 : path;
+
+    for (i = ignore->rules_len - 1; i >= 0; i--) {
+      rule = &ignore->rules[i];
+      if (rule->is_dir_only && !is_dir) continue;
+
+      if (rule->is_anchored) {
+        flags = strstr(rule->pattern, "**") ? 0 : FNM_PATHNAME;
+        if (fnmatch(rule->pattern, rel_path, flags) != 0) continue;
+      } else if (fnmatch(rule->pattern, name, 0) != 0) {
+        continue;
+      }
+
+      return rule->is_negated ? 0 : 1;
+    }
+  }
+
+  return 0;
+}
+
+// Map a file and search it
+static void _grep_search_file(grep_t* grep, int dfd, char* name, char* path) {
+  grep_result_t* results;
+  grep_result_t** results_tail;
+  struct stat st;
+  char* data;
+  int fd;
+
+  // Listing files only, no need to open them
+  if (grep->is_file_list) {
+    results = calloc(1, sizeof(grep_result_t));
+    results->path = strdup(path);
+    _grep_publish(grep, results, &results->next);
+    return;
+  }
+
+  if ((fd = openat(dfd, name, O_RDONLY | O_CLOEXEC)) < 0) return;
+
+  if (fstat(fd, &st) != 0 || st.st_size < 1) {
+    close(fd);
+    return;
+  }
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED) return;
+
+  results = NULL;
+  results_tail = &results;
+  _grep_search(grep, path, data, st.st_size, &results_tail);
+  munmap(data, st.st_size);
+
+  if (results) _grep_publish(grep, results, results_tail);
+}
+
+// Search file contents line by line
+static void _grep_search(grep_t* grep, char* path, char* data, size_t len, grep_result_t*** ret_tail) {
+  char* end;
+  char* pos;
+  char* hit;
+  char* line_start;
+  char* line_end;
+  char* counted;
+  char* nl;
+  grep_result_t* result;
+  bint_t line;
+  int ovector[3];
+
+  // Skip binary files like grep -I
+  if (memchr(data, '\0', EON_MIN(len, EON_GREP_BINARY_CHECK_SIZE))) return;
+
+  end = data + len;
+  pos = data;
+  counted = data;
+  line = 1;
+
+  while (pos < end) {
+    // Jump straight to the next line containing the literal, if we have one
+    if (grep->literal) {
+      if (!(hit = _grep_find_literal(grep, pos, end - pos))) break;
+      line_start = memrchr(pos, '\n', hit - pos);
+      line_start = line_start ? line_start + 1 : pos;
+    } else {
+      hit = NULL;
+      line_start = pos;
+    }
+
+    line_end = memchr(line_start, '\n', end - line_start);
+    if (!line_end) line_end = end;
+    pos = line_end + 1;
+
+    if (!grep->is_pure_literal) {
+      if (pcre_exec(grep->re, grep->re_extra, line_start, line_end - line_start, 0, 0, ovector, 3) < 0) {
+        continue;
+      }
+      hit = line_start + ovector[0];
+    }
+
+    // Count lines skipped since the last match
+    while ((nl = memchr(counted, '\n', line_start - counted)) != NULL) {
+      line += 1;
+      counted = nl + 1;
+    }
+
+    result = _grep_add_result(path, line, line_start, line_end, hit);
+    **ret_tail = result;
+    *ret_tail = &result->next;
+
+    if (__atomic_load_n(&grep->is_cancelled, __ATOMIC_RELAXED)) break;
+  }
+}
+
+// Find the literal in hay, ignoring case. Scans for either case of its first
+// char with memchr, which libc vectorizes, then compares the rest.
+static char* _grep_find_literal(grep_t* grep, char* hay, size_t hay_len) {
+  char* end;
+  char* lo;
+  char* up;
+  char* cand;
+  char c_lo;
+  char c_up;
+
+  if (hay_len < grep->literal_len) return NULL;
+
+  c_lo = grep->literal[0];
+  c_up = toupper((unsigned char)c_lo);
+
+  if (c_lo == c_up && grep->literal_len == 1) {
+    return memchr(hay, c_lo, hay_len);
+  }
+
+  end = hay + hay_len - grep->literal_len + 1; // last possible start + 1
+  lo = memchr(hay, c_lo, end - hay);
+  up = c_lo == c_up ? NULL : memchr(hay, c_up, end - hay);
+
+  while (lo || up) {
+    cand = !up || (lo && lo < up) ? lo : up;
+
+    if (strncasecmp(cand + 1, grep->literal + 1, grep->literal_len - 1) == 0) {
+      return cand;
+    }
+
+    if (cand == lo) {
+      lo = memchr(lo + 1, c_lo, end - lo - 1);
+    } else {
+      up = memchr(up + 1, c_up, end - up - 1);
+    }
+  }
+
+  return NULL;
+}
+
+// Return a new result for a match
+static grep_result_t* _grep_add_result(char* path, bint_t line, char* line_start, char* line_end, char* match) {
+  grep_result_t* result;
+  char* c;
+
+  if (line_end > line_start && *(line_end - 1) == '\r') line_end -= 1;
+
+  result = calloc(1, sizeof(grep_result_t));
+  result->path = strdup(path);
+  result->line = line;
+  result->text_len = EON_MIN(line_end - line_start, EON_GREP_MAX_LINE_LEN);
+  result->text = strndup(line_start, result->text_len);
+
+  // Columns are in chars, not bytes
+  for (c = line_start; c < match; c++) {
+    if ((*c & 0xc0) != 0x80) result->col += 1;
+  }
+
+  return result;
+}
+
+// Hand a file's results to the editor, waking it up if needed
+static void _grep_publish(grep_t* grep, grep_result_t* results, grep_result_t** results_tail) {
+  pthread_mutex_lock(&grep->mutex);
+  *grep->pending_tail = results;
+  grep->pending_tail = results_tail;
+
+  if (!grep->is_notified && grep->wfd >= 0) {
+    grep->is_notified = 1;
+    if (write(grep->wfd, "\n", 1) < 0) grep->is_notified = 0;
+  }
+
+  pthread_mutex_unlock(&grep->mutex);
+}
+
+// Free a result
+static void _grep_free_result(grep_result_t* result) {
+  if (result->text) free(result->text);
+  free(result->path);
+  free(result);
+}
@@ -0,0 +1,722 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "eon.h"
+
+#define EON_UNDO_JOURNAL_MAGIC "eon-undo 1"
+
+typedef struct undo_journal_id_s undo_journal_id_t;
+typedef struct undo_journal_parse_s undo_journal_parse_t;
+
+// What a file looked like on disk
+struct undo_journal_id_s {
+  bint_t size;
+  long mtime;
+  uint64_t hash; // of the contents, 0 if not known
+};
+
+// undo_journal_t. The journal is a log of the linear undo history of a
+// file, one entry per line:
+//
+//   o <size> <mtime>            file opened, a session starts
+//   a <time> <n>, then n ops    record added (drops undone records)
+//   j <time> <n>, then n ops    ops added to the last record
+//   u <n>, r <n>                n records undone or redone
+//   x                           history so far no longer connects
+//   s <size> <mtime> <hash>     file saved with the records applied
+//
+// An op is "<type> <line> <col> <num_chars> <data_len>" followed by the
+// data and a newline. A session continues the history only if the file
+// it opened is the one last saved. The session holds an exclusive flock
+// on the journal, so another eon on the same file goes without one.
+struct undo_journal_s {
+  editor_t* editor;
+  buffer_t* buffer;
+  char* path; // journal file
+  char* file_path; // real path of the file it is for
+  FILE* fp;
+  undo_journal_id_t open_id; // file as this session opened it
+  long session_offset; // where this session's 'o' entry starts
+  long compacted_size; // journal size after the last compaction
+  bint_t num_entries; // entries written this session
+};
+
+// State of the history while reading a journal
+struct undo_journal_parse_s {
+  undo_rec_t** recs; // every record read
+  bint_t recs_len;
+  bint_t recs_cap;
+  bint_t* live; // records in the history, by index into recs
+  bint_t live_len;
+  bint_t live_cap;
+  bint_t applied; // live records not undone
+  bint_t* saved; // applied records as of the last save
+  bint_t saved_len;
+  undo_journal_id_t saved_id;
+  int has_saved;
+  bint_t base_num; // saved records this session started from
+  bint_t base_len; // how many of them the history still starts with
+  undo_journal_id_t base_id;
+  int has_base;
+  int is_in_session; // past this session's 'o' entry
+};
+
+static int _undo_journal_open_file(undo_journal_t* self, char* file_path);
+static void _undo_journal_close_file(undo_journal_t* self);
+static void _undo_journal_flush(undo_journal_t* self);
+static void _undo_journal_write_rec(FILE* fp, char kind, undo_rec_t* rec);
+static int _undo_journal_parse(undo_journal_t* self, long stop_offset, undo_journal_parse_t* parse);
+static int _undo_journal_read_rec(FILE* fp, time_t when, int num_ops, undo_rec_t** ret_rec);
+static void _undo_journal_push_rec(undo_journal_parse_t* parse, undo_rec_t* rec, int is_join);
+static void _undo_journal_discard(undo_journal_parse_t* parse);
+static void _undo_journal_parse_free(undo_journal_parse_t* parse);
+static int _undo_journal_compact(undo_journal_t* self);
+static void _undo_journal_free_rec(undo_rec_t* rec);
+
+// Open the undo journal of the file buffer was opened from and start a
+// session in it. Nothing is read until undo_journal_load.
+int undo_journal_new(editor_t* editor, buffer_t* buffer, undo_journal_t** ret_journal) {
+  undo_journal_t* self;
+
+  if (!buffer->path) return EON_ERR;
+
+  self = calloc(1, sizeof(undo_journal_t));
+  self->editor = editor;
+  self->buffer = buffer;
+  self->open_id.size = buffer->st.st_size;
+  self->open_id.mtime = (long)buffer->st.st_mtime;
+
+  if (_undo_journal_open_file(self, buffer->path) != EON_OK) {
+    free(self);
+    return EON_ERR;
+  }
+
+  *ret_journal = self;
+  return EON_OK;
+}
+
+// Log a record made of num_actions actions ending at last. If is_join is
+// set, they extend the last record instead.
+int undo_journal_add(undo_journal_t* self, baction_t* last, int num_actions, int is_join) {
+  baction_t* action;
+  int i;
+
+  if (!self->fp) return EON_ERR;
+
+  for (action = last, i = 1; action && i < num_actions; i++) action = action->prev;
+  if (!action) return EON_ERR;
+
+  fprintf(self->fp, "%c %ld %d\n", is_join ? 'j' : 'a', (long)time(NULL), num_actions);
+
+  for (i = 0; i < num_actions && action; i++, action = action->next) {
+    fprintf(self->fp, "%d %ld %ld %ld %ld\n", action->type, (long)action->start_line_index, (long)action->start_col,
+      (long)(action->char_delta < 0 ? -action->char_delta : action->char_delta), (long)action->data_len);
+    fwrite(action->data, 1, action->data_len, self->fp);
+    fputc('\n', self->fp);
+  }
+
+  _undo_journal_flush(self);
+  return EON_OK;
+}
+
+// Log a record from copies of its actions
+int undo_journal_add_rec(undo_journal_t* self, undo_rec_t* rec) {
+  if (!self->fp) return EON_ERR;
+  _undo_journal_write_rec(self->fp, 'a', rec);
+  _undo_journal_flush(self);
+  return EON_OK;
+}
+
+// Log num_records records undone
+int undo_journal_undo(undo_journal_t* self, int num_records) {
+  if (!self->fp || num_records < 1) return EON_ERR;
+  fprintf(self->fp, "u %d\n", num_records);
+  _undo_journal_flush(self);
+  return EON_OK;
+}
+
+// Log num_records records redone
+int undo_journal_redo(undo_journal_t* self, int num_records) {
+  if (!self->fp || num_records < 1) return EON_ERR;
+  fprintf(self->fp, "r %d\n", num_records);
+  _undo_journal_flush(self);
+  return EON_OK;
+}
+
+// Log that the history logged so far no longer leads to the buffer
+int undo_journal_reset(undo_journal_t* self) {
+  if (!self->fp || self->num_entries < 1) return EON_ERR;
+  fprintf(self->fp, "x\n");
+  _undo_journal_flush(self);
+  return EON_OK;
+}
+
+// Log that the buffer was saved, so later sessions that open the saved
+// file can pick up its history. If the buffer was saved under a new path,
+// its history starts over in that file's journal. Set ret_is_new_file if
+// so.
+int undo_journal_save(undo_journal_t* self, int* ret_is_new_file) {
+  char real[PATH_MAX + 1];
+  struct stat st;
+  char* data;
+  bint_t data_len;
+  long size;
+
+  *ret_is_new_file = 0;
+
+  if (!self->buffer->path || !realpath(self->buffer->path, real) || stat(real, &st) != 0) return EON_ERR;
+
+  if (!self->file_path || strcmp(real, self->file_path) != 0) {
+    _undo_journal_close_file(self);
+    if (_undo_journal_open_file(self, real) != EON_OK) return EON_ERR;
+    fprintf(self->fp, "x\n");
+    *ret_is_new_file = 1;
+  }
+
+  if (!self->fp) return EON_ERR;
+
+  buffer_get(self->buffer, &data, &data_len);
+  fprintf(self->fp, "s %ld %ld %016llx\n", (long)st.st_size, (long)st.st_mtime,
+    (unsigned long long)util_fnv1a(data, data_len));
+  _undo_journal_flush(self);
+
+  // Compact once the log has grown well past what it held last time
+  size = ftell(self->fp);
+
+  if (size > EON_UNDO_JOURNAL_COMPACT_SIZE && size > self->compacted_size * 2) {
+    _undo_journal_compact(self);
+  }
+
+  return EON_OK;
+}
+
+// Read the history this session started from: the records applied when
+// the file was last saved, if the file opened is that one. The buffer must
+// be in the state it was opened in. Free with undo_journal_free_recs.
+int undo_journal_load(undo_journal_t* self, undo_rec_t** ret_recs, bint_t* ret_num_recs) {
+  undo_journal_parse_t parse;
+  undo_rec_t* recs;
+  char* data;
+  bint_t data_len;
+  bint_t i;
+  int rv;
+
+  if (!self->fp) return EON_ERR;
+
+  memset(&parse, 0, sizeof(undo_journal_parse_t));
+  rv = _undo_journal_parse(self, self->session_offset, &parse);
+
+  // Check the buffer against the save the session started from
+  if (rv == EON_OK) {
+    buffer_get(self->buffer, &data, &data_len);
+
+    if (!parse.has_base
+      || parse.applied < 1
+      || parse.base_id.size != data_len
+      || parse.base_id.hash != util_fnv1a(data, data_len)
+    ) {
+      rv = EON_ERR;
+    }
+  }
+
+  if (rv == EON_OK) {
+    recs = malloc(sizeof(undo_rec_t) * parse.applied);
+
+    for (i = 0; i < parse.applied; i++) {
+      recs[i] = *parse.recs[parse.live[i]];
+      parse.recs[parse.live[i]]->ops = NULL;
+      parse.recs[parse.live[i]]->num_ops = 0;
+    }
+
+    *ret_recs = recs;
+    *ret_num_recs = parse.applied;
+  }
+
+  _undo_journal_parse_free(&parse);
+  return rv;
+}
+
+// Free records returned by undo_journal_load
+int undo_journal_free_recs(undo_rec_t* recs, bint_t num_recs) {
+  bint_t i;
+  int j;
+
+  for (i = 0; i < num_recs; i++) {
+    for (j = 0; j < recs[i].num_ops; j++) free(recs[i].ops[j].data);
+    free(recs[i].ops);
+  }
+
+  free(recs);
+  return EON_OK;
+}
+
+// Close a journal
+int undo_journal_destroy(undo_journal_t* self) {
+  _undo_journal_close_file(self);
+  free(self);
+  return EON_OK;
+}
+
+// Delete journals not written to in EON_UNDO_JOURNAL_MAX_AGE seconds,
+// unless a running session holds them
+int undo_journal_prune(editor_t* editor) {
+  DIR* dir;
+  struct dirent* entry;
+  struct stat st;
+  char* dir_path;
+  char* path;
+  time_t now;
+  int fd;
+
+  util_expand_tilde(EON_UNDO_JOURNAL_DIR, strlen(EON_UNDO_JOURNAL_DIR), &dir_path);
+
+  if (!(dir = opendir(dir_path))) {
+    free(dir_path);
+    return EON_ERR;
+  }
+
+  now = time(NULL);
+
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') continue;
+    if (asprintf(&path, "%s/%s", dir_path, entry->d_name) < 0) continue;
+
+    if (lstat(path, &st) == 0 && S_ISREG(st.st_mode) && now - st.st_mtime > EON_UNDO_JOURNAL_MAX_AGE) {
+      fd = open(path, O_RDONLY);
+      if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0) unlink(path);
+      if (fd >= 0) close(fd);
+    }
+
+    free(path);
+  }
+
+  closedir(dir);
+  free(dir_path);
+  return EON_OK;
+}
+
+// Open the journal of file_path for appending and log the session start
+static int _undo_journal_open_file(undo_journal_t* self, char* file_path) {
+  char real[PATH_MAX + 1];
+  char* dir;
+  char* header;
+  char* line;
+  size_t line_cap;
+  FILE* fp;
+  int fd;
+  int is_valid;
+
+  if (!realpath(file_path, real)) return EON_ERR;
+
+  util_expand_tilde(EON_UNDO_JOURNAL_DIR, strlen(EON_UNDO_JOURNAL_DIR), &dir);
+
+  if (!util_mkdir_p(dir, 0700)) {
+    free(dir);
+    return EON_ERR;
+  }
+
+  // One journal per path, named by its hash
+  self->path = NULL;
+  if (asprintf(&self->path, "%s/%016llx", dir, (unsigned long long)util_fnv1a(real, strlen(real))) < 0) self->path = NULL;
+  free(dir);
+  if (!self->path) return EON_ERR;
+
+  if (asprintf(&header, "%s %s\n", EON_UNDO_JOURNAL_MAGIC, real) < 0) header = NULL;
+  fd = header ? open(self->path, O_WRONLY | O_CREAT | O_APPEND, 0600) : -1;
+
+  // Another session journaling the same file keeps the journal to itself
+  if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    close(fd);
+    fd = -1;
+  }
+
+  // Start over if the journal is for another path that hashed the same
+  is_valid = 0;
+
+  if (fd >= 0 && (fp = fopen(self->path, "rb")) != NULL) {
+    line = NULL;
+    line_cap = 0;
+    is_valid = getline(&line, &line_cap, fp) > 0 && strcmp(line, header) == 0 ? 1 : 0;
+    if (line) free(line);
+    fclose(fp);
+  }
+
+  if (fd >= 0 && !is_valid && ftruncate(fd, 0) != 0) {
+    close(fd);
+    fd = -1;
+  }
+
+  if (fd < 0 || !(self->fp = fdopen(fd, "ab"))) {
+    if (fd >= 0) close(fd);
+    if (header) free(header);
+    free(self->path);
+    self->path = NULL;
+    return EON_ERR;
+  }
+
+  if (!is_valid) fputs(header, self->fp);
+  free(header);
+  fflush(self->fp);
+  fseek(self->fp, 0, SEEK_END);
+
+  self->file_path = strdup(real);
+  self->session_offset = ftell(self->fp);
+  self->compacted_size = 0;
+  self->num_entries = 0;
+  fprintf(self->fp, "o %ld %ld\n", (long)self->open_id.size, self->open_id.mtime);
+  fflush(self->fp);
+  return EON_OK;
+}
+
+// Close the journal file
+static void _undo_journal_close_file(undo_journal_t* self) {
+  if (self->fp) fclose(self->fp);
+  if (self->path) free(self->path);
+  if (self->file_path) free(self->file_path);
+  self->fp = NULL;
+  self->path = NULL;
+  self->file_path = NULL;
+}
+
+// Push an entry to disk, or stop logging if that fails
+static void _undo_journal_flush(undo_journal_t* self) {
+  self->num_entries += 1;
+
+  if (fflush(self->fp) != 0 || ferror(self->fp)) {
+    fclose(self->fp);
+    self->fp = NULL;
+  }
+}
+
+// Write a record entry
+static void _undo_journal_write_rec(FILE* fp, char kind, undo_rec_t* rec) {
+  undo_op_t* op;
+  int i;
+
+  fprintf(fp, "%c %ld %d\n", kind, (long)rec->time, rec->num_ops);
+
+  for (i = 0; i < rec->num_ops; i++) {
+    op = rec->ops + i;
+    fprintf(fp, "%d %ld %ld %ld %ld\n", op->type, (long)op->line_index, (long)op->col, (long)op->num_chars, (long)op->data_len);
+    fwrite(op->data, 1, op->data_len, fp);
+    fputc('\n', fp);
+  }
+}
+
+// Replay the journal up to stop_offset, or all of it if negative. A torn
+// entry at the end, from a crash mid-write, ends the journal.
+static int _undo_journal_parse(undo_journal_t* self, long stop_offset, undo_journal_parse_t* parse) {
+  FILE* fp;
+  char* line;
+  size_t line_cap;
+  long offset;
+  long a;
+  long b;
+  unsigned long long h;
+  int n;
+  undo_rec_t* rec;
+  undo_journal_id_t id;
+
+  if (!(fp = fopen(self->path, "rb"))) return EON_ERR;
+
+  line = NULL;
+  line_cap = 0;
+
+  // Skip header
+  if (getline(&line, &line_cap, fp) < 1) {
+    fclose(fp);
+    if (line) free(line);
+    return EON_ERR;
+  }
+
+  while (1) {
+    offset = ftell(fp);
+    if (getline(&line, &line_cap, fp) < 1) break;
+
+    if (line[0] == 'o' && sscanf(line, "o %ld %ld", &a, &b) == 2) {
+      // Continue from the last save if that is the file opened
+      if (parse->has_saved && parse->saved_id.size == a && parse->saved_id.mtime == b) {
+        parse->live_len = 0;
+        parse->applied = 0;
+
+        for (; parse->live_len < parse->saved_len; parse->live_len++) {
+          if (parse->live_len >= parse->live_cap) {
+            parse->live_cap = parse->live_cap > 0 ? parse->live_cap * 2 : 64;
+            parse->live = realloc(parse->live, sizeof(bint_t) * parse->live_cap);
+          }
+          parse->live[parse->live_len] = parse->saved[parse->live_len];
+        }
+
+        parse->applied = parse->live_len;
+      } else {
+        _undo_journal_discard(parse);
+      }
+
+      if (offset == self->session_offset) {
+        parse->is_in_session = 1;
+        parse->has_base = parse->has_saved && parse->saved_id.size == a && parse->saved_id.mtime == b;
+        parse->base_num = parse->has_base ? parse->applied : 0;
+        parse->base_len = parse->base_num;
+        parse->base_id = parse->saved_id;
+      }
+
+      if (stop_offset >= 0 && offset >= stop_offset) break;
+
+    } else if ((line[0] == 'a' || line[0] == 'j') && sscanf(line + 1, " %ld %d", &a, &n) == 2 && n > 0) {
+      if (_undo_journal_read_rec(fp, (time_t)a, n, &rec) != EON_OK) break;
+      _undo_journal_push_rec(parse, rec, line[0] == 'j');
+
+    } else if (line[0] == 'u' && sscanf(line, "u %d", &n) == 1) {
+      if (n > parse->applied) {
+        _undo_journal_discard(parse);
+      } else {
+        parse->applied -= n;
+      }
+
+    } else if (line[0] == 'r' && sscanf(line, "r %d", &n) == 1) {
+      if (parse->applied + n > parse->live_len) {
+        _undo_journal_discard(parse);
+      } else {
+        parse->applied += n;
+      }
+
+    } else if (line[0] == 'x') {
+      _undo_journal_discard(parse);
+
+    } else if (line[0] == 's' && sscanf(line, "s %ld %ld %llx", &a, &b, &h) == 3) {
+      id.size = a;
+      id.mtime = b;
+      id.hash = (uint64_t)h;
+      parse->saved = realloc(parse->saved, sizeof(bint_t) * EON_MAX(parse->applied, 1));
+      if (parse->applied > 0) memcpy(parse->saved, parse->live, sizeof(bint_t) * parse->applied);
+      parse->saved_len = parse->applied;
+      parse->saved_id = id;
+      parse->has_saved = 1;
+      parse->base_len = EON_MIN(parse->base_len, parse->saved_len);
+
+    } else {
+      break;
+    }
+  }
+
+  if (line) free(line);
+  fclose(fp);
+  return EON_OK;
+}
+
+// Read the ops of a record entry
+static int _undo_journal_read_rec(FILE* fp, time_t when, int num_ops, undo_rec_t** ret_rec) {
+  undo_rec_t* rec;
+  undo_op_t* op;
+  long line_index;
+  long col;
+  long num_chars;
+  long data_len;
+  int type;
+  int i;
+
+  rec = calloc(1, sizeof(undo_rec_t));
+  rec->time = when;
+  rec->ops = calloc(num_ops, sizeof(undo_op_t));
+
+  for (i = 0; i < num_ops; i++) {
+    op = rec->ops + i;
+
+    if (fscanf(fp, "%d %ld %ld %ld %ld", &type, &line_index, &col, &num_chars, &data_len) != 5
+      || fgetc(fp) != '\n'
+      || data_len < 0
+    ) {
+      break;
+    }
+
+    op->type = type;
+    op->line_index = line_index;
+    op->col = col;
+    op->num_chars = num_chars;
+    op->data = malloc(EON_MAX(data_len, 1));
+    op->data_len = data_len;
+    rec->num_ops = i + 1;
+
+    if ((long)fread(op->data, 1, data_len, fp) != data_len || fgetc(fp) != '\n') break;
+  }
+
+  if (i < num_ops) {
+    _undo_journal_free_rec(rec);
+    return EON_ERR;
+  }
+
+  *ret_rec = rec;
+  return EON_OK;
+}
+
+// Add a record to the history, dropping undone ones
+static void _undo_journal_push_rec(undo_journal_parse_t* parse, undo_rec_t* rec, int is_join) {
+  undo_rec_t* prev;
+  int i;
+
+  if (parse->recs_len >= parse->recs_cap) {
+    parse->recs_cap = parse->recs_cap > 0 ? parse->recs_cap * 2 : 64;
+    parse->recs = realloc(parse->recs, sizeof(undo_rec_t*) * parse->recs_cap);
+  }
+
+  // Records past applied were undone, so they go
+  parse->live_len = parse->applied;
+
+  // Joining a record no longer kept leaves one with no known start
+  if (is_join && parse->applied < 1) {
+    _undo_journal_free_rec(rec);
+    _undo_journal_discard(parse);
+    return;
+  }
+
+  // A join replaces the last record with a longer copy, as the history of
+  // a save may hold the old one
+  if (is_join && parse->applied > 0) {
+    prev = parse->recs[parse->live[parse->applied - 1]];
+    rec->ops = realloc(rec->ops, sizeof(undo_op_t) * (prev->num_ops + rec->num_ops));
+    memmove(rec->ops + prev->num_ops, rec->ops, sizeof(undo_op_t) * rec->num_ops);
+
+    for (i = 0; i < prev->num_ops; i++) {
+      rec->ops[i] = prev->ops[i];
+      rec->ops[i].data = malloc(EON_MAX(prev->ops[i].data_len, 1));
+      memcpy(rec->ops[i].data, prev->ops[i].data, prev->ops[i].data_len);
+    }
+
+    rec->num_ops += prev->num_ops;
+    parse->applied -= 1;
+    parse->live_len -= 1;
+  }
+
+  if (parse->is_in_session) parse->base_len = EON_MIN(parse->base_len, parse->applied);
+
+  if (parse->live_len >= parse->live_cap) {
+    parse->live_cap = parse->live_cap > 0 ? parse->live_cap * 2 : 64;
+    parse->live = realloc(parse->live, sizeof(bint_t) * parse->live_cap);
+  }
+
+  parse->recs[parse->recs_len] = rec;
+  parse->live[parse->live_len++] = parse->recs_len++;
+  parse->applied = parse->live_len;
+}
+
+// Forget the history read so far
+static void _undo_journal_discard(undo_journal_parse_t* parse) {
+  parse->live_len = 0;
+  parse->applied = 0;
+  parse->base_len = 0;
+}
+
+// Free what was read
+static void _undo_journal_parse_free(undo_journal_parse_t* parse) {
+  bint_t i;
+
+  for (i = 0; i < parse->recs_len; i++) _undo_journal_free_rec(parse->recs[i]);
+
+  if (parse->recs) free(parse->recs);
+  if (parse->live) free(parse->live);
+  if (parse->saved) free(parse->saved);
+}
+
+// Rewrite the journal as just the history as of the last save, oldest
+// records first to go if it is over the undo memory cap
+static int _undo_journal_compact(undo_journal_t* self) {
+  undo_journal_parse_t parse;
+  undo_rec_t* rec;
+  char* tmp_path;
+  FILE* fp;
+  bint_t bytes;
+  bint_t drop;
+  bint_t split;
+  bint_t i;
+  int j;
+  int is_base;
+  long session_offset;
+
+  memset(&parse, 0, sizeof(undo_journal_parse_t));
+
+  if (_undo_journal_parse(self, -1, &parse) != EON_OK || !parse.has_saved) {
+    _undo_journal_parse_free(&parse);
+    return EON_ERR;
+  }
+
+  // Drop the oldest records over the cap
+  bytes = 0;
+  drop = parse.saved_len;
+
+  while (drop > 0) {
+    rec = parse.recs[parse.saved[drop - 1]];
+    for (j = 0; j < rec->num_ops; j++) bytes += (bint_t)sizeof(undo_op_t) + rec->ops[j].data_len;
+    if (self->editor->undo_max_bytes > 0 && bytes > self->editor->undo_max_bytes) break;
+    drop -= 1;
+  }
+
+  if (asprintf(&tmp_path, "%s.tmp", self->path) < 0) {
+    _undo_journal_parse_free(&parse);
+    return EON_ERR;
+  }
+
+  // Lock the new journal before it replaces the old one
+  if (!(fp = fopen(tmp_path, "wb"))) {
+    free(tmp_path);
+    _undo_journal_parse_free(&parse);
+    return EON_ERR;
+  }
+
+  fchmod(fileno(fp), 0600);
+  flock(fileno(fp), LOCK_EX | LOCK_NB);
+  fprintf(fp, "%s %s\n", EON_UNDO_JOURNAL_MAGIC, self->file_path);
+
+  // Records this session started from, if it still does, then its own
+  is_base = parse.has_base && parse.base_len == parse.base_num ? 1 : 0;
+  split = is_base ? EON_MAX(drop, parse.base_len) : drop;
+
+  if (is_base) {
+    for (i = drop; i < split; i++) _undo_journal_write_rec(fp, 'a', parse.recs[parse.saved[i]]);
+    fprintf(fp, "s %ld %ld %016llx\n", (long)parse.base_id.size, parse.base_id.mtime, (unsigned long long)parse.base_id.hash);
+  }
+
+  session_offset = ftell(fp);
+  fprintf(fp, "o %ld %ld\n", (long)self->open_id.size, self->open_id.mtime);
+
+  for (i = split; i < parse.saved_len; i++) _undo_journal_write_rec(fp, 'a', parse.recs[parse.saved[i]]);
+
+  fprintf(fp, "s %ld %ld %016llx\n", (long)parse.saved_id.size, parse.saved_id.mtime, (unsigned long long)parse.saved_id.hash);
+  _undo_journal_parse_free(&parse);
+
+  if (fflush(fp) != 0 || ferror(fp) || rename(tmp_path, self->path) != 0) {
+    fclose(fp);
+    unlink(tmp_path);
+    free(tmp_path);
+    return EON_ERR;
+  }
+
+  free(tmp_path);
+
+  // Undone records are not in the new journal. Closing the old one drops
+  // its lock.
+  fclose(self->fp);
+  self->fp = fp;
+
+  self->session_offset = session_offset;
+  self->compacted_size = ftell(self->fp);
+  return EON_OK;
+}
+
+// Free a record
+static void _undo_journal_free_rec(undo_rec_t* rec) {
+  int i;
+
+  if (rec->ops) {
+    for (i = 0; i < rec->num_ops; i++) free(rec->ops[i].data);
+    free(rec->ops);
+  }
+
+  free(rec);
+}
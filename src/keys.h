@@ -97,10 +97,12 @@ EON_KEY_DEF("MS-w", TB_META_ALTSHIFT, 87, 0)
 EON_KEY_DEF("MS-s", TB_META_ALTSHIFT, 83, 0)
 EON_KEY_DEF("MS-a", TB_META_ALTSHIFT, 65, 0)
 EON_KEY_DEF("MS-d", TB_META_ALTSHIFT, 68, 0)
+EON_KEY_DEF("MS-g", TB_META_ALTSHIFT, 71, 0)
 
 EON_KEY_DEF("S-home", TB_META_SHIFT, 0, TB_KEY_HOME)
 EON_KEY_DEF("S-end", TB_META_SHIFT, 0, TB_KEY_END)
 EON_KEY_DEF("S-delete", TB_META_SHIFT, 0, TB_KEY_DELETE)
+EON_KEY_DEF("S-F3", TB_META_SHIFT, 0, TB_KEY_F3)
 
 EON_KEY_DEF("C-page-up", TB_META_CTRL, 0, TB_KEY_PGUP)
 EON_KEY_DEF("C-page-down", TB_META_CTRL, 0, TB_KEY_PGDN)
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
@@ -13,6 +14,7 @@ int add_listener(const char * when, const char * event, const char * func);
 int register_func_as_command(const char * func);
 int add_plugin_keybinding(const char * keys, const char * func);
 int start_callback_prompt(cmd_context_t * ctx, char * text, int);
+int start_plugin_process(cmd_context_t * ctx, const char * cmd, int data_ref, int exit_ref);
 
 /* plugin functions
 -----------------------------------------------------------*/
@@ -155,6 +157,35 @@ static int open_new_tab(lua_State * L) {
   return 1;
 }
 
+// spawn(command, on_data, on_exit)
+// runs command in the background, without blocking the editor loop.
+// on_data(chunk) gets its output as it arrives and on_exit(code) is called
+// when it finishes. both are optional. returns the pid.
+static int spawn(lua_State * L) {
+  const char * cmd = luaL_checkstring(L, 1);
+  int data_ref = 0, exit_ref = 0;
+
+  if (lua_isfunction(L, 2)) {
+    lua_pushvalue(L, 2);
+    data_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+
+  if (lua_isfunction(L, 3)) {
+    lua_pushvalue(L, 3);
+    exit_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+
+  int pid = start_plugin_process(plugin_ctx, cmd, data_ref, exit_ref);
+  if (pid < 0) {
+    if (data_ref) luaL_unref(L, LUA_REGISTRYINDEX, data_ref);
+    if (exit_ref) luaL_unref(L, LUA_REGISTRYINDEX, exit_ref);
+    return 0;
+  }
+
+  lua_pushinteger(L, pid);
+  return 1;
+}
+
 static int draw(lua_State * L) {
   int x = lua_tointeger(L, 1);
   int y = lua_tointeger(L, 2);
@@ -347,6 +378,211 @@ static int append_buffer_at_line(lua_State *L) {
   return 1;
 };
 
+// get_lines(first, last)
+// returns a table with the contents of lines first..last (0-indexed; the
+// table itself is 1-indexed), walking the buffer once instead of seeking
+// for each line
+static int get_lines(lua_State * L) {
+  buffer_t * buffer = plugin_ctx->bview->buffer;
+  int first = lua_tointeger(L, 1);
+  int last  = luaL_optinteger(L, 2, buffer->line_count - 1);
+
+  if (first < 0) first = 0;
+  if (last >= buffer->line_count) last = buffer->line_count - 1;
+  if (last < first) return 0;
+
+  bline_t * line;
+  buffer_get_bline(buffer, first, &line);
+  if (!line) return 0;
+
+  int i, count = last - first + 1;
+  lua_createtable(L, count, 0);
+  for (i = 1; line && i <= count; i++, line = line->next) {
+    lua_pushlstring(L, line->data, line->data_len);
+    lua_rawseti(L, -2, i);
+  }
+
+  return 1;
+}
+
+// number of utf-8 chars in the first len bytes of data
+static bint_t _count_chars(const char * data, size_t len) {
+  bint_t n = 0;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    if (((unsigned char)data[i] & 0xc0) != 0x80) n++;
+  }
+  return n;
+}
+
+static int _is_continuation(const char * data, size_t len, size_t i) {
+  return i < len && ((unsigned char)data[i] & 0xc0) == 0x80;
+}
+
+// rewrites line so it reads str, touching only the part between the
+// common start and end of both. marks outside that part stay where they are.
+static int _set_line(bline_t * line, const char * str, size_t len) {
+  const char * data = line->data;
+  size_t data_len = line->data_len;
+  size_t prefix = 0, suffix = 0;
+  bint_t col, num_chars, ret_chars;
+  size_t ins_len;
+
+  while (prefix < data_len && prefix < len && data[prefix] == str[prefix]) prefix++;
+  while (prefix > 0 && (_is_continuation(data, data_len, prefix) || _is_continuation(str, len, prefix))) prefix--;
+
+  while (suffix < data_len - prefix && suffix < len - prefix
+    && data[data_len - suffix - 1] == str[len - suffix - 1]) suffix++;
+  while (suffix > 0 && (_is_continuation(data, data_len, data_len - suffix) || _is_continuation(str, len, len - suffix))) suffix--;
+
+  col = _count_chars(data, prefix);
+  num_chars = _count_chars(data + prefix, data_len - prefix - suffix);
+  ins_len = len - prefix - suffix;
+
+  if (num_chars > 0 && ins_len > 0) return bline_replace(line, col, num_chars, (char *)str + prefix, ins_len);
+  if (num_chars > 0) return bline_delete(line, col, num_chars);
+  if (ins_len > 0) return bline_insert(line, col, (char *)str + prefix, ins_len, &ret_chars);
+  return MLBUF_OK;
+}
+
+// set_lines(first, last, lines)
+// replaces lines first..last (0-indexed) with the strings in the lines table.
+// only lines that differ are rewritten, and within them only the part that
+// changed, so cursors and marks elsewhere stay put. it all goes in as one
+// bview edit, so restyling runs once and it undoes as one step.
+// an empty table removes the lines altogether.
+static int set_lines(lua_State * L) {
+  buffer_t * buffer = plugin_ctx->bview->buffer;
+  int first = lua_tointeger(L, 1);
+  int last  = lua_tointeger(L, 2);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  if (first < 0 || last < first || last >= buffer->line_count) return 0;
+
+  bline_t * start_line;
+  bline_t * end_line;
+  buffer_get_bline(buffer, first, &start_line);
+  if (!start_line) return 0;
+
+  int old_count = last - first + 1;
+  int new_count = lua_objlen(L, 3);
+  int num_pairs = old_count < new_count ? old_count : new_count;
+  int i, res = MLBUF_OK;
+
+  // find the last line of the range, checking the new entries are all strings
+  for (i = 1, end_line = start_line; i < old_count; i++) end_line = end_line->next;
+  for (i = 1; i <= new_count; i++) {
+    lua_rawgeti(L, 3, i);
+    if (!lua_isstring(L, -1)) return luaL_error(L, "set_lines: entry %d is not a string", i);
+    lua_pop(L, 1);
+  }
+
+  bline_t * line;
+  bline_t * prev;
+  bint_t offset, num_chars = 0;
+  size_t len;
+  const char * str;
+
+  bview_begin_edit(plugin_ctx->bview);
+
+  if (new_count < 1) {
+    for (line = start_line; line != end_line->next; line = line->next) {
+      MLBUF_BLINE_ENSURE_CHARS(line);
+      num_chars += line->char_count + (line == end_line ? 0 : 1); // plus newline
+    }
+
+    if (end_line->next) { // remove lines along with the trailing newline
+      buffer_get_offset(buffer, start_line, 0, &offset);
+      res = buffer_delete(buffer, offset, num_chars + 1);
+    } else if (start_line->prev) { // last lines of the buffer, remove the preceding newline
+      MLBUF_BLINE_ENSURE_CHARS(start_line->prev);
+      buffer_get_offset(buffer, start_line->prev, start_line->prev->char_count, &offset);
+      res = buffer_delete(buffer, offset, num_chars + 1);
+    } else { // whole buffer
+      res = buffer_delete(buffer, 0, num_chars);
+    }
+
+    bview_end_edit(plugin_ctx->bview);
+    lua_pushnumber(L, res);
+    return 1;
+  }
+
+  // find the last line that pairs with a new entry
+  for (i = 1, line = start_line; i < num_pairs; i++) line = line->next;
+
+  // lines past the pairs are removed, or extra entries added after them.
+  // this goes first as it is the bottom of the range.
+  MLBUF_BLINE_ENSURE_CHARS(line);
+  buffer_get_offset(buffer, line, line->char_count, &offset);
+
+  if (old_count > new_count) {
+    for (prev = line->next; prev != end_line->next; prev = prev->next) {
+      MLBUF_BLINE_ENSURE_CHARS(prev);
+      num_chars += 1 + prev->char_count; // newline plus line
+    }
+    res = buffer_delete(buffer, offset, num_chars);
+  } else if (new_count > old_count) {
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    for (i = num_pairs + 1; i <= new_count; i++) {
+      luaL_addchar(&b, '\n');
+      lua_rawgeti(L, 3, i);
+      luaL_addvalue(&b);
+    }
+    luaL_pushresult(&b);
+    str = lua_tolstring(L, -1, &len);
+    res = buffer_insert(buffer, offset, (char *)str, (bint_t)len, NULL);
+    lua_pop(L, 1);
+  }
+
+  // then rewrite the paired lines that differ, bottom up so the blines
+  // above stay where they are
+  for (i = num_pairs; i >= 1 && res == MLBUF_OK; i--, line = prev) {
+    prev = line->prev;
+    lua_rawgeti(L, 3, i);
+    str = lua_tolstring(L, -1, &len);
+    res = _set_line(line, str, len);
+    lua_pop(L, 1);
+  }
+
+  bview_end_edit(plugin_ctx->bview);
+
+  lua_pushnumber(L, res);
+  return 1;
+}
+
+static int _each_line_next(lua_State * L) {
+  bline_t * line = (bline_t *)lua_touserdata(L, lua_upvalueindex(1));
+  int last = lua_tointeger(L, lua_upvalueindex(2));
+  if (!line || line->line_index > last) return 0;
+
+  // advance now so the current line may be modified by the loop body
+  lua_pushlightuserdata(L, line->next);
+  lua_replace(L, lua_upvalueindex(1));
+
+  lua_pushinteger(L, line->line_index);
+  lua_pushlstring(L, line->data, line->data_len);
+  return 2;
+}
+
+// for i, line in each_line(first, last) do ... end
+// walks lines first..last following the bline list, without seeking for
+// each one. lines must not be added or removed while iterating.
+static int each_line(lua_State * L) {
+  buffer_t * buffer = plugin_ctx->bview->buffer;
+  int first = luaL_optinteger(L, 1, 0);
+  int last  = luaL_optinteger(L, 2, buffer->line_count - 1);
+
+  bline_t * line = NULL;
+  if (first >= 0 && first < buffer->line_count) {
+    buffer_get_bline(buffer, first, &line);
+  }
+
+  lua_pushlightuserdata(L, line);
+  lua_pushinteger(L, last);
+  lua_pushcclosure(L, _each_line_next, 2);
+  return 1;
+}
+
 static int set_line_bg_color(lua_State * L) {
   int line_index = lua_tointeger(L, 1);
   int color = lua_tointeger(L, 2);
@@ -357,6 +593,98 @@ static int set_line_bg_color(lua_State * L) {
   return 1;
 }
 
+/* ffi access
+-----------------------------------------------------------*/
+
+// read-only view of a buffer line, for plugins using the eon.ffi module.
+// data points straight into the bline, so a view is only valid until the
+// buffer is next modified.
+typedef struct eon_line_s {
+  const char * data;
+  int len;
+  int index;
+  bline_t * bline;
+} eon_line_t;
+
+// these are called from lua through ffi.C, so they must stay exported
+int eon_ffi_line_count(void) {
+  return plugin_ctx->bview->buffer->line_count;
+}
+
+static int _eon_ffi_set_line(eon_line_t * view, bline_t * line) {
+  if (!line) return 0;
+
+  view->data  = line->data;
+  view->len   = line->data_len;
+  view->index = line->line_index;
+  view->bline = line;
+  return 1;
+}
+
+int eon_ffi_line_at(int index, eon_line_t * view) {
+  bline_t * line = NULL;
+  if (index < 0 || index >= plugin_ctx->bview->buffer->line_count) return 0;
+
+  buffer_get_bline(plugin_ctx->bview->buffer, index, &line);
+  return _eon_ffi_set_line(view, line);
+}
+
+int eon_ffi_line_next(eon_line_t * view) {
+  if (!view->bline) return 0;
+  return _eon_ffi_set_line(view, view->bline->next);
+}
+
+// require("eon.ffi")
+// local view = ffi.line(0); ffi.tostring(view)
+// for view in ffi.lines(first, last) do ... view.data[0], view.len ... end
+// the iterator reuses a single view, so it doesn't allocate per line.
+static const char * ffi_module =
+  "local ffi = require('ffi')\n"
+  "ffi.cdef[[\n"
+  "  typedef struct eon_line_s { const char * data; int len; int index; void * bline; } eon_line_t;\n"
+  "  int eon_ffi_line_count(void);\n"
+  "  int eon_ffi_line_at(int index, eon_line_t * view);\n"
+  "  int eon_ffi_line_next(eon_line_t * view);\n"
+  "]]\n"
+  "local C = ffi.C\n"
+  "local M = {}\n"
+  "function M.line_count() return C.eon_ffi_line_count() end\n"
+  "function M.line(index)\n"
+  "  local view = ffi.new('eon_line_t')\n"
+  "  if C.eon_ffi_line_at(index, view) == 0 then return nil end\n"
+  "  return view\n"
+  "end\n"
+  "function M.lines(first, last)\n"
+  "  local view = ffi.new('eon_line_t')\n"
+  "  local started = false\n"
+  "  first = first or 0\n"
+  "  last = last or C.eon_ffi_line_count() - 1\n"
+  "  return function()\n"
+  "    local ok\n"
+  "    if started then ok = C.eon_ffi_line_next(view)\n"
+  "    else ok = C.eon_ffi_line_at(first, view); started = true end\n"
+  "    if ok == 0 or view.index > last then return nil end\n"
+  "    return view\n"
+  "  end\n"
+  "end\n"
+  "function M.tostring(view) return ffi.string(view.data, view.len) end\n"
+  "return M\n";
+
+// registers eon.ffi in package.preload, so it is only compiled if a plugin requires it
+static void load_ffi_module(lua_State * L) {
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+
+  if (luaL_loadbuffer(L, ffi_module, strlen(ffi_module), "eon.ffi") == 0) {
+    lua_setfield(L, -2, "eon.ffi");
+  } else {
+    fprintf(stderr, "Could not load eon.ffi module: %s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+
+  lua_pop(L, 2);
+}
+
 void load_plugin_api(lua_State *luaMain) {
 
   lua_pushcfunction(luaMain, get_option);
@@ -381,6 +709,12 @@ void load_plugin_api(lua_State *luaMain) {
   lua_setglobal(luaMain, "get_buffer_at_line");
   lua_pushcfunction(luaMain, set_buffer_at_line);
   lua_setglobal(luaMain, "set_buffer_at_line");
+  lua_pushcfunction(luaMain, get_lines);
+  lua_setglobal(luaMain, "get_lines");
+  lua_pushcfunction(luaMain, set_lines);
+  lua_setglobal(luaMain, "set_lines");
+  lua_pushcfunction(luaMain, each_line);
+  lua_setglobal(luaMain, "each_line");
 
   lua_pushcfunction(luaMain, insert_buffer_at_line);
   lua_setglobal(luaMain, "insert_buffer_at_line");
@@ -400,6 +734,8 @@ void load_plugin_api(lua_State *luaMain) {
   lua_setglobal(luaMain, "open_new_tab");
   lua_pushcfunction(luaMain, draw);
   lua_setglobal(luaMain, "draw");
+  lua_pushcfunction(luaMain, spawn);
+  lua_setglobal(luaMain, "spawn");
 
   lua_pushcfunction(luaMain, start_nav);
   lua_setglobal(luaMain, "start_nav");
@@ -424,4 +760,6 @@ void load_plugin_api(lua_State *luaMain) {
   lua_setglobal(luaMain, "get_url");
   lua_pushcfunction(luaMain, download_file);
   lua_setglobal(luaMain, "download_file");
+
+  load_ffi_module(luaMain);
 }
\ No newline at end of file
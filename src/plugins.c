@@ -2,14 +2,28 @@
 #include <string.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
+#include <luajit.h>
 #include "eon.h"
 #include "vector.h"
 #include "jsmn.h"
 
 void load_plugin_api(lua_State *luaMain);
+static void _plugin_procs_destroy_all(editor_t * editor);
+static void budget_alarm(int signum);
+plugin_opt * get_plugin_option(const char * key);
+int add_listener(const char * when, const char * event, const char * func);
+int register_func_as_command(const char * func);
+int add_plugin_keybinding(const char * keys, const char * func);
 
 /*-----------------------------------------------------*/
 
@@ -22,11 +36,27 @@ vector events;
 vector listeners;
 
 typedef struct listener {
-  char plugin[32];
-  char func[32];
+  char * plugin;
+  char * func;
   struct listener *next;
 } listener;
 
+// runtime stats and time budget for each loaded plugin
+typedef struct plugin_stat {
+  char * name;
+  unsigned long calls;
+  double total_ms;
+  double max_ms;
+  int budget_ms;
+  int max_overruns;
+  int is_strict; // run with the jit off, so compiled loops can't outlast the budget
+  int overruns;
+  int is_disabled;
+  int is_loaded;
+} plugin_stat;
+
+vector plugin_stats;
+
 /////////////////////////////////////////////
 
 int plugin_count = 0;
@@ -35,6 +65,14 @@ editor_t * editor_ref; // needed for function calls from lua when booting
 char * booting_plugin_name;
 
 const char * plugin_path = "~/.config/eon/plugins";
+const char * plugin_cache_path = "~/.cache/eon/plugins";
+
+static char * plugin_dir = NULL; // expanded plugin_path
+static char * plugin_cache_dir = NULL; // expanded plugin_cache_path, NULL if unusable
+static FILE * boot_cache = NULL; // set while recording a plugin's boot metadata
+static int is_replaying_boot = 0; // set while lazily booting a plugin restored from cache
+
+static int ensure_plugin_loaded(plugin_stat * stat);
 
 // for option parsing
 #define MAX_TOKENS 32
@@ -70,6 +108,7 @@ int unload_plugins(void) {
     return 0;
 
   // printf("Unloading plugins...\n");
+  if (editor_ref) _plugin_procs_destroy_all(editor_ref);
   lua_close(luaMain);
   luaMain = NULL;
 
@@ -86,12 +125,23 @@ int unload_plugins(void) {
     obj = vector_get(&listeners, i);
     while(obj) {
       temp = obj->next;
+      free(obj->plugin);
+      free(obj->func);
       free(obj);
       obj = temp;
     };
   }
 
   vector_free(&listeners);
+
+  plugin_stat * stat;
+  for (i = 0; i < vector_size(&plugin_stats); i++) {
+    stat = vector_get(&plugin_stats, i);
+    free(stat->name);
+    free(stat);
+  }
+
+  vector_free(&plugin_stats);
   return 0;
 }
 
@@ -103,6 +153,7 @@ int init_plugins(void) {
   vector_init(&plugin_versions, 1);
   vector_init(&events, 1);
   vector_init(&listeners, 1);
+  vector_init(&plugin_stats, 1);
 
   luaMain = luaL_newstate();
   if (!luaMain) {
@@ -112,14 +163,229 @@ int init_plugins(void) {
 
   luaL_openlibs(luaMain);
   load_plugin_api(luaMain);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(struct sigaction));
+  action.sa_handler = budget_alarm;
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGPROF, &action, NULL);
   return 0;
 }
 
 
+plugin_stat * get_plugin_stat(const char * pname) {
+  int i;
+  plugin_stat * stat;
+
+  for (i = 0; i < vector_size(&plugin_stats); i++) {
+    stat = vector_get(&plugin_stats, i);
+    if (strcmp(stat->name, pname) == 0) return stat;
+  }
+
+  return NULL;
+}
+
+static editor_t * get_editor(void) {
+  return plugin_ctx ? plugin_ctx->editor : editor_ref;
+}
+
+static plugin_stat * running_stat = NULL; // plugin whose code is currently running
+static lua_State * running_L = NULL; // set while the budget timer may fire
+static pthread_t running_thread;
+static struct timespec running_since;
+static int budget_exceeded = 0;
+static int budget_suspended = 0; // depth of editor work the clock is stopped for
+static struct timespec suspended_since;
+
+// cpu time is used rather than wall time so that prompts opened by a plugin,
+// which wait for the user, don't count against it
+static double cpu_ms_since(struct timespec * since) {
+  struct timespec now;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+  return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1000000.0;
+}
+
+// cpu time left in the running plugin's budget, 0 if no budget applies
+static double budget_left(void) {
+  double left;
+
+  if (!running_stat || running_stat->budget_ms <= 0) return 0;
+  left = running_stat->budget_ms - cpu_ms_since(&running_since);
+  return left > 0.001 ? left : 0.001;
+}
+
+// start the budget timer, which counts the same cpu time as the clock above,
+// or stop it if ms is 0
+static void budget_arm(double ms) {
+  struct itimerval it;
+  long us = (long)(ms * 1000.0);
+
+  memset(&it, 0, sizeof(struct itimerval));
+  if (ms > 0) {
+    if (us < 1) us = 1;
+    it.it_value.tv_sec = us / 1000000;
+    it.it_value.tv_usec = us % 1000000;
+  }
+
+  setitimer(ITIMER_PROF, &it, NULL);
+}
+
+static void budget_hook(lua_State * L, lua_Debug * ar) {
+  if (!running_stat || running_stat->budget_ms <= 0 || budget_suspended) return;
+
+  // the timer may beat the clock by a hair, or fire just as it was stopped
+  if (cpu_ms_since(&running_since) < running_stat->budget_ms) {
+    lua_sethook(L, NULL, 0, 0);
+    budget_arm(budget_left());
+    return;
+  }
+
+  budget_exceeded = 1;
+  luaL_error(L, "exceeded time budget of %d ms", running_stat->budget_ms);
+}
+
+// the budget timer fired. plugin code runs unhooked, and so compiled, until
+// its budget is used up; only then is the hook set to stop it.
+static void budget_alarm(int signum) {
+  if (!running_L) return;
+
+  // the signal goes to any thread, but the hook must be set by the lua one
+  if (!pthread_equal(pthread_self(), running_thread)) {
+    pthread_kill(running_thread, signum);
+    return;
+  }
+
+  lua_sethook(running_L, budget_hook, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, EON_PLUGIN_HOOK_COUNT);
+}
+
+// whether the jit compiler is on, as jit.status() reports it
+static int jit_is_on(lua_State * L) {
+  int is_on = 0;
+
+  lua_getglobal(L, "jit");
+  if (lua_istable(L, -1)) {
+    lua_getfield(L, -1, "status");
+    if (lua_isfunction(L, -1) && lua_pcall(L, 0, 1, 0) == 0) is_on = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+  }
+
+  lua_pop(L, 1);
+  return is_on;
+}
+
+// move the start of the running plugin's clock forward by ms, so work done
+// on its behalf is not charged to it
+static void budget_shift(double ms) {
+  long ns = (long)(ms * 1000000.0);
+
+  running_since.tv_sec += ns / 1000000000;
+  running_since.tv_nsec += ns % 1000000000;
+  if (running_since.tv_nsec >= 1000000000) {
+    running_since.tv_sec += 1;
+    running_since.tv_nsec -= 1000000000;
+  }
+}
+
+// stop the running plugin's clock while the editor does work it waits on,
+// like the loop of a prompt it opened, and restart it after
+void plugin_budget_suspend(int is_suspend) {
+  if (!running_stat) return;
+
+  if (is_suspend) {
+    if (budget_suspended++ == 0) {
+      budget_arm(0);
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &suspended_since);
+    }
+  } else if (budget_suspended > 0 && --budget_suspended == 0) {
+    budget_shift(cpu_ms_since(&suspended_since));
+    budget_arm(budget_left());
+  }
+}
+
+// call the function on top of L's stack on behalf of a plugin, enforcing
+// its time budget and keeping track of its runtime. the hook that enforces
+// it is set when the budget timer fires, but a compiled loop that never
+// leaves its trace won't see it, so plugins with strict_budget set run with
+// the jit off.
+static int plugin_pcall(lua_State * L, plugin_stat * stat, int nargs, int nresults) {
+  plugin_stat * prev_stat = running_stat;
+  lua_State * prev_L = running_L;
+  struct timespec prev_since = running_since;
+  int prev_suspended = budget_suspended;
+  int is_jit_off = 0;
+  double elapsed;
+  int res;
+
+  if (stat && stat->is_disabled) {
+    lua_pop(L, nargs + 1);
+    return -1;
+  }
+
+  // only switch it off if it was on, so that restoring it is turning it on
+  if (stat && stat->budget_ms > 0 && stat->is_strict && jit_is_on(L)) {
+    luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+    is_jit_off = 1;
+  }
+
+  // the outer call's timer stops while this one runs
+  running_L = NULL;
+  budget_arm(0);
+
+  running_stat = stat;
+  budget_exceeded = 0;
+  budget_suspended = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &running_since);
+  running_thread = pthread_self();
+  running_L = L;
+  budget_arm(budget_left());
+
+  res = lua_pcall(L, nargs, nresults, 0);
+
+  running_L = NULL;
+  budget_arm(0);
+  elapsed = cpu_ms_since(&running_since);
+  lua_sethook(L, NULL, 0, 0);
+
+  if (is_jit_off) luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_ON);
+
+  if (stat) {
+    stat->calls++;
+    stat->total_ms += elapsed;
+    if (elapsed > stat->max_ms) stat->max_ms = elapsed;
+  }
+
+  if (res != 0 && stat && budget_exceeded) {
+    stat->overruns++;
+
+    if (stat->max_overruns > 0 && stat->overruns >= stat->max_overruns) {
+      stat->is_disabled = 1;
+      EON_SET_ERR(get_editor(), "Plugin %s disabled: exceeded its %d ms time budget %d times", stat->name, stat->budget_ms, stat->overruns);
+    } else {
+      EON_SET_ERR(get_editor(), "Plugin %s interrupted: exceeded its %d ms time budget", stat->name, stat->budget_ms);
+    }
+  }
+
+  // a nested call is charged to its own plugin, not the one around it
+  budget_exceeded = 0;
+  running_stat = prev_stat;
+  running_since = prev_since;
+  budget_suspended = prev_suspended;
+  running_L = prev_L;
+  if (prev_stat && !prev_suspended) {
+    budget_shift(elapsed);
+    budget_arm(budget_left());
+  }
+  return res;
+}
+
 int call_plugin(const char * pname, const char * func, char * data) {
   lua_State  *L;
   // printf(" ----> Calling function %s on plugin %s\n", func, pname);
 
+  // plugins restored from the cache are only compiled when first called
+  plugin_stat * stat = get_plugin_stat(pname);
+  if (stat && ensure_plugin_loaded(stat) != 0) return -1;
+
   L = lua_newthread(luaMain);
   lua_getglobal(L, pname);
   if (lua_isnil(L, -1)) {
@@ -132,7 +398,7 @@ int call_plugin(const char * pname, const char * func, char * data) {
   if (data) lua_pushstring(L, data);
 
   // call it
-  if (lua_pcall(L, data ? 1 : 0, LUA_MULTRET, 0) != 0) {
+  if (plugin_pcall(L, stat, data ? 1 : 0, LUA_MULTRET) != 0) {
     // printf("Fatal: Could not run %s function on plugin: %s\n", func, pname);
     lua_pop(luaMain, 1);
     return -1;
@@ -150,23 +416,225 @@ int call_plugin(const char * pname, const char * func, char * data) {
   return 0;
 }
 
+static plugin_stat * new_plugin_stat(const char * name) {
+  plugin_stat * stat = calloc(1, sizeof(plugin_stat));
+  stat->name = strdup(name);
+  stat->budget_ms = EON_PLUGIN_TIME_BUDGET_MS;
+  stat->max_overruns = EON_PLUGIN_MAX_OVERRUNS;
+  vector_add(&plugin_stats, stat);
+  return stat;
+}
+
+// the cache is keyed by the size and mtime of plugin.lua and plugin.conf
+static int get_plugin_cache_key(const char * dir, const char * name, char * key, size_t key_len) {
+  struct stat st, conf_st;
+  char path[PATH_MAX];
+
+  snprintf(path, sizeof(path), "%s/%s/plugin.lua", dir, name);
+  if (stat(path, &st) != 0) return -1;
+
+  snprintf(path, sizeof(path), "%s/%s/plugin.conf", dir, name);
+  if (stat(path, &conf_st) != 0) memset(&conf_st, 0, sizeof(struct stat));
+
+  snprintf(key, key_len, "eon-plugin-cache %s %ld %ld %ld %ld\n", EON_VERSION,
+    (long)st.st_mtime, (long)st.st_size, (long)conf_st.st_mtime, (long)conf_st.st_size);
+  return 0;
+}
+
+static int bytecode_writer(lua_State * L, const void * p, size_t sz, void * ud) {
+  return fwrite(p, 1, sz, (FILE *)ud) == sz ? 0 : 1;
+}
+
+// compile a plugin and run its body, leaving the plugin table on the stack.
+// uses the cached bytecode if fresh, otherwise compiles the source and
+// refreshes the cache.
+static int load_plugin_chunk(const char * name, int use_cache) {
+  char path[PATH_MAX];
+  FILE * fp;
+  int loaded = 0;
+
+  if (use_cache && plugin_cache_dir) {
+    snprintf(path, sizeof(path), "%s/%s.luac", plugin_cache_dir, name);
+    loaded = luaL_loadfile(luaMain, path) == 0;
+    if (!loaded) lua_pop(luaMain, 1);
+  }
+
+  if (!loaded) {
+    snprintf(path, sizeof(path), "%s/%s/plugin.lua", plugin_dir, name);
+    if (luaL_loadfile(luaMain, path) != 0) {
+      fprintf(stderr, "Could not load plugin: %s\n", lua_tostring(luaMain, -1));
+      lua_pop(luaMain, 1);
+      return -1;
+    }
+
+    if (plugin_cache_dir) {
+      snprintf(path, sizeof(path), "%s/%s.luac", plugin_cache_dir, name);
+      if ((fp = fopen(path, "wb"))) {
+        lua_dump(luaMain, bytecode_writer, fp);
+        fclose(fp);
+      }
+    }
+  }
+
+  if (lua_pcall(luaMain, 0, 1, 0) != 0) {
+    fprintf(stderr, "Could not load plugin: %s\n", lua_tostring(luaMain, -1));
+    lua_pop(luaMain, 1);
+    return -1;
+  }
+
+  return 0;
+}
+
+// run a plugin's boot function, if present, with its options loaded
+static int boot_plugin(const char * name, plugin_stat * stat) {
+  int res;
+
+  lua_getglobal(luaMain, name);
+  lua_getfield(luaMain, -1, "boot");
+  int has_boot = !lua_isnil(luaMain, -1);
+  lua_pop(luaMain, 2);
+
+  if (!has_boot) return 0;
+
+  read_plugin_options(name);
+  booting_plugin_name = (char *)name;
+
+  plugin_opt * opt;
+  if ((opt = get_plugin_option("time_budget"))) {
+    stat->budget_ms = atoi(opt->value);
+    free(opt->value);
+    free(opt);
+  }
+
+  if ((opt = get_plugin_option("max_overruns"))) {
+    stat->max_overruns = atoi(opt->value);
+    free(opt->value);
+    free(opt);
+  }
+
+  if ((opt = get_plugin_option("strict_budget"))) {
+    stat->is_strict = strcmp(opt->value, "true") == 0 || atoi(opt->value) != 0;
+    free(opt->value);
+    free(opt);
+  }
+
+  res = call_plugin(name, "boot", NULL);
+
+  if (json_string) {
+    free(json_string);
+    json_string = NULL;
+  }
+
+  // json_root = NULL;
+  booting_plugin_name = NULL;
+  return res;
+}
+
+// compile and boot a plugin that was registered from the cache. its
+// commands, bindings and listeners are already in place, so boot only
+// runs for its other side effects.
+static int ensure_plugin_loaded(plugin_stat * stat) {
+  if (stat->is_loaded) return 0;
+  stat->is_loaded = 1;
+
+  if (load_plugin_chunk(stat->name, 1) != 0) {
+    stat->is_disabled = 1;
+    return -1;
+  }
+
+  lua_setglobal(luaMain, stat->name);
+
+  is_replaying_boot = 1;
+  boot_plugin(stat->name, stat);
+  is_replaying_boot = 0;
+  return 0;
+}
+
+// register a plugin from the boot metadata recorded in the cache, without
+// compiling it. returns -1 if there's no fresh cache entry for it.
+static int load_cached_plugin(const char * name, const char * key) {
+  char path[PATH_MAX];
+  char * line = NULL;
+  size_t line_cap = 0;
+  char * when = NULL, * event = NULL, * func = NULL;
+  char * version = NULL;
+  int n, eager = 0;
+  plugin_stat * stat;
+  FILE * fp;
+
+  if (!plugin_cache_dir) return -1;
+
+  snprintf(path, sizeof(path), "%s/%s.meta", plugin_cache_dir, name);
+  if (!(fp = fopen(path, "r"))) return -1;
+
+  if (getline(&line, &line_cap, fp) < 0 || strcmp(line, key) != 0) {
+    free(line);
+    fclose(fp);
+    return -1;
+  }
+
+  stat = new_plugin_stat(name);
+  booting_plugin_name = (char *)name;
+
+  // names are read into heap strings, however long they are
+  while (getline(&line, &line_cap, fp) >= 0) {
+    line[strcspn(line, "\n")] = '\0';
+
+    if (strncmp(line, "version ", 8) == 0) {
+      version = strdup(line + 8);
+    } else if (strcmp(line, "eager") == 0) {
+      eager = 1;
+    } else if (sscanf(line, "budget %d %d", &stat->budget_ms, &stat->max_overruns) == 2) {
+      // nothing else to do
+    } else if (strcmp(line, "strict_budget") == 0) {
+      stat->is_strict = 1;
+    } else if (sscanf(line, "command %ms", &func) == 1) {
+      register_func_as_command(func);
+    } else if (sscanf(line, "binding %ms %n", &func, &n) == 1) {
+      add_plugin_keybinding(line + n, func);
+    } else if (sscanf(line, "listener %ms %ms %ms", &when, &event, &func) == 3) {
+      add_listener(when, event, func);
+    }
+
+    free(when);
+    free(event);
+    free(func);
+    when = event = func = NULL;
+  }
+
+  booting_plugin_name = NULL;
+  free(line);
+  fclose(fp);
+
+  plugin_count++;
+  vector_add(&plugin_names, (void *)name);
+  vector_add(&plugin_versions, (void *)version);
+
+  // plugins that set eager = true need to boot right away
+  if (eager) ensure_plugin_loaded(stat);
+
+  printf("Registered cached plugin %d: %s\n", plugin_count, name);
+  return 0;
+}
+
 void load_plugin(const char * dir, const char * name) {
   const char * pname;
   const char * pver;
+  char key[128];
+  char path[PATH_MAX];
+  char tmp_path[PATH_MAX];
+  int eager;
 
-  char path[128];
-  sprintf(path, "%s/%s/plugin.lua", dir, name);
+  if (get_plugin_cache_key(dir, name, key, sizeof(key)) != 0) return;
+  if (load_cached_plugin(name, key) == 0) return;
 
   // printf("Loading plugin in path '%s': %s\n", path, name);
-  if (luaL_dofile(luaMain, path)) {
-    fprintf(stderr, "Could not load plugin: %s\n", lua_tostring(luaMain, -1));
-    return;
-  }
+  if (load_plugin_chunk(name, 0) != 0) return;
 
   // Get and check the plugin's name
   lua_getfield(luaMain, -1, "name");
   if (lua_isnil(luaMain, -1)) {
-    fprintf(stderr, "Could not load file %s: name missing\n", path);
+    fprintf(stderr, "Could not load plugin %s: name missing\n", name);
     lua_pop(luaMain, 2);
     return;
   }
@@ -179,43 +647,97 @@ void load_plugin(const char * dir, const char * name) {
   pver = lua_tostring(luaMain, -1);
   lua_pop(luaMain, 1);
 
+  // plugins whose boot does more than register things can opt out of lazy loading
+  lua_getfield(luaMain, -1, "eager");
+  eager = lua_toboolean(luaMain, -1);
+  lua_pop(luaMain, 1);
+
   // successfully loaded, so increase count
   plugin_count++;
   // printf("Adding %s to list of plugins, as number %d\n", name, plugin_count);
 
   /* Set the loaded plugin to a global using it's name. */
   lua_setglobal(luaMain, name);
+
+  plugin_stat * stat = new_plugin_stat(name);
+  stat->is_loaded = 1;
   vector_add(&plugin_names, (void *)name);
   vector_add(&plugin_versions, (void *)pver);
 
-  // run on_boot function, if present
-  lua_getfield(luaMain, 0, "boot");
-  if (!lua_isnil(luaMain, -1)) { // not nil, so present
-  
-    read_plugin_options(name);
-    booting_plugin_name = (char *)name;
+  // boot it, recording what it registers so next time it can be loaded lazily
+  if (plugin_cache_dir) {
+    snprintf(path, sizeof(path), "%s/%s.meta", plugin_cache_dir, name);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if ((boot_cache = fopen(tmp_path, "w"))) fputs(key, boot_cache);
+  }
 
-    call_plugin(name, "boot", NULL);
-  
-    if (json_string) {
-      free(json_string);
-      json_string = NULL;
-    }
+  int res = boot_plugin(name, stat);
 
-    // json_root = NULL;
-    booting_plugin_name = NULL;
+  if (boot_cache) {
+    if (pver) fprintf(boot_cache, "version %s\n", pver);
+    if (eager) fprintf(boot_cache, "eager\n");
+    fprintf(boot_cache, "budget %d %d\n", stat->budget_ms, stat->max_overruns);
+    if (stat->is_strict) fprintf(boot_cache, "strict_budget\n");
+    fclose(boot_cache);
+    boot_cache = NULL;
+
+    // don't cache a plugin that failed to boot
+    if (res == 0) rename(tmp_path, path);
+    else unlink(tmp_path);
   }
 
   printf("Finished loading plugin %d: %s\n", plugin_count, name);
 }
 
+// Show runtime stats of loaded plugins in a new view
+int cmd_plugin_stats(cmd_context_t * ctx) {
+  str_t h = {0};
+  char buf[256];
+  bview_t * bview;
+  plugin_stat * stat;
+  int i;
+
+  str_append(&h, "# eon plugin stats\n\n");
+  snprintf(buf, sizeof(buf), "    %-32s %8s %12s %10s %10s %9s\n", "plugin", "calls", "total ms", "max ms", "budget ms", "overruns");
+  str_append(&h, buf);
+
+  for (i = 0; i < vector_size(&plugin_stats); i++) {
+    stat = vector_get(&plugin_stats, i);
+    snprintf(buf, sizeof(buf), "    %-32s %8lu %12.3f %10.3f %10d %9d%s\n",
+      stat->name, stat->calls, stat->total_ms, stat->max_ms,
+      stat->budget_ms, stat->overruns, stat->is_disabled ? " (disabled)" : "");
+    str_append(&h, buf);
+  }
+
+  editor_open_bview(ctx->editor, NULL, EON_BVIEW_TYPE_EDIT, NULL, 0, 1, 0, &ctx->editor->rect_edit, NULL, &bview);
+  buffer_insert(bview->buffer, 0, h.data, (bint_t)h.len, NULL);
+  bview->buffer->is_unsaved = 0;
+  mark_move_beginning(bview->active_cursor->mark);
+  bview_zero_viewport_y(bview);
+
+  str_free(&h);
+  return EON_OK;
+}
+
 int load_plugins(editor_t * editor) {
   if (luaMain == NULL && init_plugins() == -1)
     return -1;
 
+  cmd_t cmd = {0};
+  cmd.name = "cmd_plugin_stats";
+  cmd.func = cmd_plugin_stats;
+  editor_register_cmd(editor, &cmd);
+
   editor_ref = editor;
   char* expanded_path;
   util_expand_tilde((char *)plugin_path, strlen(plugin_path), &expanded_path);
+  plugin_dir = expanded_path;
+
+  util_expand_tilde((char *)plugin_cache_path, strlen(plugin_cache_path), &plugin_cache_dir);
+  if (!util_mkdir_p(plugin_cache_dir, 0700)) {
+    free(plugin_cache_dir);
+    plugin_cache_dir = NULL;
+  }
 
   DIR *dir;
   struct dirent *ent;
@@ -380,9 +902,12 @@ int add_listener(const char * when, const char * event, const char * func) {
     return -1;
   }
 
+  if (is_replaying_boot) return 0; // already added from the plugin cache
+  if (boot_cache) fprintf(boot_cache, "listener %s %s %s\n", when, event, func);
+
   // printf("[%s] adding listener %s.%s --> %s\n", plugin, when, event, func);
 
-  int len = strlen(when) * strlen(event) + 1;
+  int len = strlen(when) + strlen(event) + 2;
   char * event_name = malloc(len);
   snprintf(event_name, len, "%s.%s", (char *)when, (char *)event);
 
@@ -395,9 +920,9 @@ int add_listener(const char * when, const char * event, const char * func) {
     event_id = count - 1;
 
     // we should set this to null, but in that case we'll get a null object afterwards
-    obj = (listener *)malloc(sizeof(listener) + 1);
-    strcpy(obj->plugin, plugin);
-    strcpy(obj->func, func);
+    obj = (listener *)malloc(sizeof(listener));
+    obj->plugin = strdup(plugin);
+    obj->func = strdup(func);
     obj->next = NULL;
     vector_add(&listeners, obj);
 
@@ -408,9 +933,9 @@ int add_listener(const char * when, const char * event, const char * func) {
     while (obj->next) { obj = obj->next; }
 
     listener * el;
-    el = (listener *)malloc(sizeof(listener) + 1);
-    strcpy(el->plugin, plugin);
-    strcpy(el->func, func);
+    el = (listener *)malloc(sizeof(listener));
+    el->plugin = strdup(plugin);
+    el->func = strdup(func);
     el->next = NULL; // very important
     obj->next = el;
 
@@ -428,8 +953,11 @@ int register_func_as_command(const char * func) {
     return -1;
   }
 
+  if (is_replaying_boot) return 0; // already registered from the plugin cache
+  if (boot_cache) fprintf(boot_cache, "command %s\n", func);
+
   char * cmd_name;
-  int len = strlen(plugin) * strlen(func) + 1;
+  int len = strlen("cmd_.") + strlen(plugin) + strlen(func) + 1;
   cmd_name = malloc(len);
   snprintf(cmd_name, len, "cmd_%s.%s", (char *)plugin, (char *)func);
 
@@ -448,11 +976,14 @@ int add_plugin_keybinding(const char * keys, const char * func) {
     fprintf(stderr, "Something's not right. Plugin called boot function out of scope!\n");
     return -1;
   }
+
+  if (is_replaying_boot) return 0; // already mapped from the plugin cache
+  if (boot_cache) fprintf(boot_cache, "binding %s %s\n", func, keys);
   
   // TODO: check if plugin func exists
 
   char * cmd_name;
-  int len = strlen(plugin) * strlen(func) + 1;
+  int len = strlen("cmd_.") + strlen(plugin) + strlen(func) + 1;
   cmd_name = malloc(len);
   snprintf(cmd_name, len, "cmd_%s.%s", (char *)plugin, (char *)func);
 
@@ -489,13 +1020,14 @@ static int get_func(lua_State *L, const void *addr) {
 */
 
 int prompt_cb_func;
+plugin_stat * prompt_cb_stat;
 
 static int fire_prompt_cb(char * action) {
   int top = lua_gettop(luaMain);
   lua_rawgeti(luaMain, LUA_REGISTRYINDEX, prompt_cb_func);
   lua_pushstring(luaMain, action);
   // lua_pushinteger(luaMain, 3);
-  lua_pcall(luaMain, 1, 1, 0);
+  plugin_pcall(luaMain, prompt_cb_stat, 1, 1);
   lua_settop(luaMain, top);
   return 0;
 }
@@ -528,5 +1060,210 @@ int start_callback_prompt(cmd_context_t * ctx, char * prompt, int cbref) {
   }
   
   prompt_cb_func = cbref;
+  prompt_cb_stat = running_stat;
   return editor_prompt_menu(ctx->editor, _nav_menu_callback, (char *)prompt, strlen(prompt));
-}
\ No newline at end of file
+}
+
+/* async processes
+-----------------------------------------------------------*/
+
+// a background process started by a plugin via spawn()
+typedef struct plugin_proc {
+  async_proc_t * aproc;
+  editor_t * editor;
+  bview_t * bview;
+  int data_ref;
+  int exit_ref;
+  int exit_code;
+  pid_t pid; // still to be reaped after eof
+  async_timer_t * reap_timer;
+  plugin_stat * stat;
+  struct plugin_proc * next;
+} plugin_proc;
+
+// procs that have exited, waiting for their on_exit callback
+static plugin_proc * exited_procs = NULL;
+
+// call a lua function stored in the registry, passing either a string or a number
+static int call_plugin_ref(editor_t * editor, plugin_stat * stat, int ref, const char * str, size_t len, int num) {
+  int res, top = lua_gettop(luaMain);
+
+  lua_rawgeti(luaMain, LUA_REGISTRYINDEX, ref);
+  if (str) lua_pushlstring(luaMain, str, len);
+  else lua_pushinteger(luaMain, num);
+
+  if ((res = plugin_pcall(luaMain, stat, 1, 0)) != 0) {
+    EON_SET_ERR(editor, "Plugin callback failed: %s", lua_tostring(luaMain, -1));
+  }
+
+  lua_settop(luaMain, top);
+  return res == 0 ? 0 : -1;
+}
+
+// set plugin_ctx to the view the process was started from, if still open
+static void set_plugin_proc_context(plugin_proc * proc, cmd_context_t * ctx) {
+  bview_t * bview;
+
+  ctx->editor = proc->editor;
+  ctx->bview = proc->editor->active_edit;
+  CDL_FOREACH2(proc->editor->all_bviews, bview, all_next) {
+    if (bview == proc->bview) {
+      ctx->bview = bview;
+      break;
+    }
+  }
+
+  ctx->cursor = ctx->bview->active_cursor;
+  ctx->buffer = ctx->bview->buffer;
+  plugin_ctx = ctx;
+}
+
+// free a proc along with its lua callbacks
+static void _plugin_proc_free(plugin_proc * proc) {
+  if (proc->reap_timer) async_timer_destroy(proc->reap_timer);
+  if (luaMain && proc->data_ref) luaL_unref(luaMain, LUA_REGISTRYINDEX, proc->data_ref);
+  if (luaMain && proc->exit_ref) luaL_unref(luaMain, LUA_REGISTRYINDEX, proc->exit_ref);
+  free(proc);
+}
+
+// reap an exited process without blocking. returns 1 once it is gone.
+static int _plugin_proc_reap(plugin_proc * proc) {
+  int status = 0;
+  pid_t rc = waitpid(proc->pid, &status, WNOHANG);
+
+  if (rc == 0 || (rc < 0 && errno == EINTR)) return 0;
+
+  proc->exit_code = rc == proc->pid && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  proc->pid = 0;
+  LL_APPEND(exited_procs, proc);
+  return 1;
+}
+
+// check again on a process that closed its output before exiting
+static void _plugin_proc_reap_timer(async_timer_t * timer, void * udata) {
+  plugin_proc * proc = (plugin_proc *)udata;
+
+  proc->reap_timer = NULL;
+  if (!_plugin_proc_reap(proc)) {
+    proc->reap_timer = async_timer_new(proc->editor, EON_PLUGIN_REAP_MS, _plugin_proc_reap_timer, proc);
+  }
+}
+
+// the aproc went away before eof, e.g. preempted on exit
+static void _plugin_proc_destroyed(async_proc_t * aproc, char * buf, size_t buf_len) {
+  plugin_proc * proc = (plugin_proc *)aproc->owner;
+
+  aproc->owner = NULL;
+  if (proc) _plugin_proc_free(proc);
+}
+
+static void _plugin_proc_callback(async_proc_t * aproc, char * buf, size_t buf_len) {
+  plugin_proc * proc = (plugin_proc *)aproc->owner;
+  cmd_context_t * prev_ctx = plugin_ctx;
+  cmd_context_t ctx = {0};
+
+  if (!proc) return;
+
+  if (buf_len > 0) {
+    if (proc->data_ref) {
+      set_plugin_proc_context(proc, &ctx);
+      call_plugin_ref(proc->editor, proc->stat, proc->data_ref, buf, buf_len, 0);
+      plugin_ctx = prev_ctx;
+    }
+    return;
+  }
+
+  // aproc is destroyed by async_proc_drain_all, so detach it from us and
+  // leave on_exit for flush_plugin_procs, as it may well open a prompt
+  proc->pid = aproc->pid;
+  proc->aproc = NULL;
+  aproc->pid = 0;
+  aproc->owner = NULL;
+  aproc->owner_aproc = NULL;
+
+  // eof, but the process may keep running after closing its output, so
+  // reap it without blocking and check again later if it has not exited
+  if (!proc->pid) {
+    proc->exit_code = -1;
+    LL_APPEND(exited_procs, proc);
+  } else if (!_plugin_proc_reap(proc)) {
+    proc->reap_timer = async_timer_new(proc->editor, EON_PLUGIN_REAP_MS, _plugin_proc_reap_timer, proc);
+  }
+}
+
+// run on_exit callbacks for finished processes. called from the editor loop
+// once async_proc_drain_all is done.
+void flush_plugin_procs(void) {
+  cmd_context_t * prev_ctx = plugin_ctx;
+  cmd_context_t ctx;
+  plugin_proc * proc;
+
+  while ((proc = exited_procs) != NULL) {
+    LL_DELETE(exited_procs, proc);
+
+    if (proc->exit_ref) {
+      memset(&ctx, 0, sizeof(cmd_context_t));
+      set_plugin_proc_context(proc, &ctx);
+      call_plugin_ref(proc->editor, proc->stat, proc->exit_ref, NULL, 0, proc->exit_code);
+      plugin_ctx = prev_ctx;
+    }
+
+    _plugin_proc_free(proc);
+  }
+}
+
+// stop processes still running and drop the ones waiting for on_exit,
+// while their lua callbacks can still be released
+static void _plugin_procs_destroy_all(editor_t * editor) {
+  async_proc_t * aproc;
+  async_proc_t * aproc_tmp;
+  async_timer_t * timer;
+  async_timer_t * timer_tmp;
+  plugin_proc * proc;
+
+  DL_FOREACH_SAFE(editor->async_procs, aproc, aproc_tmp) {
+    if (aproc->callback == _plugin_proc_callback) async_proc_destroy(aproc, 1);
+  }
+
+  DL_FOREACH_SAFE(editor->async_timers, timer, timer_tmp) {
+    if (timer->callback == _plugin_proc_reap_timer) {
+      proc = (plugin_proc *)timer->udata;
+      proc->reap_timer = NULL;
+      async_timer_destroy(timer);
+      _plugin_proc_free(proc);
+    }
+  }
+
+  while ((proc = exited_procs) != NULL) {
+    LL_DELETE(exited_procs, proc);
+    _plugin_proc_free(proc);
+  }
+}
+
+// starts cmd in the background, calling data_ref with each chunk of output
+// and exit_ref with the exit code once it finishes. returns the pid.
+int start_plugin_process(cmd_context_t * ctx, const char * cmd, int data_ref, int exit_ref) {
+  plugin_proc * proc;
+  editor_t * editor = ctx ? ctx->editor : editor_ref;
+
+  if (!editor) return -1;
+
+  proc = calloc(1, sizeof(plugin_proc));
+  proc->editor = editor;
+  proc->bview = ctx ? ctx->bview : editor->active_edit;
+  proc->data_ref = data_ref;
+  proc->exit_ref = exit_ref;
+  proc->stat = running_stat;
+
+  // open it read-write so we get the pid back, then close stdin right away
+  if (!async_proc_new(editor, proc, &proc->aproc, (char *)cmd, 1, _plugin_proc_callback)) {
+    free(proc);
+    return -1;
+  }
+
+  proc->aproc->destroy_callback = _plugin_proc_destroyed;
+  fclose(proc->aproc->wpipe);
+  proc->aproc->wpipe = NULL;
+  proc->aproc->wfd = 0;
+  return proc->aproc->pid;
+}
@@ -0,0 +1,746 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "eon.h"
+
+#define EON_SEARCH_LOWER(c) ((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+#define EON_SEARCH_IS_WORD(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || ((c) >= '0' && (c) <= '9') || (c) == '_')
+
+typedef struct search_match_s search_match_t;
+
+// A match found by a search_index_t, by byte index in its line
+struct search_match_s {
+  bint_t line_index;
+  bint_t index;
+};
+
+// search_index_t
+struct search_index_s {
+  bview_shared_t* shared;
+  char* regex;
+  bint_t regex_len;
+  pcre* cre;
+  pcre_extra* cre_extra;
+  char* literal;
+  bint_t literal_len;
+  int is_caseless;
+  search_match_t* matches; // sorted by position
+  bint_t matches_len;
+  bint_t matches_cap;
+  bint_t build_line_index; // lines before this are indexed
+  mark_t* build_mark; // near build_line_index, to find its bline quickly
+  async_timer_t* timer;
+  bint_t version; // shared->version as of the last update
+};
+
+static char* _search_memcasemem(char* hay, size_t hay_len, char* needle, size_t needle_len);
+static bint_t _search_find_last(bline_t* bline, bint_t limit, char* literal, bint_t literal_len, int is_caseless, pcre* cre, pcre_extra* cre_extra, bint_t* ret_end);
+static int _search_index_scan(search_index_t* index, bline_t* bline, search_match_t** matches, bint_t* matches_len, bint_t* matches_cap);
+static int _search_index_match_at(search_index_t* index, bline_t* bline, bint_t byte_index);
+static bint_t _search_index_lower_bound(search_index_t* index, bint_t line_index, bint_t byte_index);
+static int _search_index_check(search_index_t* index);
+static void _search_index_reset(search_index_t* index);
+static int _search_index_build(search_index_t* index, bint_t max_lines);
+static void _search_index_timer_cb(async_timer_t* timer, void* udata);
+
+// Return 1 if regex can only match itself, else 0. If so, set ret_literal
+// to the unescaped text (lowercased if caseless) and ret_is_caseless. Like
+// mlbuf, matching is caseless unless the pattern starts with (?-i).
+int search_get_literal(char* regex, bint_t regex_len, char** ret_literal, bint_t* ret_literal_len, int* ret_is_caseless) {
+  char* literal;
+  bint_t literal_len;
+  int is_caseless;
+  bint_t i;
+  char c;
+
+  is_caseless = 1;
+
+  if (regex_len >= 4 && strncmp(regex, "(?i)", 4) == 0) {
+    regex += 4;
+    regex_len -= 4;
+
+  } else if (regex_len >= 5 && strncmp(regex, "(?-i)", 5) == 0) {
+    regex += 5;
+    regex_len -= 5;
+    is_caseless = 0;
+  }
+
+  if (regex_len < 1) return 0;
+
+  literal = malloc(regex_len + 1);
+  literal_len = 0;
+
+  for (i = 0; i < regex_len; i++) {
+    c = regex[i];
+
+    if (c == '\\') {
+      // Escaped punctuation is literal, \b, \d, \Q etc. are not
+      if (i + 1 >= regex_len || (unsigned char)regex[i + 1] >= 0x80 || isalnum((unsigned char)regex[i + 1])) break;
+      c = regex[++i];
+
+    } else if (strchr("^$.[]|()?*+{}", c)) {
+      break;
+    }
+
+    // Only ASCII folds the same way in PCRE and here
+    if (is_caseless && (unsigned char)c >= 0x80) break;
+
+    literal[literal_len++] = is_caseless ? EON_SEARCH_LOWER(c) : c;
+  }
+
+  if (i < regex_len) {
+    free(literal);
+    return 0;
+  }
+
+  literal[literal_len] = '\0';
+  *ret_literal = literal;
+  *ret_literal_len = literal_len;
+  *ret_is_caseless = is_caseless;
+  return 1;
+}
+
+// Find needle in hay. If is_caseless, needle must be lowercase.
+char* search_memmem(char* hay, bint_t hay_len, char* needle, bint_t needle_len, int is_caseless) {
+  if (needle_len < 1 || hay_len < needle_len) return NULL;
+  if (!is_caseless) return memmem(hay, hay_len, needle, needle_len);
+  return _search_memcasemem(hay, hay_len, needle, needle_len);
+}
+
+// Find the next occurrence of a literal at or after mark, or after it if
+// nudge. Literals can't span lines, so each line is one memmem call.
+int search_find_next_literal(mark_t* mark, char* literal, bint_t literal_len, int is_caseless, int nudge, bline_t** ret_bline, bint_t* ret_col, bint_t* ret_num_chars) {
+  bline_t* bline;
+  bint_t offset;
+  bint_t col;
+  bint_t end_col;
+  char* hit;
+
+  bline = mark->bline;
+  col = mark->col + (nudge ? 1 : 0);
+
+  MLBUF_BLINE_ENSURE_CHARS(bline);
+
+  if (col > bline->char_count) {
+    bline = bline->next;
+    offset = 0;
+  } else {
+    offset = util_bline_col_to_index(bline, col);
+  }
+
+  for (; bline; bline = bline->next, offset = 0) {
+    if (!(hit = search_memmem(bline->data + offset, bline->data_len - offset, literal, literal_len, is_caseless))) {
+      continue;
+    }
+
+    MLBUF_BLINE_ENSURE_CHARS(bline);
+    bline_index_to_col(bline, hit - bline->data, &col);
+    bline_index_to_col(bline, (hit - bline->data) + literal_len, &end_col);
+
+    *ret_bline = bline;
+    *ret_col = col;
+    if (ret_num_chars) *ret_num_chars = end_col - col;
+    return EON_OK;
+  }
+
+  return EON_ERR;
+}
+
+// Find the next match of regex at or after mark, or after it if nudge.
+// Literal patterns skip pcre.
+int search_find_next(mark_t* mark, char* regex, bint_t regex_len, int nudge, bline_t** ret_bline, bint_t* ret_col, bint_t* ret_num_chars) {
+  mark_t tmark;
+  char* literal;
+  bint_t literal_len;
+  int is_caseless;
+  int rc;
+
+  if (search_get_literal(regex, regex_len, &literal, &literal_len, &is_caseless)) {
+    rc = search_find_next_literal(mark, literal, literal_len, is_caseless, nudge, ret_bline, ret_col, ret_num_chars);
+    free(literal);
+    return rc;
+  }
+
+  if (!nudge) {
+    return mark_find_next_re(mark, regex, regex_len, ret_bline, ret_col, ret_num_chars) == MLBUF_OK ? EON_OK : EON_ERR;
+  }
+
+  tmark = EON_TMARK(mark->bline, mark->col);
+  rc = tmark_move_by(&tmark, 1) == EON_OK
+    && mark_find_next_re(&tmark, regex, regex_len, ret_bline, ret_col, ret_num_chars) == MLBUF_OK ? EON_OK : EON_ERR;
+  return rc;
+}
+
+// Move mark to the next match of regex, see search_find_next
+int search_move_next(mark_t* mark, char* regex, bint_t regex_len, int nudge) {
+  bline_t* bline;
+  bint_t col;
+
+  if (search_find_next(mark, regex, regex_len, nudge, &bline, &col, NULL) != EON_OK) {
+    return EON_ERR;
+  }
+
+  mark_move_to_w_bline(mark, bline, col);
+  return EON_OK;
+}
+
+// Find the last match of regex that starts before mark, scanning lines in
+// reverse. The regex is compiled once per call rather than once per line.
+int search_find_prev(mark_t* mark, char* regex, bint_t regex_len, bline_t** ret_bline, bint_t* ret_col, bint_t* ret_num_chars) {
+  bline_t* bline;
+  char* literal;
+  char* regex_z;
+  bint_t literal_len;
+  bint_t limit;
+  bint_t start;
+  bint_t end;
+  bint_t col;
+  bint_t end_col;
+  pcre* cre;
+  pcre_extra* cre_extra;
+  const char* error;
+  int erroffset;
+  int is_caseless;
+  int rc;
+
+  literal = NULL;
+  literal_len = 0;
+  is_caseless = 0;
+  cre = NULL;
+  cre_extra = NULL;
+
+  if (!search_get_literal(regex, regex_len, &literal, &literal_len, &is_caseless)) {
+    regex_z = strndup(regex, regex_len);
+    cre = pcre_compile(regex_z, PCRE_CASELESS, &error, &erroffset, NULL);
+    free(regex_z);
+    if (!cre) return EON_ERR;
+    cre_extra = pcre_study(cre, 0, &error);
+  }
+
+  rc = EON_ERR;
+
+  for (bline = mark->bline; bline; bline = bline->prev) {
+    limit = bline == mark->bline ? util_bline_col_to_index(bline, mark->col) : bline->data_len + 1;
+    start = _search_find_last(bline, limit, literal, literal_len, is_caseless, cre, cre_extra, &end);
+    if (start < 0) continue;
+
+    MLBUF_BLINE_ENSURE_CHARS(bline);
+    bline_index_to_col(bline, start, &col);
+    bline_index_to_col(bline, end, &end_col);
+
+    *ret_bline = bline;
+    *ret_col = col;
+    if (ret_num_chars) *ret_num_chars = end_col - col;
+    rc = EON_OK;
+    break;
+  }
+
+  if (literal) free(literal);
+  if (cre_extra) pcre_free_study(cre_extra);
+  if (cre) pcre_free(cre);
+  return rc;
+}
+
+// Move mark to the previous match of regex, see search_find_prev
+int search_move_prev(mark_t* mark, char* regex, bint_t regex_len) {
+  bline_t* bline;
+  bint_t col;
+
+  if (search_find_prev(mark, regex, regex_len, &bline, &col, NULL) != EON_OK) {
+    return EON_ERR;
+  }
+
+  mark_move_to_w_bline(mark, bline, col);
+  return EON_OK;
+}
+
+// Move mark to the next whole-word, caseless occurrence of word, wrapping
+// around to the start of the buffer. Same as searching \bword\b.
+int search_move_next_word(mark_t* mark, char* word, bint_t word_len) {
+  mark_t tmark;
+  bline_t* bline;
+  char* literal;
+  bint_t col;
+  bint_t index;
+  bint_t i;
+  int is_wrapped;
+  int rc;
+
+  // Only plain ASCII words have the same boundaries as \b
+  for (i = 0; i < word_len; i++) {
+    if (!EON_SEARCH_IS_WORD(word[i])) break;
+  }
+
+  if (word_len < 1 || i < word_len) {
+    if (asprintf(&literal, "\\b%.*s\\b", (int)word_len, word) < 0) return EON_ERR;
+    rc = mark_move_next_re(mark, literal, strlen(literal));
+    if (rc != MLBUF_OK) {
+      mark_move_beginning(mark);
+      rc = mark_move_next_re(mark, literal, strlen(literal));
+    }
+    free(literal);
+    return rc == MLBUF_OK ? EON_OK : EON_ERR;
+  }
+
+  literal = malloc(word_len);
+  for (i = 0; i < word_len; i++) literal[i] = EON_SEARCH_LOWER(word[i]);
+
+  tmark = EON_TMARK(mark->bline, mark->col);
+  rc = EON_ERR;
+  is_wrapped = 0;
+
+  while (1) {
+    if (search_find_next_literal(&tmark, literal, word_len, 1, 0, &bline, &col, NULL) != EON_OK) {
+      if (is_wrapped) break;
+      tmark = EON_TMARK(mark->bline->buffer->first_line, 0);
+      is_wrapped = 1;
+      continue;
+    }
+
+    tmark = EON_TMARK(bline, col);
+    index = util_bline_col_to_index(bline, col);
+
+    if ((index == 0 || !EON_SEARCH_IS_WORD(bline->data[index - 1]))
+      && (index + word_len >= bline->data_len || !EON_SEARCH_IS_WORD(bline->data[index + word_len]))
+    ) {
+      mark_move_to_w_bline(mark, bline, col);
+      rc = EON_OK;
+      break;
+    }
+
+    // Not a whole word, look past it
+    if (tmark_move_by(&tmark, 1) != EON_OK) {
+      if (is_wrapped) break;
+      tmark = EON_TMARK(mark->bline->buffer->first_line, 0);
+      is_wrapped = 1;
+    }
+  }
+
+  free(literal);
+  return rc;
+}
+
+// Index every match of regex in a buffer. The index is built in the
+// background and kept up to date as lines are edited.
+int search_index_new(bview_shared_t* shared, char* regex, bint_t regex_len, search_index_t** ret_index) {
+  search_index_t* index;
+  const char* error;
+  int erroffset;
+
+  index = calloc(1, sizeof(search_index_t));
+  index->shared = shared;
+  index->regex = strndup(regex, regex_len);
+  index->regex_len = regex_len;
+
+  if (!search_get_literal(regex, regex_len, &index->literal, &index->literal_len, &index->is_caseless)) {
+    index->cre = pcre_compile(index->regex, PCRE_CASELESS, &error, &erroffset, NULL);
+
+    if (!index->cre) {
+      free(index->regex);
+      free(index);
+      return EON_ERR;
+    }
+
+    index->cre_extra = pcre_study(index->cre, 0, &error);
+  }
+
+  index->build_mark = buffer_add_mark(shared->buffer, shared->buffer->first_line, 0);
+  _search_index_reset(index);
+  *ret_index = index;
+  return EON_OK;
+}
+
+// Return 1 if index is for regex, else 0
+int search_index_is_for(search_index_t* index, char* regex, bint_t regex_len) {
+  return index->regex_len == regex_len && memcmp(index->regex, regex, regex_len) == 0 ? 1 : 0;
+}
+
+// Update index after an edit. Only the edited lines are rescanned, matches
+// below them are shifted. A NULL action means the edit is unknown, so the
+// index is rebuilt.
+int search_index_update(search_index_t* index, baction_t* action) {
+  buffer_t* buffer;
+  bline_t* bline;
+  search_match_t* scanned;
+  bint_t scanned_len;
+  bint_t scanned_cap;
+  bint_t start;
+  bint_t old_end;
+  bint_t new_end;
+  bint_t delta;
+  bint_t lo;
+  bint_t hi;
+  bint_t tail_len;
+  bint_t i;
+
+  buffer = index->shared->buffer;
+
+  if (!action) {
+    _search_index_reset(index);
+    return EON_OK;
+  }
+
+  start = action->start_line_index;
+  delta = action->line_delta < 0 ? -action->line_delta : action->line_delta;
+
+  if (action->type == MLBUF_BACTION_TYPE_DELETE) {
+    old_end = start + delta;
+    new_end = start;
+    delta = -delta;
+  } else {
+    old_end = start;
+    new_end = start + delta;
+  }
+
+  // Lines not yet indexed are picked up by the build
+  if (start >= index->build_line_index) {
+    index->version = index->shared->version;
+    return EON_OK;
+  }
+
+  lo = _search_index_lower_bound(index, start, 0);
+
+  // Edit reaches past what is indexed, so build again from start
+  if (old_end >= index->build_line_index) {
+    index->matches_len = lo;
+    index->build_line_index = start;
+    index->version = index->shared->version;
+    mark_move_to(index->build_mark, start, 0);
+    if (!index->timer) index->timer = async_timer_new(index->shared->editor, 0, _search_index_timer_cb, index);
+    return EON_OK;
+  }
+
+  hi = _search_index_lower_bound(index, old_end + 1, 0);
+
+  // Rescan edited lines
+  scanned = NULL;
+  scanned_len = 0;
+  scanned_cap = 0;
+  bline = util_get_bline(buffer, index->build_mark->bline, start);
+
+  for (i = start; bline && i <= new_end; i++, bline = bline->next) {
+    _search_index_scan(index, bline, &scanned, &scanned_len, &scanned_cap);
+  }
+
+  // Splice them in place of the old ones and shift the rest
+  tail_len = index->matches_len - hi;
+
+  if (lo + scanned_len + tail_len > index->matches_cap) {
+    index->matches_cap = lo + scanned_len + tail_len;
+    index->matches = realloc(index->matches, sizeof(search_match_t) * index->matches_cap);
+  }
+
+  memmove(index->matches + lo + scanned_len, index->matches + hi, sizeof(search_match_t) * tail_len);
+  if (scanned_len > 0) memcpy(index->matches + lo, scanned, sizeof(search_match_t) * scanned_len);
+  index->matches_len = lo + scanned_len + tail_len;
+
+  if (delta != 0) {
+    for (i = lo + scanned_len; i < index->matches_len; i++) index->matches[i].line_index += delta;
+  }
+
+  index->build_line_index += delta;
+  index->version = index->shared->version;
+  free(scanned);
+  return EON_OK;
+}
+
+// Return 1 if every line is indexed, else 0
+int search_index_is_complete(search_index_t* index) {
+  _search_index_check(index);
+  return index->build_line_index >= index->shared->buffer->line_count ? 1 : 0;
+}
+
+// Index the remaining lines now
+int search_index_complete(search_index_t* index) {
+  _search_index_check(index);
+  _search_index_build(index, index->shared->buffer->line_count);
+  return EON_OK;
+}
+
+// Return number of matches indexed so far
+bint_t search_index_get_count(search_index_t* index) {
+  _search_index_check(index);
+  return index->matches_len;
+}
+
+// Set ret_nth to the match at mark. Return EON_ERR if mark isn't at an
+// indexed match.
+int search_index_find_at(search_index_t* index, mark_t* mark, bint_t* ret_nth) {
+  bint_t byte_index;
+  bint_t nth;
+
+  _search_index_check(index);
+  byte_index = util_bline_col_to_index(mark->bline, mark->col);
+  nth = _search_index_lower_bound(index, mark->bline->line_index, byte_index);
+
+  if (nth >= index->matches_len
+    || index->matches[nth].line_index != mark->bline->line_index
+    || index->matches[nth].index != byte_index
+  ) {
+    return EON_ERR;
+  }
+
+  *ret_nth = nth;
+  return EON_OK;
+}
+
+// Set ret_nth to the last match before mark, wrapping around. Return
+// EON_ERR if the index isn't complete or there are no matches.
+int search_index_find_prev(search_index_t* index, mark_t* mark, bint_t* ret_nth) {
+  bint_t nth;
+
+  if (!search_index_is_complete(index) || index->matches_len < 1) return EON_ERR;
+
+  nth = _search_index_lower_bound(index, mark->bline->line_index, util_bline_col_to_index(mark->bline, mark->col));
+  *ret_nth = nth > 0 ? nth - 1 : index->matches_len - 1;
+  return EON_OK;
+}
+
+// Set ret_nth to the first match after mark, wrapping around. Return
+// EON_ERR if the index isn't complete or there are no matches.
+int search_index_find_next(search_index_t* index, mark_t* mark, bint_t* ret_nth) {
+  bint_t byte_index;
+  bint_t nth;
+
+  if (!search_index_is_complete(index) || index->matches_len < 1) return EON_ERR;
+
+  byte_index = util_bline_col_to_index(mark->bline, mark->col);
+  nth = _search_index_lower_bound(index, mark->bline->line_index, byte_index + 1);
+  *ret_nth = nth < index->matches_len ? nth : 0;
+  return EON_OK;
+}
+
+// Move mark to the nth match. If the buffer changed in a way the index
+// missed, rebuild it and return EON_ERR.
+int search_index_move_to(search_index_t* index, mark_t* mark, bint_t nth) {
+  bline_t* bline;
+  bint_t col;
+
+  _search_index_check(index);
+  if (nth < 0 || nth >= index->matches_len) return EON_ERR;
+
+  bline = util_get_bline(index->shared->buffer, mark->bline, index->matches[nth].line_index);
+
+  if (!bline || !_search_index_match_at(index, bline, index->matches[nth].index)) {
+    _search_index_reset(index);
+    return EON_ERR;
+  }
+
+  MLBUF_BLINE_ENSURE_CHARS(bline);
+  bline_index_to_col(bline, index->matches[nth].index, &col);
+  mark_move_to_w_bline(mark, bline, col);
+  return EON_OK;
+}
+
+// Free an index
+int search_index_destroy(search_index_t* index) {
+  if (index->timer) async_timer_destroy(index->timer);
+  if (index->build_mark) mark_destroy(index->build_mark);
+  if (index->cre_extra) pcre_free_study(index->cre_extra);
+  if (index->cre) pcre_free(index->cre);
+  if (index->matches) free(index->matches);
+  if (index->literal) free(index->literal);
+  free(index->regex);
+  free(index);
+  return EON_OK;
+}
+
+// Find lowercase needle in hay ignoring ASCII case. memchr does the
+// scanning for the first char in either case, and is vectorized in libc.
+static char* _search_memcasemem(char* hay, size_t hay_len, char* needle, size_t needle_len) {
+  char* last;
+  char* p;
+  char* lo_hit;
+  char* up_hit;
+  char* hit;
+  char lo;
+  char up;
+  size_t i;
+
+  last = hay + (hay_len - needle_len);
+  lo = needle[0];
+  up = lo >= 'a' && lo <= 'z' ? lo - ('a' - 'A') : lo;
+  lo_hit = NULL;
+  up_hit = NULL;
+
+  for (p = hay; p <= last; p = hit + 1) {
+    // Only rescan for a case whose previous hit was passed
+    if (!lo_hit || lo_hit < p) {
+      lo_hit = memchr(p, lo, (last - p) + 1);
+      if (!lo_hit) lo_hit = last + 1;
+    }
+
+    if (up == lo) {
+      up_hit = lo_hit;
+    } else if (!up_hit || up_hit < p) {
+      up_hit = memchr(p, up, (last - p) + 1);
+      if (!up_hit) up_hit = last + 1;
+    }
+
+    hit = lo_hit < up_hit ? lo_hit : up_hit;
+    if (hit > last) break;
+
+    for (i = 1; i < needle_len && EON_SEARCH_LOWER(hit[i]) == needle[i]; i++);
+    if (i == needle_len) return hit;
+  }
+
+  return NULL;
+}
+
+// Return the byte index of the last match in bline that starts before
+// limit, or -1 if none. Matches may overlap, as with a nudged search.
+static bint_t _search_find_last(bline_t* bline, bint_t limit, char* literal, bint_t literal_len, int is_caseless, pcre* cre, pcre_extra* cre_extra, bint_t* ret_end) {
+  int ovector[3];
+  char* hit;
+  bint_t offset;
+  bint_t start;
+  bint_t end;
+  bint_t last;
+
+  last = -1;
+
+  for (offset = 0; offset < limit && offset <= bline->data_len; offset = start + 1) {
+    if (literal) {
+      hit = search_memmem(bline->data + offset, bline->data_len - offset, literal, literal_len, is_caseless);
+      if (!hit) break;
+      start = hit - bline->data;
+      end = start + literal_len;
+    } else {
+      if (pcre_exec(cre, cre_extra, bline->data, bline->data_len, offset, 0, ovector, 3) < 0) break;
+      start = ovector[0];
+      end = ovector[1];
+    }
+
+    if (start >= limit) break;
+    last = start;
+    *ret_end = end;
+
+    // Resume at the next char, not the next byte
+    while (start + 1 < bline->data_len && (bline->data[start + 1] & 0xc0) == 0x80) start++;
+  }
+
+  return last;
+}
+
+// Append the matches in bline. Like a nudged search, matches may overlap.
+static int _search_index_scan(search_index_t* index, bline_t* bline, search_match_t** matches, bint_t* matches_len, bint_t* matches_cap) {
+  int ovector[3];
+  char* hit;
+  bint_t offset;
+  bint_t start;
+
+  for (offset = 0; offset <= bline->data_len; offset = start + 1) {
+    if (index->literal) {
+      hit = search_memmem(bline->data + offset, bline->data_len - offset, index->literal, index->literal_len, index->is_caseless);
+      if (!hit) break;
+      start = hit - bline->data;
+    } else {
+      if (pcre_exec(index->cre, index->cre_extra, bline->data, bline->data_len, offset, 0, ovector, 3) < 0) break;
+      start = ovector[0];
+    }
+
+    if (*matches_len >= *matches_cap) {
+      *matches_cap = *matches_cap > 0 ? *matches_cap * 2 : 64;
+      *matches = realloc(*matches, sizeof(search_match_t) * *matches_cap);
+    }
+
+    (*matches)[*matches_len].line_index = bline->line_index;
+    (*matches)[*matches_len].index = start;
+    *matches_len += 1;
+
+    // Resume at the next char, not the next byte
+    while (start + 1 < bline->data_len && (bline->data[start + 1] & 0xc0) == 0x80) start++;
+  }
+
+  return EON_OK;
+}
+
+// Return 1 if a match starts at byte_index in bline, else 0
+static int _search_index_match_at(search_index_t* index, bline_t* bline, bint_t byte_index) {
+  int ovector[3];
+
+  if (byte_index > bline->data_len) return 0;
+
+  if (index->literal) {
+    return search_memmem(bline->data + byte_index, EON_MIN(index->literal_len, bline->data_len - byte_index), index->literal, index->literal_len, index->is_caseless) ? 1 : 0;
+  }
+
+  return pcre_exec(index->cre, index->cre_extra, bline->data, bline->data_len, byte_index, PCRE_ANCHORED, ovector, 3) >= 0 ? 1 : 0;
+}
+
+// Return the nth of the first match at or after a position
+static bint_t _search_index_lower_bound(search_index_t* index, bint_t line_index, bint_t byte_index) {
+  search_match_t* match;
+  bint_t lo;
+  bint_t hi;
+  bint_t mid;
+
+  lo = 0;
+  hi = index->matches_len;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    match = index->matches + mid;
+
+    if (match->line_index < line_index || (match->line_index == line_index && match->index < byte_index)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+// Rebuild index if the buffer changed without an update. Return 1 if
+// rebuilt, else 0.
+static int _search_index_check(search_index_t* index) {
+  if (index->version == index->shared->version) return 0;
+
+  _search_index_reset(index);
+  return 1;
+}
+
+// Drop all matches and start building again
+static void _search_index_reset(search_index_t* index) {
+  index->matches_len = 0;
+  index->build_line_index = 0;
+  index->version = index->shared->version;
+  mark_move_beginning(index->build_mark);
+  if (!index->timer) index->timer = async_timer_new(index->shared->editor, 0, _search_index_timer_cb, index);
+}
+
+// Index up to max_lines more lines. Return 1 if complete, else 0.
+static int _search_index_build(search_index_t* index, bint_t max_lines) {
+  buffer_t* buffer;
+  bline_t* bline;
+  bint_t i;
+
+  buffer = index->shared->buffer;
+  bline = util_get_bline(buffer, index->build_mark->bline, index->build_line_index);
+
+  for (i = 0; bline && i < max_lines; i++, bline = bline->next) {
+    _search_index_scan(index, bline, &index->matches, &index->matches_len, &index->matches_cap);
+    index->build_line_index += 1;
+  }
+
+  if (!bline) {
+    index->build_line_index = buffer->line_count;
+    return 1;
+  }
+
+  mark_move_to_w_bline(index->build_mark, bline, 0);
+  return 0;
+}
+
+// Timer callback that builds an index a slice of lines at a time so input
+// stays responsive on big buffers
+static void _search_index_timer_cb(async_timer_t* timer, void* udata) {
+  search_index_t* index;
+  index = (search_index_t*)udata;
+  index->timer = NULL; // timer is freed by the event loop
+
+  if (!_search_index_build(index, EON_SEARCH_INDEX_LINES)) {
+    index->timer = async_timer_new(index->shared->editor, 0, _search_index_timer_cb, index);
+  }
+}
@@ -0,0 +1,618 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <libgen.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "eon.h"
+
+#define EON_SWAP_MAGIC "eon-swap 1 "
+
+// swap_t. The swap file holds the edits made to a buffer since it was
+// opened or last saved, so they can be replayed if the editor dies. It
+// starts with a header line:
+//
+//   eon-swap 1 <pid> <size> <mtime> <path>
+//
+// where pid is the editor writing it (padded so it can be rewritten in
+// place) and size and mtime are of the file the edits apply to, -1 and 0
+// if it did not exist. Then one record per edit:
+//
+//   +<line> <col> <data_len>, a newline, the data and a newline
+//   -<line> <col> <num_chars>
+//
+// Records are only ever appended. They are collected in memory and written
+// once typing pauses, with one fdatasync per write. The editor holds an
+// exclusive flock on the swap file from the moment it opens it, so a swap
+// file that can be locked was left by an editor that died.
+struct swap_s {
+    editor_t* editor;
+    buffer_t* buffer;
+    char* path; // swap file, NULL if edits to the buffer are not kept
+    char* file_path; // real path of the file edited
+    int fd; // locked swap file, -1 if none
+    str_t pending; // records not yet written
+    bint_t base_size;
+    long base_mtime;
+    long first_pending_ms; // when the oldest pending record was added
+    long last_add_ms;
+    async_timer_t* timer; // flush or recovery prompt
+    int ref_count;
+    int is_replaying;
+    int is_broken; // an edit could not be recorded, wait for a save
+    int is_kept; // leave the swap file on disk when destroyed
+    int has_header; // the file holds this editor's header and records
+    int is_recovery_pending;
+};
+
+static int _swap_set_file(swap_t* self);
+static int _swap_open_file(swap_t* self);
+static int _swap_get_real_path(char* path, char* ret_real);
+static int _swap_read_header(FILE* fp, char* file_path, int* ret_pid, bint_t* ret_size, long* ret_mtime);
+static void _swap_timer_cb(async_timer_t* timer, void* udata);
+static void _swap_prompt_recovery(swap_t* self);
+static int _swap_write(int fd, char* data, size_t data_len);
+static void _swap_drop_file(swap_t* self);
+static void _swap_disable(swap_t* self);
+static long _swap_now_ms();
+
+// Start keeping the edits made to buffer. If an editor that died left
+// unsaved edits to the same file, offer to replay them once the editor
+// loop runs.
+int swap_new(editor_t* editor, buffer_t* buffer, swap_t** ret_swap) {
+  swap_t* self;
+
+  if (!buffer->path) return EON_ERR;
+
+  self = calloc(1, sizeof(swap_t));
+  self->editor = editor;
+  self->buffer = buffer;
+  self->fd = -1;
+  self->ref_count = 1;
+
+  if (_swap_set_file(self) != EON_OK) {
+    _swap_disable(self);
+  }
+
+  *ret_swap = self;
+  return EON_OK;
+}
+
+// Take another reference to a swap, for a bview sharing the buffer
+swap_t* swap_share(swap_t* self) {
+  self->ref_count += 1;
+  return self;
+}
+
+// Record an edit. A NULL action is a change that cannot be replayed, so
+// the swap file is dropped until the next save.
+int swap_add(swap_t* self, baction_t* action) {
+  char head[96];
+  bint_t num_chars;
+  long now;
+
+  if (!self->path || self->is_replaying || self->is_broken) return EON_OK;
+
+  // Editing before answering would replay the old edits onto new ones
+  if (self->is_recovery_pending) {
+    EON_SET_INFO(self->editor, "Unsaved changes to %s from an earlier session left in %s", self->file_path, self->path);
+    _swap_disable(self);
+    return EON_OK;
+  }
+
+  if (!action) {
+    _swap_drop_file(self);
+    self->is_broken = 1;
+    return EON_OK;
+  }
+
+  if (action->type == MLBUF_BACTION_TYPE_INSERT) {
+    snprintf(head, sizeof(head), "+%ld %ld %ld\n", (long)action->start_line_index, (long)action->start_col, (long)action->data_len);
+    str_append(&self->pending, head);
+    str_append_len(&self->pending, action->data, action->data_len);
+    str_append_len(&self->pending, "\n", 1);
+  } else {
+    num_chars = action->char_delta < 0 ? -action->char_delta : action->char_delta;
+    snprintf(head, sizeof(head), "-%ld %ld %ld\n", (long)action->start_line_index, (long)action->start_col, (long)num_chars);
+    str_append(&self->pending, head);
+  }
+
+  // Write once typing pauses, or right away if a lot is pending
+  now = _swap_now_ms();
+  if (!self->timer) self->first_pending_ms = now;
+  self->last_add_ms = now;
+
+  if (self->pending.len >= EON_SWAP_FLUSH_SIZE) {
+    return swap_flush(self);
+  } else if (!self->timer) {
+    self->timer = async_timer_new(self->editor, EON_SWAP_IDLE_MS, _swap_timer_cb, self);
+  }
+
+  return EON_OK;
+}
+
+// Write pending records and sync them to disk
+int swap_flush(swap_t* self) {
+  str_t out = {0};
+  char* header;
+  int rv;
+
+  if (self->timer && !self->is_recovery_pending) {
+    async_timer_destroy(self->timer);
+    self->timer = NULL;
+  }
+
+  if (!self->path || self->pending.len < 1) return EON_OK;
+
+  // Start the file over with the first write
+  if (!self->has_header) {
+    if (ftruncate(self->fd, 0) != 0) {
+      EON_SET_ERR(self->editor, "Swap %s: %s", self->path, strerror(errno));
+      _swap_disable(self);
+      return EON_ERR;
+    }
+
+    self->has_header = 1;
+
+    if (asprintf(&header, "%s%10d %ld %ld %s\n", EON_SWAP_MAGIC, (int)getpid(), (long)self->base_size, self->base_mtime, self->file_path) >= 0) {
+      str_append(&out, header);
+      free(header);
+    }
+  }
+
+  str_append_len(&out, self->pending.data, self->pending.len);
+  rv = lseek(self->fd, 0, SEEK_END) >= 0 ? _swap_write(self->fd, out.data, out.len) : EON_ERR;
+  str_free(&out);
+  str_clear(&self->pending);
+
+  if (rv != EON_OK) {
+    EON_SET_ERR(self->editor, "Swap %s: %s", self->path, strerror(errno));
+    _swap_drop_file(self);
+    self->is_broken = 1;
+    return EON_ERR;
+  }
+
+  return EON_OK;
+}
+
+// Start over from the file just saved. If it was saved under a new path,
+// the swap file moves with it.
+int swap_save(swap_t* self) {
+  if (!self->path) return EON_OK;
+
+  // A save would make the old edits apply to the wrong file
+  if (self->is_recovery_pending) {
+    EON_SET_INFO(self->editor, "Unsaved changes to %s from an earlier session left in %s", self->file_path, self->path);
+    _swap_disable(self);
+    return EON_OK;
+  }
+
+  _swap_drop_file(self);
+  self->is_broken = 0;
+  free(self->path);
+  free(self->file_path);
+  self->path = NULL;
+  self->file_path = NULL;
+
+  if (_swap_set_file(self) != EON_OK) {
+    _swap_disable(self);
+    return EON_ERR;
+  }
+
+  return EON_OK;
+}
+
+// Write pending records and leave the swap file on disk when the swap is
+// destroyed, for an editor exiting on a signal
+int swap_keep(swap_t* self) {
+  swap_flush(self);
+  self->is_kept = 1;
+  return EON_OK;
+}
+
+// Drop a reference to a swap. The last one removes the swap file unless it
+// is kept.
+int swap_destroy(swap_t* self) {
+  self->ref_count -= 1;
+  if (self->ref_count > 0) return EON_OK;
+
+  if (self->timer) async_timer_destroy(self->timer);
+  self->timer = NULL;
+
+  // A kept file needs records in it to be worth keeping
+  if (!self->is_recovery_pending && (!self->is_kept || !self->has_header)) {
+    _swap_drop_file(self);
+  } else if (self->fd >= 0) {
+    close(self->fd);
+  }
+
+  str_free(&self->pending);
+  if (self->path) free(self->path);
+  if (self->file_path) free(self->file_path);
+  free(self);
+  return EON_OK;
+}
+
+// Point the swap at the file the buffer is for. A swap file left there by
+// an editor that died is offered for recovery if it is for the file as it
+// is now.
+static int _swap_set_file(swap_t* self) {
+  char real[PATH_MAX + 1];
+  struct stat st;
+  char* dir;
+  FILE* fp;
+  bint_t size;
+  long mtime;
+  int pid;
+
+  if (_swap_get_real_path(self->buffer->path, real) != EON_OK) return EON_ERR;
+
+  util_expand_tilde(EON_SWAP_DIR, strlen(EON_SWAP_DIR), &dir);
+
+  if (!util_mkdir_p(dir, 0700)) {
+    free(dir);
+    return EON_ERR;
+  }
+
+  // One swap file per path, named by its hash
+  if (asprintf(&self->path, "%s/%016llx", dir, (unsigned long long)util_fnv1a(real, strlen(real))) < 0) self->path = NULL;
+  free(dir);
+  if (!self->path) return EON_ERR;
+
+  self->file_path = strdup(real);
+
+  if (stat(real, &st) == 0) {
+    self->base_size = st.st_size;
+    self->base_mtime = (long)st.st_mtime;
+  } else {
+    self->base_size = -1;
+    self->base_mtime = 0;
+  }
+
+  // Whoever holds the lock has the file open, another buffer here included
+  if (_swap_open_file(self) != EON_OK) {
+    if (!(fp = fopen(self->path, "rb"))) return EON_ERR;
+
+    if (_swap_read_header(fp, real, &pid, &size, &mtime) != EON_OK) {
+      EON_SET_INFO(self->editor, "%s is being edited elsewhere, unsaved changes will not be kept", self->buffer->path);
+    } else if (pid != getpid()) {
+      EON_SET_INFO(self->editor, "%s is being edited by process %d, unsaved changes will not be kept", self->buffer->path, pid);
+    }
+
+    fclose(fp);
+    return EON_ERR;
+  }
+
+  // Anything already in the file was left by an editor that died
+  if (!(fp = fopen(self->path, "rb"))) return EON_OK;
+
+  if (_swap_read_header(fp, real, &pid, &size, &mtime) == EON_OK
+    && size == self->base_size
+    && mtime == self->base_mtime
+    && fgetc(fp) != EOF
+  ) {
+    self->is_recovery_pending = 1;
+    self->timer = async_timer_new(self->editor, 0, _swap_timer_cb, self);
+  }
+
+  fclose(fp);
+  return EON_OK;
+}
+
+// Open the swap file, creating it if need be, and lock it. Fail if another
+// editor holds the lock.
+static int _swap_open_file(swap_t* self) {
+  struct stat st;
+  struct stat fd_st;
+  int fd;
+  int i;
+
+  // Try again if the file was removed between the open and the lock
+  for (i = 0; i < 3; i++) {
+    if ((fd = open(self->path, O_RDWR | O_CREAT, 0600)) < 0) return EON_ERR;
+
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+      close(fd);
+      return EON_ERR;
+    }
+
+    if (fstat(fd, &fd_st) == 0
+      && stat(self->path, &st) == 0
+      && st.st_dev == fd_st.st_dev
+      && st.st_ino == fd_st.st_ino
+    ) {
+      self->fd = fd;
+      self->has_header = 0;
+      return EON_OK;
+    }
+
+    close(fd);
+  }
+
+  return EON_ERR;
+}
+
+// Resolve path, which need not exist yet
+static int _swap_get_real_path(char* path, char* ret_real) {
+  char dir_real[PATH_MAX + 1];
+  char* dir_copy;
+  char* base_copy;
+  int rv;
+
+  if (realpath(path, ret_real)) return EON_OK;
+
+  dir_copy = strdup(path);
+  base_copy = strdup(path);
+  rv = EON_ERR;
+
+  if (realpath(dirname(dir_copy), dir_real)
+    && snprintf(ret_real, PATH_MAX + 1, "%s/%s", dir_real, basename(base_copy)) <= PATH_MAX
+  ) {
+    rv = EON_OK;
+  }
+
+  free(dir_copy);
+  free(base_copy);
+  return rv;
+}
+
+// Read the header of the swap file in fp, which must be for file_path
+static int _swap_read_header(FILE* fp, char* file_path, int* ret_pid, bint_t* ret_size, long* ret_mtime) {
+  char* line;
+  size_t line_cap;
+  long size;
+  int path_offset;
+  int rv;
+
+  line = NULL;
+  line_cap = 0;
+  path_offset = 0;
+  rv = EON_ERR;
+
+  if (getline(&line, &line_cap, fp) > 0
+    && sscanf(line, EON_SWAP_MAGIC "%d %ld %ld %n", ret_pid, &size, ret_mtime, &path_offset) == 3
+    && path_offset > 0
+    && strncmp(line + path_offset, file_path, strlen(file_path)) == 0
+    && strcmp(line + path_offset + strlen(file_path), "\n") == 0
+  ) {
+    *ret_size = size;
+    rv = EON_OK;
+  }
+
+  if (line) free(line);
+  return rv;
+}
+
+// Write pending records once typing has paused, or has gone on for too
+// long, or ask about recovering an earlier session
+static void _swap_timer_cb(async_timer_t* timer, void* udata) {
+  swap_t* self;
+  long now;
+  long wait_ms;
+
+  self = (swap_t*)udata;
+  self->timer = NULL;
+
+  if (self->is_recovery_pending) {
+    _swap_prompt_recovery(self);
+    return;
+  }
+
+  now = _swap_now_ms();
+  wait_ms = EON_MIN(self->last_add_ms + EON_SWAP_IDLE_MS, self->first_pending_ms + EON_SWAP_MAX_DELAY_MS) - now;
+
+  if (wait_ms > 0) {
+    self->timer = async_timer_new(self->editor, wait_ms, _swap_timer_cb, self);
+    return;
+  }
+
+  swap_flush(self);
+}
+
+// Ask whether to replay the edits left by an editor that died
+static void _swap_prompt_recovery(swap_t* self) {
+  char* prompt;
+  char* yn;
+  bint_t num_edits;
+
+  if (asprintf(&prompt, "Recover unsaved changes to %s? (y/n)", self->buffer->path) < 0) return;
+
+  yn = NULL;
+
+  // Try again later if another prompt is open
+  if (editor_prompt(self->editor, prompt, &(editor_prompt_params_t) { .kmap = self->editor->kmap_prompt_yn }, &yn) != EON_OK) {
+    free(prompt);
+    self->timer = async_timer_new(self->editor, EON_SWAP_IDLE_MS, _swap_timer_cb, self);
+    return;
+  }
+
+  free(prompt);
+
+  // Answered in the meantime by an edit or a save
+  if (!self->is_recovery_pending) {
+    if (yn) free(yn);
+    return;
+  }
+
+  self->is_recovery_pending = 0;
+
+  if (!yn) {
+    EON_SET_INFO(self->editor, "Unsaved changes to %s from an earlier session left in %s", self->file_path, self->path);
+    _swap_disable(self);
+  } else if (strcmp(yn, EON_PROMPT_YES) != 0) {
+    if (ftruncate(self->fd, 0) != 0) _swap_disable(self);
+  } else if (swap_recover(self, &num_edits) == EON_OK) {
+    EON_SET_INFO(self->editor, "Recovered %ld edits to %s", (long)num_edits, self->buffer->path);
+  } else {
+    EON_SET_ERR(self->editor, "Could not recover changes to %s, left in %s", self->buffer->path, self->path);
+    _swap_disable(self);
+  }
+
+  if (yn) free(yn);
+}
+
+// Replay the records in the swap file as one edit, then carry on appending
+// to it. A record cut short by the crash ends the replay.
+int swap_recover(swap_t* self, bint_t* ret_num_edits) {
+  bview_t* bview;
+  bview_t* edit_bview;
+  bline_t* bline;
+  FILE* fp;
+  char* line;
+  char* data;
+  char pid_str[16];
+  size_t line_cap;
+  ssize_t line_len;
+  bint_t offset;
+  long line_index;
+  long col;
+  long num;
+  long good_end;
+  int pid;
+  bint_t size;
+  long mtime;
+  int rv;
+
+  *ret_num_edits = 0;
+
+  // Nothing else asks about these edits now
+  self->is_recovery_pending = 0;
+
+  if (self->timer) {
+    async_timer_destroy(self->timer);
+    self->timer = NULL;
+  }
+
+  edit_bview = NULL;
+  CDL_FOREACH2(self->editor->all_bviews, bview, all_next) {
+    if (bview->buffer == self->buffer && bview->type == EON_BVIEW_TYPE_EDIT) {
+      edit_bview = bview;
+      break;
+    }
+  }
+
+  if (!edit_bview || !self->path || !(fp = fopen(self->path, "rb"))) return EON_ERR;
+
+  if (_swap_read_header(fp, self->file_path, &pid, &size, &mtime) != EON_OK) {
+    fclose(fp);
+    return EON_ERR;
+  }
+
+  good_end = ftell(fp);
+  line = NULL;
+  line_cap = 0;
+  bline = NULL;
+  rv = EON_OK;
+
+  self->is_replaying = 1;
+  bview_begin_edit(edit_bview);
+
+  while ((line_len = getline(&line, &line_cap, fp)) > 0) {
+    if (line[line_len - 1] != '\n' || sscanf(line + 1, "%ld %ld %ld", &line_index, &col, &num) != 3 || num < 0) break;
+
+    bline = util_get_bline(self->buffer, bline, line_index);
+    if (!bline || buffer_get_offset(self->buffer, bline, col, &offset) != MLBUF_OK) {
+      rv = EON_ERR;
+      break;
+    }
+
+    if (*line == '+') {
+      data = malloc(num + 1);
+      if (!data || fread(data, 1, num + 1, fp) != (size_t)num + 1 || data[num] != '\n') {
+        free(data);
+        break;
+      }
+      rv = buffer_insert(self->buffer, offset, data, num, NULL) == MLBUF_OK ? EON_OK : EON_ERR;
+      free(data);
+    } else if (*line == '-') {
+      rv = buffer_delete(self->buffer, offset, num) == MLBUF_OK ? EON_OK : EON_ERR;
+    } else {
+      break;
+    }
+
+    if (rv != EON_OK) break;
+    *ret_num_edits += 1;
+    good_end = ftell(fp);
+  }
+
+  bview_end_edit(edit_bview);
+  self->is_replaying = 0;
+
+  if (line) free(line);
+  fclose(fp);
+
+  if (rv != EON_OK) return EON_ERR;
+
+  // Append after the last whole record, as the editor writing the file
+  if (ftruncate(self->fd, good_end) != 0) return EON_ERR;
+  self->has_header = 1;
+
+  snprintf(pid_str, sizeof(pid_str), "%10d", (int)getpid());
+  if (pwrite(self->fd, pid_str, strlen(pid_str), strlen(EON_SWAP_MAGIC)) != (ssize_t)strlen(pid_str)
+    || lseek(self->fd, 0, SEEK_END) < 0
+  ) {
+    return EON_ERR;
+  }
+
+  fdatasync(self->fd);
+  return EON_OK;
+}
+
+// Write all of data, then sync it
+static int _swap_write(int fd, char* data, size_t data_len) {
+  ssize_t nbytes;
+
+  while (data_len > 0) {
+    nbytes = write(fd, data, data_len);
+    if (nbytes < 0 && errno == EINTR) continue;
+    if (nbytes <= 0) return EON_ERR;
+    data += nbytes;
+    data_len -= nbytes;
+  }
+
+  return fdatasync(fd) == 0 ? EON_OK : EON_ERR;
+}
+
+// Remove the swap file along with pending records
+static void _swap_drop_file(swap_t* self) {
+  if (self->timer && !self->is_recovery_pending) {
+    async_timer_destroy(self->timer);
+    self->timer = NULL;
+  }
+
+  // Unlink while still holding the lock
+  if (self->path) unlink(self->path);
+
+  if (self->fd >= 0) {
+    close(self->fd);
+    self->fd = -1;
+  }
+
+  str_clear(&self->pending);
+}
+
+// Stop keeping edits to the buffer, leaving any swap file as it is
+static void _swap_disable(swap_t* self) {
+  if (self->timer) async_timer_destroy(self->timer);
+  self->timer = NULL;
+
+  if (self->fd >= 0) close(self->fd);
+  self->fd = -1;
+
+  if (self->path) free(self->path);
+  self->path = NULL;
+  self->is_recovery_pending = 0;
+  self->is_broken = 0;
+  str_clear(&self->pending);
+}
+
+// Return a monotonic time in milliseconds
+static long _swap_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,1086 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "eon.h"
+
+// undo_node_t. The root stands for the oldest state still reachable and
+// holds no actions. Every EON_UNDO_CHECKPOINT_RECORDS records down, a node
+// may keep a snapshot of the buffer for undo_tree_jump to start from.
+struct undo_node_s {
+  undo_node_t* parent;
+  undo_node_t* next; // child on the path held by mlbuf, NULL at its end
+  bint_t seq; // order of creation
+  bint_t depth;
+  time_t time; // when the record was made or last extended
+  baction_t* last; // newest action while mlbuf holds the record, else NULL
+  int num_actions;
+  undo_op_t* ops; // copies of the actions while undone or dropped by mlbuf
+  undo_snapshot_t* snapshot; // buffer contents in this state, NULL if none
+  int is_above_base; // an ancestor of the base, so kept however old
+  int is_gone;
+};
+
+// undo_snapshot_t. Most snapshots are the bytes that differ from the one
+// at the checkpoint above, with a whole one every EON_UNDO_CHECKPOINT_CHAIN.
+struct undo_snapshot_s {
+  undo_node_t* from; // checkpoint this is a diff from, NULL if whole
+  bint_t start; // bytes of from's contents kept before data
+  bint_t end; // and after it
+  char* data;
+  bint_t data_len;
+  int chain; // diffs between this and a whole snapshot
+  int num_refs; // snapshots that are diffs from this one
+};
+
+// undo_tree_t
+struct undo_tree_s {
+  editor_t* editor;
+  buffer_t* buffer;
+  undo_node_t** nodes; // by seq, so a parent always precedes its children
+  bint_t nodes_len;
+  bint_t nodes_cap;
+  undo_node_t* root;
+  undo_node_t* base; // oldest state mlbuf can undo to, root or a checkpoint
+  undo_node_t* cur; // state the buffer is in
+  bint_t next_seq;
+  bint_t ops_bytes; // memory held by ops, snapshots and the snapshot cache
+  char* cache; // contents of cache_node's snapshot with its diffs applied
+  bint_t cache_len;
+  undo_node_t* cache_node;
+  int ref_count;
+  int is_in_jump;
+  int is_out_of_sync; // set if mlbuf moved in a way the tree did not follow
+  int is_base_lost; // set once the root can no longer be the file as opened
+  undo_journal_t* journal; // NULL if the buffer has no file or journals are off
+};
+
+static baction_t* _undo_tree_get_applied(undo_tree_t* self);
+static undo_node_t* _undo_tree_add_node(undo_tree_t* self, undo_node_t* parent);
+static void _undo_tree_reset(undo_tree_t* self, baction_t* applied);
+static void _undo_tree_sweep(undo_tree_t* self, bint_t max_ops_bytes);
+static void _undo_tree_drop_branch(undo_tree_t* self);
+static int _undo_tree_replay(undo_tree_t* self, bview_t* bview, undo_node_t* node);
+static int _undo_tree_jump_checkpoint(undo_tree_t* self, bview_t* bview, undo_node_t* node, undo_node_t* a, undo_node_t* c);
+static void _undo_tree_checkpoint(undo_tree_t* self);
+static int _undo_tree_restore(undo_tree_t* self, undo_node_t* node);
+static char* _undo_tree_get_snapshot(undo_tree_t* self, undo_node_t* node, bint_t* ret_len);
+static void _undo_tree_diff(undo_tree_t* self, char* data, bint_t data_len, bint_t* ret_start, bint_t* ret_end);
+static bint_t _undo_tree_read(undo_tree_t* self, bint_t start, bint_t end, char* optret_data);
+static void _undo_tree_drop_cache(undo_tree_t* self);
+static int _undo_tree_load_base(undo_tree_t* self, bview_t* bview);
+static int _undo_tree_apply_recs(undo_tree_t* self, bview_t* bview, undo_rec_t* recs, bint_t num_recs, baction_t** lasts);
+static int _undo_tree_apply_op(undo_tree_t* self, undo_op_t* op, int is_inverse, bline_t** optret_bline);
+static int _undo_tree_check_op(undo_tree_t* self, undo_op_t* op, bline_t* bline, bint_t offset);
+static void _undo_tree_add_base(undo_tree_t* self, undo_rec_t* recs, baction_t** lasts, bint_t num_recs);
+static void _undo_node_copy_ops(undo_tree_t* self, undo_node_t* node);
+static void _undo_node_free_ops(undo_tree_t* self, undo_node_t* node);
+static void _undo_node_free_snapshot(undo_tree_t* self, undo_node_t* node);
+
+// Track the undo records of buffer as a tree. Undoing and then editing
+// makes mlbuf drop the undone actions; the tree keeps copies of them so
+// every earlier state stays reachable with undo_tree_jump.
+int undo_tree_new(editor_t* editor, buffer_t* buffer, undo_tree_t** ret_tree) {
+  undo_tree_t* self;
+
+  self = calloc(1, sizeof(undo_tree_t));
+  self->editor = editor;
+  self->buffer = buffer;
+  self->ref_count = 1;
+  _undo_tree_reset(self, _undo_tree_get_applied(self));
+
+  // History from earlier sessions is read from the journal on demand
+  if (editor->undo_journal && buffer->path) undo_journal_new(editor, buffer, &self->journal);
+
+  *ret_tree = self;
+  return EON_OK;
+}
+
+// Take another reference to a tree, for a bview sharing the buffer
+undo_tree_t* undo_tree_share(undo_tree_t* self) {
+  self->ref_count += 1;
+  return self;
+}
+
+// Add a record made of the actions first through last. If is_join is set
+// and the record follows the current one, extend that one instead.
+int undo_tree_add(undo_tree_t* self, baction_t* first, baction_t* last, int num_actions, int is_join) {
+  undo_node_t* node;
+  baction_t* prev;
+
+  if (self->is_in_jump) return EON_OK;
+
+  // mlbuf dropped its undone actions, so their records become a branch
+  _undo_tree_drop_branch(self);
+
+  prev = first == self->buffer->actions ? NULL : first->prev;
+
+  if (self->is_out_of_sync || self->cur->last != prev) {
+    _undo_tree_reset(self, prev);
+    is_join = 0;
+  }
+
+  // Branches off the current record were made from it as it is, so it
+  // only grows while it is the newest
+  if (is_join && self->cur != self->base && self->cur->seq == self->next_seq - 1) {
+    node = self->cur;
+    node->num_actions += num_actions;
+    _undo_node_free_snapshot(self, node);
+  } else {
+    is_join = 0;
+    node = _undo_tree_add_node(self, self->cur);
+    node->num_actions = num_actions;
+    self->cur->next = node;
+    self->cur = node;
+  }
+
+  node->last = last;
+  node->time = time(NULL);
+  if (self->journal) undo_journal_add(self->journal, last, num_actions, is_join);
+  if (!is_join) _undo_tree_checkpoint(self);
+
+  // Keep dropped branches within the undo memory cap
+  if (self->editor->undo_max_bytes > 0 && self->ops_bytes > self->editor->undo_max_bytes) {
+    _undo_tree_sweep(self, self->editor->undo_max_bytes);
+  }
+
+  return EON_OK;
+}
+
+// Follow buffer_undo calls back to the record now current
+int undo_tree_undo(undo_tree_t* self) {
+  baction_t* applied;
+  int num_records;
+
+  applied = _undo_tree_get_applied(self);
+  num_records = 0;
+
+  while (!self->is_out_of_sync && self->cur->last != applied) {
+    if (self->cur == self->base) {
+      self->is_out_of_sync = 1;
+      break;
+    }
+
+    _undo_node_copy_ops(self, self->cur);
+    self->cur = self->cur->parent;
+    num_records += 1;
+  }
+
+  if (self->journal && !self->is_out_of_sync) undo_journal_undo(self->journal, num_records);
+  if (!self->is_out_of_sync) _undo_tree_checkpoint(self);
+
+  if (self->is_out_of_sync && !self->is_in_jump) _undo_tree_reset(self, applied);
+  return EON_OK;
+}
+
+// Follow buffer_redo calls forward to the record now current
+int undo_tree_redo(undo_tree_t* self) {
+  baction_t* applied;
+  int num_records;
+
+  applied = _undo_tree_get_applied(self);
+  num_records = 0;
+
+  while (!self->is_out_of_sync && self->cur->last != applied) {
+    if (!self->cur->next) {
+      self->is_out_of_sync = 1;
+      break;
+    }
+
+    self->cur = self->cur->next;
+    _undo_node_free_ops(self, self->cur);
+    num_records += 1;
+  }
+
+  if (self->journal && !self->is_out_of_sync) undo_journal_redo(self->journal, num_records);
+  if (!self->is_out_of_sync) _undo_tree_checkpoint(self);
+
+  if (self->is_out_of_sync && !self->is_in_jump) _undo_tree_reset(self, applied);
+  return EON_OK;
+}
+
+// Forget records whose actions are about to be freed, i.e. the ones before
+// stop. Called before the buffer's oldest actions are discarded.
+int undo_tree_trim(undo_tree_t* self, baction_t* stop) {
+  baction_t* action;
+  undo_node_t* node;
+  undo_node_t* new_root;
+
+  new_root = NULL;
+  node = self->base->next;
+
+  for (action = self->buffer->actions; action && action != stop; action = action->next) {
+    if (action == self->base->last) {
+      new_root = self->base;
+    } else if (node && action == node->last) {
+      new_root = node;
+      node = node->next;
+    }
+  }
+
+  if (!new_root) return EON_OK;
+
+  // The root is no longer the file as opened
+  self->is_base_lost = 1;
+
+  // States before new_root are out of reach, and so are branches off them
+  for (node = new_root->parent; node; node = node->parent) node->is_gone = 1;
+
+  _undo_node_free_ops(self, new_root);
+  new_root->parent = NULL;
+  new_root->last = NULL;
+  new_root->num_actions = 0;
+  self->root = new_root;
+  self->base = new_root;
+  _undo_tree_sweep(self, -1);
+  return EON_OK;
+}
+
+// Move the buffer to the state after node. Records are undone back to the
+// branch point and replayed down to node as one edit, so the buffer is
+// restyled once however far the jump. Far jumps start from the nearest
+// checkpoint above node instead.
+int undo_tree_jump(undo_tree_t* self, bview_t* bview, undo_node_t* node) {
+  undo_node_t* a;
+  undo_node_t* b;
+  undo_node_t* c;
+  undo_node_t* prev;
+  undo_node_t** path;
+  bint_t path_len;
+  bint_t i;
+  int rv;
+
+  if (node == self->cur) return EON_OK;
+
+  // Find the nearest common record
+  a = self->cur;
+  b = node;
+  while (a->depth > b->depth) a = a->parent;
+  while (b->depth > a->depth) b = b->parent;
+
+  while (a != b) {
+    a = a->parent;
+    b = b->parent;
+  }
+
+  // Restoring a snapshot costs about as much as a checkpoint's worth of
+  // records, so only pays off when stepping there is longer
+  for (c = node; c && !c->snapshot; c = c->parent);
+
+  if (c && (node->depth - c->depth) + EON_UNDO_CHECKPOINT_RECORDS < (self->cur->depth - a->depth) + (node->depth - a->depth)) {
+    return _undo_tree_jump_checkpoint(self, bview, node, a, c);
+  }
+
+  // Records to replay, oldest first
+  path_len = node->depth - a->depth;
+  path = malloc(sizeof(undo_node_t*) * EON_MAX(path_len, 1));
+  for (i = path_len - 1, b = node; i >= 0; i--, b = b->parent) path[i] = b;
+
+  rv = EON_OK;
+  self->is_in_jump = 1;
+  bview_begin_edit(bview);
+
+  while (rv == EON_OK && self->cur != a) {
+    prev = self->cur;
+    if (bview_undo(bview) != EON_OK || self->cur == prev || self->is_out_of_sync) rv = EON_ERR;
+  }
+
+  for (i = 0; rv == EON_OK && i < path_len; i++) {
+    if (path[i]->last) {
+      if (bview_redo(bview) != EON_OK || self->cur != path[i] || self->is_out_of_sync) rv = EON_ERR;
+    } else {
+      rv = _undo_tree_replay(self, bview, path[i]);
+    }
+  }
+
+  // Nothing here is a new record
+  bview->is_in_undo = 1;
+  bview_end_edit(bview);
+  bview->is_in_undo = 0;
+  self->is_in_jump = 0;
+  free(path);
+
+  if (self->is_out_of_sync) _undo_tree_reset(self, _undo_tree_get_applied(self));
+  return rv;
+}
+
+// Get the state num_steps after (or before, if negative) the current one
+// in the order the states were made
+int undo_tree_step(undo_tree_t* self, int num_steps, undo_node_t** ret_node) {
+  bint_t lo;
+  bint_t hi;
+  bint_t mid;
+
+  // Find the current state by seq
+  lo = 0;
+  hi = self->nodes_len - 1;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (self->nodes[mid]->seq < self->cur->seq) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  lo += num_steps;
+  if (lo < 0 || lo >= self->nodes_len) return EON_ERR;
+
+  *ret_node = self->nodes[lo];
+  return EON_OK;
+}
+
+// Get the newest state made at or before when, or the oldest state if all
+// are newer
+int undo_tree_find_time(undo_tree_t* self, time_t when, undo_node_t** ret_node) {
+  bint_t lo;
+  bint_t hi;
+  bint_t mid;
+
+  // The root is as old as it gets, whatever its time
+  lo = 0;
+  hi = self->nodes_len - 1;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo + 1) / 2;
+    if (self->nodes[mid]->time <= when) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  *ret_node = self->nodes[lo];
+  return EON_OK;
+}
+
+// Get the position of the current state among all states, how many there
+// are, and when it was made
+int undo_tree_get_state(undo_tree_t* self, bint_t* ret_index, bint_t* ret_count, time_t* ret_time) {
+  undo_node_t* node;
+  bint_t i;
+
+  for (i = 0; i < self->nodes_len; i++) {
+    node = self->nodes[i];
+    if (node != self->cur) continue;
+    *ret_index = i;
+    *ret_count = self->nodes_len;
+    *ret_time = node == self->root ? 0 : node->time;
+    return EON_OK;
+  }
+
+  return EON_ERR;
+}
+
+// Read the history of the buffer's file from before this session out of
+// its journal, so undo can go past the state the file was opened in. Only
+// works while the buffer is back in that state. If a checkpoint jump left
+// records above the base, those are given back to mlbuf first.
+int undo_tree_load(undo_tree_t* self, bview_t* bview) {
+  undo_rec_t* recs;
+  baction_t** lasts;
+  bint_t num_recs;
+  int rv;
+
+  if (self->cur != self->base || self->base->last) return EON_ERR;
+  if (self->base != self->root) return _undo_tree_load_base(self, bview);
+  if (!self->journal || self->is_base_lost) return EON_ERR;
+
+  // Only try once
+  self->is_base_lost = 1;
+  if (undo_journal_load(self->journal, &recs, &num_recs) != EON_OK) return EON_ERR;
+
+  lasts = calloc(num_recs, sizeof(baction_t*));
+  rv = _undo_tree_apply_recs(self, bview, recs, num_recs, lasts);
+  if (rv == EON_OK) _undo_tree_add_base(self, recs, lasts, num_recs);
+
+  free(lasts);
+  undo_journal_free_recs(recs, num_recs);
+  return rv;
+}
+
+// Note in the journal that the buffer was saved
+int undo_tree_save(undo_tree_t* self) {
+  int is_new_file;
+
+  if (!self->editor->undo_journal || !self->buffer->path) return EON_ERR;
+
+  // A buffer gets a journal when it gets a file
+  if (!self->journal) {
+    if (undo_journal_new(self->editor, self->buffer, &self->journal) != EON_OK) return EON_ERR;
+    self->is_base_lost = 1;
+  }
+
+  if (undo_journal_save(self->journal, &is_new_file) != EON_OK) return EON_ERR;
+  if (is_new_file) self->is_base_lost = 1;
+  return EON_OK;
+}
+
+// Drop a reference to a tree, freeing it with the last one
+int undo_tree_destroy(undo_tree_t* self) {
+  bint_t i;
+
+  self->ref_count -= 1;
+  if (self->ref_count > 0) return EON_OK;
+
+  // Newest first, so diffs go before the snapshots they are from
+  for (i = self->nodes_len - 1; i >= 0; i--) {
+    _undo_node_free_ops(self, self->nodes[i]);
+    _undo_node_free_snapshot(self, self->nodes[i]);
+    free(self->nodes[i]);
+  }
+
+  if (self->nodes) free(self->nodes);
+  if (self->journal) undo_journal_destroy(self->journal);
+  free(self);
+  return EON_OK;
+}
+
+// Return the newest action not undone, or NULL if all are
+static baction_t* _undo_tree_get_applied(undo_tree_t* self) {
+  if (self->buffer->action_undone) {
+    if (self->buffer->action_undone == self->buffer->actions) return NULL;
+    return self->buffer->action_undone->prev;
+  }
+
+  return self->buffer->action_tail;
+}
+
+// Allocate a node under parent
+static undo_node_t* _undo_tree_add_node(undo_tree_t* self, undo_node_t* parent) {
+  undo_node_t* node;
+
+  if (self->nodes_len >= self->nodes_cap) {
+    self->nodes_cap = self->nodes_cap > 0 ? self->nodes_cap * 2 : 64;
+    self->nodes = realloc(self->nodes, sizeof(undo_node_t*) * self->nodes_cap);
+  }
+
+  node = calloc(1, sizeof(undo_node_t));
+  node->parent = parent;
+  node->depth = parent ? parent->depth + 1 : 0;
+  node->seq = self->next_seq++;
+  node->time = time(NULL);
+  self->nodes[self->nodes_len++] = node;
+  return node;
+}
+
+// Start over with just a root at the state after applied
+static void _undo_tree_reset(undo_tree_t* self, baction_t* applied) {
+  bint_t i;
+
+  for (i = self->nodes_len - 1; i >= 0; i--) {
+    _undo_node_free_ops(self, self->nodes[i]);
+    _undo_node_free_snapshot(self, self->nodes[i]);
+    free(self->nodes[i]);
+  }
+
+  self->nodes_len = 0;
+  self->root = _undo_tree_add_node(self, NULL);
+  self->root->last = applied;
+  self->base = self->root;
+  self->cur = self->root;
+  self->is_out_of_sync = 0;
+  if (self->journal) undo_journal_reset(self->journal);
+}
+
+// Free gone nodes and everything under them. If max_ops_bytes is not
+// negative, also drop the snapshot cache, the oldest snapshots, then the
+// oldest branches, until ops fit in it.
+static void _undo_tree_sweep(undo_tree_t* self, bint_t max_ops_bytes) {
+  undo_node_t* node;
+  bint_t i;
+  bint_t j;
+
+  if (max_ops_bytes >= 0 && self->ops_bytes > max_ops_bytes) _undo_tree_drop_cache(self);
+
+  for (i = 0; max_ops_bytes >= 0 && self->ops_bytes > max_ops_bytes && i < self->nodes_len; i++) {
+    _undo_node_free_snapshot(self, self->nodes[i]);
+  }
+
+  for (i = 0; i < self->nodes_len; i++) {
+    node = self->nodes[i];
+
+    if (node->parent && node->parent->is_gone) {
+      node->is_gone = 1;
+    } else if (max_ops_bytes >= 0 && self->ops_bytes > max_ops_bytes && !node->last && node != self->base && !node->is_above_base) {
+      node->is_gone = 1;
+    }
+
+    if (node->is_gone) {
+      _undo_node_free_ops(self, node);
+      _undo_node_free_snapshot(self, node);
+    }
+  }
+
+  // Free after the pass, as children look at their parent
+  for (i = 0, j = 0; i < self->nodes_len; i++) {
+    node = self->nodes[i];
+
+    if (node->is_gone) {
+      free(node);
+    } else {
+      self->nodes[j++] = node;
+    }
+  }
+
+  self->nodes_len = j;
+}
+
+// Turn the undone records past the current one into a branch. mlbuf drops
+// their actions on the next edit; the nodes keep copies.
+static void _undo_tree_drop_branch(undo_tree_t* self) {
+  undo_node_t* node;
+
+  for (node = self->cur->next; node; node = node->next) node->last = NULL;
+  self->cur->next = NULL;
+}
+
+// Apply the copied actions of a node on a branch, making it the current
+// record
+static int _undo_tree_replay(undo_tree_t* self, bview_t* bview, undo_node_t* node) {
+  baction_t* first;
+  bline_t* bline;
+  int i;
+
+  _undo_tree_drop_branch(self);
+  bline = NULL;
+
+  for (i = 0; i < node->num_actions; i++) {
+    if (_undo_tree_apply_op(self, node->ops + i, 0, &bline) != EON_OK) {
+      self->is_out_of_sync = 1;
+      return EON_ERR;
+    }
+  }
+
+  // Undo and redo the replayed actions together, like the original record
+  if (node->num_actions > 1) {
+    for (first = self->buffer->action_tail, i = 1; first && i < node->num_actions; i++) first = first->prev;
+    bview_add_undo_group(bview, first, self->buffer->action_tail, node->num_actions);
+  }
+
+  node->last = self->buffer->action_tail;
+  self->cur->next = node;
+  self->cur = node;
+  _undo_node_free_ops(self, node);
+  if (self->journal) undo_journal_add(self->journal, node->last, node->num_actions, 0);
+  _undo_tree_checkpoint(self);
+  return EON_OK;
+}
+
+// Jump to node by restoring the snapshot of c, a checkpoint above it, and
+// replaying the records from there. mlbuf's history is started over at c,
+// which becomes the base; the records above it keep their copies and go
+// back to mlbuf on undo_tree_load. a is where cur and node branch apart.
+static int _undo_tree_jump_checkpoint(undo_tree_t* self, bview_t* bview, undo_node_t* node, undo_node_t* a, undo_node_t* c) {
+  undo_node_t* b;
+  undo_node_t* j;
+  undo_node_t** path;
+  undo_rec_t rec;
+  baction_t* stop;
+  bint_t path_len;
+  bint_t num_logged;
+  bint_t i;
+  int rv;
+
+  // The journal goes back to where its history and the new one part. The
+  // records from there to c are only logged, the ones after c replayed.
+  j = c->depth < a->depth ? c : a;
+  num_logged = c->depth - j->depth;
+  path_len = node->depth - j->depth;
+  path = malloc(sizeof(undo_node_t*) * EON_MAX(path_len, 1));
+  for (i = path_len - 1, b = node; i >= 0; i--, b = b->parent) path[i] = b;
+
+  self->is_in_jump = 1;
+  bview_begin_edit(bview);
+
+  // Copy the records mlbuf holds, as their actions are about to go
+  for (b = self->cur; b != self->base; b = b->parent) {
+    _undo_node_copy_ops(self, b);
+    b->last = NULL;
+  }
+
+  _undo_tree_drop_branch(self);
+  self->base->last = NULL;
+
+  if (self->journal && self->cur->depth > j->depth) undo_journal_undo(self->journal, self->cur->depth - j->depth);
+
+  for (i = 0; i < self->nodes_len; i++) self->nodes[i]->is_above_base = 0;
+  for (b = c->parent; b; b = b->parent) b->is_above_base = 1;
+
+  rv = _undo_tree_restore(self, c);
+  stop = self->buffer->action_tail;
+  self->base = c;
+  self->cur = c;
+  c->last = stop;
+  c->next = NULL;
+
+  for (i = 0; self->journal && rv == EON_OK && i < num_logged; i++) {
+    rec.time = path[i]->time;
+    rec.ops = path[i]->ops;
+    rec.num_ops = path[i]->num_actions;
+    undo_journal_add_rec(self->journal, &rec);
+  }
+
+  for (i = num_logged; rv == EON_OK && i < path_len; i++) {
+    rv = _undo_tree_replay(self, bview, path[i]);
+  }
+
+  // mlbuf keeps only the replayed actions
+  if (rv == EON_OK) {
+    bview_forget_undo(bview, stop ? stop->next : self->buffer->actions);
+    c->last = NULL;
+  } else {
+    self->is_out_of_sync = 1;
+  }
+
+  bview->is_in_undo = 1;
+  bview_end_edit(bview);
+  bview->is_in_undo = 0;
+  self->is_in_jump = 0;
+  free(path);
+
+  if (self->is_out_of_sync) _undo_tree_reset(self, _undo_tree_get_applied(self));
+  return rv;
+}
+
+// Snapshot the buffer if the current state is a checkpoint without one. It
+// is kept as a diff from the checkpoint above when there is one. Snapshots
+// that would push the tree past the undo memory cap are skipped.
+static void _undo_tree_checkpoint(undo_tree_t* self) {
+  undo_node_t* node;
+  undo_node_t* from;
+  undo_snapshot_t* snap;
+  char* data;
+  bint_t data_len;
+  bint_t max_bytes;
+
+  node = self->cur;
+  if (node->snapshot || node->depth % EON_UNDO_CHECKPOINT_RECORDS != 0) return;
+
+  max_bytes = self->editor->undo_max_bytes;
+  if (max_bytes > 0 && self->ops_bytes + (bint_t)sizeof(undo_snapshot_t) > max_bytes) return;
+
+  // Start over with a whole one once the chain of diffs gets long
+  for (from = node->parent; from && !from->snapshot; from = from->parent);
+  if (from && from->snapshot->chain + 1 >= EON_UNDO_CHECKPOINT_CHAIN) from = NULL;
+
+  snap = calloc(1, sizeof(undo_snapshot_t));
+  if (from) {
+    data = _undo_tree_get_snapshot(self, from, &data_len);
+    _undo_tree_diff(self, data, data_len, &snap->start, &snap->end);
+    snap->from = from;
+    snap->chain = from->snapshot->chain + 1;
+  }
+  snap->data_len = self->buffer->byte_count - snap->start - snap->end;
+
+  if (max_bytes > 0 && self->ops_bytes + (bint_t)sizeof(undo_snapshot_t) + snap->data_len > max_bytes) {
+    free(snap);
+    return;
+  }
+
+  snap->data = malloc(EON_MAX(snap->data_len, 1));
+  _undo_tree_read(self, snap->start, snap->start + snap->data_len, snap->data);
+  node->snapshot = snap;
+  self->ops_bytes += (bint_t)sizeof(undo_snapshot_t) + snap->data_len;
+
+  // Move the cache on to this checkpoint, for the next diff to be from
+  if (from) {
+    from->snapshot->num_refs += 1;
+    _undo_tree_get_snapshot(self, node, &data_len);
+  }
+}
+
+// Edit the buffer into the state node has a snapshot of, replacing only the
+// part that differs
+static int _undo_tree_restore(undo_tree_t* self, undo_node_t* node) {
+  char* data;
+  bint_t data_len;
+  bint_t start;
+  bint_t end;
+  bint_t offset;
+  bint_t num_chars;
+  bint_t i;
+
+  data = _undo_tree_get_snapshot(self, node, &data_len);
+  _undo_tree_diff(self, data, data_len, &start, &end);
+  if (start + end == self->buffer->byte_count && start + end == data_len) return EON_OK;
+
+  // mlbuf counts in characters
+  for (offset = 0, i = 0; i < start; i++) if ((data[i] & 0xc0) != 0x80) offset += 1;
+  num_chars = _undo_tree_read(self, start, self->buffer->byte_count - end, NULL);
+
+  if (buffer_replace(self->buffer, offset, num_chars, data + start, data_len - start - end) != MLBUF_OK) {
+    return EON_ERR;
+  }
+
+  return EON_OK;
+}
+
+// Return the buffer contents in the state node has a snapshot of. A diff is
+// applied onto its checkpoint's contents in the cache, which then holds
+// node's instead. Returns memory owned by the tree.
+static char* _undo_tree_get_snapshot(undo_tree_t* self, undo_node_t* node, bint_t* ret_len) {
+  undo_snapshot_t* snap;
+  char* base;
+  char* cache;
+  bint_t base_len;
+  bint_t len;
+
+  snap = node->snapshot;
+  if (!snap->from) {
+    *ret_len = snap->data_len;
+    return snap->data;
+  } else if (self->cache_node == node) {
+    *ret_len = self->cache_len;
+    return self->cache;
+  }
+
+  base = _undo_tree_get_snapshot(self, snap->from, &base_len);
+  len = snap->start + snap->data_len + snap->end;
+
+  if (base == self->cache) {
+    // Splice in place; the allocation is never smaller than cache_len
+    if (len > base_len) self->cache = realloc(self->cache, len);
+    memmove(self->cache + snap->start + snap->data_len, self->cache + base_len - snap->end, snap->end);
+  } else {
+    cache = malloc(EON_MAX(len, 1));
+    memcpy(cache, base, snap->start);
+    memcpy(cache + snap->start + snap->data_len, base + base_len - snap->end, snap->end);
+    if (self->cache) free(self->cache);
+    self->cache = cache;
+  }
+
+  memcpy(self->cache + snap->start, snap->data, snap->data_len);
+  self->ops_bytes += len - self->cache_len;
+  self->cache_len = len;
+  self->cache_node = node;
+  *ret_len = len;
+  return self->cache;
+}
+
+// Find how many bytes the buffer has in common with data at its start and,
+// past those, at its end, on whole characters. Walks the lines instead of
+// flattening the buffer.
+static void _undo_tree_diff(undo_tree_t* self, char* data, bint_t data_len, bint_t* ret_start, bint_t* ret_end) {
+  bline_t* bline;
+  bint_t start;
+  bint_t end;
+  bint_t max_end;
+  bint_t i;
+
+  start = 0;
+  for (bline = self->buffer->first_line; bline; bline = bline->next) {
+    for (i = 0; i < bline->data_len && start < data_len && bline->data[i] == data[start]; i++, start++);
+    if (i < bline->data_len || !bline->next || start >= data_len || data[start] != '\n') break;
+    start += 1;
+  }
+
+  while (start > 0 && start < data_len && (data[start] & 0xc0) == 0x80) start -= 1;
+
+  end = 0;
+  max_end = EON_MIN(self->buffer->byte_count, data_len) - start;
+  for (bline = self->buffer->last_line; bline && end < max_end; bline = bline->prev) {
+    for (i = bline->data_len - 1; i >= 0 && end < max_end && bline->data[i] == data[data_len - 1 - end]; i--, end++);
+    if (i >= 0 || !bline->prev || end >= max_end || data[data_len - 1 - end] != '\n') break;
+    end += 1;
+  }
+
+  while (end > 0 && (data[data_len - end] & 0xc0) == 0x80) end -= 1;
+
+  *ret_start = start;
+  *ret_end = end;
+}
+
+// Count the characters in the buffer's bytes from start up to end, copying
+// them to optret_data if it is not NULL
+static bint_t _undo_tree_read(undo_tree_t* self, bint_t start, bint_t end, char* optret_data) {
+  bline_t* bline;
+  bint_t pos;
+  bint_t line_end;
+  bint_t num_chars;
+  bint_t i;
+  char c;
+
+  num_chars = 0;
+  for (bline = self->buffer->first_line, pos = 0; bline && pos < end; bline = bline->next, pos = line_end) {
+    line_end = pos + bline->data_len + (bline->next ? 1 : 0);
+    if (line_end <= start) continue;
+
+    for (i = EON_MAX(start, pos) - pos; i < EON_MIN(end, line_end) - pos; i++) {
+      c = i < bline->data_len ? bline->data[i] : '\n';
+      if (optret_data) *optret_data++ = c;
+      if ((c & 0xc0) != 0x80) num_chars += 1;
+    }
+  }
+
+  return num_chars;
+}
+
+// Free the snapshot cache
+static void _undo_tree_drop_cache(undo_tree_t* self) {
+  if (!self->cache) return;
+  free(self->cache);
+  self->ops_bytes -= self->cache_len;
+  self->cache = NULL;
+  self->cache_len = 0;
+  self->cache_node = NULL;
+}
+
+// Give the records above the base back to mlbuf, making the root the base
+// again
+static int _undo_tree_load_base(undo_tree_t* self, bview_t* bview) {
+  undo_node_t* node;
+  undo_rec_t* recs;
+  baction_t** lasts;
+  bint_t num_recs;
+  bint_t i;
+  int rv;
+
+  num_recs = self->base->depth - self->root->depth;
+  recs = calloc(num_recs, sizeof(undo_rec_t));
+  lasts = calloc(num_recs, sizeof(baction_t*));
+
+  for (i = num_recs - 1, node = self->base; i >= 0; i--, node = node->parent) {
+    recs[i].time = node->time;
+    recs[i].ops = node->ops;
+    recs[i].num_ops = node->num_actions;
+  }
+
+  rv = _undo_tree_apply_recs(self, bview, recs, num_recs, lasts);
+
+  if (rv == EON_OK) {
+    for (i = num_recs - 1, node = self->base; i >= 0; i--, node = node->parent) {
+      node->last = lasts[i];
+      node->parent->next = node;
+      node->parent->is_above_base = 0;
+      _undo_node_free_ops(self, node);
+    }
+
+    self->base = self->root;
+  }
+
+  free(recs);
+  free(lasts);
+  return rv;
+}
+
+// Give mlbuf actions for recs, which end in the current state, by undoing
+// them back to where they start and redoing them as one edit. lasts gets
+// the newest action of each. On a bad record the buffer is put back.
+static int _undo_tree_apply_recs(undo_tree_t* self, bview_t* bview, undo_rec_t* recs, bint_t num_recs, baction_t** lasts) {
+  baction_t* action;
+  bview_t* other;
+  bline_t* bline;
+  bint_t num_inverse;
+  bint_t num_actions;
+  bint_t i;
+  int was_in_jump;
+  int j;
+  int rv;
+
+  rv = EON_OK;
+  num_actions = 0;
+  bline = NULL;
+  was_in_jump = self->is_in_jump;
+  self->is_in_jump = 1;
+  bview_begin_edit(bview);
+
+  // Undo the records back to where they start...
+  for (i = num_recs - 1; rv == EON_OK && i >= 0; i--) {
+    for (j = recs[i].num_ops - 1; rv == EON_OK && j >= 0; j--) {
+      rv = _undo_tree_apply_op(self, recs[i].ops + j, 1, &bline);
+      if (rv == EON_OK) num_actions += 1;
+    }
+  }
+
+  num_inverse = num_actions;
+
+  // ...then redo them as actions mlbuf can undo
+  for (i = 0; rv == EON_OK && i < num_recs; i++) {
+    for (j = 0; rv == EON_OK && j < recs[i].num_ops; j++) {
+      rv = _undo_tree_apply_op(self, recs[i].ops + j, 0, &bline);
+      if (rv == EON_OK) num_actions += 1;
+    }
+    lasts[i] = self->buffer->action_tail;
+  }
+
+  // On a bad record, put the buffer back as it was
+  bview->is_in_undo = 1;
+  if (rv != EON_OK) {
+    for (; num_actions > 0; num_actions--) buffer_undo(self->buffer);
+  }
+
+  bview_end_edit(bview);
+  bview->is_in_undo = 0;
+  self->is_in_jump = was_in_jump;
+
+  // mlbuf dropped its undone actions with the first new one
+  if (num_inverse > 0) _undo_tree_drop_branch(self);
+
+  // Undo memory is recounted from scratch on the next edit
+  CDL_FOREACH2(self->editor->all_bviews, other, all_next) {
+    if (other->buffer == self->buffer) other->undo_counted_action = NULL;
+  }
+
+  if (rv != EON_OK) return rv;
+
+  // The history starts where the records do, so the undoing goes
+  for (action = self->buffer->actions, i = 0; action && i < num_inverse; i++) action = action->next;
+  buffer_trim_actions(self->buffer, action);
+
+  for (i = 0; i < num_recs; i++) {
+    if (recs[i].num_ops < 2) continue;
+    for (action = lasts[i], j = 1; j < recs[i].num_ops; j++) action = action->prev;
+    bview_add_undo_group(bview, action, lasts[i], recs[i].num_ops);
+  }
+
+  return EON_OK;
+}
+
+// Make the action op is a copy of, or if is_inverse the action undoing it.
+// Fail unless that adds exactly one action, or if the text it would delete
+// is not the text it was made with.
+static int _undo_tree_apply_op(undo_tree_t* self, undo_op_t* op, int is_inverse, bline_t** optret_bline) {
+  baction_t* tail;
+  bline_t* bline;
+  bint_t offset;
+
+  bline = util_get_bline(self->buffer, optret_bline ? *optret_bline : NULL, op->line_index);
+  if (optret_bline) *optret_bline = bline;
+
+  if (!bline || buffer_get_offset(self->buffer, bline, op->col, &offset) != MLBUF_OK) return EON_ERR;
+
+  tail = self->buffer->action_tail;
+
+  if ((op->type == MLBUF_BACTION_TYPE_INSERT) != (is_inverse != 0)) {
+    buffer_insert(self->buffer, offset, op->data, op->data_len, NULL);
+  } else if (_undo_tree_check_op(self, op, bline, offset) == EON_OK) {
+    buffer_delete(self->buffer, offset, op->num_chars);
+  } else {
+    return EON_ERR;
+  }
+
+  return self->buffer->action_tail != tail && !self->buffer->action_undone ? EON_OK : EON_ERR;
+}
+
+// Check that the text at offset is the text op holds
+static int _undo_tree_check_op(undo_tree_t* self, undo_op_t* op, bline_t* bline, bint_t offset) {
+  bline_t* end_bline;
+  bint_t end_col;
+  char* data;
+  bint_t data_len;
+  bint_t num_chars;
+  int rv;
+
+  if (buffer_get_bline_col(self->buffer, offset + op->num_chars, &end_bline, &end_col) != MLBUF_OK
+    || buffer_substr(self->buffer, bline, op->col, end_bline, end_col, &data, &data_len, &num_chars) != MLBUF_OK
+  ) {
+    return EON_ERR;
+  }
+
+  rv = num_chars == op->num_chars && data_len == op->data_len && memcmp(data, op->data, data_len) == 0 ? EON_OK : EON_ERR;
+  free(data);
+  return rv;
+}
+
+// Put nodes for loaded records before the root, which becomes the node of
+// the newest one. lasts holds the newest action of each record.
+static void _undo_tree_add_base(undo_tree_t* self, undo_rec_t* recs, baction_t** lasts, bint_t num_recs) {
+  undo_node_t* old_root;
+  undo_node_t* node;
+  bint_t i;
+
+  old_root = self->root;
+
+  if (self->nodes_len + num_recs > self->nodes_cap) {
+    self->nodes_cap = self->nodes_len + num_recs;
+    self->nodes = realloc(self->nodes, sizeof(undo_node_t*) * self->nodes_cap);
+  }
+
+  for (i = 0; i < self->nodes_len; i++) self->nodes[i]->depth += num_recs;
+  memmove(self->nodes + num_recs, self->nodes, sizeof(undo_node_t*) * self->nodes_len);
+  self->nodes_len += num_recs;
+
+  // The new nodes come before the old root in seq and time
+  for (i = 0; i < num_recs; i++) {
+    node = calloc(1, sizeof(undo_node_t));
+    node->parent = i > 0 ? self->nodes[i - 1] : NULL;
+    node->seq = old_root->seq - num_recs + i;
+    node->depth = i;
+    node->time = recs[i > 0 ? i - 1 : 0].time;
+    node->last = i > 0 ? lasts[i - 1] : NULL;
+    node->num_actions = i > 0 ? recs[i - 1].num_ops : 0;
+    if (node->parent) node->parent->next = node;
+    self->nodes[i] = node;
+  }
+
+  self->nodes[num_recs - 1]->next = old_root;
+  old_root->parent = self->nodes[num_recs - 1];
+  old_root->time = recs[num_recs - 1].time;
+  old_root->last = lasts[num_recs - 1];
+  old_root->num_actions = recs[num_recs - 1].num_ops;
+  self->root = self->nodes[0];
+  self->base = self->root;
+}
+
+// Copy the actions of a record before mlbuf can drop them
+static void _undo_node_copy_ops(undo_tree_t* self, undo_node_t* node) {
+  baction_t* action;
+  undo_op_t* op;
+  int i;
+
+  if (node->ops || !node->last) return;
+
+  node->ops = calloc(node->num_actions, sizeof(undo_op_t));
+  action = node->last;
+
+  for (i = node->num_actions - 1; i >= 0 && action; i--, action = action->prev) {
+    op = node->ops + i;
+    op->type = action->type;
+    op->line_index = action->start_line_index;
+    op->col = action->start_col;
+    op->num_chars = action->char_delta < 0 ? -action->char_delta : action->char_delta;
+    op->data = malloc(EON_MAX(action->data_len, 1));
+    memcpy(op->data, action->data, action->data_len);
+    op->data_len = action->data_len;
+    self->ops_bytes += (bint_t)sizeof(undo_op_t) + op->data_len;
+  }
+}
+
+// Free the copied actions of a record
+static void _undo_node_free_ops(undo_tree_t* self, undo_node_t* node) {
+  int i;
+
+  if (!node->ops) return;
+
+  for (i = 0; i < node->num_actions; i++) {
+    if (node->ops[i].data) free(node->ops[i].data);
+    self->ops_bytes -= (bint_t)sizeof(undo_op_t) + node->ops[i].data_len;
+  }
+
+  free(node->ops);
+  node->ops = NULL;
+}
+
+// Free the snapshot of a node, and the ones that are diffs from it
+static void _undo_node_free_snapshot(undo_tree_t* self, undo_node_t* node) {
+  undo_snapshot_t* snap;
+  bint_t i;
+
+  snap = node->snapshot;
+  if (!snap) return;
+
+  for (i = 0; snap->num_refs > 0 && i < self->nodes_len; i++) {
+    if (self->nodes[i]->snapshot && self->nodes[i]->snapshot->from == node) {
+      _undo_node_free_snapshot(self, self->nodes[i]);
+    }
+  }
+
+  if (snap->from) snap->from->snapshot->num_refs -= 1;
+  if (self->cache_node == node) _undo_tree_drop_cache(self);
+
+  self->ops_bytes -= (bint_t)sizeof(undo_snapshot_t) + snap->data_len;
+  if (snap->data) free(snap->data);
+  free(snap);
+  node->snapshot = NULL;
+}
@@ -4,6 +4,11 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include "eon.h"
 
 struct Data {
@@ -11,6 +16,8 @@ struct Data {
   size_t size;
 };
 
+static void _util_add_dir_entry(dir_entry_t** entries, int* entries_len, int* entries_cap, char* name, unsigned char type);
+
 static size_t write_to_memory(void *contents, size_t size, size_t nmemb, void *userp) {
   size_t realsize = size * nmemb;
   struct Data *mem = (struct Data *)userp;
@@ -322,6 +329,93 @@ int util_is_dir(char* path) {
   return 1;
 }
 
+// Create dir and any missing parents. Return 1 if it exists afterwards
+int util_mkdir_p(char* path, mode_t mode) {
+  char tmp[PATH_MAX];
+  char* p;
+
+  snprintf(tmp, sizeof(tmp), "%s", path);
+
+  for (p = tmp + 1; *p; p++) {
+    if (*p != '/') continue;
+
+    *p = '\0';
+    if (mkdir(tmp, mode) != 0 && errno != EEXIST) return 0;
+    *p = '/';
+  }
+
+  if (mkdir(tmp, mode) != 0 && errno != EEXIST) return 0;
+  return 1;
+}
+
+// Read all entries of a directory, except . and ..
+int util_read_dir(int dfd, dir_entry_t** ret_entries, int* ret_entries_len) {
+  dir_entry_t* entries;
+  int entries_len;
+  int entries_cap;
+
+  entries = NULL;
+  entries_len = 0;
+  entries_cap = 0;
+
+#ifdef __linux__
+  // getdents64 fills a whole buffer of entries per syscall
+  struct eon_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+  } *ent;
+  char buf[32768];
+  long nbytes;
+  long pos;
+
+  while ((nbytes = syscall(SYS_getdents64, dfd, buf, sizeof(buf))) > 0) {
+    for (pos = 0; pos < nbytes; pos += ent->d_reclen) {
+      ent = (struct eon_dirent64*)(buf + pos);
+      _util_add_dir_entry(&entries, &entries_len, &entries_cap, ent->d_name, ent->d_type);
+    }
+  }
+#else
+  DIR* dirp;
+  struct dirent* ent;
+
+  if (!(dirp = fdopendir(dup(dfd)))) return EON_ERR;
+
+  while ((ent = readdir(dirp)) != NULL) {
+    _util_add_dir_entry(&entries, &entries_len, &entries_cap, ent->d_name, ent->d_type);
+  }
+
+  closedir(dirp);
+#endif
+
+  *ret_entries = entries;
+  *ret_entries_len = entries_len;
+  return EON_OK;
+}
+
+// Add an entry to a growing list, skipping . and ..
+static void _util_add_dir_entry(dir_entry_t** entries, int* entries_len, int* entries_cap, char* name, unsigned char type) {
+  if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return;
+
+  if (*entries_len >= *entries_cap) {
+    *entries_cap = *entries_cap ? *entries_cap * 2 : 64;
+    *entries = realloc(*entries, sizeof(dir_entry_t) * *entries_cap);
+  }
+
+  (*entries)[*entries_len].name = strdup(name);
+  (*entries)[*entries_len].type = type;
+  *entries_len += 1;
+}
+
+// Free entries returned by util_read_dir
+void util_free_dir(dir_entry_t* entries, int entries_len) {
+  int i;
+  for (i = 0; i < entries_len; i++) free(entries[i].name);
+  free(entries);
+}
+
 char * util_read_file(char *filename) {
   char *buf = NULL;
   long length;
@@ -487,6 +581,42 @@ int util_pcre_replace(char* re, char* subj, char* repl, char** ret_result, int*
   return num_repls;
 }
 
+// Return the byte index of char col in bline
+bint_t util_bline_col_to_index(bline_t* bline, bint_t col) {
+  bint_t index;
+  bint_t i;
+
+  MLBUF_BLINE_ENSURE_CHARS(bline);
+  index = 0;
+  for (i = 0; i < col && i < bline->char_count; i++) index += bline->chars[i].len;
+  return index;
+}
+
+// Return the bline at line_index, walking from whichever of hint, first
+// line or last line is nearest
+bline_t* util_get_bline(buffer_t* buffer, bline_t* hint, bint_t line_index) {
+  bline_t* bline;
+  bint_t dist;
+
+  if (line_index < 0 || line_index >= buffer->line_count) return NULL;
+
+  bline = buffer->first_line;
+  dist = line_index;
+
+  if (buffer->line_count - 1 - line_index < dist) {
+    bline = buffer->last_line;
+    dist = buffer->line_count - 1 - line_index;
+  }
+
+  if (hint && (hint->line_index > line_index ? hint->line_index - line_index : line_index - hint->line_index) < dist) {
+    bline = hint;
+  }
+
+  while (bline && bline->line_index < line_index) bline = bline->next;
+  while (bline && bline->line_index > line_index) bline = bline->prev;
+  return bline;
+}
+
 // Return 1 if a > b, else return 0.
 int util_timeval_is_gt(struct timeval* a, struct timeval* b) {
   if (a->tv_sec > b->tv_sec) {
@@ -499,6 +629,21 @@ int util_timeval_is_gt(struct timeval* a, struct timeval* b) {
   return 0;
 }
 
+// FNV-1a hash
+uint64_t util_fnv1a(char* data, bint_t data_len) {
+  uint64_t hash;
+  bint_t i;
+
+  hash = 14695981039346656037ULL;
+
+  for (i = 0; i < data_len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
 // Ported from php_escape_shell_arg
 // https://github.com/php/php-src/blob/master/ext/standard/exec.c
 char* util_escape_shell_arg(char* str, int l) {
@@ -618,3 +763,78 @@ int rect_printf_attr(bview_rect_t rect, int x, int y, const char *fmt, ...) {
 
   return c;
 }
+
+// Move a transient mark by char_delta chars, stepping over line ends like
+// mark_move_by. Return EON_ERR if that would leave the buffer.
+int tmark_move_by(mark_t* tmark, bint_t char_delta) {
+  bline_t* bline;
+  bint_t col;
+
+  bline = tmark->bline;
+  col = tmark->col;
+  MLBUF_BLINE_ENSURE_CHARS(bline);
+
+  while (char_delta > 0) {
+    if (col + char_delta <= bline->char_count) {
+      col += char_delta;
+      break;
+    }
+
+    if (!bline->next) return EON_ERR;
+
+    char_delta -= bline->char_count - col + 1;
+    bline = bline->next;
+    col = 0;
+    MLBUF_BLINE_ENSURE_CHARS(bline);
+  }
+
+  while (char_delta < 0) {
+    if (col + char_delta >= 0) {
+      col += char_delta;
+      break;
+    }
+
+    if (!bline->prev) return EON_ERR;
+
+    char_delta += col + 1;
+    bline = bline->prev;
+    MLBUF_BLINE_ENSURE_CHARS(bline);
+    col = bline->char_count;
+  }
+
+  *tmark = EON_TMARK(bline, col);
+  return EON_OK;
+}
+
+// Replace the text between two marks, either of which may be transient.
+// Neither is moved, so a transient one is stale afterwards.
+int tmark_replace_between(mark_t* a, mark_t* b, char* data, bint_t data_len) {
+  buffer_t* buffer;
+  bint_t offset_a;
+  bint_t offset_b;
+
+  buffer = a->bline->buffer;
+  buffer_get_offset(buffer, a->bline, a->col, &offset_a);
+  buffer_get_offset(buffer, b->bline, b->col, &offset_b);
+
+  if (offset_a > offset_b) {
+    return buffer_replace(buffer, offset_b, offset_a - offset_b, data, data_len) == MLBUF_OK ? EON_OK : EON_ERR;
+  }
+
+  return buffer_replace(buffer, offset_a, offset_b - offset_a, data, data_len) == MLBUF_OK ? EON_OK : EON_ERR;
+}
+
+// Delete the text between two marks, see tmark_replace_between
+int tmark_delete_between(mark_t* a, mark_t* b) {
+  buffer_t* buffer;
+  bint_t offset_a;
+  bint_t offset_b;
+
+  buffer = a->bline->buffer;
+  buffer_get_offset(buffer, a->bline, a->col, &offset_a);
+  buffer_get_offset(buffer, b->bline, b->col, &offset_b);
+
+  if (offset_a == offset_b) return EON_OK;
+
+  return buffer_delete(buffer, EON_MIN(offset_a, offset_b), offset_a > offset_b ? offset_a - offset_b : offset_b - offset_a) == MLBUF_OK ? EON_OK : EON_ERR;
+}
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include "test.h"
+
+editor_t _editor;
+
+static char test_dir[] = "/tmp/eon-test-XXXXXX";
+
+// Run the test against a fresh editor. HOME points at a temp dir, so undo
+// journals and swap files stay out of the real one.
+int main(int argc, char** argv) {
+  char* args[] = { "eon", "-N", "-H", "0", NULL };
+
+  setlocale(LC_ALL, "");
+
+  if (!mkdtemp(test_dir)) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+
+  setenv("HOME", test_dir, 1);
+  memset(&_editor, 0, sizeof(editor_t));
+
+  if (editor_init(&_editor, 4, args) != EON_OK) {
+    editor_deinit(&_editor);
+    return EXIT_FAILURE;
+  }
+
+  test(&_editor);
+  editor_deinit(&_editor);
+  return EXIT_SUCCESS;
+}
+
+// Open an edit bview on opt_path, or on a new buffer if NULL
+int test_open_bview(editor_t* editor, char* opt_path, bview_t** ret_bview) {
+  return editor_open_bview(editor, NULL, EON_BVIEW_TYPE_EDIT, opt_path, opt_path ? strlen(opt_path) : 0, 1, 0, NULL, NULL, ret_bview);
+}
+
+// Return 1 if the buffer of bview holds exactly expected
+int test_buffer_is(bview_t* bview, char* expected) {
+  char* data;
+  bint_t data_len;
+
+  buffer_get(bview->buffer, &data, &data_len);
+  return data_len == (bint_t)strlen(expected) && memcmp(data, expected, data_len) == 0 ? 1 : 0;
+}
+
+// Get the temp dir the test runs in
+char* test_get_dir(void) {
+  return test_dir;
+}
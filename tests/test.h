@@ -0,0 +1,27 @@
+#ifndef __EON_TEST_H
+#define __EON_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eon.h"
+
+#define ASSERT(testname, expected, observed) do { \
+  if ((expected) == (observed)) { \
+    printf("  \x1b[32mOK \x1b[0m %s\n", (testname)); \
+  } else { \
+    printf("  \x1b[31mERR\x1b[0m %s expected=%ld observed=%ld\n", (testname), (long)(expected), (long)(observed)); \
+    exit(EXIT_FAILURE); \
+  } \
+} while (0)
+
+#define ASSERT_TEXT(testname, expected, bview) ASSERT((testname), 1, test_buffer_is((bview), (expected)))
+
+// Defined by each test_*.c
+void test(editor_t* editor);
+
+int test_open_bview(editor_t* editor, char* opt_path, bview_t** ret_bview);
+int test_buffer_is(bview_t* bview, char* expected);
+char* test_get_dir(void);
+
+#endif
@@ -0,0 +1,75 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "test.h"
+
+// Edits left in a swap file by an editor that died are replayed up to the
+// record the crash cut short, and the file carries on from there
+void test(editor_t* editor) {
+  bview_t* bview;
+  char real[PATH_MAX + 1];
+  char tail[16];
+  char* file_path;
+  char* swap_dir;
+  char* swap_path;
+  char* header;
+  struct stat st;
+  FILE* fp;
+  bint_t num_edits;
+  long good_len;
+  int fd;
+
+  editor->swap = 1;
+  if (asprintf(&file_path, "%s/file.txt", test_get_dir()) < 0) exit(EXIT_FAILURE);
+
+  fp = fopen(file_path, "wb");
+  fputs("hello\n", fp);
+  fclose(fp);
+  stat(file_path, &st);
+  realpath(file_path, real);
+
+  util_expand_tilde(EON_SWAP_DIR, strlen(EON_SWAP_DIR), &swap_dir);
+  util_mkdir_p(swap_dir, 0700);
+  if (asprintf(&swap_path, "%s/%016llx", swap_dir, (unsigned long long)util_fnv1a(real, strlen(real))) < 0) exit(EXIT_FAILURE);
+  if (asprintf(&header, "eon-swap 1 %10d %ld %ld %s\n", 999999, (long)st.st_size, (long)st.st_mtime, real) < 0) exit(EXIT_FAILURE);
+
+  // The second record lost its data to the crash
+  fp = fopen(swap_path, "wb");
+  fputs(header, fp);
+  fputs("+0 5 6\n world\n", fp);
+  fputs("+0 11 1\n!", fp);
+  fclose(fp);
+  good_len = strlen(header) + strlen("+0 5 6\n world\n");
+
+  test_open_bview(editor, file_path, &bview);
+  ASSERT("recover", EON_OK, swap_recover(bview->swap, &num_edits));
+  ASSERT("num edits", 1, num_edits);
+  ASSERT_TEXT("replayed", "hello world\n", bview);
+
+  stat(swap_path, &st);
+  ASSERT("cut at last whole record", good_len, (long)st.st_size);
+
+  // New records follow it
+  buffer_insert(bview->buffer, 11, "?", 1, NULL);
+  swap_flush(bview->swap);
+  fp = fopen(swap_path, "rb");
+  fseek(fp, good_len, SEEK_SET);
+  memset(tail, 0, sizeof(tail));
+  ASSERT("appended", 10, (long)fread(tail, 1, sizeof(tail) - 1, fp));
+  ASSERT("appended record", 0, strcmp(tail, "+0 11 1\n?\n"));
+  fclose(fp);
+
+  // Another editor can not take the file over while this one has it
+  fd = open(swap_path, O_RDWR);
+  ASSERT("locked", -1, flock(fd, LOCK_EX | LOCK_NB));
+  close(fd);
+
+  editor_close_bview(editor, bview, NULL);
+  ASSERT("removed on close", -1, access(swap_path, F_OK));
+
+  free(header);
+  free(swap_path);
+  free(swap_dir);
+  free(file_path);
+}
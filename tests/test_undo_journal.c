@@ -0,0 +1,90 @@
+#include <dirent.h>
+#include "test.h"
+
+static char* file_path;
+
+// Write data to the test file
+static void write_file(char* data) {
+  FILE* fp;
+  fp = fopen(file_path, "wb");
+  fputs(data, fp);
+  fclose(fp);
+}
+
+// Swap the first from in the only journal for to, of the same length
+static void tamper_journal(char* from, char* to) {
+  DIR* dir;
+  struct dirent* entry;
+  FILE* fp;
+  char* dir_path;
+  char* path;
+  char* data;
+  char* match;
+  size_t len;
+
+  path = NULL;
+  util_expand_tilde(EON_UNDO_JOURNAL_DIR, strlen(EON_UNDO_JOURNAL_DIR), &dir_path);
+  dir = opendir(dir_path);
+
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] != '.' && asprintf(&path, "%s/%s", dir_path, entry->d_name) >= 0) break;
+  }
+
+  closedir(dir);
+  free(dir_path);
+
+  fp = fopen(path, "r+b");
+  data = calloc(1, 65536);
+  len = fread(data, 1, 65535, fp);
+  match = memmem(data, len, from, strlen(from));
+  fseek(fp, match - data, SEEK_SET);
+  fwrite(to, 1, strlen(to), fp);
+  fclose(fp);
+  free(data);
+  free(path);
+}
+
+// Undo history carries over to the next session on the saved file, and is
+// left alone if the file or the journal no longer match
+void test(editor_t* editor) {
+  bview_t* bview;
+  undo_journal_t* journal;
+  int num_undos;
+
+  editor->undo_journal = 1;
+  editor->swap = 0;
+  if (asprintf(&file_path, "%s/file.txt", test_get_dir()) < 0) exit(EXIT_FAILURE);
+  write_file("hello\n");
+
+  // Two records, saved
+  test_open_bview(editor, file_path, &bview);
+  buffer_insert(bview->buffer, 5, " world", 6, NULL);
+  buffer_insert(bview->buffer, 11, "!", 1, NULL);
+  ASSERT("lock", EON_ERR, undo_journal_new(editor, bview->buffer, &journal));
+  buffer_save(bview->buffer);
+  bview_save_undo(bview);
+  editor_close_bview(editor, bview, NULL);
+
+  // The next session undoes them
+  test_open_bview(editor, file_path, &bview);
+  ASSERT_TEXT("reopen", "hello world!\n", bview);
+  for (num_undos = 0; bview_undo(bview) == EON_OK; num_undos++);
+  ASSERT("undo count", 2, num_undos);
+  ASSERT_TEXT("undo all", "hello\n", bview);
+  editor_close_bview(editor, bview, NULL);
+
+  // An op that does not match the buffer loads nothing
+  tamper_journal(" world", " wxrld");
+  test_open_bview(editor, file_path, &bview);
+  ASSERT("bad op", EON_ERR, bview_undo(bview));
+  ASSERT_TEXT("bad op text", "hello world!\n", bview);
+  editor_close_bview(editor, bview, NULL);
+
+  // Neither does a file changed outside eon
+  tamper_journal(" wxrld", " world");
+  write_file("hello there\n");
+  test_open_bview(editor, file_path, &bview);
+  ASSERT("changed file", EON_ERR, bview_undo(bview));
+  ASSERT_TEXT("changed file text", "hello there\n", bview);
+  editor_close_bview(editor, bview, NULL);
+}
@@ -0,0 +1,68 @@
+#include "test.h"
+
+// Jumps reach every undo state, near ones by undo and redo and far ones
+// from a checkpoint snapshot, and undo still goes all the way back after
+void test(editor_t* editor) {
+  bview_t* bview;
+  char text[128];
+  bint_t index;
+  bint_t count;
+  time_t when;
+  int num_undos;
+  int i;
+
+  test_open_bview(editor, NULL, &bview);
+
+  // One record per insert, a few checkpoints' worth
+  for (i = 0; i < 100; i++) {
+    text[i] = 'a' + i % 26;
+    buffer_insert(bview->buffer, i, text + i, 1, NULL);
+  }
+
+  text[100] = '\0';
+  ASSERT_TEXT("inserts", text, bview);
+  bview_get_undo_state(bview, &index, &count, &when);
+  ASSERT("state count", 101, count);
+  ASSERT("state index", 100, index);
+
+  // All states are at least as new as the oldest one
+  bview_undo_to_time(bview, 0);
+  ASSERT_TEXT("to oldest", "", bview);
+  bview_get_undo_state(bview, &index, &count, &when);
+  ASSERT("oldest index", 0, index);
+  ASSERT("oldest time", 0, when);
+
+  bview_undo_to_time(bview, time(NULL) + 60);
+  ASSERT_TEXT("to newest", text, bview);
+
+  bview_undo_step(bview, -40);
+  text[60] = '\0';
+  ASSERT_TEXT("step back", text, bview);
+
+  // Editing here makes the rest a branch, still in reach
+  buffer_insert(bview->buffer, 60, "X", 1, NULL);
+  text[60] = 'X';
+  text[61] = '\0';
+  ASSERT_TEXT("branch", text, bview);
+  bview_get_undo_state(bview, &index, &count, &when);
+  ASSERT("branch count", 102, count);
+  ASSERT("branch index", 101, index);
+
+  bview_undo_step(bview, -1);
+  for (i = 0; i < 100; i++) text[i] = 'a' + i % 26;
+  text[100] = '\0';
+  ASSERT_TEXT("to old branch", text, bview);
+
+  bview_undo_step(bview, 1);
+  text[60] = 'X';
+  text[61] = '\0';
+  ASSERT_TEXT("to new branch", text, bview);
+
+  // Undo goes back past the checkpoint the jumps started from
+  for (num_undos = 0; bview_undo(bview) == EON_OK; num_undos++);
+  ASSERT("undo count", 61, num_undos);
+  ASSERT_TEXT("undo all", "", bview);
+
+  bview_undo_to_time(bview, time(NULL) + 60);
+  ASSERT_TEXT("newest is branch", text, bview);
+}